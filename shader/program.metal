@@ -8,12 +8,92 @@ struct V2F
     float3 normal;
 };
 
+// MeshVertexFormat in mesh.hpp, chosen at build time and must match VERTEX_FORMAT in the C++ build.
+#define VERTEX_FORMAT_FLOAT32 0
+#define VERTEX_FORMAT_HALF_OCTAHEDRAL 1
+#define VERTEX_FORMAT_HALF_1010102 2
+#define VERTEX_FORMAT_SNORM16_OCTAHEDRAL 3
+#define VERTEX_FORMAT_SNORM16_1010102 4
+
+#ifndef VERTEX_FORMAT
+#define VERTEX_FORMAT VERTEX_FORMAT_FLOAT32
+#endif
+
+#if VERTEX_FORMAT == VERTEX_FORMAT_FLOAT32
+
 struct VertexData
 {
     float3 position;
     float3 normal;
 };
 
+#else
+
+// Snorm16 positions are in units of the mesh's radius, which the instance transform scales by.
+struct VertexData
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_HALF_OCTAHEDRAL || VERTEX_FORMAT == VERTEX_FORMAT_HALF_1010102
+    packed_half4 position;
+#else
+    packed_short4 position;
+#endif
+    uint normal;
+};
+
+#endif
+
+float3 vertex_position( const device VertexData& vd )
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_FLOAT32
+    return vd.position;
+#elif VERTEX_FORMAT == VERTEX_FORMAT_HALF_OCTAHEDRAL || VERTEX_FORMAT == VERTEX_FORMAT_HALF_1010102
+    return float3( half4( vd.position ).xyz );
+#else
+    return max( float3( short4( vd.position ).xyz ) / 32767.0, -1.0 );
+#endif
+}
+
+// Octahedral normals are normalized here, their length varies with direction. 10:10:10:2 ones
+// are near unit length already, main_fragment renormalizes after interpolation.
+float3 vertex_normal( const device VertexData& vd )
+{
+#if VERTEX_FORMAT == VERTEX_FORMAT_FLOAT32
+    return vd.normal;
+#elif VERTEX_FORMAT == VERTEX_FORMAT_HALF_OCTAHEDRAL || VERTEX_FORMAT == VERTEX_FORMAT_SNORM16_OCTAHEDRAL
+    // The lower hemisphere is folded over the diagonals of the upper one.
+    const float2 e = unpack_snorm2x16_to_float( vd.normal );
+    float3 n = float3( e, 1.0 - abs( e.x ) - abs( e.y ) );
+    const float t = max( -n.z, 0.0 );
+    n.xy += select( float2( t ), float2( -t ), n.xy >= 0.0 );
+    return normalize( n );
+#else
+    return unpack_unorm10a2_to_float( vd.normal ).xyz * 2.0 - 1.0;
+#endif
+}
+
+// Chosen at build time, must match INSTANCE_FORMAT_COMPACT in the C++ build.
+#ifndef INSTANCE_FORMAT_COMPACT
+#define INSTANCE_FORMAT_COMPACT 0
+#endif
+
+#if INSTANCE_FORMAT_COMPACT
+
+// CompactInstance in instance_store.hpp.
+struct InstanceData
+{
+    packed_float3 position;
+    uint color;         // RGBA8 unorm
+    short4 rotation;    // snorm16 quaternion
+    half4 scale;
+};
+
+float3 rotate( float4 q, float3 v )
+{
+    return v + 2.0 * cross( q.xyz, cross( q.xyz, v ) + q.w * v );
+}
+
+#else
+
 struct InstanceData
 {
     float4x4 instanceTransform;
@@ -21,6 +101,8 @@ struct InstanceData
     float3x3 instanceNormalTransform;
 };
 
+#endif
+
 struct CameraData
 {
     float4x4 perspectiveTransform;
@@ -32,22 +114,33 @@ vertex
 V2F main_vertex( device const VertexData* vertexData [[ buffer(0) ]],
                  device const InstanceData* instanceData [[ buffer(1) ]],
                  device const CameraData& cameraData [[ buffer(2) ]],
+                 device const uint* visibleInstances [[ buffer(3) ]],
                  uint instanceId [[ instance_id ]],
                  uint vertexId [[ vertex_id ]] )
 {
     V2F o;
 
     const device VertexData& vd = vertexData[ vertexId ];
-    float4 pos = float4( vd.position, 1.0 );
-    pos = instanceData[ instanceId ].instanceTransform * pos;
+    const device InstanceData& instance = instanceData[ visibleInstances[ instanceId ] ];
+#if INSTANCE_FORMAT_COMPACT
+    const float4 rotation = normalize( max( float4( instance.rotation ) / 32767.0, -1.0 ) );
+    const float3 scale = float3( instance.scale.xyz );
+    float4 pos = float4( rotate( rotation, vertex_position( vd ) * scale ) + float3( instance.position ), 1.0 );
+    float3 normal = rotate( rotation, vertex_normal( vd ) * scale );
+    o.color = half3( unpack_unorm4x8_to_float( instance.color ).rgb );
+#else
+    float4 pos = float4( vertex_position( vd ), 1.0 );
+    pos = instance.instanceTransform * pos;
+    float3 normal = instance.instanceNormalTransform * vertex_normal( vd );
+    o.color = half3( instance.instanceColor.rgb );
+#endif
+
     pos = cameraData.perspectiveTransform * cameraData.worldTransform * pos;
     o.position = pos;
 
-    float3 normal = instanceData[ instanceId ].instanceNormalTransform * vd.normal;
     normal = cameraData.worldNormalTransform * normal;
     o.normal = normal;
 
-    o.color = half3( instanceData[ instanceId ].instanceColor.rgb );
     return o;
 
 }
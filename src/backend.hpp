@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "pipeline_cache.hpp"
+
+// Thin interface over the graphics API the renderer draws with. It covers just
+// what Renderer needs: buffers, pipelines, depth state, a frame pacing fence and
+// command buffers with a single render encoder. The Metal implementation lives
+// in metal_backend, a headless CPU implementation in headless_backend.
+//
+// Objects created by a Device belong to the caller and are destroyed with
+// release(), the same way the metal-cpp objects they wrap are.
+namespace gpu
+{
+
+enum class PixelFormat : uint16_t
+{
+    Invalid,
+    BGRA8Unorm_sRGB,
+    Depth16Unorm,
+    Depth32Float
+};
+
+enum class IndexType : uint8_t
+{
+    UInt16,
+    UInt32
+};
+
+enum class CullMode : uint8_t
+{
+    None,
+    Front,
+    Back
+};
+
+enum class Winding : uint8_t
+{
+    Clockwise,
+    CounterClockwise
+};
+
+enum class CompareFunction : uint8_t
+{
+    Never,
+    Less,
+    Equal,
+    LessEqual,
+    Greater,
+    NotEqual,
+    GreaterEqual,
+    Always
+};
+
+class Object
+{
+    public:
+        virtual ~Object() = default;
+        void release() { delete this; }
+};
+
+// CPU writable memory the GPU reads. Writes must be flagged with
+// did_modify_range() before the command buffer using them is committed.
+class Buffer : public Object
+{
+    public:
+        virtual void* contents() = 0;
+        virtual size_t length() const = 0;
+        virtual void did_modify_range( size_t offset, size_t size ) = 0;
+};
+
+class Pipeline : public Object { };
+
+class DepthStencilState : public Object { };
+
+// Counting semaphore the CPU waits on before building a frame and the GPU
+// signals when one completes.
+class Fence : public Object
+{
+    public:
+        virtual void wait() = 0;
+        virtual void signal() = 0;
+};
+
+// Something to render into and present, e.g. a window's drawable. Targets are
+// provided by the backend's platform code and only work with its own devices.
+class Target
+{
+    public:
+        virtual ~Target() = default;
+};
+
+class RenderEncoder
+{
+    public:
+        virtual void set_pipeline( Pipeline* pPipeline ) = 0;
+        virtual void set_depth_stencil_state( DepthStencilState* pState ) = 0;
+        virtual void set_vertex_buffer( Buffer* pBuffer, size_t offset, size_t index ) = 0;
+        virtual void set_cull_mode( CullMode mode ) = 0;
+        virtual void set_front_facing_winding( Winding winding ) = 0;
+        virtual void draw_indexed( size_t indexCount, IndexType indexType, Buffer* pIndexBuffer, size_t indexOffset, size_t instanceCount ) = 0;
+        virtual void end_encoding() = 0;
+
+    protected:
+        ~RenderEncoder() = default;
+};
+
+// Owned by the device. Nothing may touch a command buffer after commit().
+class CommandBuffer
+{
+    public:
+        // Starts a pass that clears the target's color and depth. The encoder
+        // belongs to the command buffer and is valid until end_encoding().
+        virtual RenderEncoder* render_pass( Target& target ) = 0;
+
+        // Runs once the GPU has finished the command buffer, possibly on another thread.
+        virtual void add_completed_handler( std::function<void()> handler ) = 0;
+        virtual void present( Target& target ) = 0;
+        virtual void commit() = 0;
+
+    protected:
+        ~CommandBuffer() = default;
+};
+
+// Preprocessor macro a program is compiled with, as if by -D<name>=<value>.
+struct ShaderMacro
+{
+    const char* name;
+    const char* value;
+};
+
+class Device
+{
+    public:
+        virtual ~Device() = default;
+
+        // Loads the program pipelines are built from. PipelineDesc refers to
+        // its functions by index into `functionNames`. The macros must match
+        // the ones the C++ side of the shader interface was built with.
+        virtual bool load_program( const char* sourcePath, const char* const* functionNames, size_t functionCount,
+                                   const ShaderMacro* pMacros, size_t macroCount ) = 0;
+
+        virtual Buffer* new_buffer( size_t length ) = 0;
+        // May be called from any thread once the program is loaded, returns nullptr on failure.
+        virtual Pipeline* new_pipeline( const PipelineDesc& desc ) = 0;
+        virtual DepthStencilState* new_depth_stencil_state( CompareFunction compare, bool depthWrite ) = 0;
+        virtual Fence* new_fence( size_t count ) = 0;
+
+        virtual CommandBuffer* command_buffer() = 0;
+};
+
+}
@@ -0,0 +1,407 @@
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "instance_store.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+
+constexpr uint32_t kNoNode = UINT32_MAX;
+
+// Half the surface area, which is all the heuristic needs.
+float half_area( const float min[3], const float max[3] )
+{
+    const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+void grow( float min[3], float max[3], const float otherMin[3], const float otherMax[3] )
+{
+    for ( int k = 0; k < 3; ++k )
+    {
+        min[k] = std::min( min[k], otherMin[k] );
+        max[k] = std::max( max[k], otherMax[k] );
+    }
+}
+
+math::float3 bounds_min( const Bvh::Node& node ) { return { node.min[0], node.min[1], node.min[2] }; }
+math::float3 bounds_max( const Bvh::Node& node ) { return { node.max[0], node.max[1], node.max[2] }; }
+
+void reset( float min[3], float max[3] )
+{
+    for ( int k = 0; k < 3; ++k )
+    {
+        min[k] = INFINITY;
+        max[k] = -INFINITY;
+    }
+}
+
+}
+
+void Bvh::read_instance( const InstanceStore& store, size_t i )
+{
+    const math::float4 s = instance_sphere( store, i );
+    m_spheres[ i ] = s;
+    m_boxes[ i ] = { { s.x - s.w, s.y - s.w, s.z - s.w }, { s.x + s.w, s.y + s.w, s.z + s.w } };
+}
+
+void Bvh::fit_node( Node& node ) const
+{
+    reset( node.min, node.max );
+    for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+    {
+        const Box& box = m_boxes[ m_indices[ k ] ];
+        grow( node.min, node.max, box.min, box.max );
+    }
+}
+
+void Bvh::build( const InstanceStore& store )
+{
+    PROFILE_ZONE( "Bvh::build" );
+
+    const size_t count = store.size();
+    m_boxes.resize( count );
+    m_spheres.resize( count );
+    m_leaves.assign( count, kNoNode );
+    m_indices.resize( count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        read_instance( store, i );
+        m_indices[ i ] = static_cast<uint32_t>( i );
+    }
+
+    m_nodes.clear();
+    m_nodes.reserve( count > 0 ? 2 * count - 1 : 0 );
+    m_marked.clear();
+    if ( count == 0 )
+        return;
+
+    Node root = {};
+    root.count = static_cast<uint32_t>( count );
+    root.parent = kNoNode;
+    fit_node( root );
+    m_nodes.push_back( root );
+    split_node( 0, 1 );
+    m_marked.assign( m_nodes.size(), 0 );
+}
+
+void Bvh::split_node( uint32_t nodeIndex, size_t depth )
+{
+    const Node node = m_nodes[ nodeIndex ];
+    auto make_leaf = [&]() {
+        for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+            m_leaves[ m_indices[ k ] ] = nodeIndex;
+    };
+
+    if ( node.count <= 1 || depth >= kMaxDepth )
+    {
+        make_leaf();
+        return;
+    }
+
+    float centroidMin[3], centroidMax[3];
+    reset( centroidMin, centroidMax );
+    for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+    {
+        const math::float4& s = m_spheres[ m_indices[ k ] ];
+        const float c[3] = { s.x, s.y, s.z };
+        grow( centroidMin, centroidMax, c, c );
+    }
+
+    // Every axis is binned in the same pass, so each instance is read once.
+    Box bins[3][ kBinCount ];
+    size_t binCounts[3][ kBinCount ] = {};
+    float scales[3];
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        for ( Box& bin : bins[ axis ] )
+            reset( bin.min, bin.max );
+        const float extent = centroidMax[ axis ] - centroidMin[ axis ];
+        scales[ axis ] = extent > 0.f ? kBinCount / extent : 0.f;
+    }
+    for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+    {
+        const uint32_t i = m_indices[ k ];
+        const Box& box = m_boxes[ i ];
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            const size_t bin = std::min( kBinCount - 1, static_cast<size_t>( ( ( &m_spheres[ i ].x )[ axis ] - centroidMin[ axis ] ) * scales[ axis ] ) );
+            grow( bins[ axis ][ bin ].min, bins[ axis ][ bin ].max, box.min, box.max );
+            binCounts[ axis ][ bin ]++;
+        }
+    }
+
+    // Cost of a split relative to the node's area, in sphere tests: the instances of both sides.
+    float bestCost = INFINITY;
+    int bestAxis = -1;
+    size_t bestSplit = 0;
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        if ( scales[ axis ] == 0.f )
+            continue;
+
+        // Sweep from the right first, then evaluate every split from the left.
+        float rightAreas[ kBinCount ];
+        size_t rightCounts[ kBinCount ];
+        Box right;
+        reset( right.min, right.max );
+        size_t rightCount = 0;
+        for ( size_t b = kBinCount - 1; b > 0; --b )
+        {
+            grow( right.min, right.max, bins[ axis ][ b ].min, bins[ axis ][ b ].max );
+            rightCount += binCounts[ axis ][ b ];
+            rightAreas[ b ] = rightCount > 0 ? half_area( right.min, right.max ) : 0.f;
+            rightCounts[ b ] = rightCount;
+        }
+
+        Box left;
+        reset( left.min, left.max );
+        size_t leftCount = 0;
+        for ( size_t split = 1; split < kBinCount; ++split )
+        {
+            grow( left.min, left.max, bins[ axis ][ split - 1 ].min, bins[ axis ][ split - 1 ].max );
+            leftCount += binCounts[ axis ][ split - 1 ];
+            if ( leftCount == 0 || rightCounts[ split ] == 0 )
+                continue;
+
+            const float cost = half_area( left.min, left.max ) * leftCount + rightAreas[ split ] * rightCounts[ split ];
+            if ( cost < bestCost )
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    const float area = half_area( node.min, node.max );
+    const float leafCost = static_cast<float>( node.count );
+    const float splitCost = area > 0.f ? kTraversalCost + bestCost / area : INFINITY;
+    if ( node.count <= kMaxLeafSize && !( splitCost < leafCost ) )
+    {
+        make_leaf();
+        return;
+    }
+
+    uint32_t* pBegin = m_indices.data() + node.first;
+    uint32_t* pEnd = pBegin + node.count;
+    uint32_t* pMiddle = pBegin;
+    if ( bestAxis >= 0 )
+    {
+        const float scale = scales[ bestAxis ];
+        pMiddle = std::partition( pBegin, pEnd, [&]( uint32_t i ) {
+            const size_t bin = std::min( kBinCount - 1, static_cast<size_t>( ( ( &m_spheres[ i ].x )[ bestAxis ] - centroidMin[ bestAxis ] ) * scale ) );
+            return bin < bestSplit;
+        } );
+    }
+    // Every centroid in one place: any halves are as good as others.
+    if ( pMiddle == pBegin || pMiddle == pEnd )
+        pMiddle = pBegin + node.count / 2;
+
+    const uint32_t left = static_cast<uint32_t>( m_nodes.size() );
+    for ( int side = 0; side < 2; ++side )
+    {
+        Node child = {};
+        child.first = side == 0 ? node.first : node.first + static_cast<uint32_t>( pMiddle - pBegin );
+        child.count = side == 0 ? static_cast<uint32_t>( pMiddle - pBegin ) : static_cast<uint32_t>( pEnd - pMiddle );
+        child.parent = nodeIndex;
+        fit_node( child );
+        m_nodes.push_back( child );
+    }
+    m_nodes[ nodeIndex ].left = left;
+
+    split_node( left, depth + 1 );
+    split_node( left + 1, depth + 1 );
+}
+
+void Bvh::update( const InstanceStore& store, const uint32_t* pMoved, size_t count )
+{
+    PROFILE_ZONE( "Bvh::update" );
+    assert( store.size() == m_leaves.size() && "instances were added or removed, build() instead" );
+
+    // Nodes are created after their parents, so refitting in descending order has the children ready.
+    // With a good part of the instances moved, sorting the marked nodes costs more than refitting them all.
+    const bool refitAll = count * 16 >= m_leaves.size();
+    for ( size_t k = 0; k < count && refitAll; ++k )
+        read_instance( store, pMoved[ k ] );
+    for ( size_t k = 0; k < count && !refitAll; ++k )
+    {
+        const uint32_t i = pMoved[ k ];
+        read_instance( store, i );
+        for ( uint32_t node = m_leaves[ i ]; node != kNoNode && !m_marked[ node ]; node = m_nodes[ node ].parent )
+        {
+            m_marked[ node ] = 1;
+            m_refit.push_back( node );
+        }
+    }
+
+    if ( refitAll )
+    {
+        m_refit.resize( m_nodes.size() );
+        for ( size_t k = 0; k < m_refit.size(); ++k )
+            m_refit[ k ] = static_cast<uint32_t>( m_refit.size() - 1 - k );
+    }
+    else
+    {
+        std::sort( m_refit.begin(), m_refit.end(), std::greater<uint32_t>() );
+    }
+
+    for ( uint32_t index : m_refit )
+    {
+        Node& node = m_nodes[ index ];
+        if ( node.left == 0 )
+        {
+            fit_node( node );
+        }
+        else
+        {
+            const Node& a = m_nodes[ node.left ];
+            const Node& b = m_nodes[ node.left + 1 ];
+            std::copy( a.min, a.min + 3, node.min );
+            std::copy( a.max, a.max + 3, node.max );
+            grow( node.min, node.max, b.min, b.max );
+        }
+        m_marked[ index ] = 0;
+    }
+    m_refit.clear();
+}
+
+void Bvh::cull_ranges( const Frustum& frustum, std::vector<Range>& outRanges ) const
+{
+    PROFILE_ZONE( "Bvh::cull_ranges" );
+
+    const size_t firstRange = outRanges.size();
+    auto emit = [&]( uint32_t begin, uint32_t end ) {
+        if ( outRanges.size() > firstRange && outRanges.back().end == begin )
+            outRanges.back().end = end;
+        else
+            outRanges.push_back( { begin, end } );
+    };
+
+    if ( m_nodes.empty() )
+        return;
+
+    // Left children are visited first, so ranges come out in ascending order.
+    uint32_t stack[ kMaxDepth + 1 ];
+    size_t top = 0;
+    stack[ top++ ] = 0;
+    while ( top > 0 )
+    {
+        const Node& node = m_nodes[ stack[ --top ] ];
+        const Containment containment = classify_aabb( frustum, bounds_min( node ), bounds_max( node ) );
+        if ( containment == Containment::Outside )
+            continue;
+
+        if ( containment == Containment::Inside )
+        {
+            emit( node.first, node.first + node.count );
+        }
+        else if ( node.left == 0 )
+        {
+            for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+            {
+                const math::float4& s = m_spheres[ m_indices[ k ] ];
+                if ( sphere_visible( frustum, s.xyz(), s.w ) )
+                    emit( k, k + 1 );
+            }
+        }
+        else
+        {
+            stack[ top++ ] = node.left + 1;
+            stack[ top++ ] = node.left;
+        }
+    }
+}
+
+size_t Bvh::cull( const Frustum& frustum, uint32_t* pVisible ) const
+{
+    std::vector<Range> ranges;
+    cull_ranges( frustum, ranges );
+
+    size_t visible = 0;
+    for ( const Range& range : ranges )
+    {
+        std::copy( m_indices.data() + range.begin, m_indices.data() + range.end, pVisible + visible );
+        visible += range.end - range.begin;
+    }
+    return visible;
+}
+
+bool Bvh::raycast( const Ray& ray, RayHit& hit ) const
+{
+    if ( m_nodes.empty() )
+        return false;
+
+    const math::float3 invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+    float nearest = ray.maxDistance;
+    bool found = false;
+
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[ kMaxDepth + 1 ];
+    size_t top = 0;
+
+    const float rootDistance = ray_box( ray, invDirection, bounds_min( m_nodes[0] ), bounds_max( m_nodes[0] ), nearest );
+    if ( rootDistance >= 0.f )
+        stack[ top++ ] = { 0, rootDistance };
+
+    while ( top > 0 )
+    {
+        const Entry entry = stack[ --top ];
+        if ( entry.distance > nearest )
+            continue;
+
+        const Node& node = m_nodes[ entry.node ];
+        if ( node.left == 0 )
+        {
+            for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+            {
+                const uint32_t i = m_indices[ k ];
+                const float t = ray_sphere( ray, m_spheres[ i ] );
+                if ( t >= 0.f && t <= nearest )
+                {
+                    nearest = t;
+                    hit = { i, t };
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // The nearer child goes on top, so it is searched first and shortens the ray for the other.
+        Entry children[2];
+        size_t hits = 0;
+        for ( uint32_t child = node.left; child <= node.left + 1; ++child )
+        {
+            const float t = ray_box( ray, invDirection, bounds_min( m_nodes[ child ] ), bounds_max( m_nodes[ child ] ), nearest );
+            if ( t >= 0.f )
+                children[ hits++ ] = { child, t };
+        }
+        if ( hits == 2 && children[0].distance < children[1].distance )
+            std::swap( children[0], children[1] );
+        for ( size_t c = 0; c < hits; ++c )
+            stack[ top++ ] = children[ c ];
+    }
+    return found;
+}
+
+float Bvh::sah_cost() const
+{
+    if ( m_nodes.empty() )
+        return 0.f;
+
+    const float rootArea = half_area( m_nodes[0].min, m_nodes[0].max );
+    if ( !( rootArea > 0.f ) )
+        return static_cast<float>( m_nodes[0].count );
+
+    double cost = 0.0;
+    for ( const Node& node : m_nodes )
+        cost += half_area( node.min, node.max ) * ( node.left == 0 ? node.count : kTraversalCost );
+    return static_cast<float>( cost / rootArea );
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "spatial_index.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the boxes around the instances' bounding
+// spheres, split by the surface area heuristic over binned centroids.
+//
+// Every node covers one contiguous range of indices(), so a node entirely in
+// view is emitted as one range without visiting its subtree. update() refits
+// the boxes above moved instances and keeps the tree as it is, which is cheap
+// but lets it degrade as instances wander away from where they were built;
+// sah_cost() measures how far, and build() starts over.
+class Bvh : public SpatialIndex
+{
+    public:
+        struct Node
+        {
+            float min[3];
+            // The node's instances are indices()[ first, first + count ).
+            uint32_t first;
+            float max[3];
+            uint32_t count;
+            // Children are left and left + 1, 0 for leaves (the root is nobody's child).
+            uint32_t left;
+            uint32_t parent;
+        };
+
+        // A range of indices().
+        struct Range
+        {
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        static constexpr size_t kMaxLeafSize = 8;
+        static constexpr size_t kBinCount = 16;
+        // Of visiting a node, in sphere tests: classifying a box against the frustum or a ray and
+        // pushing the children costs several of them, so a few spheres are cheaper tested in a leaf.
+        static constexpr float kTraversalCost = 4.f;
+        static constexpr size_t kMaxDepth = 64;
+
+        const char* name() const override { return "bvh"; }
+
+        void build( const InstanceStore& store ) override;
+        void update( const InstanceStore& store, const uint32_t* pMoved, size_t count ) override;
+        size_t cull( const Frustum& frustum, uint32_t* pVisible ) const override;
+        bool raycast( const Ray& ray, RayHit& hit ) const override;
+
+        // Appends the ranges of indices() whose instances are in view. Ranges come
+        // in ascending order, adjacent ones merged.
+        void cull_ranges( const Frustum& frustum, std::vector<Range>& outRanges ) const;
+
+        const std::vector<uint32_t>& indices() const { return m_indices; }
+        const std::vector<Node>& nodes() const { return m_nodes; }
+
+        // Expected cost of finding what a random ray or small query touches, with
+        // kTraversalCost per node visited and one per instance tested, relative to the root.
+        float sah_cost() const;
+
+    private:
+        struct Box
+        {
+            float min[3];
+            float max[3];
+        };
+
+        void read_instance( const InstanceStore& store, size_t i );
+        void fit_node( Node& node ) const;
+        // Splits the node if the heuristic says a split pays off.
+        void split_node( uint32_t nodeIndex, size_t depth );
+
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_indices;
+        // Per instance: the box around its sphere, the sphere itself as ( x, y, z, radius ) and the leaf holding it.
+        std::vector<Box> m_boxes;
+        std::vector<math::float4> m_spheres;
+        std::vector<uint32_t> m_leaves;
+
+        // Scratch of update().
+        std::vector<uint8_t> m_marked;
+        std::vector<uint32_t> m_refit;
+};
@@ -0,0 +1,167 @@
+#include "culling.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+math::float4 normalize_plane( const math::float4& plane )
+{
+    const float invLength = 1.f / math::length( plane.xyz() );
+    return plane * invLength;
+}
+
+float plane_distance( const math::float4& plane, float x, float y, float z )
+{
+    return plane.x * x + plane.y * y + plane.z * z + plane.w;
+}
+
+size_t cull_spheres_scalar( const Frustum& frustum,
+                            const float* x, const float* y, const float* z, const float* radius,
+                            size_t count, uint32_t baseIndex, uint32_t* pVisible )
+{
+    size_t visible = 0;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        bool inside = true;
+        for ( const math::float4& plane : frustum.planes )
+            inside &= plane_distance( plane, x[i], y[i], z[i] ) >= -radius[i];
+
+        pVisible[ visible ] = baseIndex + static_cast<uint32_t>( i );
+        visible += inside;
+    }
+    return visible;
+}
+
+}
+
+Frustum make_frustum( const math::float4x4& clipTransform )
+{
+    // Rows of the clip transform; a clip space point is inside when -w <= x, y <= w and 0 <= z <= w.
+    const math::float4x4 rows = math::transpose( clipTransform );
+    const math::float4* r = rows.columns;
+
+    Frustum frustum;
+    frustum.planes[ Frustum::Left ]   = normalize_plane( r[3] + r[0] );
+    frustum.planes[ Frustum::Right ]  = normalize_plane( r[3] - r[0] );
+    frustum.planes[ Frustum::Bottom ] = normalize_plane( r[3] + r[1] );
+    frustum.planes[ Frustum::Top ]    = normalize_plane( r[3] - r[1] );
+    frustum.planes[ Frustum::Near ]   = normalize_plane( r[2] );
+    frustum.planes[ Frustum::Far ]    = normalize_plane( r[3] - r[2] );
+    return frustum;
+}
+
+bool sphere_visible( const Frustum& frustum, const math::float3& center, float radius )
+{
+    for ( const math::float4& plane : frustum.planes )
+    {
+        if ( plane_distance( plane, center.x, center.y, center.z ) < -radius )
+            return false;
+    }
+    return true;
+}
+
+bool aabb_visible( const Frustum& frustum, const math::float3& boundsMin, const math::float3& boundsMax )
+{
+    for ( const math::float4& plane : frustum.planes )
+    {
+        // Corner furthest along the plane normal.
+        const float x = plane.x >= 0.f ? boundsMax.x : boundsMin.x;
+        const float y = plane.y >= 0.f ? boundsMax.y : boundsMin.y;
+        const float z = plane.z >= 0.f ? boundsMax.z : boundsMin.z;
+        if ( plane_distance( plane, x, y, z ) < 0.f )
+            return false;
+    }
+    return true;
+}
+
+Containment classify_aabb( const Frustum& frustum, const math::float3& boundsMin, const math::float3& boundsMax )
+{
+    Containment result = Containment::Inside;
+    for ( const math::float4& plane : frustum.planes )
+    {
+        // Corners furthest along and against the plane normal.
+        const bool px = plane.x >= 0.f, py = plane.y >= 0.f, pz = plane.z >= 0.f;
+        if ( plane_distance( plane, px ? boundsMax.x : boundsMin.x, py ? boundsMax.y : boundsMin.y, pz ? boundsMax.z : boundsMin.z ) < 0.f )
+            return Containment::Outside;
+        if ( plane_distance( plane, px ? boundsMin.x : boundsMax.x, py ? boundsMin.y : boundsMax.y, pz ? boundsMin.z : boundsMax.z ) < 0.f )
+            result = Containment::Intersecting;
+    }
+    return result;
+}
+
+size_t cull_spheres( const Frustum& frustum,
+                     const float* x, const float* y, const float* z, const float* radius,
+                     size_t count, uint32_t baseIndex, uint32_t* pVisible )
+{
+    size_t i = 0;
+    size_t visible = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 px[ Frustum::PlaneCount ], py[ Frustum::PlaneCount ], pz[ Frustum::PlaneCount ], pw[ Frustum::PlaneCount ];
+    for ( int p = 0; p < Frustum::PlaneCount; ++p )
+    {
+        px[p] = _mm256_set1_ps( frustum.planes[p].x );
+        py[p] = _mm256_set1_ps( frustum.planes[p].y );
+        pz[p] = _mm256_set1_ps( frustum.planes[p].z );
+        pw[p] = _mm256_set1_ps( frustum.planes[p].w );
+    }
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        const __m256 cx = _mm256_loadu_ps( x + i );
+        const __m256 cy = _mm256_loadu_ps( y + i );
+        const __m256 cz = _mm256_loadu_ps( z + i );
+        const __m256 negRadius = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_loadu_ps( radius + i ) );
+
+        __m256 inside = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+        for ( int p = 0; p < Frustum::PlaneCount; ++p )
+        {
+            __m256 d = _mm256_fmadd_ps( px[p], cx, pw[p] );
+            d = _mm256_fmadd_ps( py[p], cy, d );
+            d = _mm256_fmadd_ps( pz[p], cz, d );
+            inside = _mm256_and_ps( inside, _mm256_cmp_ps( d, negRadius, _CMP_GE_OQ ) );
+        }
+
+        unsigned mask = static_cast<unsigned>( _mm256_movemask_ps( inside ) );
+        while ( mask )
+        {
+            pVisible[ visible++ ] = baseIndex + static_cast<uint32_t>( i ) + __builtin_ctz( mask );
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        const float32x4_t cx = vld1q_f32( x + i );
+        const float32x4_t cy = vld1q_f32( y + i );
+        const float32x4_t cz = vld1q_f32( z + i );
+        const float32x4_t negRadius = vnegq_f32( vld1q_f32( radius + i ) );
+
+        uint32x4_t inside = vdupq_n_u32( ~0u );
+        for ( const math::float4& plane : frustum.planes )
+        {
+            float32x4_t d = vfmaq_n_f32( vdupq_n_f32( plane.w ), cx, plane.x );
+            d = vfmaq_n_f32( d, cy, plane.y );
+            d = vfmaq_n_f32( d, cz, plane.z );
+            inside = vandq_u32( inside, vcgeq_f32( d, negRadius ) );
+        }
+
+        // Branch-free compaction: always store, only advance on visible lanes.
+        uint32_t lanes[4];
+        vst1q_u32( lanes, inside );
+        for ( uint32_t lane = 0; lane < 4; ++lane )
+        {
+            pVisible[ visible ] = baseIndex + static_cast<uint32_t>( i ) + lane;
+            visible += lanes[ lane ] & 1u;
+        }
+    }
+#endif
+
+    return visible + cull_spheres_scalar( frustum, x + i, y + i, z + i, radius + i, count - i,
+                                          baseIndex + static_cast<uint32_t>( i ), pVisible + visible );
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "math_types.hpp"
+
+// Six planes ( nx, ny, nz, d ) with normalized normals pointing inwards, a
+// point p is inside a plane when dot( n, p ) + d >= 0.
+struct Frustum
+{
+    enum Plane { Left, Right, Bottom, Top, Near, Far, PlaneCount };
+
+    math::float4 planes[PlaneCount];
+};
+
+// Extracts the planes of a clip transform (e.g. perspective * world) in the
+// space the matrix transforms from. Uses Metal clip space, 0 <= z <= w.
+Frustum make_frustum( const math::float4x4& clipTransform );
+
+bool sphere_visible( const Frustum& frustum, const math::float3& center, float radius );
+bool aabb_visible( const Frustum& frustum, const math::float3& boundsMin, const math::float3& boundsMax );
+
+// Like aabb_visible, but also tells boxes entirely inside every plane apart,
+// for hierarchies that can accept a whole subtree without testing it.
+enum class Containment { Outside, Intersecting, Inside };
+Containment classify_aabb( const Frustum& frustum, const math::float3& boundsMin, const math::float3& boundsMax );
+
+// Tests `count` spheres given as separate x/y/z/radius streams and writes the
+// indices of the visible ones, offset by `baseIndex`, to pVisible. Returns how
+// many were written; pVisible needs room for `count` indices.
+size_t cull_spheres( const Frustum& frustum,
+                     const float* x, const float* y, const float* z, const float* radius,
+                     size_t count, uint32_t baseIndex, uint32_t* pVisible );
@@ -0,0 +1,236 @@
+#include "entity_world.hpp"
+#include "job_system.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+namespace
+{
+
+constexpr uint32_t kNoArchetype = UINT32_MAX;
+
+constexpr size_t align_up( size_t size, size_t alignment )
+{
+    return ( size + alignment - 1 ) & ~( alignment - 1 );
+}
+
+}
+
+EntityWorld::EntityWorld()
+    : m_count( 0 )
+{ }
+
+EntityWorld::~EntityWorld()
+{
+    for ( Archetype& archetype : m_archetypes )
+        for ( uint8_t* pChunk : archetype.chunks )
+            ::operator delete( pChunk, std::align_val_t( kCacheLine ) );
+}
+
+EntityWorld::ComponentId EntityWorld::register_component( size_t size, size_t alignment )
+{
+    assert( m_components.size() < kMaxComponents && "too many component types" );
+    assert( alignment <= kCacheLine && size > 0 );
+    m_components.push_back( { size, alignment } );
+    return static_cast<ComponentId>( m_components.size() - 1 );
+}
+
+uint32_t EntityWorld::find_archetype( ComponentMask components )
+{
+    auto it = m_archetypeIndex.find( components );
+    if ( it != m_archetypeIndex.end() )
+        return it->second;
+
+    Archetype archetype = {};
+    archetype.mask = components;
+
+    // Every array may waste up to a cache line on padding; what is left is split evenly between the rows.
+    size_t rowSize = sizeof(Entity);
+    size_t arrays = 1;
+    for ( ComponentId id = 0; id < m_components.size(); ++id )
+    {
+        if ( components & mask( id ) )
+        {
+            rowSize += m_components[ id ].size;
+            arrays++;
+        }
+    }
+    assert( kChunkSize > arrays * kCacheLine && "too many components for one chunk" );
+    archetype.capacity = ( kChunkSize - arrays * kCacheLine ) / rowSize;
+    assert( archetype.capacity > 0 && "components too large for one chunk" );
+
+    size_t offset = align_up( archetype.capacity * sizeof(Entity), kCacheLine );
+    for ( ComponentId id = 0; id < m_components.size(); ++id )
+    {
+        if ( !( components & mask( id ) ) )
+            continue;
+        archetype.offsets[ id ] = static_cast<uint32_t>( offset );
+        offset = align_up( offset + archetype.capacity * m_components[ id ].size, kCacheLine );
+    }
+    assert( offset <= kChunkSize );
+
+    m_archetypes.push_back( std::move( archetype ) );
+    const uint32_t index = static_cast<uint32_t>( m_archetypes.size() - 1 );
+    m_archetypeIndex.emplace( components, index );
+    return index;
+}
+
+uint8_t* EntityWorld::component( const Archetype& archetype, uint32_t row, ComponentId id ) const
+{
+    uint8_t* pChunk = archetype.chunks[ row / archetype.capacity ];
+    return pChunk + archetype.offsets[ id ] + ( row % archetype.capacity ) * m_components[ id ].size;
+}
+
+uint32_t EntityWorld::push_row( Archetype& archetype, Entity entity )
+{
+    const uint32_t row = static_cast<uint32_t>( archetype.count++ );
+    if ( row / archetype.capacity == archetype.chunks.size() )
+        archetype.chunks.push_back( static_cast<uint8_t*>( ::operator new( kChunkSize, std::align_val_t( kCacheLine ) ) ) );
+
+    reinterpret_cast<Entity*>( archetype.chunks[ row / archetype.capacity ] )[ row % archetype.capacity ] = entity;
+    for ( ComponentId id = 0; id < m_components.size(); ++id )
+        if ( archetype.mask & mask( id ) )
+            memset( component( archetype, row, id ), 0, m_components[ id ].size );
+    return row;
+}
+
+void EntityWorld::remove_row( Archetype& archetype, uint32_t row )
+{
+    const uint32_t last = static_cast<uint32_t>( --archetype.count );
+    if ( row != last )
+    {
+        const Entity moved = reinterpret_cast<const Entity*>( archetype.chunks[ last / archetype.capacity ] )[ last % archetype.capacity ];
+        reinterpret_cast<Entity*>( archetype.chunks[ row / archetype.capacity ] )[ row % archetype.capacity ] = moved;
+        for ( ComponentId id = 0; id < m_components.size(); ++id )
+            if ( archetype.mask & mask( id ) )
+                memcpy( component( archetype, row, id ), component( archetype, last, id ), m_components[ id ].size );
+        m_records[ moved.index ].row = row;
+    }
+
+    if ( last % archetype.capacity == 0 )
+    {
+        ::operator delete( archetype.chunks.back(), std::align_val_t( kCacheLine ) );
+        archetype.chunks.pop_back();
+    }
+}
+
+Entity EntityWorld::create( ComponentMask components )
+{
+    assert( ( m_components.size() == kMaxComponents || ( components >> m_components.size() ) == 0 ) && "unregistered component" );
+
+    uint32_t index;
+    if ( !m_freeIndices.empty() )
+    {
+        index = m_freeIndices.back();
+        m_freeIndices.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>( m_records.size() );
+        m_records.push_back( { kNoArchetype, 0, 0 } );
+    }
+
+    Record& record = m_records[ index ];
+    record.generation = record.generation + 1 == 0 ? 1 : record.generation + 1;
+    const Entity entity = { index, record.generation };
+
+    record.archetype = find_archetype( components );
+    record.row = push_row( m_archetypes[ record.archetype ], entity );
+    m_count++;
+    return entity;
+}
+
+bool EntityWorld::alive( Entity entity ) const
+{
+    return entity.index < m_records.size()
+        && m_records[ entity.index ].generation == entity.generation
+        && m_records[ entity.index ].archetype != kNoArchetype;
+}
+
+void EntityWorld::destroy( Entity entity )
+{
+    assert( alive( entity ) );
+    Record& record = m_records[ entity.index ];
+    remove_row( m_archetypes[ record.archetype ], record.row );
+    record.archetype = kNoArchetype;
+    m_freeIndices.push_back( entity.index );
+    m_count--;
+}
+
+EntityWorld::ComponentMask EntityWorld::components( Entity entity ) const
+{
+    assert( alive( entity ) );
+    return m_archetypes[ m_records[ entity.index ].archetype ].mask;
+}
+
+void EntityWorld::set_components( Entity entity, ComponentMask components )
+{
+    assert( alive( entity ) );
+    const uint32_t from = m_records[ entity.index ].archetype;
+    if ( m_archetypes[ from ].mask == components )
+        return;
+
+    // find_archetype may grow m_archetypes, so the archetypes are looked up afterwards.
+    const uint32_t to = find_archetype( components );
+    Archetype& source = m_archetypes[ from ];
+    Archetype& target = m_archetypes[ to ];
+    const uint32_t fromRow = m_records[ entity.index ].row;
+    const uint32_t toRow = push_row( target, entity );
+
+    const ComponentMask shared = source.mask & target.mask;
+    for ( ComponentId id = 0; id < m_components.size(); ++id )
+        if ( shared & mask( id ) )
+            memcpy( component( target, toRow, id ), component( source, fromRow, id ), m_components[ id ].size );
+
+    remove_row( source, fromRow );
+    m_records[ entity.index ].archetype = to;
+    m_records[ entity.index ].row = toRow;
+}
+
+void* EntityWorld::get( Entity entity, ComponentId id )
+{
+    assert( alive( entity ) );
+    const Record& record = m_records[ entity.index ];
+    const Archetype& archetype = m_archetypes[ record.archetype ];
+    return archetype.mask & mask( id ) ? component( archetype, record.row, id ) : nullptr;
+}
+
+void EntityWorld::query( ComponentMask required, std::vector<Chunk>& outChunks )
+{
+    for ( const Archetype& archetype : m_archetypes )
+    {
+        if ( ( archetype.mask & required ) != required )
+            continue;
+
+        for ( size_t c = 0; c < archetype.chunks.size(); ++c )
+        {
+            uint8_t* pChunk = archetype.chunks[ c ];
+            Chunk chunk = {};
+            chunk.count = std::min( archetype.capacity, archetype.count - c * archetype.capacity );
+            chunk.entities = reinterpret_cast<const Entity*>( pChunk );
+            for ( ComponentId id = 0; id < m_components.size(); ++id )
+                if ( archetype.mask & mask( id ) )
+                    chunk.components[ id ] = pChunk + archetype.offsets[ id ];
+            outChunks.push_back( chunk );
+        }
+    }
+}
+
+void EntityWorld::for_each_chunk( ComponentMask required, const ChunkJob& fn )
+{
+    std::vector<Chunk> chunks;
+    query( required, chunks );
+    for ( const Chunk& chunk : chunks )
+        fn( chunk );
+}
+
+void EntityWorld::parallel_for_each_chunk( JobSystem& jobs, ComponentMask required, const ChunkJob& fn )
+{
+    std::vector<Chunk> chunks;
+    query( required, chunks );
+    jobs.parallel_for( chunks.size(), 1, [&]( size_t begin, size_t end ) {
+        for ( size_t c = begin; c < end; ++c )
+            fn( chunks[ c ] );
+    } );
+}
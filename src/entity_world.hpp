@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+
+// Handle to an entity. The generation tells a destroyed entity's handle from
+// the one that reuses its index; 0 is never a live generation.
+struct Entity
+{
+    uint32_t index;
+    uint32_t generation;
+};
+
+// Archetype based entity-component store. Entities with the same set of
+// components share an archetype, whose entities live in fixed size chunks:
+// the entity handles and then one array per component, each starting on its
+// own cache line. Chunks are kept full except for the last one of each
+// archetype, so a query visits dense arrays of exactly the components it
+// asks for, chunk by chunk.
+//
+// Components are plain data, moved with memcpy when an entity changes
+// archetype or another entity's removal fills its place.
+class EntityWorld
+{
+    public:
+        using ComponentId = uint32_t;
+        using ComponentMask = uint32_t;
+
+        static constexpr size_t kChunkSize = 16 * 1024;
+        static constexpr size_t kCacheLine = 64;
+        static constexpr size_t kMaxComponents = 32;
+
+        // The arrays of one chunk. Components of `components` the archetype does not have are null.
+        struct Chunk
+        {
+            size_t count;
+            const Entity* entities;
+            void* components[kMaxComponents];
+
+            template<typename T>
+            T* get( ComponentId id ) const { return static_cast<T*>( components[ id ] ); }
+        };
+
+        using ChunkJob = std::function<void( const Chunk& chunk )>;
+
+        EntityWorld();
+        ~EntityWorld();
+
+        EntityWorld( const EntityWorld& ) = delete;
+        EntityWorld& operator=( const EntityWorld& ) = delete;
+
+        // Alignments above kCacheLine are not supported.
+        ComponentId register_component( size_t size, size_t alignment );
+
+        template<typename T>
+        ComponentId register_component()
+        {
+            static_assert( std::is_trivially_copyable<T>::value, "components are moved with memcpy" );
+            return register_component( sizeof(T), alignof(T) );
+        }
+
+        static ComponentMask mask( ComponentId id ) { return ComponentMask( 1 ) << id; }
+
+        // New components are zeroed.
+        Entity create( ComponentMask components );
+        void destroy( Entity entity );
+        bool alive( Entity entity ) const;
+
+        // Moves the entity to the archetype of `components`. Components it keeps
+        // keep their values, components it gains are zeroed.
+        void set_components( Entity entity, ComponentMask components );
+        ComponentMask components( Entity entity ) const;
+
+        // Null when the entity does not have the component. Valid until an entity
+        // is created, destroyed or changes archetype.
+        void* get( Entity entity, ComponentId id );
+
+        template<typename T>
+        T* get( Entity entity, ComponentId id ) { return static_cast<T*>( get( entity, id ) ); }
+
+        size_t size() const { return m_count; }
+        size_t archetype_count() const { return m_archetypes.size(); }
+
+        // Appends the chunks of every archetype with all of `required`, in the
+        // order the archetypes were created. Valid until the world changes.
+        void query( ComponentMask required, std::vector<Chunk>& outChunks );
+
+        void for_each_chunk( ComponentMask required, const ChunkJob& fn );
+
+        // One job per chunk. Jobs may write the components of their own chunk,
+        // but must not create, destroy or change entities.
+        void parallel_for_each_chunk( JobSystem& jobs, ComponentMask required, const ChunkJob& fn );
+
+    private:
+        struct ComponentInfo
+        {
+            size_t size;
+            size_t alignment;
+        };
+
+        struct Archetype
+        {
+            ComponentMask mask;
+            size_t capacity;
+            // Byte offset of each component's array in a chunk, entity handles at 0.
+            uint32_t offsets[kMaxComponents];
+            std::vector<uint8_t*> chunks;
+            size_t count;
+        };
+
+        // Where an entity lives; row is its position across the archetype's chunks.
+        struct Record
+        {
+            uint32_t archetype;
+            uint32_t row;
+            uint32_t generation;
+        };
+
+        uint32_t find_archetype( ComponentMask components );
+        // Adds a zeroed row at the end of the archetype and returns it.
+        uint32_t push_row( Archetype& archetype, Entity entity );
+        // Fills the row with the archetype's last one, which is then dropped.
+        void remove_row( Archetype& archetype, uint32_t row );
+        uint8_t* component( const Archetype& archetype, uint32_t row, ComponentId id ) const;
+
+        std::vector<ComponentInfo> m_components;
+        std::vector<Archetype> m_archetypes;
+        std::unordered_map<ComponentMask, uint32_t> m_archetypeIndex;
+
+        std::vector<Record> m_records;
+        std::vector<uint32_t> m_freeIndices;
+        size_t m_count;
+};
@@ -0,0 +1,101 @@
+#include "frame_ring.hpp"
+#include <cassert>
+
+FrameRing::FrameRing( size_t capacity, size_t framesInFlight )
+    : m_capacity( capacity )
+    , m_maxFrames( framesInFlight )
+    , m_head( 0 )
+    , m_tail( 0 )
+    , m_frameStart( 0 )
+    , m_highWater( 0 )
+    , m_pending( framesInFlight )
+    , m_pendingFirst( 0 )
+    , m_pendingCount( 0 )
+    , m_nextFence( 1 )
+    , m_frameOpen( false )
+    , m_completedFence( 0 )
+{
+    assert( capacity > 0 && framesInFlight > 0 );
+}
+
+void FrameRing::begin_frame()
+{
+    assert( !m_frameOpen );
+
+    reclaim();
+    assert( m_pendingCount < m_maxFrames && "too many frames in flight" );
+
+    m_frameStart = m_head;
+    m_frameOpen = true;
+}
+
+bool FrameRing::allocate( size_t size, size_t alignment, Allocation& out )
+{
+    assert( m_frameOpen );
+    assert( alignment > 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+
+    if ( size == 0 || size > m_capacity )
+        return false;
+
+    const size_t pos = static_cast<size_t>( m_head % m_capacity );
+    size_t start = ( pos + alignment - 1 ) & ~( alignment - 1 );
+
+    // Never split an allocation across the end of the buffer, skip to the front instead.
+    if ( start + size > m_capacity )
+        start = 0;
+
+    const uint64_t skipped = ( start >= pos ) ? ( start - pos ) : ( m_capacity - pos );
+    const uint64_t newHead = m_head + skipped + size;
+    if ( newHead - m_tail > m_capacity )
+        return false;
+
+    m_head = newHead;
+    if ( bytes_in_use() > m_highWater )
+        m_highWater = bytes_in_use();
+
+    out.offset = start;
+    out.size = size;
+    return true;
+}
+
+uint64_t FrameRing::end_frame()
+{
+    assert( m_frameOpen );
+    m_frameOpen = false;
+
+    const uint64_t fence = m_nextFence++;
+    m_pending[ ( m_pendingFirst + m_pendingCount ) % m_maxFrames ] = { fence, m_head };
+    m_pendingCount++;
+
+    return fence;
+}
+
+void FrameRing::abandon_frame()
+{
+    assert( m_frameOpen );
+    m_frameOpen = false;
+    m_head = m_frameStart;
+}
+
+void FrameRing::signal( uint64_t fence )
+{
+    uint64_t current = m_completedFence.load( std::memory_order_relaxed );
+    while ( current < fence && !m_completedFence.compare_exchange_weak( current, fence, std::memory_order_release ) )
+    { }
+}
+
+uint64_t FrameRing::completed_fence() const
+{
+    return m_completedFence.load( std::memory_order_acquire );
+}
+
+void FrameRing::reclaim()
+{
+    const uint64_t completed = completed_fence();
+    while ( m_pendingCount > 0 && m_pending[ m_pendingFirst ].fence <= completed )
+    {
+        m_tail = m_pending[ m_pendingFirst ].end;
+        m_pendingFirst = ( m_pendingFirst + 1 ) % m_maxFrames;
+        m_pendingCount--;
+    }
+}
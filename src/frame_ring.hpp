@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Ring allocator for per-frame transient GPU data.
+//
+// One persistent buffer of `capacity` bytes is carved up linearly every frame.
+// A frame's region is only handed out again once the fence value returned by
+// end_frame() has been signalled, so memory stays bounded and regions the GPU
+// may still be reading are never reused. The ring only deals in offsets; the
+// caller owns the backing memory (e.g. an MTL::Buffer).
+class FrameRing
+{
+    public:
+        struct Allocation
+        {
+            size_t offset;
+            size_t size;
+        };
+
+        FrameRing( size_t capacity, size_t framesInFlight );
+
+        // Reclaims completed frames. At most `framesInFlight` frames may be
+        // outstanding, the caller is expected to throttle before calling this.
+        void begin_frame();
+        bool allocate( size_t size, size_t alignment, Allocation& out );
+        uint64_t end_frame();
+        // Closes the frame without submitting it, handing back everything it
+        // allocated. For when a frame can't get all the memory it needs.
+        void abandon_frame();
+
+        // Safe to call from the GPU completion thread.
+        void signal( uint64_t fence );
+
+        uint64_t completed_fence() const;
+        size_t capacity() const { return m_capacity; }
+        size_t frames_in_flight() const { return m_pendingCount; }
+        size_t bytes_in_use() const { return static_cast<size_t>( m_head - m_tail ); }
+        size_t high_water_mark() const { return m_highWater; }
+
+    private:
+        struct PendingFrame
+        {
+            uint64_t fence;
+            uint64_t end;
+        };
+
+        void reclaim();
+
+        size_t m_capacity;
+        size_t m_maxFrames;
+
+        // Offsets are monotonic; the physical position is `offset % capacity`.
+        uint64_t m_head;
+        uint64_t m_tail;
+        uint64_t m_frameStart;
+        size_t m_highWater;
+
+        std::vector<PendingFrame> m_pending;
+        size_t m_pendingFirst;
+        size_t m_pendingCount;
+
+        uint64_t m_nextFence;
+        bool m_frameOpen;
+        std::atomic<uint64_t> m_completedFence;
+};
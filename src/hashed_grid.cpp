@@ -0,0 +1,335 @@
+#include "hashed_grid.hpp"
+#include "culling.hpp"
+#include "instance_store.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+
+// Cell coordinates are kept to 21 bits each, a couple of million cells across, so that they pack into one key.
+constexpr int32_t kCoordLimit = ( 1 << 20 ) - 1;
+
+uint64_t cell_key( const int32_t coords[3] )
+{
+    auto bits = []( int32_t c ) { return static_cast<uint64_t>( c + kCoordLimit + 1 ) & 0x1fffff; };
+    return bits( coords[0] ) | bits( coords[1] ) << 21 | bits( coords[2] ) << 42;
+}
+
+// Bounds of the frustum's eight corners, each where a side plane pair meets the near or far plane. False
+// when they aren't finite, for a far plane at infinity or planes that don't close.
+bool frustum_bounds( const Frustum& frustum, math::float3& outMin, math::float3& outMax )
+{
+    outMin = { INFINITY, INFINITY, INFINITY };
+    outMax = { -INFINITY, -INFINITY, -INFINITY };
+    for ( int corner = 0; corner < 8; ++corner )
+    {
+        const math::float4& a = frustum.planes[ corner & 1 ? Frustum::Right : Frustum::Left ];
+        const math::float4& b = frustum.planes[ corner & 2 ? Frustum::Top : Frustum::Bottom ];
+        const math::float4& c = frustum.planes[ corner & 4 ? Frustum::Far : Frustum::Near ];
+        const math::float3 bc = math::cross( b.xyz(), c.xyz() );
+        const math::float3 p = ( bc * a.w + math::cross( c.xyz(), a.xyz() ) * b.w + math::cross( a.xyz(), b.xyz() ) * c.w ) * ( -1.f / math::dot( a.xyz(), bc ) );
+        if ( !std::isfinite( p.x ) || !std::isfinite( p.y ) || !std::isfinite( p.z ) )
+            return false;
+        outMin = { std::min( outMin.x, p.x ), std::min( outMin.y, p.y ), std::min( outMin.z, p.z ) };
+        outMax = { std::max( outMax.x, p.x ), std::max( outMax.y, p.y ), std::max( outMax.z, p.z ) };
+    }
+    return true;
+}
+
+}
+
+void HashedGrid::cell_coords( const math::float4& sphere, int32_t coords[3] ) const
+{
+    const float inverseSize = 1.f / m_cellSize;
+    const float p[3] = { sphere.x, sphere.y, sphere.z };
+    for ( int k = 0; k < 3; ++k )
+        coords[k] = static_cast<int32_t>( std::clamp( std::floor( p[k] * inverseSize ), float( -kCoordLimit ), float( kCoordLimit ) ) );
+}
+
+void HashedGrid::build( const InstanceStore& store )
+{
+    PROFILE_ZONE( "HashedGrid::build" );
+
+    const size_t count = store.size();
+    m_spheres.resize( count );
+    m_slots.resize( count );
+
+    math::float3 min = { INFINITY, INFINITY, INFINITY };
+    math::float3 max = { -INFINITY, -INFINITY, -INFINITY };
+    m_maxRadius = 0.f;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const math::float4 s = instance_sphere( store, i );
+        m_spheres[ i ] = s;
+        min = { std::min( min.x, s.x ), std::min( min.y, s.y ), std::min( min.z, s.z ) };
+        max = { std::max( max.x, s.x ), std::max( max.y, s.y ), std::max( max.z, s.z ) };
+        m_maxRadius = std::max( m_maxRadius, s.w );
+    }
+
+    // As if the instances were spread evenly through their bounds, but no smaller than the largest of them.
+    m_cellSize = 1.f;
+    if ( count > 0 )
+    {
+        const math::float3 extent = max - min;
+        const float volume = std::max( extent.x, 1.f ) * std::max( extent.y, 1.f ) * std::max( extent.z, 1.f );
+        m_cellSize = std::max( std::cbrt( volume * kInstancesPerCell / count ), 2.f * m_maxRadius );
+    }
+
+    m_cells.clear();
+    m_lookup.clear();
+    m_lookup.reserve( count / kInstancesPerCell + 1 );
+    std::fill( m_cellMin, m_cellMin + 3, INT32_MAX );
+    std::fill( m_cellMax, m_cellMax + 3, INT32_MIN );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        int32_t coords[3];
+        cell_coords( m_spheres[ i ], coords );
+        insert( static_cast<uint32_t>( i ), coords );
+    }
+}
+
+uint32_t HashedGrid::find_cell( const int32_t coords[3] )
+{
+    const auto [it, created] = m_lookup.try_emplace( cell_key( coords ), static_cast<uint32_t>( m_cells.size() ) );
+    if ( created )
+    {
+        Cell cell;
+        std::copy( coords, coords + 3, cell.coords );
+        m_cells.push_back( std::move( cell ) );
+        for ( int k = 0; k < 3; ++k )
+        {
+            m_cellMin[k] = std::min( m_cellMin[k], coords[k] );
+            m_cellMax[k] = std::max( m_cellMax[k], coords[k] );
+        }
+    }
+    return it->second;
+}
+
+void HashedGrid::insert( uint32_t instance, const int32_t coords[3] )
+{
+    const uint32_t cell = find_cell( coords );
+    std::vector<uint32_t>& instances = m_cells[ cell ].instances;
+    m_slots[ instance ] = { cell, static_cast<uint32_t>( instances.size() ) };
+    instances.push_back( instance );
+}
+
+void HashedGrid::remove( uint32_t instance )
+{
+    const Slot slot = m_slots[ instance ];
+    std::vector<uint32_t>& instances = m_cells[ slot.cell ].instances;
+    const uint32_t last = instances.back();
+    instances[ slot.index ] = last;
+    m_slots[ last ].index = slot.index;
+    instances.pop_back();
+    if ( !instances.empty() )
+        return;
+
+    // Empty cells go, the last cell takes the place of this one.
+    m_lookup.erase( cell_key( m_cells[ slot.cell ].coords ) );
+    const uint32_t lastCell = static_cast<uint32_t>( m_cells.size() - 1 );
+    if ( slot.cell != lastCell )
+    {
+        m_cells[ slot.cell ] = std::move( m_cells[ lastCell ] );
+        m_lookup[ cell_key( m_cells[ slot.cell ].coords ) ] = slot.cell;
+        for ( uint32_t moved : m_cells[ slot.cell ].instances )
+            m_slots[ moved ].cell = slot.cell;
+    }
+    m_cells.pop_back();
+}
+
+void HashedGrid::update( const InstanceStore& store, const uint32_t* pMoved, size_t count )
+{
+    PROFILE_ZONE( "HashedGrid::update" );
+    assert( store.size() == m_slots.size() && "instances were added or removed, build() instead" );
+
+    for ( size_t k = 0; k < count; ++k )
+    {
+        const uint32_t i = pMoved[ k ];
+        const math::float4 s = instance_sphere( store, i );
+        m_spheres[ i ] = s;
+        m_maxRadius = std::max( m_maxRadius, s.w );
+
+        int32_t coords[3];
+        cell_coords( s, coords );
+        const int32_t* pCurrent = m_cells[ m_slots[ i ].cell ].coords;
+        if ( std::equal( coords, coords + 3, pCurrent ) )
+            continue;
+        remove( i );
+        insert( i, coords );
+    }
+}
+
+size_t HashedGrid::cull( const Frustum& frustum, uint32_t* pVisible ) const
+{
+    PROFILE_ZONE( "HashedGrid::cull" );
+    if ( m_cells.empty() )
+        return 0;
+
+    // Boxes of cells, grown by the largest radius to hold every sphere whose center is in them.
+    const math::float3 slack = { m_maxRadius, m_maxRadius, m_maxRadius };
+    auto classify_cells = [&]( const int32_t first[3], const int32_t last[3] ) {
+        const math::float3 min = math::float3{ float( first[0] ), float( first[1] ), float( first[2] ) } * m_cellSize;
+        const math::float3 max = math::float3{ float( last[0] + 1 ), float( last[1] + 1 ), float( last[2] + 1 ) } * m_cellSize;
+        return classify_aabb( frustum, min - slack, max + slack );
+    };
+
+    size_t visible = 0;
+    auto cull_cell = [&]( const Cell& cell, Containment containment ) {
+        if ( containment == Containment::Intersecting )
+            containment = classify_cells( cell.coords, cell.coords );
+        if ( containment == Containment::Outside )
+            return;
+
+        if ( containment == Containment::Inside )
+        {
+            std::copy( cell.instances.begin(), cell.instances.end(), pVisible + visible );
+            visible += cell.instances.size();
+            return;
+        }
+
+        for ( uint32_t i : cell.instances )
+            if ( sphere_visible( frustum, m_spheres[ i ].xyz(), m_spheres[ i ].w ) )
+                pVisible[ visible++ ] = i;
+    };
+
+    // The occupied cells a sphere in the frustum can have its center in: those within the largest radius
+    // of the frustum's bounds.
+    math::float3 boundsMin, boundsMax;
+    int32_t rangeMin[3], rangeMax[3];
+    double rangeCells = 1.0;
+    if ( frustum_bounds( frustum, boundsMin, boundsMax ) )
+    {
+        boundsMin = boundsMin - slack;
+        boundsMax = boundsMax + slack;
+        const float low[3] = { boundsMin.x, boundsMin.y, boundsMin.z };
+        const float high[3] = { boundsMax.x, boundsMax.y, boundsMax.z };
+        const float inverseSize = 1.f / m_cellSize;
+        for ( int k = 0; k < 3; ++k )
+        {
+            rangeMin[k] = std::max( m_cellMin[k], static_cast<int32_t>( std::clamp( std::floor( low[k] * inverseSize ), float( -kCoordLimit ), float( kCoordLimit ) ) ) );
+            rangeMax[k] = std::min( m_cellMax[k], static_cast<int32_t>( std::clamp( std::floor( high[k] * inverseSize ), float( -kCoordLimit ), float( kCoordLimit ) ) ) );
+            rangeCells *= std::max( rangeMax[k] - rangeMin[k] + 1, 0 );
+        }
+    }
+    else
+    {
+        rangeCells = INFINITY;
+    }
+
+    // More lookups than there are cells to test: test them all.
+    if ( rangeCells > double( m_cells.size() ) )
+    {
+        for ( const Cell& cell : m_cells )
+            cull_cell( cell, Containment::Intersecting );
+        return visible;
+    }
+
+    // Slab by slab and row by row, so that the lookups are of rows that reach into the frustum, and the
+    // cells of rows entirely in it aren't tested one by one.
+    int32_t coords[3], first[3], last[3];
+    for ( coords[2] = rangeMin[2]; coords[2] <= rangeMax[2]; ++coords[2] )
+    {
+        first[2] = last[2] = coords[2];
+        first[0] = rangeMin[0];
+        last[0] = rangeMax[0];
+        first[1] = rangeMin[1];
+        last[1] = rangeMax[1];
+        if ( classify_cells( first, last ) == Containment::Outside )
+            continue;
+
+        for ( coords[1] = rangeMin[1]; coords[1] <= rangeMax[1]; ++coords[1] )
+        {
+            first[1] = last[1] = coords[1];
+            const Containment row = classify_cells( first, last );
+            if ( row == Containment::Outside )
+                continue;
+
+            for ( coords[0] = rangeMin[0]; coords[0] <= rangeMax[0]; ++coords[0] )
+            {
+                const auto it = m_lookup.find( cell_key( coords ) );
+                if ( it != m_lookup.end() )
+                    cull_cell( m_cells[ it->second ], row );
+            }
+        }
+    }
+    return visible;
+}
+
+bool HashedGrid::raycast( const Ray& ray, RayHit& hit ) const
+{
+    if ( m_cells.empty() )
+        return false;
+
+    // A sphere the ray meets in some cell has its center at most `reach` cells away from it.
+    const int32_t reach = static_cast<int32_t>( std::ceil( m_maxRadius / m_cellSize ) );
+    int32_t rangeMin[3], rangeMax[3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        rangeMin[k] = m_cellMin[k] - reach;
+        rangeMax[k] = m_cellMax[k] + reach;
+    }
+
+    const math::float3 invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+    const math::float3 boundsMin = math::float3{ float( rangeMin[0] ), float( rangeMin[1] ), float( rangeMin[2] ) } * m_cellSize;
+    const math::float3 boundsMax = math::float3{ float( rangeMax[0] + 1 ), float( rangeMax[1] + 1 ), float( rangeMax[2] + 1 ) } * m_cellSize;
+    float t = ray_box( ray, invDirection, boundsMin, boundsMax, ray.maxDistance );
+    if ( t < 0.f )
+        return false;
+
+    // Cell by cell from where the ray enters the occupied bounds.
+    const math::float3 start = ray.origin + ray.direction * t;
+    const float p[3] = { start.x, start.y, start.z };
+    const float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+    int32_t cell[3], step[3];
+    float tNext[3], tDelta[3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        cell[k] = std::clamp( static_cast<int32_t>( std::floor( p[k] / m_cellSize ) ), rangeMin[k], rangeMax[k] );
+        step[k] = direction[k] > 0.f ? 1 : direction[k] < 0.f ? -1 : 0;
+        if ( step[k] == 0 )
+        {
+            tNext[k] = INFINITY;
+            tDelta[k] = INFINITY;
+            continue;
+        }
+        const float boundary = float( cell[k] + ( step[k] > 0 ? 1 : 0 ) ) * m_cellSize;
+        tNext[k] = t + std::max( ( boundary - p[k] ) / direction[k], 0.f );
+        tDelta[k] = m_cellSize / std::fabs( direction[k] );
+    }
+
+    float nearest = ray.maxDistance;
+    bool found = false;
+    while ( t <= nearest )
+    {
+        int32_t neighbor[3];
+        for ( neighbor[2] = cell[2] - reach; neighbor[2] <= cell[2] + reach; ++neighbor[2] )
+            for ( neighbor[1] = cell[1] - reach; neighbor[1] <= cell[1] + reach; ++neighbor[1] )
+                for ( neighbor[0] = cell[0] - reach; neighbor[0] <= cell[0] + reach; ++neighbor[0] )
+                {
+                    const auto it = m_lookup.find( cell_key( neighbor ) );
+                    if ( it == m_lookup.end() )
+                        continue;
+                    for ( uint32_t i : m_cells[ it->second ].instances )
+                    {
+                        const float distance = ray_sphere( ray, m_spheres[ i ] );
+                        if ( distance >= 0.f && distance <= nearest )
+                        {
+                            nearest = distance;
+                            hit = { i, distance };
+                            found = true;
+                        }
+                    }
+                }
+
+        const int axis = tNext[0] < tNext[1] ? ( tNext[0] < tNext[2] ? 0 : 2 ) : ( tNext[1] < tNext[2] ? 1 : 2 );
+        t = tNext[ axis ];
+        tNext[ axis ] += tDelta[ axis ];
+        cell[ axis ] += step[ axis ];
+        if ( cell[ axis ] < rangeMin[ axis ] || cell[ axis ] > rangeMax[ axis ] )
+            break;
+    }
+    return found;
+}
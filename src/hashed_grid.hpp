@@ -0,0 +1,64 @@
+#pragma once
+
+#include "spatial_index.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid of cubic cells, only the occupied ones stored and found by a
+// hash of their coordinates. An instance sits in the cell containing its
+// center, so moving one is a hash lookup and, when it changed cells, two swap
+// removes; the cost doesn't depend on how far it went or how many others moved.
+//
+// Every cell's bounds are grown by the largest radius seen, which build()
+// resets. Culling looks up the cells within that radius of the frustum's
+// bounds, row by row, or tests every occupied cell when there are fewer of
+// them; raycasts step through the cells along the ray.
+class HashedGrid : public SpatialIndex
+{
+    public:
+        // What build() sizes the cells for, on average.
+        static constexpr size_t kInstancesPerCell = 8;
+
+        const char* name() const override { return "hashed grid"; }
+
+        void build( const InstanceStore& store ) override;
+        void update( const InstanceStore& store, const uint32_t* pMoved, size_t count ) override;
+        size_t cull( const Frustum& frustum, uint32_t* pVisible ) const override;
+        bool raycast( const Ray& ray, RayHit& hit ) const override;
+
+        size_t cell_count() const { return m_cells.size(); }
+        float cell_size() const { return m_cellSize; }
+
+    private:
+        struct Cell
+        {
+            int32_t coords[3];
+            std::vector<uint32_t> instances;
+        };
+
+        struct Slot
+        {
+            uint32_t cell;
+            uint32_t index;
+        };
+
+        void cell_coords( const math::float4& sphere, int32_t coords[3] ) const;
+        // The cell at the coordinates, created if needed.
+        uint32_t find_cell( const int32_t coords[3] );
+        void insert( uint32_t instance, const int32_t coords[3] );
+        void remove( uint32_t instance );
+
+        std::vector<Cell> m_cells;
+        std::unordered_map<uint64_t, uint32_t> m_lookup;
+        std::vector<math::float4> m_spheres;
+        std::vector<Slot> m_slots;
+
+        float m_cellSize = 1.f;
+        float m_maxRadius = 0.f;
+        // Bounds of the cell coordinates used since build().
+        int32_t m_cellMin[3] = {};
+        int32_t m_cellMax[3] = {};
+};
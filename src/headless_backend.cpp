@@ -0,0 +1,418 @@
+#include "headless_backend.hpp"
+#include "profiler.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <new>
+
+namespace gpu
+{
+
+namespace
+{
+
+// Matches the offset alignment Metal requires for constant buffers.
+constexpr size_t kBufferAlignment = 256;
+
+size_t index_size( IndexType type )
+{
+    return type == IndexType::UInt16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+class HeadlessBuffer : public Buffer
+{
+    public:
+        HeadlessBuffer( std::atomic<uint64_t>& bytesModified, size_t length )
+            : p_data( static_cast<uint8_t*>( ::operator new( std::max<size_t>( length, 1 ), std::align_val_t( kBufferAlignment ) ) ) )
+            , m_length( length )
+            , m_bytesModified( bytesModified )
+        { }
+
+        ~HeadlessBuffer() override
+        {
+            ::operator delete( p_data, std::align_val_t( kBufferAlignment ) );
+        }
+
+        void* contents() override { return p_data; }
+        size_t length() const override { return m_length; }
+
+        void did_modify_range( size_t offset, size_t size ) override
+        {
+            assert( offset + size <= m_length && "did_modify_range outside the buffer" );
+            m_bytesModified.fetch_add( size, std::memory_order_relaxed );
+        }
+
+        uint8_t* data() { return p_data; }
+
+    private:
+        uint8_t* p_data;
+        size_t m_length;
+        std::atomic<uint64_t>& m_bytesModified;
+};
+
+class HeadlessPipeline : public Pipeline
+{
+    public:
+        explicit HeadlessPipeline( const PipelineDesc& desc ) : m_desc( desc ) { }
+        PipelineDesc m_desc;
+};
+
+class HeadlessDepthStencilState : public DepthStencilState
+{
+    public:
+        HeadlessDepthStencilState( CompareFunction compare, bool depthWrite )
+            : m_compare( compare )
+            , m_depthWrite( depthWrite )
+        { }
+
+        CompareFunction m_compare;
+        bool m_depthWrite;
+};
+
+class HeadlessFence : public Fence
+{
+    public:
+        explicit HeadlessFence( size_t count ) : m_count( count ) { }
+
+        void wait() override
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_available.wait( lock, [this]() { return m_count > 0; } );
+            m_count--;
+        }
+
+        // Notifies under the lock, the last signal may let the owner destroy the fence.
+        void signal() override
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_count++;
+            m_available.notify_one();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_available;
+        size_t m_count;
+};
+
+}
+
+HeadlessTarget::HeadlessTarget( size_t width, size_t height )
+    : m_width( width )
+    , m_height( height )
+    , m_clearColor( 0xff000000 )
+    , m_color( width * height, m_clearColor )
+    , m_depth( width * height, 1.f )
+    , m_framesPresented( 0 )
+{ }
+
+void HeadlessTarget::clear()
+{
+    std::fill( m_color.begin(), m_color.end(), m_clearColor );
+    std::fill( m_depth.begin(), m_depth.end(), 1.f );
+}
+
+bool HeadlessTarget::write_ppm( const char* path ) const
+{
+    FILE* pFile = fopen( path, "wb" );
+    if ( !pFile )
+    {
+        __builtin_printf("Failed to open %s for writing. \n\n", path);
+        return false;
+    }
+
+    fprintf( pFile, "P6\n%zu %zu\n255\n", m_width, m_height );
+
+    std::vector<uint8_t> row( m_width * 3 );
+    bool ok = true;
+    for ( size_t y = 0; y < m_height && ok; ++y )
+    {
+        for ( size_t x = 0; x < m_width; ++x )
+        {
+            const uint32_t bgra = m_color[ y * m_width + x ];
+            row[ x * 3 + 0 ] = static_cast<uint8_t>( bgra >> 16 );
+            row[ x * 3 + 1 ] = static_cast<uint8_t>( bgra >> 8 );
+            row[ x * 3 + 2 ] = static_cast<uint8_t>( bgra );
+        }
+        ok = fwrite( row.data(), 1, row.size(), pFile ) == row.size();
+    }
+
+    ok = fclose( pFile ) == 0 && ok;
+    if ( !ok )
+        __builtin_printf("Failed to write %s. \n\n", path);
+    return ok;
+}
+
+// Records into passes of fully resolved draws and doubles as the pass's encoder.
+class HeadlessDevice::HeadlessCommandBuffer final : public CommandBuffer, public RenderEncoder
+{
+    public:
+        explicit HeadlessCommandBuffer( HeadlessDevice& device )
+            : m_device( device )
+            , m_encoding( false )
+        { }
+
+        RenderEncoder* render_pass( Target& target ) override
+        {
+            assert( !m_encoding && "previous render pass not ended" );
+            m_passes.push_back( { static_cast<HeadlessTarget*>( &target ), {} } );
+            m_encoding = true;
+
+            m_state = {};
+            m_state.depthCompare = CompareFunction::Always;
+            m_state.cullMode = CullMode::None;
+            m_state.winding = Winding::Clockwise;
+            p_pipeline = nullptr;
+            return this;
+        }
+
+        void add_completed_handler( std::function<void()> handler ) override
+        {
+            m_completedHandlers.push_back( std::move( handler ) );
+        }
+
+        void present( Target& target ) override
+        {
+            m_presents.push_back( static_cast<HeadlessTarget*>( &target ) );
+        }
+
+        void commit() override
+        {
+            assert( !m_encoding && "render pass not ended before commit" );
+            m_device.submit( this );
+        }
+
+        void set_pipeline( Pipeline* pPipeline ) override
+        {
+            p_pipeline = static_cast<HeadlessPipeline*>( pPipeline );
+            m_state.pipeline = p_pipeline->m_desc;
+            m_state.vertexFunction = m_device.m_functionNames[ p_pipeline->m_desc.vertexFunction ].c_str();
+            m_state.fragmentFunction = m_device.m_functionNames[ p_pipeline->m_desc.fragmentFunction ].c_str();
+        }
+
+        void set_depth_stencil_state( DepthStencilState* pState ) override
+        {
+            auto pDepth = static_cast<HeadlessDepthStencilState*>( pState );
+            m_state.depthCompare = pDepth->m_compare;
+            m_state.depthWrite = pDepth->m_depthWrite;
+        }
+
+        void set_vertex_buffer( Buffer* pBuffer, size_t offset, size_t index ) override
+        {
+            if ( index >= HeadlessDraw::kMaxVertexBuffers )
+            {
+                __builtin_printf("Vertex buffer index %zu out of range, binding ignored. \n", index);
+                return;
+            }
+
+            // An empty binding fails the bounds check of every draw that reads it.
+            if ( offset > pBuffer->length() )
+            {
+                __builtin_printf("Vertex buffer offset %zu outside the %zu byte buffer, buffer %zu unbound. \n",
+                                 offset, pBuffer->length(), index);
+                m_state.vertexBuffers[ index ] = { nullptr, 0 };
+                return;
+            }
+
+            auto pHeadless = static_cast<HeadlessBuffer*>( pBuffer );
+            m_state.vertexBuffers[ index ] = { pHeadless->data() + offset, pHeadless->length() - offset };
+        }
+
+        void set_cull_mode( CullMode mode ) override { m_state.cullMode = mode; }
+        void set_front_facing_winding( Winding winding ) override { m_state.winding = winding; }
+
+        void draw_indexed( size_t indexCount, IndexType indexType, Buffer* pIndexBuffer, size_t indexOffset, size_t instanceCount ) override
+        {
+            assert( m_encoding && p_pipeline && "draw without a pipeline" );
+
+            const size_t length = pIndexBuffer->length();
+            if ( indexOffset > length || indexCount > ( length - indexOffset ) / index_size( indexType ) )
+            {
+                __builtin_printf("Index range of %zu indices at %zu outside the %zu byte buffer, draw skipped. \n",
+                                 indexCount, indexOffset, length);
+                return;
+            }
+
+            HeadlessDraw draw = m_state;
+            draw.indexType = indexType;
+            draw.pIndices = static_cast<HeadlessBuffer*>( pIndexBuffer )->data() + indexOffset;
+            draw.indexCount = indexCount;
+            draw.instanceCount = instanceCount;
+            m_passes.back().draws.push_back( draw );
+        }
+
+        void end_encoding() override
+        {
+            assert( m_encoding );
+            m_encoding = false;
+        }
+
+        struct Pass
+        {
+            HeadlessTarget* pTarget;
+            std::vector<HeadlessDraw> draws;
+        };
+
+        HeadlessDevice& m_device;
+        std::vector<Pass> m_passes;
+        std::vector<HeadlessTarget*> m_presents;
+        std::vector<std::function<void()>> m_completedHandlers;
+
+    private:
+        bool m_encoding;
+        HeadlessPipeline* p_pipeline;
+        HeadlessDraw m_state;
+};
+
+HeadlessDevice::HeadlessDevice()
+    : m_busy( false )
+    , m_running( true )
+    , m_commandBuffers( 0 )
+    , m_renderPasses( 0 )
+    , m_drawCalls( 0 )
+    , m_instances( 0 )
+    , m_primitives( 0 )
+    , m_bytesModified( 0 )
+{
+    m_thread = std::thread( &HeadlessDevice::queue_main, this );
+}
+
+HeadlessDevice::~HeadlessDevice()
+{
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void HeadlessDevice::wait_idle()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_idle.wait( lock, [this]() { return m_queue.empty() && !m_busy; } );
+}
+
+HeadlessDevice::Stats HeadlessDevice::stats() const
+{
+    return { m_commandBuffers.load( std::memory_order_relaxed ),
+             m_renderPasses.load( std::memory_order_relaxed ),
+             m_drawCalls.load( std::memory_order_relaxed ),
+             m_instances.load( std::memory_order_relaxed ),
+             m_primitives.load( std::memory_order_relaxed ),
+             m_bytesModified.load( std::memory_order_relaxed ) };
+}
+
+bool HeadlessDevice::load_program( const char* sourcePath, const char* const* functionNames, size_t functionCount,
+                                   const ShaderMacro*, size_t )
+{
+    // There is nothing to compile, the software functions are built with the same macros as the core.
+    // Still fail the same way the Metal device would for a missing source.
+    MappedFile source( sourcePath );
+    if ( !source.is_open() )
+    {
+        __builtin_printf("Failed to open shader source: %s \n\n", sourcePath);
+        return false;
+    }
+
+    m_functionNames.assign( functionNames, functionNames + functionCount );
+    return true;
+}
+
+Buffer* HeadlessDevice::new_buffer( size_t length )
+{
+    return new HeadlessBuffer( m_bytesModified, length );
+}
+
+Pipeline* HeadlessDevice::new_pipeline( const PipelineDesc& desc )
+{
+    if ( desc.vertexFunction >= m_functionNames.size() || desc.fragmentFunction >= m_functionNames.size() )
+    {
+        __builtin_printf("Pipeline refers to a function that is not in the loaded program. \n\n");
+        return nullptr;
+    }
+
+    return new HeadlessPipeline( desc );
+}
+
+DepthStencilState* HeadlessDevice::new_depth_stencil_state( CompareFunction compare, bool depthWrite )
+{
+    return new HeadlessDepthStencilState( compare, depthWrite );
+}
+
+Fence* HeadlessDevice::new_fence( size_t count )
+{
+    return new HeadlessFence( count );
+}
+
+CommandBuffer* HeadlessDevice::command_buffer()
+{
+    return new HeadlessCommandBuffer( *this );
+}
+
+void HeadlessDevice::submit( HeadlessCommandBuffer* pCommands )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_queue.push_back( pCommands );
+    }
+    m_wake.notify_one();
+}
+
+void HeadlessDevice::execute( HeadlessCommandBuffer* pCommands )
+{
+    PROFILE_ZONE( "execute command buffer" );
+
+    for ( HeadlessCommandBuffer::Pass& pass : pCommands->m_passes )
+    {
+        pass.pTarget->clear();
+        m_renderPasses.fetch_add( 1, std::memory_order_relaxed );
+
+        for ( const HeadlessDraw& draw : pass.draws )
+        {
+            m_drawCalls.fetch_add( 1, std::memory_order_relaxed );
+            m_instances.fetch_add( draw.instanceCount, std::memory_order_relaxed );
+            m_primitives.fetch_add( draw.indexCount / 3 * draw.instanceCount, std::memory_order_relaxed );
+
+            if ( m_drawHandler )
+                m_drawHandler( *pass.pTarget, draw );
+        }
+    }
+
+    for ( HeadlessTarget* pTarget : pCommands->m_presents )
+        pTarget->mark_presented();
+
+    m_commandBuffers.fetch_add( 1, std::memory_order_relaxed );
+
+    for ( auto& handler : pCommands->m_completedHandlers )
+        handler();
+}
+
+void HeadlessDevice::queue_main()
+{
+    PROFILE_THREAD( "headless queue" );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_wake.wait( lock, [this]() { return !m_running || !m_queue.empty(); } );
+        if ( m_queue.empty() )
+            return;
+
+        HeadlessCommandBuffer* pCommands = m_queue.front();
+        m_queue.pop_front();
+        m_busy = true;
+        lock.unlock();
+
+        execute( pCommands );
+        delete pCommands;
+
+        lock.lock();
+        m_busy = false;
+        m_idle.notify_all();
+    }
+}
+
+}
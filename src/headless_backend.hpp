@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend.hpp"
+
+namespace gpu
+{
+
+// Offscreen render target for HeadlessDevice, color is BGRA8 and depth float.
+class HeadlessTarget : public Target
+{
+    public:
+        HeadlessTarget( size_t width, size_t height );
+
+        size_t width() const { return m_width; }
+        size_t height() const { return m_height; }
+
+        uint32_t* color() { return m_color.data(); }
+        const uint32_t* color() const { return m_color.data(); }
+        float* depth() { return m_depth.data(); }
+        const float* depth() const { return m_depth.data(); }
+
+        void set_clear_color( uint32_t bgra ) { m_clearColor = bgra; }
+        void clear();
+
+        // Writes the color image as binary PPM, e.g. for comparing against a golden image.
+        bool write_ppm( const char* path ) const;
+
+        // Bumped on the queue thread each time a command buffer presents the target.
+        uint64_t frames_presented() const { return m_framesPresented.load( std::memory_order_acquire ); }
+        void mark_presented() { m_framesPresented.fetch_add( 1, std::memory_order_acq_rel ); }
+
+    private:
+        size_t m_width;
+        size_t m_height;
+        uint32_t m_clearColor;
+        std::vector<uint32_t> m_color;
+        std::vector<float> m_depth;
+        std::atomic<uint64_t> m_framesPresented;
+};
+
+// A draw with the state it was recorded with and its buffer bindings already
+// resolved to memory, as handed to HeadlessDevice's draw handler.
+struct HeadlessDraw
+{
+    static constexpr size_t kMaxVertexBuffers = 8;
+
+    struct Binding
+    {
+        const uint8_t* pData;
+        size_t size;
+    };
+
+    PipelineDesc pipeline;
+    const char* vertexFunction;
+    const char* fragmentFunction;
+    CompareFunction depthCompare;
+    bool depthWrite;
+    CullMode cullMode;
+    Winding winding;
+
+    Binding vertexBuffers[ kMaxVertexBuffers ];
+
+    IndexType indexType;
+    const uint8_t* pIndices;
+    size_t indexCount;
+    size_t instanceCount;
+};
+
+// Device that records command buffers and executes them in order on its own
+// queue thread, the way a GPU would. Draws are validated against the buffers
+// they use and passed to the draw handler; without one they are only counted.
+class HeadlessDevice : public Device
+{
+    public:
+        using DrawHandler = std::function<void( HeadlessTarget& target, const HeadlessDraw& draw )>;
+
+        struct Stats
+        {
+            uint64_t commandBuffers;
+            uint64_t renderPasses;
+            uint64_t drawCalls;
+            uint64_t instances;
+            uint64_t primitives;
+            uint64_t bytesModified;
+        };
+
+        HeadlessDevice();
+        ~HeadlessDevice() override;
+
+        HeadlessDevice( const HeadlessDevice& ) = delete;
+        HeadlessDevice& operator=( const HeadlessDevice& ) = delete;
+
+        // Set before the first commit, it runs on the queue thread.
+        void set_draw_handler( DrawHandler handler ) { m_drawHandler = std::move( handler ); }
+
+        // Blocks until every committed command buffer has completed.
+        void wait_idle();
+        Stats stats() const;
+
+        bool load_program( const char* sourcePath, const char* const* functionNames, size_t functionCount,
+                           const ShaderMacro* pMacros, size_t macroCount ) override;
+
+        Buffer* new_buffer( size_t length ) override;
+        Pipeline* new_pipeline( const PipelineDesc& desc ) override;
+        DepthStencilState* new_depth_stencil_state( CompareFunction compare, bool depthWrite ) override;
+        Fence* new_fence( size_t count ) override;
+
+        CommandBuffer* command_buffer() override;
+
+    private:
+        class HeadlessCommandBuffer;
+
+        void submit( HeadlessCommandBuffer* pCommands );
+        void execute( HeadlessCommandBuffer* pCommands );
+        void queue_main();
+
+        std::vector<std::string> m_functionNames;
+        DrawHandler m_drawHandler;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_idle;
+        std::deque<HeadlessCommandBuffer*> m_queue;
+        bool m_busy;
+        bool m_running;
+        std::thread m_thread;
+
+        std::atomic<uint64_t> m_commandBuffers;
+        std::atomic<uint64_t> m_renderPasses;
+        std::atomic<uint64_t> m_drawCalls;
+        std::atomic<uint64_t> m_instances;
+        std::atomic<uint64_t> m_primitives;
+        std::atomic<uint64_t> m_bytesModified;
+};
+
+}
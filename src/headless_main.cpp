@@ -0,0 +1,126 @@
+#include "headless_backend.hpp"
+#include "profiler.hpp"
+#include "renderer.hpp"
+#include "software_rasterizer.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+// Runs the renderer's frame loop against the headless backend, e.g. on CI:
+//   HeadlessApp [frame count] [-r] [-o image.ppm] [-t trace.json] [-m model.mesh]
+// -r rasterizes every frame in software, -o does so too and writes the last
+// frame to an image, -t writes the profiler's zones as a Chrome trace, -m
+// draws a mesh converted by mesh_tool instead of the cube.
+// Expects to be started from the repository root, like MetalApp.
+int main( int argc, char** argv )
+{
+    long frameCount = 300;
+    bool rasterize = false;
+    const char* imagePath = nullptr;
+    const char* tracePath = nullptr;
+    const char* meshPath = nullptr;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "-r" ) == 0 )
+            rasterize = true;
+        else if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc )
+            imagePath = argv[ ++i ];
+        else if ( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc )
+            tracePath = argv[ ++i ];
+        else if ( strcmp( argv[i], "-m" ) == 0 && i + 1 < argc )
+            meshPath = argv[ ++i ];
+        else
+            frameCount = strtol( argv[i], nullptr, 10 );
+    }
+
+    if ( frameCount <= 0 )
+    {
+        __builtin_printf("usage: %s [frame count] [-r] [-o image.ppm] [-t trace.json] [-m model.mesh] \n", argv[0]);
+        return 1;
+    }
+
+    PROFILE_THREAD( "main" );
+
+    gpu::HeadlessDevice device;
+    gpu::HeadlessTarget target( 1200, 750 );
+    // The Metal view clears to 0.01 linear, 25 once sRGB encoded.
+    target.set_clear_color( 0xff191919 );
+
+    JobSystem rasterJobs;
+    SoftwareRasterizer rasterizer( rasterJobs );
+    if ( rasterize || imagePath )
+    {
+        register_program_functions( rasterizer );
+        device.set_draw_handler( [&rasterizer]( gpu::HeadlessTarget& drawTarget, const gpu::HeadlessDraw& draw ) {
+            rasterizer.draw( drawTarget, draw );
+        } );
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        Renderer renderer( &device, meshPath );
+        for ( long frame = 0; frame < frameCount; ++frame )
+            renderer.draw( target );
+
+        const Renderer::UploadStats& uploads = renderer.upload_stats();
+        __builtin_printf("last frame: %zu instances packed, %zu ranges flagged, %zu bytes uploaded \n",
+                         uploads.instancesPacked, uploads.rangesFlagged, uploads.bytesUploaded);
+
+        const Renderer::SceneStats& scene = renderer.scene_stats();
+        __builtin_printf("last frame: %zu of %zu scene nodes in %zu levels updated \n",
+                         scene.nodesUpdated, scene.nodes, scene.levels);
+
+        const PipelineCache<gpu::Pipeline*>::Stats pipelines = renderer.pipeline_stats();
+        __builtin_printf("pipelines: %llu compiled in %.3f ms, %llu hits, %llu misses \n",
+                         static_cast<unsigned long long>( pipelines.compiles ), pipelines.compileNanoseconds * 1e-6,
+                         static_cast<unsigned long long>( pipelines.hits ), static_cast<unsigned long long>( pipelines.misses ));
+
+        const Renderer::CullStats& culling = renderer.cull_stats();
+        __builtin_printf("last frame: %zu instances visible, %zu of %zu meshlets visible, %zu draws \n",
+                         culling.instancesVisible, culling.meshletsVisible, culling.meshletsTested, culling.drawCalls);
+        __builtin_printf("last frame: %zu instances occluded, %zu occluder triangles rasterized \n",
+                         culling.instancesOccluded, culling.occluderTriangles);
+        __builtin_printf("last frame: instances per level of detail");
+        for ( size_t count : culling.instancesPerLod )
+            __builtin_printf(" %zu", count);
+        __builtin_printf(" \n");
+    }
+    device.wait_idle();
+    const auto elapsed = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+
+    const gpu::HeadlessDevice::Stats stats = device.stats();
+    __builtin_printf("%llu frames in %.2f ms, %.3f ms per frame \n",
+                     static_cast<unsigned long long>( target.frames_presented() ), elapsed, elapsed / frameCount);
+    __builtin_printf("%llu draws, %llu instances, %llu triangles, %llu bytes flagged modified \n",
+                     static_cast<unsigned long long>( stats.drawCalls ),
+                     static_cast<unsigned long long>( stats.instances ),
+                     static_cast<unsigned long long>( stats.primitives ),
+                     static_cast<unsigned long long>( stats.bytesModified ));
+
+    const profiler::FrameSummary frames = profiler::frame_summary();
+    __builtin_printf("frame time over the last %zu frames: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms \n",
+                     frames.frames, frames.p50Ms, frames.p95Ms, frames.p99Ms, frames.maxMs);
+
+    if ( rasterize || imagePath )
+    {
+        const SoftwareRasterizer::Stats raster = rasterizer.stats();
+        __builtin_printf("raster: %llu vertices, %llu triangles (%llu culled, %llu clipped), %llu tile bins, %llu fragments covered, %llu shaded \n",
+                         static_cast<unsigned long long>( raster.vertices ),
+                         static_cast<unsigned long long>( raster.triangles ),
+                         static_cast<unsigned long long>( raster.trianglesCulled ),
+                         static_cast<unsigned long long>( raster.trianglesClipped ),
+                         static_cast<unsigned long long>( raster.tileBins ),
+                         static_cast<unsigned long long>( raster.fragmentsCovered ),
+                         static_cast<unsigned long long>( raster.fragmentsShaded ));
+    }
+
+    if ( imagePath && !target.write_ppm( imagePath ) )
+        return 1;
+
+    if ( tracePath && !profiler::write_chrome_trace( tracePath ) )
+        return 1;
+
+    return target.frames_presented() == static_cast<uint64_t>( frameCount ) ? 0 : 1;
+}
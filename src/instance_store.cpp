@@ -0,0 +1,387 @@
+#include "instance_store.hpp"
+#include "math.hpp"
+#include "packing.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+constexpr size_t kStreamAlignment = 32;
+constexpr size_t kPackedStride = sizeof(PackedInstance) / sizeof(float);
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+struct Isa
+{
+    using V = __m256;
+    static constexpr size_t kWidth = 8;
+
+    static V load( const float* p ) { return _mm256_load_ps( p ); }
+    static V gather( const float* p, const uint32_t* pIndices ) { return _mm256_i32gather_ps( p, _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pIndices ) ), 4 ); }
+    static V splat( float f ) { return _mm256_set1_ps( f ); }
+    static V zero() { return _mm256_setzero_ps(); }
+    static V add( V a, V b ) { return _mm256_add_ps( a, b ); }
+    static V sub( V a, V b ) { return _mm256_sub_ps( a, b ); }
+    static V mul( V a, V b ) { return _mm256_mul_ps( a, b ); }
+    static V madd( V a, V b, V c ) { return _mm256_fmadd_ps( a, b, c ); }
+
+    // Transposes four rows of 8 lanes into one float4 per instance.
+    static void store_float4( V r0, V r1, V r2, V r3, float* pOut )
+    {
+        __m128 lo0 = _mm256_castps256_ps128( r0 ), hi0 = _mm256_extractf128_ps( r0, 1 );
+        __m128 lo1 = _mm256_castps256_ps128( r1 ), hi1 = _mm256_extractf128_ps( r1, 1 );
+        __m128 lo2 = _mm256_castps256_ps128( r2 ), hi2 = _mm256_extractf128_ps( r2, 1 );
+        __m128 lo3 = _mm256_castps256_ps128( r3 ), hi3 = _mm256_extractf128_ps( r3, 1 );
+        _MM_TRANSPOSE4_PS( lo0, lo1, lo2, lo3 );
+        _MM_TRANSPOSE4_PS( hi0, hi1, hi2, hi3 );
+        _mm_store_ps( pOut + 0 * kPackedStride, lo0 );
+        _mm_store_ps( pOut + 1 * kPackedStride, lo1 );
+        _mm_store_ps( pOut + 2 * kPackedStride, lo2 );
+        _mm_store_ps( pOut + 3 * kPackedStride, lo3 );
+        _mm_store_ps( pOut + 4 * kPackedStride, hi0 );
+        _mm_store_ps( pOut + 5 * kPackedStride, hi1 );
+        _mm_store_ps( pOut + 6 * kPackedStride, hi2 );
+        _mm_store_ps( pOut + 7 * kPackedStride, hi3 );
+    }
+};
+
+#define INSTANCE_STORE_SIMD 1
+
+#elif defined(__ARM_NEON)
+
+struct Isa
+{
+    using V = float32x4_t;
+    static constexpr size_t kWidth = 4;
+
+    static V load( const float* p ) { return vld1q_f32( p ); }
+    static V gather( const float* p, const uint32_t* pIndices )
+    {
+        const float lanes[4] = { p[ pIndices[0] ], p[ pIndices[1] ], p[ pIndices[2] ], p[ pIndices[3] ] };
+        return vld1q_f32( lanes );
+    }
+    static V splat( float f ) { return vdupq_n_f32( f ); }
+    static V zero() { return vdupq_n_f32( 0.f ); }
+    static V add( V a, V b ) { return vaddq_f32( a, b ); }
+    static V sub( V a, V b ) { return vsubq_f32( a, b ); }
+    static V mul( V a, V b ) { return vmulq_f32( a, b ); }
+    static V madd( V a, V b, V c ) { return vfmaq_f32( c, a, b ); }
+
+    static void store_float4( V r0, V r1, V r2, V r3, float* pOut )
+    {
+        float32x4x2_t t01 = vtrnq_f32( r0, r1 );
+        float32x4x2_t t23 = vtrnq_f32( r2, r3 );
+        vst1q_f32( pOut + 0 * kPackedStride, vcombine_f32( vget_low_f32( t01.val[0] ), vget_low_f32( t23.val[0] ) ) );
+        vst1q_f32( pOut + 1 * kPackedStride, vcombine_f32( vget_low_f32( t01.val[1] ), vget_low_f32( t23.val[1] ) ) );
+        vst1q_f32( pOut + 2 * kPackedStride, vcombine_f32( vget_high_f32( t01.val[0] ), vget_high_f32( t23.val[0] ) ) );
+        vst1q_f32( pOut + 3 * kPackedStride, vcombine_f32( vget_high_f32( t01.val[1] ), vget_high_f32( t23.val[1] ) ) );
+    }
+};
+
+#define INSTANCE_STORE_SIMD 1
+
+#endif
+
+#if INSTANCE_STORE_SIMD
+
+// Composes Isa::kWidth instances; fetch( stream ) loads the lanes' values from a stream.
+template <typename Fetch>
+void pack_lanes( const InstanceStore& store, const float parent[16], const Fetch& fetch, PackedInstance* pOut )
+{
+    using V = Isa::V;
+    using S = InstanceStore::Stream;
+
+    const V px = fetch( store.stream( S::PositionX ) );
+    const V py = fetch( store.stream( S::PositionY ) );
+    const V pz = fetch( store.stream( S::PositionZ ) );
+    const V qx = fetch( store.stream( S::RotationX ) );
+    const V qy = fetch( store.stream( S::RotationY ) );
+    const V qz = fetch( store.stream( S::RotationZ ) );
+    const V qw = fetch( store.stream( S::RotationW ) );
+    const V sx = fetch( store.stream( S::ScaleX ) );
+    const V sy = fetch( store.stream( S::ScaleY ) );
+    const V sz = fetch( store.stream( S::ScaleZ ) );
+
+    const V one = Isa::splat( 1.f );
+    const V two = Isa::splat( 2.f );
+
+    const V xx = Isa::mul( qx, qx ), yy = Isa::mul( qy, qy ), zz = Isa::mul( qz, qz );
+    const V xy = Isa::mul( qx, qy ), xz = Isa::mul( qx, qz ), yz = Isa::mul( qy, qz );
+    const V xw = Isa::mul( qx, qw ), yw = Isa::mul( qy, qw ), zw = Isa::mul( qz, qw );
+
+    // Local R * S, l[row][column].
+    V l[3][3];
+    l[0][0] = Isa::mul( Isa::sub( one, Isa::mul( two, Isa::add( yy, zz ) ) ), sx );
+    l[1][0] = Isa::mul( Isa::mul( two, Isa::add( xy, zw ) ), sx );
+    l[2][0] = Isa::mul( Isa::mul( two, Isa::sub( xz, yw ) ), sx );
+    l[0][1] = Isa::mul( Isa::mul( two, Isa::sub( xy, zw ) ), sy );
+    l[1][1] = Isa::mul( Isa::sub( one, Isa::mul( two, Isa::add( xx, zz ) ) ), sy );
+    l[2][1] = Isa::mul( Isa::mul( two, Isa::add( yz, xw ) ), sy );
+    l[0][2] = Isa::mul( Isa::mul( two, Isa::add( xz, yw ) ), sz );
+    l[1][2] = Isa::mul( Isa::mul( two, Isa::sub( yz, xw ) ), sz );
+    l[2][2] = Isa::mul( Isa::sub( one, Isa::mul( two, Isa::add( xx, yy ) ) ), sz );
+
+    // world = parent * local, w[row][column].
+    V w[4][4];
+    for ( int r = 0; r < 4; ++r )
+    {
+        const V p0 = Isa::splat( parent[ 0 * 4 + r ] );
+        const V p1 = Isa::splat( parent[ 1 * 4 + r ] );
+        const V p2 = Isa::splat( parent[ 2 * 4 + r ] );
+        const V p3 = Isa::splat( parent[ 3 * 4 + r ] );
+
+        for ( int c = 0; c < 3; ++c )
+            w[r][c] = Isa::madd( p0, l[0][c], Isa::madd( p1, l[1][c], Isa::mul( p2, l[2][c] ) ) );
+        w[r][3] = Isa::madd( p0, px, Isa::madd( p1, py, Isa::madd( p2, pz, p3 ) ) );
+    }
+
+    float* pBase = reinterpret_cast<float*>( pOut );
+    const V zero = Isa::zero();
+    for ( int c = 0; c < 4; ++c )
+        Isa::store_float4( w[0][c], w[1][c], w[2][c], w[3][c], pBase + offsetof( PackedInstance, transform ) / sizeof(float) + c * 4 );
+    for ( int c = 0; c < 3; ++c )
+        Isa::store_float4( w[0][c], w[1][c], w[2][c], zero, pBase + offsetof( PackedInstance, normalTransform ) / sizeof(float) + c * 4 );
+
+    Isa::store_float4( fetch( store.stream( S::ColorR ) ),
+                       fetch( store.stream( S::ColorG ) ),
+                       fetch( store.stream( S::ColorB ) ),
+                       fetch( store.stream( S::ColorA ) ),
+                       pBase + offsetof( PackedInstance, color ) / sizeof(float) );
+}
+
+#endif
+
+void pack_one( const InstanceStore& store, const math::float4x4& parent, size_t i, PackedInstance& out )
+{
+    using S = InstanceStore::Stream;
+
+    const math::float3 position = { store.stream( S::PositionX )[ i ], store.stream( S::PositionY )[ i ], store.stream( S::PositionZ )[ i ] };
+    const math::quat rotation = { store.stream( S::RotationX )[ i ], store.stream( S::RotationY )[ i ], store.stream( S::RotationZ )[ i ], store.stream( S::RotationW )[ i ] };
+    const math::float3 scale = { store.stream( S::ScaleX )[ i ], store.stream( S::ScaleY )[ i ], store.stream( S::ScaleZ )[ i ] };
+
+    const math::float4x4 world = parent * math::make_trs( position, rotation, scale );
+    const float color[4] = { store.stream( S::ColorR )[ i ], store.stream( S::ColorG )[ i ], store.stream( S::ColorB )[ i ], store.stream( S::ColorA )[ i ] };
+    pack_instance( reinterpret_cast<const float*>( &world ), color, out );
+}
+
+math::float4x4 to_matrix( const float parent[16] )
+{
+    math::float4x4 m;
+    memcpy( &m, parent, sizeof(m) );
+    return m;
+}
+
+}
+
+InstanceStore::InstanceStore()
+    : p_data( nullptr )
+    , m_count( 0 )
+    , m_stride( 0 )
+{ }
+
+InstanceStore::~InstanceStore()
+{
+    ::operator delete( p_data, std::align_val_t( kStreamAlignment ) );
+}
+
+void InstanceStore::resize( size_t count )
+{
+    ::operator delete( p_data, std::align_val_t( kStreamAlignment ) );
+    p_data = nullptr;
+
+    m_count = count;
+    m_stride = ( count + kBatchSize - 1 ) / kBatchSize * kBatchSize;
+    m_generations.assign( m_stride, 1 );
+    if ( m_stride == 0 )
+        return;
+
+    const size_t bytes = StreamCount * m_stride * sizeof(float);
+    p_data = static_cast<float*>( ::operator new( bytes, std::align_val_t( kStreamAlignment ) ) );
+    memset( p_data, 0, bytes );
+
+    // Padding lanes get the same defaults so SIMD batches never see garbage.
+    for ( size_t i = 0; i < m_stride; ++i )
+    {
+        set_rotation( i, 0.f, 0.f, 0.f, 1.f );
+        set_scale( i, 1.f, 1.f, 1.f );
+        set_color( i, 1.f, 1.f, 1.f, 1.f );
+    }
+
+    m_generations.assign( m_stride, 1 );
+}
+
+void InstanceStore::set_position( size_t i, float x, float y, float z )
+{
+    stream( PositionX )[ i ] = x;
+    stream( PositionY )[ i ] = y;
+    stream( PositionZ )[ i ] = z;
+    touch( i );
+}
+
+void InstanceStore::set_rotation( size_t i, float x, float y, float z, float w )
+{
+    stream( RotationX )[ i ] = x;
+    stream( RotationY )[ i ] = y;
+    stream( RotationZ )[ i ] = z;
+    stream( RotationW )[ i ] = w;
+    touch( i );
+}
+
+void InstanceStore::set_scale( size_t i, float x, float y, float z )
+{
+    stream( ScaleX )[ i ] = x;
+    stream( ScaleY )[ i ] = y;
+    stream( ScaleZ )[ i ] = z;
+    touch( i );
+}
+
+void InstanceStore::set_color( size_t i, float r, float g, float b, float a )
+{
+    stream( ColorR )[ i ] = r;
+    stream( ColorG )[ i ] = g;
+    stream( ColorB )[ i ] = b;
+    stream( ColorA )[ i ] = a;
+    touch( i );
+}
+
+void InstanceStore::set_bounding_radius( size_t i, float radius )
+{
+    stream( BoundingRadius )[ i ] = radius;
+    touch( i );
+}
+
+void pack_instances( const InstanceStore& store, const float parent[16], size_t begin, size_t end, PackedInstance* pOut )
+{
+    assert( end <= store.size() );
+
+#if INSTANCE_STORE_SIMD
+    // Streams are aligned per batch, so peel until `begin` sits on a batch boundary.
+    size_t i = begin;
+    const size_t head = std::min( end, ( begin + Isa::kWidth - 1 ) / Isa::kWidth * Isa::kWidth );
+    pack_instances_scalar( store, parent, i, head, pOut );
+    i = head;
+
+    for ( ; i + Isa::kWidth <= end; i += Isa::kWidth )
+        pack_lanes( store, parent, [i]( const float* pStream ) { return Isa::load( pStream + i ); }, pOut + ( i - begin ) );
+
+    pack_instances_scalar( store, parent, i, end, pOut + ( i - begin ) );
+#else
+    pack_instances_scalar( store, parent, begin, end, pOut );
+#endif
+}
+
+void pack_instances( const InstanceStore& store, const float parent[16], const uint32_t* pIndices, size_t count, PackedInstance* pOut )
+{
+    size_t i = 0;
+
+#if INSTANCE_STORE_SIMD
+    for ( ; i + Isa::kWidth <= count; i += Isa::kWidth )
+    {
+        const uint32_t* pLanes = pIndices + i;
+        pack_lanes( store, parent, [pLanes]( const float* pStream ) { return Isa::gather( pStream, pLanes ); }, pOut + i );
+    }
+#endif
+
+    pack_instances_scalar( store, parent, pIndices + i, count - i, pOut + i );
+}
+
+void pack_instances_scalar( const InstanceStore& store, const float parent[16], size_t begin, size_t end, PackedInstance* pOut )
+{
+    const math::float4x4 parentMatrix = to_matrix( parent );
+    for ( size_t i = begin; i < end; ++i )
+        pack_one( store, parentMatrix, i, pOut[ i - begin ] );
+}
+
+void pack_instances_scalar( const InstanceStore& store, const float parent[16], const uint32_t* pIndices, size_t count, PackedInstance* pOut )
+{
+    const math::float4x4 parentMatrix = to_matrix( parent );
+    for ( size_t i = 0; i < count; ++i )
+        pack_one( store, parentMatrix, pIndices[ i ], pOut[ i ] );
+}
+
+void pack_instances_compact( const InstanceStore& store, size_t begin, size_t end, CompactInstance* pOut )
+{
+    using S = InstanceStore::Stream;
+    assert( end <= store.size() );
+
+    for ( size_t i = begin; i < end; ++i )
+    {
+        const float position[3] = { store.stream( S::PositionX )[ i ], store.stream( S::PositionY )[ i ], store.stream( S::PositionZ )[ i ] };
+        const float rotation[4] = { store.stream( S::RotationX )[ i ], store.stream( S::RotationY )[ i ], store.stream( S::RotationZ )[ i ], store.stream( S::RotationW )[ i ] };
+        const float scale[3] = { store.stream( S::ScaleX )[ i ], store.stream( S::ScaleY )[ i ], store.stream( S::ScaleZ )[ i ] };
+        const float color[4] = { store.stream( S::ColorR )[ i ], store.stream( S::ColorG )[ i ], store.stream( S::ColorB )[ i ], store.stream( S::ColorA )[ i ] };
+        pack_instance_compact( position, rotation, scale, color, pOut[ i - begin ] );
+    }
+}
+
+void pack_instance( const float world[16], const float color[4], PackedInstance& out )
+{
+    math::float4x4 transform;
+    memcpy( &transform, world, sizeof(transform) );
+    const math::float3x3 normal = math::discard_translation( transform );
+
+    memcpy( out.transform, world, sizeof(out.transform) );
+    memcpy( out.color, color, sizeof(out.color) );
+    memcpy( out.normalTransform, &normal, sizeof(out.normalTransform) );
+}
+
+void pack_instance_compact( const float position[3], const float rotation[4], const float scale[3], const float color[4], CompactInstance& out )
+{
+    out.position[0] = position[0];
+    out.position[1] = position[1];
+    out.position[2] = position[2];
+
+    // Little endian RGBA, what unpack_unorm4x8_to_float expects.
+    out.color = uint32_t( quantize_unorm8( color[0] ) )
+              | uint32_t( quantize_unorm8( color[1] ) ) << 8
+              | uint32_t( quantize_unorm8( color[2] ) ) << 16
+              | uint32_t( quantize_unorm8( color[3] ) ) << 24;
+
+    out.rotation[0] = quantize_snorm16( rotation[0] );
+    out.rotation[1] = quantize_snorm16( rotation[1] );
+    out.rotation[2] = quantize_snorm16( rotation[2] );
+    out.rotation[3] = quantize_snorm16( rotation[3] );
+
+    out.scale[0] = float_to_half( scale[0] );
+    out.scale[1] = float_to_half( scale[1] );
+    out.scale[2] = float_to_half( scale[2] );
+    out.scale[3] = 0;
+}
+
+void unpack_instance( const CompactInstance& in, PackedInstance& out )
+{
+    math::quat rotation = {
+        dequantize_snorm16( in.rotation[0] ),
+        dequantize_snorm16( in.rotation[1] ),
+        dequantize_snorm16( in.rotation[2] ),
+        dequantize_snorm16( in.rotation[3] )
+    };
+    const float length = std::sqrt( rotation.x * rotation.x + rotation.y * rotation.y + rotation.z * rotation.z + rotation.w * rotation.w );
+    rotation = { rotation.x / length, rotation.y / length, rotation.z / length, rotation.w / length };
+
+    const math::float3 position = { in.position[0], in.position[1], in.position[2] };
+    const math::float3 scale = { half_to_float( in.scale[0] ), half_to_float( in.scale[1] ), half_to_float( in.scale[2] ) };
+    const math::float4x4 world = math::make_trs( position, rotation, scale );
+    const math::float3x3 normal = math::discard_translation( world );
+    const math::float4 color = {
+        ( in.color & 0xff ) / 255.f,
+        ( ( in.color >> 8 ) & 0xff ) / 255.f,
+        ( ( in.color >> 16 ) & 0xff ) / 255.f,
+        ( in.color >> 24 ) / 255.f
+    };
+
+    memcpy( out.transform, &world, sizeof(out.transform) );
+    memcpy( out.color, &color, sizeof(out.color) );
+    memcpy( out.normalTransform, &normal, sizeof(out.normalTransform) );
+}
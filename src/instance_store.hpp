@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte-for-byte layout of shader_types::InstanceData as the Metal shader sees it:
+// column-major float4x4, float4 color, and a float3x3 whose columns are padded to 16 bytes.
+struct alignas(16) PackedInstance
+{
+    float transform[16];
+    float color[4];
+    float normalTransform[12];
+};
+
+static_assert( sizeof(PackedInstance) == 128, "PackedInstance must match the shader's InstanceData" );
+
+// Quantized alternative to PackedInstance, used when the core is built with
+// INSTANCE_FORMAT_COMPACT=1 (the COMPACT_INSTANCES CMake option). The shader
+// rebuilds the transform from translation, rotation and scale:
+//   position  float3, exact
+//   color     RGBA8 unorm, channels clamped to [0, 1], error <= 1/510
+//   rotation  quaternion as 4 x snorm16, error <= 1/65534 per component
+//             before the shader renormalizes it
+//   scale     3 x half, relative error <= 2^-11
+// The normal transform is the transform's upper 3x3, same as PackedInstance.
+struct alignas(8) CompactInstance
+{
+    float position[3];
+    uint32_t color;
+    int16_t rotation[4];
+    uint16_t scale[4];
+};
+
+static_assert( sizeof(CompactInstance) == 32, "CompactInstance must match the shader's InstanceData" );
+
+#ifndef INSTANCE_FORMAT_COMPACT
+#define INSTANCE_FORMAT_COMPACT 0
+#endif
+
+// Structure-of-arrays instance storage. Every component lives in its own
+// 32 byte aligned stream, padded to a whole number of SIMD batches so the
+// kernels can load full batches without bounds checks.
+//
+// Every instance also carries a generation counter that the setters bump, so
+// consumers such as UploadTracker can tell which instances changed.
+class InstanceStore
+{
+    public:
+        enum Stream
+        {
+            PositionX, PositionY, PositionZ,
+            RotationX, RotationY, RotationZ, RotationW,
+            ScaleX, ScaleY, ScaleZ,
+            ColorR, ColorG, ColorB, ColorA,
+            BoundingRadius,
+            StreamCount
+        };
+
+        static constexpr size_t kBatchSize = 8;
+
+        InstanceStore();
+        ~InstanceStore();
+
+        InstanceStore( const InstanceStore& ) = delete;
+        InstanceStore& operator=( const InstanceStore& ) = delete;
+
+        // Existing contents are discarded, new instances get an identity transform and white color.
+        void resize( size_t count );
+        size_t size() const { return m_count; }
+
+        // Writes made directly through a stream must be followed by touch().
+        float* stream( Stream s ) { return p_data + s * m_stride; }
+        const float* stream( Stream s ) const { return p_data + s * m_stride; }
+
+        void touch( size_t i ) { m_generations[ i ]++; }
+        // Starts at 1 after resize(), never 0.
+        uint32_t generation( size_t i ) const { return m_generations[ i ]; }
+        const uint32_t* generations() const { return m_generations.data(); }
+
+        void set_position( size_t i, float x, float y, float z );
+        void set_rotation( size_t i, float x, float y, float z, float w );
+        void set_scale( size_t i, float x, float y, float z );
+        void set_color( size_t i, float r, float g, float b, float a );
+        // Radius of a sphere around the position that encloses the scaled mesh.
+        void set_bounding_radius( size_t i, float radius );
+
+    private:
+        float* p_data;
+        size_t m_count;
+        size_t m_stride;
+        std::vector<uint32_t> m_generations;
+};
+
+// Writes world = parent * T * R * S (and its upper 3x3 as normal transform) for
+// instances [begin, end) into pOut[0 .. end - begin). `parent` is column-major.
+// Uses AVX2 or NEON when available, processing kBatchSize instances at a time.
+void pack_instances( const InstanceStore& store, const float parent[16], size_t begin, size_t end, PackedInstance* pOut );
+
+// Same for the instances listed in pIndices, written densely to pOut[0 .. count).
+void pack_instances( const InstanceStore& store, const float parent[16], const uint32_t* pIndices, size_t count, PackedInstance* pOut );
+
+// Plain scalar version of pack_instances, kept as the correctness reference.
+void pack_instances_scalar( const InstanceStore& store, const float parent[16], size_t begin, size_t end, PackedInstance* pOut );
+void pack_instances_scalar( const InstanceStore& store, const float parent[16], const uint32_t* pIndices, size_t count, PackedInstance* pOut );
+
+// Quantizes instances [begin, end) into pOut[0 .. end - begin). There is no
+// parent, a shared transform belongs in the camera.
+void pack_instances_compact( const InstanceStore& store, size_t begin, size_t end, CompactInstance* pOut );
+
+// Single instances from transforms kept elsewhere. `world` is column-major;
+// the compact one quantizes exactly like pack_instances_compact.
+void pack_instance( const float world[16], const float color[4], PackedInstance& out );
+void pack_instance_compact( const float position[3], const float rotation[4], const float scale[3], const float color[4], CompactInstance& out );
+
+// Expands a compact instance to the full layout the way the shader does.
+void unpack_instance( const CompactInstance& in, PackedInstance& out );
@@ -0,0 +1,198 @@
+#include "job_system.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+
+namespace
+{
+
+thread_local const JobSystem* tl_pOwner = nullptr;
+thread_local size_t tl_queueIndex = 0;
+
+size_t resolve_worker_count( size_t requested )
+{
+    if ( requested > 0 )
+        return requested;
+
+    const size_t hw = std::thread::hardware_concurrency();
+    return hw > 1 ? hw - 1 : 0;
+}
+
+}
+
+JobSystem::JobSystem( size_t workerCount )
+    : m_queues( resolve_worker_count( workerCount ) + 1 )
+    , m_queuedJobs( 0 )
+    , m_nextQueue( 0 )
+    , m_running( true )
+{
+    // The last queue belongs to threads outside the pool (e.g. the render thread).
+    const size_t workers = m_queues.size() - 1;
+    m_workers.reserve( workers );
+    for ( size_t i = 0; i < workers; ++i )
+        m_workers.emplace_back( &JobSystem::worker_main, this, i );
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_sleepMutex );
+        m_running = false;
+    }
+    m_wake.notify_all();
+
+    for ( std::thread& worker : m_workers )
+        worker.join();
+}
+
+void JobSystem::run( JobCounter& counter, Job job, JobCounter* pDependency )
+{
+    counter.m_pending.fetch_add( 1, std::memory_order_relaxed );
+
+    Job wrapped = [&counter, job = std::move( job ), this]() {
+        job();
+
+        std::vector<Job> continuations;
+        {
+            // Decrement under the lock so wait() cannot return while we still touch the counter.
+            std::lock_guard<std::mutex> lock( counter.m_mutex );
+            if ( counter.m_pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                continuations.swap( counter.m_continuations );
+        }
+
+        for ( Job& continuation : continuations )
+            push( std::move( continuation ) );
+    };
+
+    if ( pDependency )
+    {
+        std::lock_guard<std::mutex> lock( pDependency->m_mutex );
+        if ( !pDependency->done() )
+        {
+            pDependency->m_continuations.push_back( std::move( wrapped ) );
+            return;
+        }
+    }
+
+    push( std::move( wrapped ) );
+}
+
+void JobSystem::wait( JobCounter& counter )
+{
+    const size_t queueIndex = current_queue();
+    while ( !counter.done() )
+    {
+        Job job;
+        if ( pop_or_steal( queueIndex, job ) )
+            job();
+        else
+            std::this_thread::yield();
+    }
+
+    // Pairs with the locked decrement in run(), the last job may still hold the mutex.
+    std::lock_guard<std::mutex> lock( counter.m_mutex );
+}
+
+void JobSystem::parallel_for( size_t count, size_t grain, const RangeJob& fn )
+{
+    if ( count == 0 )
+        return;
+
+    grain = std::max<size_t>( grain, 1 );
+    if ( count <= grain || m_workers.empty() )
+    {
+        fn( 0, count );
+        return;
+    }
+
+    JobCounter counter;
+    for ( size_t begin = grain; begin < count; begin += grain )
+    {
+        const size_t end = std::min( begin + grain, count );
+        run( counter, [&fn, begin, end]() { fn( begin, end ); } );
+    }
+
+    // The caller takes the first chunk instead of idling.
+    fn( 0, grain );
+    wait( counter );
+}
+
+void JobSystem::push( Job job )
+{
+    Queue& queue = m_queues[ current_queue() ];
+    {
+        std::lock_guard<std::mutex> lock( queue.mutex );
+        queue.jobs.push_back( std::move( job ) );
+    }
+
+    m_queuedJobs.fetch_add( 1, std::memory_order_release );
+    {
+        std::lock_guard<std::mutex> lock( m_sleepMutex );
+    }
+    m_wake.notify_one();
+}
+
+bool JobSystem::pop_or_steal( size_t queueIndex, Job& job )
+{
+    if ( m_queuedJobs.load( std::memory_order_acquire ) == 0 )
+        return false;
+
+    {
+        Queue& own = m_queues[ queueIndex ];
+        std::lock_guard<std::mutex> lock( own.mutex );
+        if ( !own.jobs.empty() )
+        {
+            job = std::move( own.jobs.back() );
+            own.jobs.pop_back();
+            m_queuedJobs.fetch_sub( 1, std::memory_order_relaxed );
+            return true;
+        }
+    }
+
+    const size_t numQueues = m_queues.size();
+    const size_t start = m_nextQueue.fetch_add( 1, std::memory_order_relaxed );
+    for ( size_t i = 0; i < numQueues; ++i )
+    {
+        const size_t victimIndex = ( start + i ) % numQueues;
+        if ( victimIndex == queueIndex )
+            continue;
+
+        Queue& victim = m_queues[ victimIndex ];
+        std::lock_guard<std::mutex> lock( victim.mutex );
+        if ( !victim.jobs.empty() )
+        {
+            job = std::move( victim.jobs.front() );
+            victim.jobs.pop_front();
+            m_queuedJobs.fetch_sub( 1, std::memory_order_relaxed );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::worker_main( size_t queueIndex )
+{
+    tl_pOwner = this;
+    tl_queueIndex = queueIndex;
+    PROFILE_THREAD( "job worker" );
+
+    while ( m_running.load( std::memory_order_acquire ) )
+    {
+        Job job;
+        if ( pop_or_steal( queueIndex, job ) )
+        {
+            job();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( m_sleepMutex );
+        m_wake.wait( lock, [this]() {
+            return !m_running.load( std::memory_order_acquire ) || m_queuedJobs.load( std::memory_order_acquire ) > 0;
+        } );
+    }
+}
+
+size_t JobSystem::current_queue() const
+{
+    return tl_pOwner == this ? tl_queueIndex : m_queues.size() - 1;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks outstanding jobs. Jobs queued with a dependency counter only start
+// once that counter has dropped to zero.
+class JobCounter
+{
+    public:
+        JobCounter() : m_pending( 0 ) { }
+        JobCounter( const JobCounter& ) = delete;
+        JobCounter& operator=( const JobCounter& ) = delete;
+
+        bool done() const { return m_pending.load( std::memory_order_acquire ) == 0; }
+
+    private:
+        friend class JobSystem;
+
+        std::atomic<int> m_pending;
+        std::mutex m_mutex;
+        std::vector<std::function<void()>> m_continuations;
+};
+
+// Fixed pool of worker threads, one work-stealing deque per worker. Owners pop
+// the newest job, idle workers steal the oldest job from their neighbours.
+// The thread calling wait() or parallel_for() executes jobs too.
+class JobSystem
+{
+    public:
+        using Job = std::function<void()>;
+        using RangeJob = std::function<void( size_t begin, size_t end )>;
+
+        // 0 picks one worker per hardware thread, minus the calling thread.
+        explicit JobSystem( size_t workerCount = 0 );
+        ~JobSystem();
+
+        JobSystem( const JobSystem& ) = delete;
+        JobSystem& operator=( const JobSystem& ) = delete;
+
+        void run( JobCounter& counter, Job job, JobCounter* pDependency = nullptr );
+        void wait( JobCounter& counter );
+
+        // Splits [0, count) into chunks of `grain` elements and blocks until all are done.
+        void parallel_for( size_t count, size_t grain, const RangeJob& fn );
+
+        size_t thread_count() const { return m_workers.size() + 1; }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        void push( Job job );
+        bool pop_or_steal( size_t queueIndex, Job& job );
+        void worker_main( size_t queueIndex );
+        size_t current_queue() const;
+
+        std::vector<std::thread> m_workers;
+        std::vector<Queue> m_queues;
+
+        std::atomic<size_t> m_queuedJobs;
+        std::atomic<size_t> m_nextQueue;
+        std::atomic<bool> m_running;
+
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wake;
+};
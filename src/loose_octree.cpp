@@ -0,0 +1,235 @@
+#include "loose_octree.hpp"
+#include "culling.hpp"
+#include "instance_store.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+
+constexpr uint32_t kNoNode = UINT32_MAX;
+constexpr size_t kStackSize = 8 * LooseOctree::kMaxDepth + 8;
+
+bool in_cell( const math::float3& center, float halfSize, const math::float4& sphere )
+{
+    return std::fabs( sphere.x - center.x ) <= halfSize && std::fabs( sphere.y - center.y ) <= halfSize && std::fabs( sphere.z - center.z ) <= halfSize;
+}
+
+math::float3 loose_min( const math::float3& center, float halfSize ) { return center - math::float3{ 2.f * halfSize, 2.f * halfSize, 2.f * halfSize }; }
+math::float3 loose_max( const math::float3& center, float halfSize ) { return center + math::float3{ 2.f * halfSize, 2.f * halfSize, 2.f * halfSize }; }
+
+}
+
+void LooseOctree::build( const InstanceStore& store )
+{
+    PROFILE_ZONE( "LooseOctree::build" );
+
+    const size_t count = store.size();
+    m_spheres.resize( count );
+    m_slots.resize( count );
+
+    math::float3 min = { INFINITY, INFINITY, INFINITY };
+    math::float3 max = { -INFINITY, -INFINITY, -INFINITY };
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const math::float4 s = instance_sphere( store, i );
+        m_spheres[ i ] = s;
+        min = { std::min( min.x, s.x ), std::min( min.y, s.y ), std::min( min.z, s.z ) };
+        max = { std::max( max.x, s.x ), std::max( max.y, s.y ), std::max( max.z, s.z ) };
+    }
+
+    // A little room, so that instances on the border don't leave the root cell at their first step.
+    Node root = {};
+    root.center = count > 0 ? ( min + max ) * 0.5f : math::float3{ 0.f, 0.f, 0.f };
+    root.halfSize = count > 0 ? std::max( { max.x - min.x, max.y - min.y, max.z - min.z, 1.f } ) * 0.55f : 1.f;
+    root.parent = kNoNode;
+
+    m_depthLimit = 0;
+    while ( m_depthLimit < kMaxDepth && size_t( 1 ) << ( 3 * ( m_depthLimit + 1 ) ) <= count / kInstancesPerCell )
+        m_depthLimit++;
+
+    m_nodes.clear();
+    m_nodes.push_back( root );
+    for ( size_t i = 0; i < count; ++i )
+        insert( static_cast<uint32_t>( i ), find_node( m_spheres[ i ] ) );
+}
+
+uint32_t LooseOctree::find_node( const math::float4& sphere )
+{
+    if ( !in_cell( m_nodes[0].center, m_nodes[0].halfSize, sphere ) )
+        return 0;
+
+    uint32_t node = 0;
+    while ( m_nodes[ node ].depth < m_depthLimit )
+    {
+        const Node& parent = m_nodes[ node ];
+        const float childHalfSize = parent.halfSize * 0.5f;
+        if ( sphere.w > childHalfSize )
+            break;
+
+        const uint32_t octant = ( sphere.x >= parent.center.x ? 1 : 0 ) | ( sphere.y >= parent.center.y ? 2 : 0 ) | ( sphere.z >= parent.center.z ? 4 : 0 );
+        uint32_t child = parent.children[ octant ];
+        if ( child == 0 )
+        {
+            Node created = {};
+            created.center = parent.center + math::float3{ octant & 1 ? childHalfSize : -childHalfSize,
+                                                           octant & 2 ? childHalfSize : -childHalfSize,
+                                                           octant & 4 ? childHalfSize : -childHalfSize };
+            created.halfSize = childHalfSize;
+            created.depth = parent.depth + 1;
+            created.parent = node;
+
+            child = static_cast<uint32_t>( m_nodes.size() );
+            m_nodes.push_back( std::move( created ) );
+            m_nodes[ node ].children[ octant ] = child;
+        }
+        node = child;
+    }
+    return node;
+}
+
+bool LooseOctree::fits( uint32_t node, const math::float4& sphere ) const
+{
+    const Node& n = m_nodes[ node ];
+    const bool deepest = n.depth == m_depthLimit || sphere.w > n.halfSize * 0.5f;
+    if ( node == 0 )
+        return deepest || !in_cell( n.center, n.halfSize, sphere );
+    return deepest && sphere.w <= n.halfSize && in_cell( n.center, n.halfSize, sphere );
+}
+
+void LooseOctree::insert( uint32_t instance, uint32_t node )
+{
+    std::vector<uint32_t>& instances = m_nodes[ node ].instances;
+    m_slots[ instance ] = { node, static_cast<uint32_t>( instances.size() ) };
+    instances.push_back( instance );
+    for ( uint32_t n = node; n != kNoNode; n = m_nodes[ n ].parent )
+        m_nodes[ n ].subtreeCount++;
+}
+
+void LooseOctree::remove( uint32_t instance )
+{
+    const Slot slot = m_slots[ instance ];
+    std::vector<uint32_t>& instances = m_nodes[ slot.node ].instances;
+    const uint32_t last = instances.back();
+    instances[ slot.index ] = last;
+    m_slots[ last ].index = slot.index;
+    instances.pop_back();
+    for ( uint32_t n = slot.node; n != kNoNode; n = m_nodes[ n ].parent )
+        m_nodes[ n ].subtreeCount--;
+}
+
+void LooseOctree::update( const InstanceStore& store, const uint32_t* pMoved, size_t count )
+{
+    PROFILE_ZONE( "LooseOctree::update" );
+    assert( store.size() == m_slots.size() && "instances were added or removed, build() instead" );
+
+    for ( size_t k = 0; k < count; ++k )
+    {
+        const uint32_t i = pMoved[ k ];
+        const math::float4 s = instance_sphere( store, i );
+        m_spheres[ i ] = s;
+        if ( fits( m_slots[ i ].node, s ) )
+            continue;
+        remove( i );
+        insert( i, find_node( s ) );
+    }
+}
+
+size_t LooseOctree::gather( uint32_t node, uint32_t* pVisible ) const
+{
+    const Node& n = m_nodes[ node ];
+    std::copy( n.instances.begin(), n.instances.end(), pVisible );
+    size_t visible = n.instances.size();
+    for ( uint32_t child : n.children )
+        if ( child != 0 && m_nodes[ child ].subtreeCount > 0 )
+            visible += gather( child, pVisible + visible );
+    return visible;
+}
+
+size_t LooseOctree::cull( const Frustum& frustum, uint32_t* pVisible ) const
+{
+    PROFILE_ZONE( "LooseOctree::cull" );
+
+    uint32_t stack[ kStackSize ];
+    size_t top = 0;
+    size_t visible = 0;
+    stack[ top++ ] = 0;
+    while ( top > 0 )
+    {
+        const uint32_t node = stack[ --top ];
+        const Node& n = m_nodes[ node ];
+        if ( n.subtreeCount == 0 )
+            continue;
+
+        // The root also holds whatever strayed outside its bounds.
+        if ( node != 0 )
+        {
+            const Containment containment = classify_aabb( frustum, loose_min( n.center, n.halfSize ), loose_max( n.center, n.halfSize ) );
+            if ( containment == Containment::Outside )
+                continue;
+            if ( containment == Containment::Inside )
+            {
+                visible += gather( node, pVisible + visible );
+                continue;
+            }
+        }
+
+        for ( uint32_t i : n.instances )
+            if ( sphere_visible( frustum, m_spheres[ i ].xyz(), m_spheres[ i ].w ) )
+                pVisible[ visible++ ] = i;
+        for ( uint32_t child : n.children )
+            if ( child != 0 )
+                stack[ top++ ] = child;
+    }
+    return visible;
+}
+
+bool LooseOctree::raycast( const Ray& ray, RayHit& hit ) const
+{
+    const math::float3 invDirection = { 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+    float nearest = ray.maxDistance;
+    bool found = false;
+
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[ kStackSize ];
+    size_t top = 0;
+    stack[ top++ ] = { 0, 0.f };
+    while ( top > 0 )
+    {
+        const Entry entry = stack[ --top ];
+        const Node& n = m_nodes[ entry.node ];
+        if ( entry.distance > nearest || n.subtreeCount == 0 )
+            continue;
+
+        for ( uint32_t i : n.instances )
+        {
+            const float t = ray_sphere( ray, m_spheres[ i ] );
+            if ( t >= 0.f && t <= nearest )
+            {
+                nearest = t;
+                hit = { i, t };
+                found = true;
+            }
+        }
+
+        // Children nearer along the ray go on top, so they are searched first and shorten the ray for the others.
+        const size_t first = top;
+        for ( uint32_t child : n.children )
+        {
+            if ( child == 0 || m_nodes[ child ].subtreeCount == 0 )
+                continue;
+            const Node& c = m_nodes[ child ];
+            const float t = ray_box( ray, invDirection, loose_min( c.center, c.halfSize ), loose_max( c.center, c.halfSize ), nearest );
+            if ( t >= 0.f )
+                stack[ top++ ] = { child, t };
+        }
+        std::sort( stack + first, stack + top, []( const Entry& a, const Entry& b ) { return a.distance > b.distance; } );
+    }
+    return found;
+}
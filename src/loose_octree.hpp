@@ -0,0 +1,69 @@
+#pragma once
+
+#include "spatial_index.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Octree whose nodes' bounds are their cells grown by half the cell size on
+// every side, so an instance is placed by its center alone: at the depth where
+// its radius still fits the cell's slack, in the cell containing its center.
+// Moving an instance costs at most one walk down the tree and never touches
+// other instances, however many move.
+//
+// The root cell covers the centers seen by build(). Instances whose centers
+// leave it or whose radius outgrows it are kept in the root, which is never
+// culled as a whole.
+class LooseOctree : public SpatialIndex
+{
+    public:
+        static constexpr size_t kMaxDepth = 8;
+        // How many instances build() expects per cell of the deepest level it allows,
+        // were they spread evenly. Smaller cells are only more nodes to walk.
+        static constexpr size_t kInstancesPerCell = 8;
+
+        const char* name() const override { return "loose octree"; }
+
+        void build( const InstanceStore& store ) override;
+        void update( const InstanceStore& store, const uint32_t* pMoved, size_t count ) override;
+        size_t cull( const Frustum& frustum, uint32_t* pVisible ) const override;
+        bool raycast( const Ray& ray, RayHit& hit ) const override;
+
+        size_t node_count() const { return m_nodes.size(); }
+
+    private:
+        struct Node
+        {
+            math::float3 center;
+            // Of the cell, the loose bounds reach twice as far.
+            float halfSize;
+            uint32_t depth;
+            uint32_t parent;
+            // 0 where there is no child yet (the root is nobody's child).
+            uint32_t children[8];
+            // Instances in this node and below, empty subtrees are skipped.
+            uint32_t subtreeCount;
+            std::vector<uint32_t> instances;
+        };
+
+        struct Slot
+        {
+            uint32_t node;
+            uint32_t index;
+        };
+
+        // The node the sphere belongs in, created if needed.
+        uint32_t find_node( const math::float4& sphere );
+        // Whether find_node() would still pick the node.
+        bool fits( uint32_t node, const math::float4& sphere ) const;
+        void insert( uint32_t instance, uint32_t node );
+        void remove( uint32_t instance );
+        // Writes every instance below the node to pVisible.
+        size_t gather( uint32_t node, uint32_t* pVisible ) const;
+
+        std::vector<Node> m_nodes;
+        std::vector<math::float4> m_spheres;
+        std::vector<Slot> m_slots;
+        uint32_t m_depthLimit = 0;
+};
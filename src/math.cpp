@@ -1,77 +1,182 @@
 #include "math.hpp"
 
-simd::float4x4 math::make_perspective( float fovRad, float aspect, float znear, float zfar )
+math::float4x4 math::make_perspective( float fovRad, float aspect, float znear, float zfar )
 {
-    using simd::float4;
     float ys = 1.f / tanf(fovRad * 0.5f);
     float xs = ys / aspect;
     float zs = zfar / ( znear - zfar );
-    return simd_matrix_from_rows((float4){ xs, 0.0f, 0.0f, 0.0f },
-                                 (float4){ 0.0f, ys, 0.0f, 0.0f },
-                                 (float4){ 0.0f, 0.0f, zs, znear * zs },
-                                 (float4){ 0, 0, -1, 0 });
+    return matrix_from_rows(float4{ xs, 0.0f, 0.0f, 0.0f },
+                            float4{ 0.0f, ys, 0.0f, 0.0f },
+                            float4{ 0.0f, 0.0f, zs, znear * zs },
+                            float4{ 0, 0, -1, 0 });
 }
 
-simd::float4x4 math::make_orthographic(float left, float right, float bottom, float top, float near, float far)
+math::float4x4 math::make_orthographic(float left, float right, float bottom, float top, float near, float far)
 {
-    using simd::float4;
-    return simd_matrix_from_rows(
-        (float4){ 2.f/(right - left),                  0.f,                0.f,   -(right + left)/(right - left) },
-        (float4){                0.f,   2.f/(top - bottom),                0.f,   -(top + bottom)/(top - bottom) },
-        (float4){                0.f,                  0.f,  -2.f/(far - near),   -(far + near)/(far - near) },
-        (float4){                0.f,                  0.f,                0.f,               1.f                });
+    return matrix_from_rows(
+        float4{ 2.f/(right - left),                  0.f,                0.f,   -(right + left)/(right - left) },
+        float4{                0.f,   2.f/(top - bottom),                0.f,   -(top + bottom)/(top - bottom) },
+        float4{                0.f,                  0.f,  -2.f/(far - near),   -(far + near)/(far - near) },
+        float4{                0.f,                  0.f,                0.f,               1.f                });
 }
 
-simd::float4x4 math::make_X_rotate( float rad )
+math::float4x4 math::make_X_rotate( float rad )
 {
-    using simd::float4;
     const float a = rad;
-    return simd_matrix_from_rows((float4){ 1.0f, 0.0f, 0.0f, 0.0f },
-                                 (float4){ 0.0f, cosf( a ), sinf( a ), 0.0f },
-                                 (float4){ 0.0f, -sinf( a ), cosf( a ), 0.0f },
-                                 (float4){ 0.0f, 0.0f, 0.0f, 1.0f });
+    return matrix_from_rows(float4{ 1.0f, 0.0f, 0.0f, 0.0f },
+                            float4{ 0.0f, cosf( a ), sinf( a ), 0.0f },
+                            float4{ 0.0f, -sinf( a ), cosf( a ), 0.0f },
+                            float4{ 0.0f, 0.0f, 0.0f, 1.0f });
 }
 
-simd::float4x4 math::make_Y_rotate( float rad )
+math::float4x4 math::make_Y_rotate( float rad )
 {
-    using simd::float4;
     const float a = rad;
-    return simd_matrix_from_rows((float4){ cosf( a ), 0.0f, sinf( a ), 0.0f },
-                                 (float4){ 0.0f, 1.0f, 0.0f, 0.0f },
-                                 (float4){ -sinf( a ), 0.0f, cosf( a ), 0.0f },
-                                 (float4){ 0.0f, 0.0f, 0.0f, 1.0f });
+    return matrix_from_rows(float4{ cosf( a ), 0.0f, sinf( a ), 0.0f },
+                            float4{ 0.0f, 1.0f, 0.0f, 0.0f },
+                            float4{ -sinf( a ), 0.0f, cosf( a ), 0.0f },
+                            float4{ 0.0f, 0.0f, 0.0f, 1.0f });
 }
 
-simd::float4x4 math::make_Z_rotate( float rad )
+math::float4x4 math::make_Z_rotate( float rad )
 {
-    using simd::float4;
     const float a = rad;
-    return simd_matrix_from_rows((float4){ cosf( a ), sinf( a ), 0.0f, 0.0f },
-                                 (float4){ -sinf( a ), cosf( a ), 0.0f, 0.0f },
-                                 (float4){ 0.0f, 0.0f, 1.0f, 0.0f },
-                                 (float4){ 0.0f, 0.0f, 0.0f, 1.0f });
+    return matrix_from_rows(float4{ cosf( a ), sinf( a ), 0.0f, 0.0f },
+                            float4{ -sinf( a ), cosf( a ), 0.0f, 0.0f },
+                            float4{ 0.0f, 0.0f, 1.0f, 0.0f },
+                            float4{ 0.0f, 0.0f, 0.0f, 1.0f });
 }
 
-simd::float4x4 math::make_translate( const simd::float3& vec )
+math::float4x4 math::make_translate( const float3& vec )
 {
-    using simd::float4;
     const float4 col0 = { 1.0f, 0.0f, 0.0f, 0.0f };
     const float4 col1 = { 0.0f, 1.0f, 0.0f, 0.0f };
     const float4 col2 = { 0.0f, 0.0f, 1.0f, 0.0f };
     const float4 col3 = { vec.x, vec.y, vec.z, 1.0f };
-    return simd_matrix( col0, col1, col2, col3 );
+    return matrix_from_columns( col0, col1, col2, col3 );
 }
 
-simd::float4x4 math::make_scale( const simd::float3& vec )
+math::float4x4 math::make_scale( const float3& vec )
 {
-    using simd::float4;
-    return simd_matrix((float4){ vec.x, 0, 0, 0 },
-                       (float4){ 0, vec.y, 0, 0 },
-                       (float4){ 0, 0, vec.z, 0 },
-                       (float4){ 0, 0, 0, 1.0 });
+    return matrix_from_columns(float4{ vec.x, 0, 0, 0 },
+                               float4{ 0, vec.y, 0, 0 },
+                               float4{ 0, 0, vec.z, 0 },
+                               float4{ 0, 0, 0, 1.0 });
 }
 
-simd::float3x3 math::discard_translation( const simd::float4x4& mat )
+math::float3x3 math::discard_translation( const float4x4& mat )
 {
-    return simd_matrix( mat.columns[0].xyz, mat.columns[1].xyz, mat.columns[2].xyz );
+    return matrix_from_columns( mat.columns[0].xyz(), mat.columns[1].xyz(), mat.columns[2].xyz() );
+}
+
+math::quat math::make_quat_X_rotate( float rad )
+{
+    return { -sinf( rad * 0.5f ), 0.0f, 0.0f, cosf( rad * 0.5f ) };
+}
+
+math::quat math::make_quat_Y_rotate( float rad )
+{
+    return { 0.0f, sinf( rad * 0.5f ), 0.0f, cosf( rad * 0.5f ) };
+}
+
+math::quat math::make_quat_Z_rotate( float rad )
+{
+    return { 0.0f, 0.0f, -sinf( rad * 0.5f ), cosf( rad * 0.5f ) };
+}
+
+math::float4x4 math::make_trs( const float3& translation, const float3& eulerRad, const float3& scale )
+{
+    const float sx = sinf( eulerRad.x ), cx = cosf( eulerRad.x );
+    const float sy = sinf( eulerRad.y ), cy = cosf( eulerRad.y );
+    const float sz = sinf( eulerRad.z ), cz = cosf( eulerRad.z );
+
+    return matrix_from_columns(float4{ cy * cz * scale.x, ( -sx * sy * cz - cx * sz ) * scale.x, ( -cx * sy * cz + sx * sz ) * scale.x, 0.0f },
+                               float4{ cy * sz * scale.y, ( -sx * sy * sz + cx * cz ) * scale.y, ( -cx * sy * sz - sx * cz ) * scale.y, 0.0f },
+                               float4{ sy * scale.z, sx * cy * scale.z, cx * cy * scale.z, 0.0f },
+                               float4{ translation.x, translation.y, translation.z, 1.0f });
+}
+
+math::float4x4 math::make_trs( const float3& translation, const quat& rotation, const float3& scale )
+{
+    const float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float xw = x * w, yw = y * w, zw = z * w;
+
+    return matrix_from_columns(float4{ ( 1.0f - 2.0f * ( yy + zz ) ) * scale.x, 2.0f * ( xy + zw ) * scale.x, 2.0f * ( xz - yw ) * scale.x, 0.0f },
+                               float4{ 2.0f * ( xy - zw ) * scale.y, ( 1.0f - 2.0f * ( xx + zz ) ) * scale.y, 2.0f * ( yz + xw ) * scale.y, 0.0f },
+                               float4{ 2.0f * ( xz + yw ) * scale.z, 2.0f * ( yz - xw ) * scale.z, ( 1.0f - 2.0f * ( xx + yy ) ) * scale.z, 0.0f },
+                               float4{ translation.x, translation.y, translation.z, 1.0f });
+}
+
+void math::decompose_trs( const float4x4& mat, float3& translation, quat& rotation, float3& scale )
+{
+    translation = mat.columns[3].xyz();
+    const float lengths[3] = { length( mat.columns[0].xyz() ), length( mat.columns[1].xyz() ), length( mat.columns[2].xyz() ) };
+    scale = { lengths[0], lengths[1], lengths[2] };
+
+    // m[r][c] is row r of the basis with the scale divided out of its columns.
+    float m[3][3];
+    for ( int c = 0; c < 3; ++c )
+    {
+        const float3 axis = mat.columns[c].xyz() * ( lengths[c] > 0.f ? 1.f / lengths[c] : 0.f );
+        m[0][c] = axis.x;
+        m[1][c] = axis.y;
+        m[2][c] = axis.z;
+    }
+
+    // Solved for the largest of w, x, y, z so the division is well conditioned.
+    const float trace = m[0][0] + m[1][1] + m[2][2];
+    if ( trace > 0.f )
+    {
+        const float t = sqrtf( 1.f + trace ) * 2.f;
+        rotation = { ( m[2][1] - m[1][2] ) / t, ( m[0][2] - m[2][0] ) / t, ( m[1][0] - m[0][1] ) / t, 0.25f * t };
+    }
+    else if ( m[0][0] > m[1][1] && m[0][0] > m[2][2] )
+    {
+        const float t = sqrtf( 1.f + m[0][0] - m[1][1] - m[2][2] ) * 2.f;
+        rotation = { 0.25f * t, ( m[0][1] + m[1][0] ) / t, ( m[0][2] + m[2][0] ) / t, ( m[2][1] - m[1][2] ) / t };
+    }
+    else if ( m[1][1] > m[2][2] )
+    {
+        const float t = sqrtf( 1.f + m[1][1] - m[0][0] - m[2][2] ) * 2.f;
+        rotation = { ( m[0][1] + m[1][0] ) / t, 0.25f * t, ( m[1][2] + m[2][1] ) / t, ( m[0][2] - m[2][0] ) / t };
+    }
+    else
+    {
+        const float t = sqrtf( 1.f + m[2][2] - m[0][0] - m[1][1] ) * 2.f;
+        rotation = { ( m[0][2] + m[2][0] ) / t, ( m[1][2] + m[2][1] ) / t, 0.25f * t, ( m[1][0] - m[0][1] ) / t };
+    }
+}
+
+math::float4x4 math::mul_affine( const float4x4& a, const float4x4& b )
+{
+    // Columns 0-2 of b have w == 0, so a's last column only adds to the translation. The columns stay four lanes
+    // wide so that nothing is assembled from scalars on the stack; a's bottom row keeps the w lanes exact.
+    float4x4 r;
+    for ( int c = 0; c < 3; ++c )
+        r.columns[c] = detail::store_as<float4>( detail::transform<3>( a.columns, detail::load( b.columns[c] ) ) );
+    r.columns[3] = a * b.columns[3];
+    return r;
+}
+
+math::float4x4 math::inverse_affine( const float4x4& mat )
+{
+    // The rows of the inverse basis are the cross products of its columns over the determinant.
+    const float3 a = mat.columns[0].xyz();
+    const float3 b = mat.columns[1].xyz();
+    const float3 c = mat.columns[2].xyz();
+    const float3 r0 = cross( b, c );
+    const float3 r1 = cross( c, a );
+    const float3 r2 = cross( a, b );
+    const float invDet = 1.f / dot( a, r0 );
+    const float3 i0 = r0 * invDet;
+    const float3 i1 = r1 * invDet;
+    const float3 i2 = r2 * invDet;
+
+    const float3 t = mat.columns[3].xyz();
+    return matrix_from_columns(float4{ i0.x, i1.x, i2.x, 0.0f },
+                               float4{ i0.y, i1.y, i2.y, 0.0f },
+                               float4{ i0.z, i1.z, i2.z, 0.0f },
+                               float4{ -dot( i0, t ), -dot( i1, t ), -dot( i2, t ), 1.0f });
 }
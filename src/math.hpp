@@ -1,38 +1,58 @@
 #ifndef MATH_HPP
 #define MATH_HPP
 
-#include <simd/simd.h>
+#include "math_types.hpp"
 
 namespace math
 {
 
-constexpr simd::float3 add( const simd::float3& a, const simd::float3& b );
-constexpr simd_float4x4 make_identity();
-simd::float4x4 make_perspective( float fovRad, float aspect, float znear, float zfar );
-simd::float4x4 make_orthographic( float left, float right, float bottom, float top, float near, float far );
-simd::float4x4 make_X_rotate( float rad );
-simd::float4x4 make_Y_rotate( float rad );
-simd::float4x4 make_Z_rotate( float rad );
-simd::float4x4 make_translate( const simd::float3& vec );
-simd::float4x4 make_scale( const simd::float3& vec );
-simd::float3x3 discard_translation( const simd::float4x4& mat );
+constexpr float3 add( const float3& a, const float3& b );
+constexpr float4x4 make_identity();
+float4x4 make_perspective( float fovRad, float aspect, float znear, float zfar );
+float4x4 make_orthographic( float left, float right, float bottom, float top, float near, float far );
+float4x4 make_X_rotate( float rad );
+float4x4 make_Y_rotate( float rad );
+float4x4 make_Z_rotate( float rad );
+float4x4 make_translate( const float3& vec );
+float4x4 make_scale( const float3& vec );
+float3x3 discard_translation( const float4x4& mat );
+
+// Quaternions turning the same way as the matching make_*_rotate matrix.
+quat make_quat_X_rotate( float rad );
+quat make_quat_Y_rotate( float rad );
+quat make_quat_Z_rotate( float rad );
+
+// Builds translate * rotate * scale directly, without the intermediate matrices.
+// The Euler variant rotates as make_X_rotate( x ) * make_Y_rotate( y ) * make_Z_rotate( z ).
+float4x4 make_trs( const float3& translation, const float3& eulerRad, const float3& scale );
+float4x4 make_trs( const float3& translation, const quat& rotation, const float3& scale );
+
+// Inverse of make_trs( translation, rotation, scale ) for matrices without shear, such as
+// products of transforms with uniform scale. Scales come out positive.
+void decompose_trs( const float4x4& mat, float3& translation, quat& rotation, float3& scale );
+
+// a * b for matrices whose bottom row is ( 0, 0, 0, 1 ), skipping the products that row makes constant.
+float4x4 mul_affine( const float4x4& a, const float4x4& b );
+
+// Inverse of a matrix whose bottom row is ( 0, 0, 0, 1 ) and whose basis is not singular.
+float4x4 inverse_affine( const float4x4& mat );
 
 }
 
 
-constexpr simd::float3 math::add( const simd::float3& a, const simd::float3& b )
+constexpr math::float3 math::add( const float3& a, const float3& b )
 {
     return { a.x + b.x, a.y + b.y, a.z + b.z };
 }
 
-constexpr simd_float4x4 math::make_identity()
+constexpr math::float4x4 math::make_identity()
 {
-    return (simd_float4x4) {
-        (simd::float4) { 1.f, 0.f, 0.f, 0.f },
-        (simd::float4) { 0.f, 1.f, 0.f, 0.f },
-        (simd::float4) { 0.f, 0.f, 1.f, 0.f },
-        (simd::float4) { 0.f, 0.f, 0.f, 1.f }
-    };
+    return float4x4 { {
+        float4 { 1.f, 0.f, 0.f, 0.f },
+        float4 { 0.f, 1.f, 0.f, 0.f },
+        float4 { 0.f, 0.f, 1.f, 0.f },
+        float4 { 0.f, 0.f, 0.f, 1.f }
+    } };
 }
 
 #endif // !MATH_HPP
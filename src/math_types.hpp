@@ -0,0 +1,204 @@
+#ifndef MATH_TYPES_HPP
+#define MATH_TYPES_HPP
+
+// Portable replacement for the subset of <simd/simd.h> we use.
+//
+// Sizes and alignments follow the Metal shading language so the types can be
+// written straight into GPU buffers: float3 occupies 16 bytes, matrices are
+// column-major with 16 byte aligned columns (float3x3 is 48 bytes). Operations
+// go through SSE on x86 and NEON on ARM, with a scalar fallback elsewhere.
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define MATH_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATH_NEON 1
+#endif
+
+namespace math
+{
+
+struct alignas(16) float3
+{
+    float x, y, z;
+    // The fourth lane the SIMD operations compute along, zero so that it
+    // never holds the denormals that stall them.
+    float padding = 0.f;
+};
+
+struct alignas(16) float4
+{
+    float x, y, z, w;
+
+    float3 xyz() const { return { x, y, z }; }
+};
+
+// Unit quaternion, (x, y, z) imaginary and w real.
+struct alignas(16) quat
+{
+    float x, y, z, w;
+};
+
+struct float3x3
+{
+    float3 columns[3];
+};
+
+struct float4x4
+{
+    float4 columns[4];
+};
+
+static_assert( sizeof(float3) == 16 && alignof(float3) == 16, "float3 must match the Metal layout" );
+static_assert( sizeof(float4) == 16 && alignof(float4) == 16, "float4 must match the Metal layout" );
+static_assert( sizeof(float3x3) == 48, "float3x3 must match the Metal layout" );
+static_assert( sizeof(float4x4) == 64, "float4x4 must match the Metal layout" );
+
+namespace detail
+{
+
+#if MATH_SSE
+
+using vec = __m128;
+
+inline vec load( const float* p ) { return _mm_load_ps( p ); }
+inline void store( float* p, vec v ) { _mm_store_ps( p, v ); }
+inline vec splat( float f ) { return _mm_set1_ps( f ); }
+inline vec add( vec a, vec b ) { return _mm_add_ps( a, b ); }
+inline vec sub( vec a, vec b ) { return _mm_sub_ps( a, b ); }
+inline vec mul( vec a, vec b ) { return _mm_mul_ps( a, b ); }
+template <int Lane> inline vec broadcast( vec v ) { return _mm_shuffle_ps( v, v, _MM_SHUFFLE( Lane, Lane, Lane, Lane ) ); }
+
+#elif MATH_NEON
+
+using vec = float32x4_t;
+
+inline vec load( const float* p ) { return vld1q_f32( p ); }
+inline void store( float* p, vec v ) { vst1q_f32( p, v ); }
+inline vec splat( float f ) { return vdupq_n_f32( f ); }
+inline vec add( vec a, vec b ) { return vaddq_f32( a, b ); }
+inline vec sub( vec a, vec b ) { return vsubq_f32( a, b ); }
+inline vec mul( vec a, vec b ) { return vmulq_f32( a, b ); }
+template <int Lane> inline vec broadcast( vec v ) { return vdupq_laneq_f32( v, Lane ); }
+
+#else
+
+struct vec { float f[4]; };
+
+inline vec load( const float* p ) { return { { p[0], p[1], p[2], p[3] } }; }
+inline void store( float* p, vec v ) { for ( int i = 0; i < 4; ++i ) p[i] = v.f[i]; }
+inline vec splat( float f ) { return { { f, f, f, f } }; }
+inline vec add( vec a, vec b ) { return { { a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3] } }; }
+inline vec sub( vec a, vec b ) { return { { a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3] } }; }
+inline vec mul( vec a, vec b ) { return { { a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3] } }; }
+template <int Lane> inline vec broadcast( vec v ) { return splat( v.f[Lane] ); }
+
+#endif
+
+// float3 is loaded as four lanes; the fourth lane is padding and never read back.
+template <typename T> inline vec load( const T& v ) { return load( &v.x ); }
+template <typename T> inline T store_as( vec v ) { T out; store( &out.x, v ); return out; }
+
+// m * v for a matrix with N columns, v given as four lanes.
+template <int N, typename Column>
+inline vec transform( const Column* columns, vec v )
+{
+    vec r = mul( load( columns[0] ), broadcast<0>( v ) );
+    r = add( r, mul( load( columns[1] ), broadcast<1>( v ) ) );
+    if constexpr ( N > 2 )
+        r = add( r, mul( load( columns[2] ), broadcast<2>( v ) ) );
+    if constexpr ( N > 3 )
+        r = add( r, mul( load( columns[3] ), broadcast<3>( v ) ) );
+    return r;
+}
+
+}
+
+inline float3 operator+( const float3& a, const float3& b ) { return detail::store_as<float3>( detail::add( detail::load( a ), detail::load( b ) ) ); }
+inline float3 operator-( const float3& a, const float3& b ) { return detail::store_as<float3>( detail::sub( detail::load( a ), detail::load( b ) ) ); }
+inline float3 operator*( const float3& a, const float3& b ) { return detail::store_as<float3>( detail::mul( detail::load( a ), detail::load( b ) ) ); }
+inline float3 operator*( const float3& a, float s ) { return detail::store_as<float3>( detail::mul( detail::load( a ), detail::splat( s ) ) ); }
+inline float3 operator*( float s, const float3& a ) { return a * s; }
+inline float3 operator-( const float3& a ) { return { -a.x, -a.y, -a.z }; }
+
+inline float4 operator+( const float4& a, const float4& b ) { return detail::store_as<float4>( detail::add( detail::load( a ), detail::load( b ) ) ); }
+inline float4 operator-( const float4& a, const float4& b ) { return detail::store_as<float4>( detail::sub( detail::load( a ), detail::load( b ) ) ); }
+inline float4 operator*( const float4& a, const float4& b ) { return detail::store_as<float4>( detail::mul( detail::load( a ), detail::load( b ) ) ); }
+inline float4 operator*( const float4& a, float s ) { return detail::store_as<float4>( detail::mul( detail::load( a ), detail::splat( s ) ) ); }
+inline float4 operator*( float s, const float4& a ) { return a * s; }
+inline float4 operator-( const float4& a ) { return { -a.x, -a.y, -a.z, -a.w }; }
+
+inline float dot( const float3& a, const float3& b ) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float dot( const float4& a, const float4& b ) { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+inline float length( const float3& a ) { return std::sqrt( dot( a, a ) ); }
+inline float3 normalize( const float3& a ) { return a * ( 1.f / length( a ) ); }
+inline float3 cross( const float3& a, const float3& b )
+{
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+// Hamilton product, rotates by b first and then by a.
+inline quat operator*( const quat& a, const quat& b )
+{
+    return { a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+             a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+             a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+             a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z };
+}
+
+inline float4 operator*( const float4x4& m, const float4& v )
+{
+    return detail::store_as<float4>( detail::transform<4>( m.columns, detail::load( v ) ) );
+}
+
+inline float3 operator*( const float3x3& m, const float3& v )
+{
+    return detail::store_as<float3>( detail::transform<3>( m.columns, detail::load( v ) ) );
+}
+
+inline float4x4 operator*( const float4x4& a, const float4x4& b )
+{
+    float4x4 r;
+    for ( int c = 0; c < 4; ++c )
+        r.columns[c] = a * b.columns[c];
+    return r;
+}
+
+inline float3x3 operator*( const float3x3& a, const float3x3& b )
+{
+    float3x3 r;
+    for ( int c = 0; c < 3; ++c )
+        r.columns[c] = a * b.columns[c];
+    return r;
+}
+
+inline float4x4 transpose( const float4x4& m )
+{
+    const float4* c = m.columns;
+    return { { { c[0].x, c[1].x, c[2].x, c[3].x },
+               { c[0].y, c[1].y, c[2].y, c[3].y },
+               { c[0].z, c[1].z, c[2].z, c[3].z },
+               { c[0].w, c[1].w, c[2].w, c[3].w } } };
+}
+
+inline float4x4 matrix_from_columns( const float4& c0, const float4& c1, const float4& c2, const float4& c3 )
+{
+    return { { c0, c1, c2, c3 } };
+}
+
+inline float4x4 matrix_from_rows( const float4& r0, const float4& r1, const float4& r2, const float4& r3 )
+{
+    return transpose( matrix_from_columns( r0, r1, r2, r3 ) );
+}
+
+inline float3x3 matrix_from_columns( const float3& c0, const float3& c1, const float3& c2 )
+{
+    return { { c0, c1, c2 } };
+}
+
+}
+
+#endif // !MATH_TYPES_HPP
@@ -0,0 +1,368 @@
+#include "mesh.hpp"
+#include "packing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+// One vertex in MeshVertexFormat::Float32.
+struct GpuVertex
+{
+    float position[4];
+    float normal[4];
+};
+
+// One vertex in any of the packed formats; positions are half or snorm16 bits.
+struct PackedVertex
+{
+    uint16_t position[4];
+    uint32_t normal;
+};
+
+static_assert( sizeof(GpuVertex) == mesh_vertex_stride( MeshVertexFormat::Float32 ), "GpuVertex is MeshVertexFormat::Float32" );
+static_assert( sizeof(PackedVertex) == mesh_vertex_stride( MeshVertexFormat::HalfOctahedral ), "PackedVertex is every packed format" );
+
+bool half_positions( MeshVertexFormat format )
+{
+    return format == MeshVertexFormat::HalfOctahedral || format == MeshVertexFormat::Half1010102;
+}
+
+bool octahedral_normals( MeshVertexFormat format )
+{
+    return format == MeshVertexFormat::HalfOctahedral || format == MeshVertexFormat::Snorm16Octahedral;
+}
+
+constexpr uint64_t kMeshletAlignment = 16;
+
+constexpr uint64_t align_up( uint64_t size, uint64_t alignment )
+{
+    return ( size + alignment - 1 ) / alignment * alignment;
+}
+
+MeshBounds empty_bounds()
+{
+    return { { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY }, 0.f };
+}
+
+void grow( MeshBounds& bounds, const float p[3] )
+{
+    for ( int k = 0; k < 3; ++k )
+    {
+        bounds.min[k] = std::min( bounds.min[k], p[k] );
+        bounds.max[k] = std::max( bounds.max[k], p[k] );
+    }
+    bounds.radius = std::max( bounds.radius, std::sqrt( p[0] * p[0] + p[1] * p[1] + p[2] * p[2] ) );
+}
+
+void grow( MeshBounds& bounds, const MeshBounds& other )
+{
+    for ( int k = 0; k < 3; ++k )
+    {
+        bounds.min[k] = std::min( bounds.min[k], other.min[k] );
+        bounds.max[k] = std::max( bounds.max[k], other.max[k] );
+    }
+    bounds.radius = std::max( bounds.radius, other.radius );
+}
+
+// Branch free, so the compiler can vectorize it; the file is only rejected after the whole pass.
+template<typename Index>
+bool indices_below( const Index* pIndices, size_t count, uint32_t limit )
+{
+    Index largest = 0;
+    for ( size_t i = 0; i < count; ++i )
+        largest = std::max( largest, pIndices[ i ] );
+    return count == 0 || largest < limit;
+}
+
+bool write_padding( FILE* pFile, uint64_t& offset, uint64_t alignment )
+{
+    static const uint8_t zeros[ kMeshSectionAlignment ] = {};
+    const uint64_t padding = align_up( offset, alignment ) - offset;
+    offset += padding;
+    return fwrite( zeros, 1, padding, pFile ) == padding;
+}
+
+}
+
+const char* mesh_vertex_format_name( MeshVertexFormat format )
+{
+    switch ( format )
+    {
+        case MeshVertexFormat::Float32: return "float32";
+        case MeshVertexFormat::HalfOctahedral: return "half-oct";
+        case MeshVertexFormat::Half1010102: return "half-1010102";
+        case MeshVertexFormat::Snorm16Octahedral: return "snorm16-oct";
+        case MeshVertexFormat::Snorm16_1010102: return "snorm16-1010102";
+        case MeshVertexFormat::Count: break;
+    }
+    return "unknown";
+}
+
+void encode_vertices( const MeshData::Vertex* pVertices, size_t count, MeshVertexFormat format, float positionScale, void* pOut )
+{
+    if ( format == MeshVertexFormat::Float32 )
+    {
+        auto pGpu = static_cast<GpuVertex*>( pOut );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const MeshData::Vertex& v = pVertices[ i ];
+            pGpu[ i ] = { { v.position[0], v.position[1], v.position[2], 1.f },
+                          { v.normal[0], v.normal[1], v.normal[2], 0.f } };
+        }
+        return;
+    }
+
+    const bool half = half_positions( format );
+    const bool octahedral = octahedral_normals( format );
+    const float toUnits = positionScale > 0.f ? 1.f / positionScale : 0.f;
+    auto pPacked = static_cast<PackedVertex*>( pOut );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const MeshData::Vertex& v = pVertices[ i ];
+        PackedVertex& out = pPacked[ i ];
+        for ( int k = 0; k < 3; ++k )
+            out.position[ k ] = half ? float_to_half( v.position[ k ] ) : static_cast<uint16_t>( quantize_snorm16( v.position[ k ] * toUnits ) );
+        out.position[3] = 0;
+        out.normal = octahedral ? encode_octahedral( v.normal ) : encode_unorm10_10_10_2( v.normal );
+    }
+}
+
+void decode_vertices( const void* pData, size_t count, MeshVertexFormat format, float positionScale, MeshData::Vertex* pOut )
+{
+    if ( format == MeshVertexFormat::Float32 )
+    {
+        auto pGpu = static_cast<const GpuVertex*>( pData );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const GpuVertex& v = pGpu[ i ];
+            pOut[ i ] = { { v.position[0], v.position[1], v.position[2] }, { v.normal[0], v.normal[1], v.normal[2] } };
+        }
+        return;
+    }
+
+    const bool half = half_positions( format );
+    const bool octahedral = octahedral_normals( format );
+    auto pPacked = static_cast<const PackedVertex*>( pData );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const PackedVertex& v = pPacked[ i ];
+        MeshData::Vertex& out = pOut[ i ];
+        for ( int k = 0; k < 3; ++k )
+            out.position[ k ] = half ? half_to_float( v.position[ k ] ) : dequantize_snorm16( static_cast<int16_t>( v.position[ k ] ) ) * positionScale;
+        if ( octahedral )
+            decode_octahedral( v.normal, out.normal );
+        else
+            decode_unorm10_10_10_2( v.normal, out.normal );
+    }
+}
+
+bool write_mesh( const char* path, const MeshData& mesh, MeshVertexFormat format )
+{
+    const size_t vertexCount = mesh.vertices.size();
+    if ( vertexCount == 0 || vertexCount > UINT32_MAX || mesh.indices.size() > UINT32_MAX )
+    {
+        __builtin_printf("Mesh has %zu vertices, cannot write it. \n\n", vertexCount);
+        return false;
+    }
+
+    std::vector<MeshSubmesh> submeshes = mesh.submeshes;
+    if ( submeshes.empty() )
+        submeshes.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+
+    MeshHeader header = {};
+    header.magic = kMeshMagic;
+    header.version = kMeshVersion;
+    header.vertexFormat = static_cast<uint32_t>( format );
+    header.vertexStride = static_cast<uint32_t>( mesh_vertex_stride( format ) );
+    header.vertexCount = static_cast<uint32_t>( vertexCount );
+    header.indexSize = vertexCount <= 0x10000 ? 2 : 4;
+    header.indexCount = static_cast<uint32_t>( mesh.indices.size() );
+    header.submeshCount = static_cast<uint32_t>( submeshes.size() );
+    header.bounds = empty_bounds();
+    header.meshletCount = static_cast<uint32_t>( mesh.meshlets.size() );
+    header.lodCount = static_cast<uint32_t>( mesh.lods.size() );
+
+    // Submeshes, levels of detail and meshlets are all ranges of the one index array.
+    for ( size_t i = 0; i < mesh.indices.size(); ++i )
+    {
+        if ( mesh.indices[ i ] >= vertexCount )
+        {
+            __builtin_printf("Index %u at %zu refers past the last vertex. \n\n", mesh.indices[ i ], i);
+            return false;
+        }
+    }
+
+    for ( MeshSubmesh& submesh : submeshes )
+    {
+        if ( uint64_t( submesh.indexOffset ) + submesh.indexCount > mesh.indices.size() )
+        {
+            __builtin_printf("Submesh indices [%u, +%u) are out of range. \n\n", submesh.indexOffset, submesh.indexCount);
+            return false;
+        }
+
+        submesh.bounds = empty_bounds();
+        for ( uint32_t i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; ++i )
+            grow( submesh.bounds, mesh.vertices[ mesh.indices[ i ] ].position );
+        submesh.reserved = 0;
+        grow( header.bounds, submesh.bounds );
+    }
+
+    if ( mesh.lods.size() > kMeshMaxLods )
+    {
+        __builtin_printf("Mesh has %zu levels of detail, at most %zu are supported. \n\n", mesh.lods.size(), kMeshMaxLods);
+        return false;
+    }
+
+    for ( const MeshLod& lod : mesh.lods )
+    {
+        if ( uint64_t( lod.indexOffset ) + lod.indexCount > mesh.indices.size()
+          || uint64_t( lod.meshletOffset ) + lod.meshletCount > mesh.meshlets.size() )
+        {
+            __builtin_printf("Level of detail at indices [%u, +%u) is out of range. \n\n", lod.indexOffset, lod.indexCount);
+            return false;
+        }
+    }
+
+    for ( const Meshlet& meshlet : mesh.meshlets )
+    {
+        if ( uint64_t( meshlet.indexOffset ) + uint64_t( meshlet.triangleCount ) * 3 > mesh.indices.size() )
+        {
+            __builtin_printf("Meshlet indices [%u, +%u) are out of range. \n\n", meshlet.indexOffset, meshlet.triangleCount * 3);
+            return false;
+        }
+    }
+
+    uint64_t offset = sizeof(MeshHeader) + submeshes.size() * sizeof(MeshSubmesh);
+    header.lodOffset = offset;
+    header.meshletOffset = align_up( offset + mesh.lods.size() * sizeof(MeshLod), kMeshletAlignment );
+    header.vertexOffset = align_up( header.meshletOffset + mesh.meshlets.size() * sizeof(Meshlet), kMeshSectionAlignment );
+    header.indexOffset = align_up( header.vertexOffset + vertexCount * header.vertexStride, kMeshSectionAlignment );
+
+    FILE* pFile = fopen( path, "wb" );
+    if ( !pFile )
+    {
+        __builtin_printf("Failed to open %s for writing. \n\n", path);
+        return false;
+    }
+
+    bool ok = fwrite( &header, sizeof(header), 1, pFile ) == 1
+           && fwrite( submeshes.data(), sizeof(MeshSubmesh), submeshes.size(), pFile ) == submeshes.size()
+           && ( mesh.lods.empty() || fwrite( mesh.lods.data(), sizeof(MeshLod), mesh.lods.size(), pFile ) == mesh.lods.size() );
+    offset += mesh.lods.size() * sizeof(MeshLod);
+    ok = ok && write_padding( pFile, offset, kMeshletAlignment )
+           && ( mesh.meshlets.empty() || fwrite( mesh.meshlets.data(), sizeof(Meshlet), mesh.meshlets.size(), pFile ) == mesh.meshlets.size() );
+    offset += mesh.meshlets.size() * sizeof(Meshlet);
+    ok = ok && write_padding( pFile, offset, kMeshSectionAlignment );
+
+    // Converted in batches, so the whole file never has to be held twice. GpuVertex is the widest format.
+    constexpr size_t kBatch = 4096;
+    std::vector<GpuVertex> vertices( std::min( vertexCount, kBatch ) );
+    for ( size_t begin = 0; ok && begin < vertexCount; begin += kBatch )
+    {
+        const size_t count = std::min( vertexCount - begin, kBatch );
+        encode_vertices( mesh.vertices.data() + begin, count, format, header.bounds.radius, vertices.data() );
+        ok = fwrite( vertices.data(), header.vertexStride, count, pFile ) == count;
+        offset += count * header.vertexStride;
+    }
+
+    ok = ok && write_padding( pFile, offset, kMeshSectionAlignment );
+
+    if ( ok && header.indexSize == 2 )
+    {
+        std::vector<uint16_t> indices( mesh.indices.begin(), mesh.indices.end() );
+        ok = fwrite( indices.data(), sizeof(uint16_t), indices.size(), pFile ) == indices.size();
+    }
+    else if ( ok )
+    {
+        ok = fwrite( mesh.indices.data(), sizeof(uint32_t), mesh.indices.size(), pFile ) == mesh.indices.size();
+    }
+
+    if ( fclose( pFile ) != 0 || !ok )
+    {
+        __builtin_printf("Failed to write %s. \n\n", path);
+        return false;
+    }
+    return true;
+}
+
+MeshFile::MeshFile( const char* path )
+    : m_file( path, MappedFile::Access::WillNeed )
+{
+    if ( !m_file.is_open() )
+        return;
+
+    const uint64_t size = m_file.size();
+    if ( size < sizeof(MeshHeader) )
+    {
+        __builtin_printf("%s is not a mesh file. \n\n", path);
+        return;
+    }
+
+    const MeshHeader& h = header();
+    if ( h.magic != kMeshMagic || h.version != kMeshVersion )
+    {
+        __builtin_printf("%s is not a version %u mesh file. \n\n", path, kMeshVersion);
+        return;
+    }
+
+    // Everything that decides what gets read is checked here, index values included below.
+    const bool layoutOk = h.vertexFormat < static_cast<uint32_t>( MeshVertexFormat::Count )
+                       && h.vertexStride == mesh_vertex_stride( static_cast<MeshVertexFormat>( h.vertexFormat ) )
+                       && ( h.indexSize == 2 || h.indexSize == 4 )
+                       && sizeof(MeshHeader) + uint64_t( h.submeshCount ) * sizeof(MeshSubmesh) <= size
+                       && h.lodCount <= kMeshMaxLods && h.lodOffset % alignof(MeshLod) == 0
+                       && h.lodOffset <= size && uint64_t( h.lodCount ) * sizeof(MeshLod) <= size - h.lodOffset
+                       && h.meshletOffset % kMeshletAlignment == 0
+                       && h.meshletOffset <= size && uint64_t( h.meshletCount ) * sizeof(Meshlet) <= size - h.meshletOffset
+                       && h.vertexOffset % kMeshSectionAlignment == 0
+                       && h.indexOffset % kMeshSectionAlignment == 0
+                       && h.vertexOffset <= size && uint64_t( h.vertexCount ) * h.vertexStride <= size - h.vertexOffset
+                       && h.indexOffset <= size && uint64_t( h.indexCount ) * h.indexSize <= size - h.indexOffset;
+    if ( !layoutOk )
+    {
+        __builtin_printf("%s is truncated or has an unsupported layout. \n\n", path);
+        return;
+    }
+
+    for ( uint32_t i = 0; i < h.submeshCount; ++i )
+    {
+        if ( uint64_t( submeshes()[ i ].indexOffset ) + submeshes()[ i ].indexCount > h.indexCount )
+        {
+            __builtin_printf("%s has a submesh outside its index data. \n\n", path);
+            return;
+        }
+    }
+
+    for ( uint32_t i = 0; i < h.lodCount; ++i )
+    {
+        if ( uint64_t( lods()[ i ].indexOffset ) + lods()[ i ].indexCount > h.indexCount
+          || uint64_t( lods()[ i ].meshletOffset ) + lods()[ i ].meshletCount > h.meshletCount )
+        {
+            __builtin_printf("%s has a level of detail outside its index or meshlet data. \n\n", path);
+            return;
+        }
+    }
+
+    for ( uint32_t i = 0; i < h.meshletCount; ++i )
+    {
+        if ( uint64_t( meshlets()[ i ].indexOffset ) + uint64_t( meshlets()[ i ].triangleCount ) * 3 > h.indexCount )
+        {
+            __builtin_printf("%s has a meshlet outside its index data. \n\n", path);
+            return;
+        }
+    }
+
+    // Every index of every submesh, level of detail and meshlet is drawn as is, one pass over them all.
+    const bool indicesOk = h.indexSize == 2 ? indices_below( static_cast<const uint16_t*>( index_data() ), h.indexCount, h.vertexCount )
+                                            : indices_below( static_cast<const uint32_t*>( index_data() ), h.indexCount, h.vertexCount );
+    if ( !indicesOk )
+    {
+        __builtin_printf("%s has an index past its last vertex. \n\n", path);
+        return;
+    }
+
+    m_valid = true;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "utility.hpp"
+
+// Binary mesh container, written by tools/mesh_tool and read with MeshFile:
+//
+//   MeshHeader | MeshSubmesh[ submeshCount ] | MeshLod[ lodCount ] | Meshlet[ meshletCount ] | vertices | indices
+//
+// The vertex and index sections start on kMeshSectionAlignment boundaries, so
+// a mapping of the file can be copied into GPU buffers as is, or wrapped
+// without a copy by APIs that take page aligned memory. Little endian.
+constexpr uint32_t kMeshMagic = 0x4853454d; // "MESH"
+constexpr uint32_t kMeshVersion = 3;
+constexpr size_t kMeshSectionAlignment = 4096;
+constexpr size_t kMeshMaxLods = 8;
+
+// The packed formats take 12 bytes: a position as 4 x 16 bits, w unused, and
+// the normal in 32 bits. Snorm16 positions are in units of bounds.radius, so
+// whoever draws them scales by it. See packing.hpp for the normal encodings.
+enum class MeshVertexFormat : uint32_t
+{
+    // float3 position and float3 normal, each padded to 16 bytes.
+    Float32 = 0,
+    HalfOctahedral = 1,
+    Half1010102 = 2,
+    Snorm16Octahedral = 3,
+    Snorm16_1010102 = 4,
+    Count
+};
+
+constexpr size_t mesh_vertex_stride( MeshVertexFormat format )
+{
+    return format == MeshVertexFormat::Float32 ? 32 : 12;
+}
+
+const char* mesh_vertex_format_name( MeshVertexFormat format );
+
+struct MeshBounds
+{
+    float min[3];
+    float max[3];
+    // Sphere around the mesh origin (not the box center) enclosing every vertex.
+    float radius;
+};
+
+struct MeshSubmesh
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    MeshBounds bounds;
+    uint32_t reserved;
+};
+
+// One level of detail. Level 0 spans the submeshes, coarser levels follow in
+// the index data and draw the whole mesh with the same vertices.
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    // Meshlets of this level, if any, as a range of the meshlet table.
+    uint32_t meshletOffset;
+    uint32_t meshletCount;
+    // How far, in mesh units, the simplified surface may be from level 0.
+    float error;
+    uint32_t reserved;
+};
+
+// A run of consecutive triangles of one submesh, small enough to be culled on
+// its own; see meshlet.hpp. Bounds are in mesh space.
+struct Meshlet
+{
+    uint32_t indexOffset;
+    uint32_t triangleCount;
+    uint32_t vertexCount;
+    uint32_t reserved;
+    float center[3];
+    float radius;
+    // Normal cone: the cutoff is the sine of the angle between coneAxis and the
+    // furthest triangle normal. 1 means the triangles face too many ways to be culled.
+    float coneAxis[3];
+    float coneCutoff;
+};
+
+struct MeshHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexFormat;
+    uint32_t vertexStride;
+    uint32_t vertexCount;
+    uint32_t indexSize;
+    uint32_t indexCount;
+    uint32_t submeshCount;
+    MeshBounds bounds;
+    uint32_t meshletCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t meshletOffset;
+    uint32_t lodCount;
+    uint32_t reserved;
+    uint64_t lodOffset;
+};
+
+static_assert( sizeof(MeshSubmesh) == 40, "MeshSubmesh is part of the file format" );
+static_assert( sizeof(MeshLod) == 24, "MeshLod is part of the file format" );
+static_assert( sizeof(Meshlet) == 48, "Meshlet is part of the file format" );
+static_assert( sizeof(MeshHeader) == 104, "MeshHeader is part of the file format" );
+
+// Mesh as importers produce it, before it is written out.
+struct MeshData
+{
+    struct Vertex
+    {
+        float position[3];
+        float normal[3];
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Only indexOffset and indexCount are used, bounds are computed on write.
+    std::vector<MeshSubmesh> submeshes;
+    // Optional, see build_lods() and build_meshlets(); written as they are.
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+};
+
+// Converts vertices to and from `format`, mesh_vertex_stride( format ) bytes
+// each. positionScale is what snorm16 positions are in units of; other formats
+// ignore it.
+void encode_vertices( const MeshData::Vertex* pVertices, size_t count, MeshVertexFormat format, float positionScale, void* pOut );
+void decode_vertices( const void* pData, size_t count, MeshVertexFormat format, float positionScale, MeshData::Vertex* pOut );
+
+// Writes `mesh` in the container format. Indices are stored as 16 bit when
+// every vertex is addressable that way.
+bool write_mesh( const char* path, const MeshData& mesh, MeshVertexFormat format = MeshVertexFormat::Float32 );
+
+// Mapped, validated mesh container.
+class MeshFile
+{
+    public:
+        MeshFile() = default;
+        explicit MeshFile( const char* path );
+
+        bool is_valid() const { return m_valid; }
+
+        const MeshHeader& header() const { return *reinterpret_cast<const MeshHeader*>( m_file.data() ); }
+        const MeshSubmesh* submeshes() const { return reinterpret_cast<const MeshSubmesh*>( m_file.data() + sizeof(MeshHeader) ); }
+        const MeshLod* lods() const { return reinterpret_cast<const MeshLod*>( m_file.data() + header().lodOffset ); }
+        const Meshlet* meshlets() const { return reinterpret_cast<const Meshlet*>( m_file.data() + header().meshletOffset ); }
+
+        const void* vertex_data() const { return m_file.data() + header().vertexOffset; }
+        size_t vertex_data_size() const { return size_t( header().vertexCount ) * header().vertexStride; }
+        const void* index_data() const { return m_file.data() + header().indexOffset; }
+        size_t index_data_size() const { return size_t( header().indexCount ) * header().indexSize; }
+
+    private:
+        MappedFile m_file;
+        bool m_valid = false;
+};
@@ -0,0 +1,930 @@
+#include "mesh_import.hpp"
+#include "math.hpp"
+#include "utility.hpp"
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+
+using Float3 = math::float3;
+
+// Adds the area weighted normal of every triangle to its flagged vertices, then normalizes them.
+void generate_normals( MeshData& mesh, const std::vector<uint8_t>& missing )
+{
+    std::vector<Float3> sums( mesh.vertices.size(), Float3 { 0.f, 0.f, 0.f } );
+    bool any = false;
+    for ( size_t i = 0; i + 2 < mesh.indices.size(); i += 3 )
+    {
+        const uint32_t a = mesh.indices[ i ], b = mesh.indices[ i + 1 ], c = mesh.indices[ i + 2 ];
+        if ( !missing[ a ] && !missing[ b ] && !missing[ c ] )
+            continue;
+
+        const float* pa = mesh.vertices[ a ].position;
+        const float* pb = mesh.vertices[ b ].position;
+        const float* pc = mesh.vertices[ c ].position;
+        const Float3 ab = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+        const Float3 ac = { pc[0] - pa[0], pc[1] - pa[1], pc[2] - pa[2] };
+        const Float3 n = math::cross( ab, ac );
+        for ( uint32_t v : { a, b, c } )
+            sums[ v ] = sums[ v ] + n;
+        any = true;
+    }
+
+    if ( !any )
+        return;
+
+    for ( size_t v = 0; v < mesh.vertices.size(); ++v )
+    {
+        if ( !missing[ v ] )
+            continue;
+        const float length = math::length( sums[ v ] );
+        const Float3 n = length > 0.f ? sums[ v ] * ( 1.f / length ) : Float3 { 0.f, 0.f, 1.f };
+        mesh.vertices[ v ].normal[0] = n.x;
+        mesh.vertices[ v ].normal[1] = n.y;
+        mesh.vertices[ v ].normal[2] = n.z;
+    }
+}
+
+void close_submesh( MeshData& mesh, uint32_t& firstIndex )
+{
+    const uint32_t count = static_cast<uint32_t>( mesh.indices.size() ) - firstIndex;
+    if ( count > 0 )
+        mesh.submeshes.push_back( { firstIndex, count, {}, 0 } );
+    firstIndex = static_cast<uint32_t>( mesh.indices.size() );
+}
+
+bool parse_floats( const char* p, float* pOut, int count )
+{
+    for ( int i = 0; i < count; ++i )
+    {
+        char* pEnd;
+        pOut[ i ] = strtof( p, &pEnd );
+        if ( pEnd == p )
+            return false;
+        p = pEnd;
+    }
+    return true;
+}
+
+// 1 based, negative counts back from the last element. Returns -1 when out of range.
+long resolve_index( long index, size_t count )
+{
+    const long resolved = index < 0 ? static_cast<long>( count ) + index : index - 1;
+    return resolved >= 0 && resolved < static_cast<long>( count ) ? resolved : -1;
+}
+
+struct Json
+{
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    const Json* find( const char* key ) const
+    {
+        for ( const auto& member : members )
+            if ( member.first == key )
+                return &member.second;
+        return nullptr;
+    }
+
+    double number_or( const char* key, double fallback ) const
+    {
+        const Json* pValue = find( key );
+        return pValue && pValue->type == Type::Number ? pValue->number : fallback;
+    }
+
+    const char* string_or( const char* key, const char* fallback ) const
+    {
+        const Json* pValue = find( key );
+        return pValue && pValue->type == Type::String ? pValue->string.c_str() : fallback;
+    }
+
+    // Element `index` of the array `key`, or nullptr.
+    const Json* element( const char* key, double index ) const
+    {
+        const Json* pArray = find( key );
+        if ( !pArray || pArray->type != Type::Array || index < 0 || index >= static_cast<double>( pArray->items.size() ) )
+            return nullptr;
+        return &pArray->items[ static_cast<size_t>( index ) ];
+    }
+};
+
+class JsonParser
+{
+    public:
+        explicit JsonParser( std::string_view text ) : p( text.data() ), p_end( text.data() + text.size() ) { }
+
+        bool parse( Json& out )
+        {
+            if ( !value( out, 0 ) )
+                return false;
+            skip_space();
+            return p == p_end;
+        }
+
+    private:
+        static constexpr int kMaxDepth = 64;
+
+        void skip_space()
+        {
+            while ( p < p_end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) )
+                ++p;
+        }
+
+        bool literal( const char* word )
+        {
+            const size_t length = strlen( word );
+            if ( static_cast<size_t>( p_end - p ) < length || memcmp( p, word, length ) != 0 )
+                return false;
+            p += length;
+            return true;
+        }
+
+        static void append_utf8( std::string& out, uint32_t c )
+        {
+            if ( c < 0x80 )
+                out += static_cast<char>( c );
+            else if ( c < 0x800 )
+            {
+                out += static_cast<char>( 0xc0 | ( c >> 6 ) );
+                out += static_cast<char>( 0x80 | ( c & 0x3f ) );
+            }
+            else if ( c < 0x10000 )
+            {
+                out += static_cast<char>( 0xe0 | ( c >> 12 ) );
+                out += static_cast<char>( 0x80 | ( ( c >> 6 ) & 0x3f ) );
+                out += static_cast<char>( 0x80 | ( c & 0x3f ) );
+            }
+            else
+            {
+                out += static_cast<char>( 0xf0 | ( c >> 18 ) );
+                out += static_cast<char>( 0x80 | ( ( c >> 12 ) & 0x3f ) );
+                out += static_cast<char>( 0x80 | ( ( c >> 6 ) & 0x3f ) );
+                out += static_cast<char>( 0x80 | ( c & 0x3f ) );
+            }
+        }
+
+        bool hex4( uint32_t& out )
+        {
+            if ( p_end - p < 4 )
+                return false;
+            out = 0;
+            for ( int i = 0; i < 4; ++i, ++p )
+            {
+                const char c = *p;
+                const int digit = c >= '0' && c <= '9' ? c - '0'
+                                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                if ( digit < 0 )
+                    return false;
+                out = out * 16 + static_cast<uint32_t>( digit );
+            }
+            return true;
+        }
+
+        bool string( std::string& out )
+        {
+            ++p; // opening quote
+            while ( p < p_end && *p != '"' )
+            {
+                if ( *p != '\\' )
+                {
+                    out += *p++;
+                    continue;
+                }
+
+                if ( ++p == p_end )
+                    return false;
+                const char escape = *p++;
+                switch ( escape )
+                {
+                    case '"': case '\\': case '/': out += escape; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u':
+                    {
+                        uint32_t c;
+                        if ( !hex4( c ) )
+                            return false;
+                        uint32_t low;
+                        if ( c >= 0xd800 && c < 0xdc00 && p_end - p >= 6 && p[0] == '\\' && p[1] == 'u' )
+                        {
+                            p += 2;
+                            if ( !hex4( low ) )
+                                return false;
+                            c = 0x10000 + ( ( c - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+                        }
+                        append_utf8( out, c );
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+
+            if ( p == p_end )
+                return false;
+            ++p; // closing quote
+            return true;
+        }
+
+        bool value( Json& out, int depth )
+        {
+            skip_space();
+            if ( p == p_end || depth > kMaxDepth )
+                return false;
+
+            switch ( *p )
+            {
+                case '{':
+                {
+                    out.type = Json::Type::Object;
+                    ++p;
+                    skip_space();
+                    if ( p < p_end && *p == '}' )
+                    {
+                        ++p;
+                        return true;
+                    }
+                    for ( ;; )
+                    {
+                        skip_space();
+                        if ( p == p_end || *p != '"' )
+                            return false;
+                        out.members.emplace_back();
+                        if ( !string( out.members.back().first ) )
+                            return false;
+                        skip_space();
+                        if ( p == p_end || *p++ != ':' )
+                            return false;
+                        if ( !value( out.members.back().second, depth + 1 ) )
+                            return false;
+                        skip_space();
+                        if ( p == p_end )
+                            return false;
+                        if ( *p == '}' )
+                        {
+                            ++p;
+                            return true;
+                        }
+                        if ( *p++ != ',' )
+                            return false;
+                    }
+                }
+                case '[':
+                {
+                    out.type = Json::Type::Array;
+                    ++p;
+                    skip_space();
+                    if ( p < p_end && *p == ']' )
+                    {
+                        ++p;
+                        return true;
+                    }
+                    for ( ;; )
+                    {
+                        out.items.emplace_back();
+                        if ( !value( out.items.back(), depth + 1 ) )
+                            return false;
+                        skip_space();
+                        if ( p == p_end )
+                            return false;
+                        if ( *p == ']' )
+                        {
+                            ++p;
+                            return true;
+                        }
+                        if ( *p++ != ',' )
+                            return false;
+                    }
+                }
+                case '"':
+                    out.type = Json::Type::String;
+                    return string( out.string );
+                case 't':
+                    out.type = Json::Type::Bool;
+                    out.boolean = true;
+                    return literal( "true" );
+                case 'f':
+                    out.type = Json::Type::Bool;
+                    return literal( "false" );
+                case 'n':
+                    return literal( "null" );
+                default:
+                {
+                    // strtod needs a terminator, numbers are short.
+                    char buffer[ 64 ];
+                    size_t length = 0;
+                    while ( p + length < p_end && length + 1 < sizeof(buffer) && strchr( "+-0123456789.eE", p[ length ] ) )
+                    {
+                        buffer[ length ] = p[ length ];
+                        ++length;
+                    }
+                    buffer[ length ] = '\0';
+
+                    char* pEnd;
+                    out.type = Json::Type::Number;
+                    out.number = strtod( buffer, &pEnd );
+                    if ( length == 0 || pEnd != buffer + length )
+                        return false;
+                    p += length;
+                    return true;
+                }
+            }
+        }
+
+        const char* p;
+        const char* p_end;
+};
+
+struct Blob
+{
+    const uint8_t* pData;
+    size_t size;
+};
+
+bool decode_base64( std::string_view text, std::vector<uint8_t>& out )
+{
+    uint32_t accumulator = 0;
+    int bits = 0;
+    for ( char c : text )
+    {
+        int value;
+        if ( c >= 'A' && c <= 'Z' ) value = c - 'A';
+        else if ( c >= 'a' && c <= 'z' ) value = c - 'a' + 26;
+        else if ( c >= '0' && c <= '9' ) value = c - '0' + 52;
+        else if ( c == '+' ) value = 62;
+        else if ( c == '/' ) value = 63;
+        else if ( c == '=' ) break;
+        else return false;
+
+        accumulator = ( accumulator << 6 ) | static_cast<uint32_t>( value );
+        bits += 6;
+        if ( bits >= 8 )
+        {
+            bits -= 8;
+            out.push_back( static_cast<uint8_t>( accumulator >> bits ) );
+        }
+    }
+    return true;
+}
+
+std::string decode_uri( const std::string& uri )
+{
+    std::string out;
+    for ( size_t i = 0; i < uri.size(); ++i )
+    {
+        if ( uri[ i ] == '%' && i + 2 < uri.size() )
+        {
+            out += static_cast<char>( strtol( uri.substr( i + 1, 2 ).c_str(), nullptr, 16 ) );
+            i += 2;
+        }
+        else
+            out += uri[ i ];
+    }
+    return out;
+}
+
+class GltfImporter
+{
+    public:
+        GltfImporter( const char* path, MeshData& out ) : m_path( path ), m_out( out ) { }
+
+        bool run()
+        {
+            if ( !m_file.is_open() )
+                return false;
+
+            std::string_view json;
+            Blob glbBinary = { nullptr, 0 };
+            if ( !split_container( json, glbBinary ) )
+                return false;
+
+            if ( !JsonParser( json ).parse( m_root ) || m_root.type != Json::Type::Object )
+            {
+                __builtin_printf("%s: malformed glTF JSON. \n\n", m_path);
+                return false;
+            }
+
+            if ( !load_buffers( glbBinary ) )
+                return false;
+
+            const math::float4x4 identity = math::make_identity();
+            const Json* pScenes = m_root.find( "scenes" );
+            if ( pScenes && pScenes->type == Json::Type::Array && !pScenes->items.empty() )
+            {
+                const Json* pScene = m_root.element( "scenes", m_root.number_or( "scene", 0 ) );
+                const Json* pRoots = pScene ? pScene->find( "nodes" ) : nullptr;
+                if ( pRoots && pRoots->type == Json::Type::Array )
+                {
+                    for ( const Json& node : pRoots->items )
+                        if ( !import_node( node.number, identity, 0 ) )
+                            return false;
+                }
+            }
+            else
+            {
+                const Json* pMeshes = m_root.find( "meshes" );
+                for ( size_t i = 0; pMeshes && i < pMeshes->items.size(); ++i )
+                    if ( !import_mesh( pMeshes->items[ i ], identity ) )
+                        return false;
+            }
+
+            generate_normals( m_out, m_missingNormals );
+            return true;
+        }
+
+    private:
+        // Finds the JSON text, and for .glb the embedded binary chunk.
+        bool split_container( std::string_view& json, Blob& binary )
+        {
+            const uint8_t* pData = m_file.data();
+            const size_t size = m_file.size();
+            if ( size < 12 || memcmp( pData, "glTF", 4 ) != 0 )
+            {
+                json = m_file.view();
+                return true;
+            }
+
+            uint32_t version;
+            memcpy( &version, pData + 4, 4 );
+            if ( version != 2 )
+            {
+                __builtin_printf("%s: only glTF 2.0 binaries are supported. \n\n", m_path);
+                return false;
+            }
+
+            for ( size_t offset = 12; offset + 8 <= size; )
+            {
+                uint32_t length, type;
+                memcpy( &length, pData + offset, 4 );
+                memcpy( &type, pData + offset + 4, 4 );
+                offset += 8;
+                if ( length > size - offset )
+                    break;
+
+                if ( type == 0x4e4f534a ) // "JSON"
+                    json = std::string_view( reinterpret_cast<const char*>( pData + offset ), length );
+                else if ( type == 0x004e4942 && !binary.pData ) // "BIN"
+                    binary = { pData + offset, length };
+                offset += ( length + 3 ) & ~size_t( 3 );
+            }
+
+            if ( json.empty() )
+            {
+                __builtin_printf("%s: binary glTF without a JSON chunk. \n\n", m_path);
+                return false;
+            }
+            return true;
+        }
+
+        bool load_buffers( const Blob& glbBinary )
+        {
+            const Json* pBuffers = m_root.find( "buffers" );
+            if ( !pBuffers )
+                return true;
+
+            const std::string file = m_path;
+            const size_t slash = file.find_last_of( "/\\" );
+            const std::string directory = slash == std::string::npos ? "" : file.substr( 0, slash + 1 );
+
+            for ( const Json& buffer : pBuffers->items )
+            {
+                const Json* pUri = buffer.find( "uri" );
+                const size_t byteLength = static_cast<size_t>( buffer.number_or( "byteLength", 0 ) );
+                Blob blob = { nullptr, 0 };
+
+                if ( !pUri )
+                {
+                    blob = glbBinary;
+                }
+                else if ( pUri->string.compare( 0, 5, "data:" ) == 0 )
+                {
+                    const size_t comma = pUri->string.find( ',' );
+                    m_decoded.emplace_back( std::make_unique<std::vector<uint8_t>>() );
+                    if ( comma == std::string::npos || pUri->string.find( ";base64" ) > comma
+                      || !decode_base64( std::string_view( pUri->string ).substr( comma + 1 ), *m_decoded.back() ) )
+                    {
+                        __builtin_printf("%s: only base64 data URIs are supported. \n\n", m_path);
+                        return false;
+                    }
+                    blob = { m_decoded.back()->data(), m_decoded.back()->size() };
+                }
+                else
+                {
+                    m_external.emplace_back( std::make_unique<MappedFile>( ( directory + decode_uri( pUri->string ) ).c_str(), MappedFile::Access::Random ) );
+                    if ( !m_external.back()->is_open() )
+                        return false;
+                    blob = { m_external.back()->data(), m_external.back()->size() };
+                }
+
+                if ( blob.size < byteLength )
+                {
+                    __builtin_printf("%s: buffer %zu is shorter than its byteLength. \n\n", m_path, m_buffers.size());
+                    return false;
+                }
+                m_buffers.push_back( { blob.pData, byteLength } );
+            }
+            return true;
+        }
+
+        // Resolves an accessor to strided elements of `componentCount` components.
+        bool accessor( double index, const char* type, int componentCount,
+                       const uint8_t*& pFirst, size_t& stride, size_t& count, uint32_t& componentType )
+        {
+            const Json* pAccessor = m_root.element( "accessors", index );
+            if ( !pAccessor || strcmp( pAccessor->string_or( "type", "" ), type ) != 0 )
+            {
+                __builtin_printf("%s: accessor %g is missing or not a %s. \n\n", m_path, index, type);
+                return false;
+            }
+            if ( pAccessor->find( "sparse" ) )
+            {
+                __builtin_printf("%s: sparse accessors are not supported. \n\n", m_path);
+                return false;
+            }
+
+            const Json* pView = m_root.element( "bufferViews", pAccessor->number_or( "bufferView", -1 ) );
+            const double bufferIndex = pView ? pView->number_or( "buffer", -1 ) : -1;
+            if ( !pView || bufferIndex < 0 || bufferIndex >= static_cast<double>( m_buffers.size() ) )
+            {
+                __builtin_printf("%s: accessor %g has no usable buffer view. \n\n", m_path, index);
+                return false;
+            }
+
+            componentType = static_cast<uint32_t>( pAccessor->number_or( "componentType", 0 ) );
+            const size_t componentSize = componentType == 5126 || componentType == 5125 ? 4
+                                       : componentType == 5123 || componentType == 5122 ? 2 : 1;
+            const size_t elementSize = componentSize * componentCount;
+
+            const Blob& buffer = m_buffers[ static_cast<size_t>( bufferIndex ) ];
+            const size_t viewOffset = static_cast<size_t>( pView->number_or( "byteOffset", 0 ) );
+            const size_t viewLength = static_cast<size_t>( pView->number_or( "byteLength", 0 ) );
+            const size_t offset = static_cast<size_t>( pAccessor->number_or( "byteOffset", 0 ) );
+            stride = static_cast<size_t>( pView->number_or( "byteStride", 0 ) );
+            if ( stride == 0 )
+                stride = elementSize;
+            count = static_cast<size_t>( pAccessor->number_or( "count", 0 ) );
+
+            if ( viewOffset > buffer.size || viewLength > buffer.size - viewOffset
+              || ( count > 0 && offset + ( count - 1 ) * stride + elementSize > viewLength ) )
+            {
+                __builtin_printf("%s: accessor %g reads outside its buffer. \n\n", m_path, index);
+                return false;
+            }
+
+            pFirst = buffer.pData + viewOffset + offset;
+            return true;
+        }
+
+        bool import_node( double index, const math::float4x4& parent, size_t depth )
+        {
+            const Json* pNode = m_root.element( "nodes", index );
+            const Json* pNodes = m_root.find( "nodes" );
+            if ( !pNode || depth > pNodes->items.size() )
+            {
+                __builtin_printf("%s: node %g is missing or part of a cycle. \n\n", m_path, index);
+                return false;
+            }
+
+            math::float4x4 local = math::make_identity();
+            const Json* pMatrix = pNode->find( "matrix" );
+            if ( pMatrix && pMatrix->items.size() == 16 )
+            {
+                float* pOut = reinterpret_cast<float*>( &local );
+                for ( size_t i = 0; i < 16; ++i )
+                    pOut[ i ] = static_cast<float>( pMatrix->items[ i ].number );
+            }
+            else
+            {
+                auto read = []( const Json* pArray, float* pOut, size_t n ) {
+                    for ( size_t i = 0; pArray && i < n && i < pArray->items.size(); ++i )
+                        pOut[ i ] = static_cast<float>( pArray->items[ i ].number );
+                };
+                float t[3] = { 0.f, 0.f, 0.f }, r[4] = { 0.f, 0.f, 0.f, 1.f }, s[3] = { 1.f, 1.f, 1.f };
+                read( pNode->find( "translation" ), t, 3 );
+                read( pNode->find( "rotation" ), r, 4 );
+                read( pNode->find( "scale" ), s, 3 );
+                local = math::make_trs( { t[0], t[1], t[2] }, math::quat { r[0], r[1], r[2], r[3] }, { s[0], s[1], s[2] } );
+            }
+
+            const math::float4x4 world = parent * local;
+            if ( const Json* pMesh = m_root.element( "meshes", pNode->number_or( "mesh", -1 ) ) )
+                if ( !import_mesh( *pMesh, world ) )
+                    return false;
+
+            if ( const Json* pChildren = pNode->find( "children" ) )
+                for ( const Json& child : pChildren->items )
+                    if ( !import_node( child.number, world, depth + 1 ) )
+                        return false;
+            return true;
+        }
+
+        bool import_mesh( const Json& mesh, const math::float4x4& transform )
+        {
+            // Normals take the cofactor matrix, the inverse transpose up to a positive scale.
+            const math::float3 c0 = transform.columns[0].xyz(), c1 = transform.columns[1].xyz(), c2 = transform.columns[2].xyz();
+            const float determinant = math::dot( c0, math::cross( c1, c2 ) );
+            const float sign = determinant < 0.f ? -1.f : 1.f;
+            const math::float3x3 normalTransform = math::matrix_from_columns( math::cross( c1, c2 ) * sign,
+                                                                              math::cross( c2, c0 ) * sign,
+                                                                              math::cross( c0, c1 ) * sign );
+
+            const Json* pPrimitives = mesh.find( "primitives" );
+            for ( size_t p = 0; pPrimitives && p < pPrimitives->items.size(); ++p )
+            {
+                const Json& primitive = pPrimitives->items[ p ];
+                if ( primitive.number_or( "mode", 4 ) != 4 )
+                {
+                    __builtin_printf("%s: skipping a primitive that is not a triangle list. \n", m_path);
+                    continue;
+                }
+
+                const Json* pAttributes = primitive.find( "attributes" );
+                const Json* pPosition = pAttributes ? pAttributes->find( "POSITION" ) : nullptr;
+                if ( !pPosition )
+                    continue;
+
+                const uint8_t* pPositions;
+                size_t positionStride, vertexCount;
+                uint32_t componentType;
+                if ( !accessor( pPosition->number, "VEC3", 3, pPositions, positionStride, vertexCount, componentType ) )
+                    return false;
+                if ( componentType != 5126 )
+                {
+                    __builtin_printf("%s: positions must be floats. \n\n", m_path);
+                    return false;
+                }
+
+                const uint8_t* pNormals = nullptr;
+                size_t normalStride = 0;
+                if ( const Json* pNormal = pAttributes->find( "NORMAL" ) )
+                {
+                    size_t normalCount;
+                    if ( !accessor( pNormal->number, "VEC3", 3, pNormals, normalStride, normalCount, componentType ) )
+                        return false;
+                    if ( componentType != 5126 || normalCount != vertexCount )
+                        pNormals = nullptr;
+                }
+
+                const uint32_t baseVertex = static_cast<uint32_t>( m_out.vertices.size() );
+                for ( size_t v = 0; v < vertexCount; ++v )
+                {
+                    float p3[3], n3[3] = { 0.f, 0.f, 0.f };
+                    memcpy( p3, pPositions + v * positionStride, sizeof(p3) );
+                    const math::float4 position = transform * math::float4 { p3[0], p3[1], p3[2], 1.f };
+
+                    MeshData::Vertex vertex = { { position.x, position.y, position.z }, { 0.f, 0.f, 0.f } };
+                    if ( pNormals )
+                    {
+                        memcpy( n3, pNormals + v * normalStride, sizeof(n3) );
+                        const math::float3 n = normalTransform * math::float3 { n3[0], n3[1], n3[2] };
+                        const float length = math::length( n );
+                        if ( length > 0.f )
+                        {
+                            vertex.normal[0] = n.x / length;
+                            vertex.normal[1] = n.y / length;
+                            vertex.normal[2] = n.z / length;
+                        }
+                    }
+                    m_out.vertices.push_back( vertex );
+                    m_missingNormals.push_back( pNormals ? 0 : 1 );
+                }
+
+                uint32_t firstIndex = static_cast<uint32_t>( m_out.indices.size() );
+                if ( const Json* pIndices = primitive.find( "indices" ) )
+                {
+                    const uint8_t* pData;
+                    size_t stride, count;
+                    if ( !accessor( pIndices->number, "SCALAR", 1, pData, stride, count, componentType ) )
+                        return false;
+                    for ( size_t i = 0; i < count; ++i )
+                    {
+                        uint32_t index = 0;
+                        if ( componentType == 5125 )
+                            memcpy( &index, pData + i * stride, 4 );
+                        else if ( componentType == 5123 )
+                        {
+                            uint16_t index16;
+                            memcpy( &index16, pData + i * stride, 2 );
+                            index = index16;
+                        }
+                        else if ( componentType == 5121 )
+                            index = pData[ i * stride ];
+                        else
+                        {
+                            __builtin_printf("%s: unsupported index component type %u. \n\n", m_path, componentType);
+                            return false;
+                        }
+
+                        if ( index >= vertexCount )
+                        {
+                            __builtin_printf("%s: index %u is out of range. \n\n", m_path, index);
+                            return false;
+                        }
+                        m_out.indices.push_back( baseVertex + index );
+                    }
+                }
+                else
+                {
+                    for ( size_t v = 0; v < vertexCount; ++v )
+                        m_out.indices.push_back( baseVertex + static_cast<uint32_t>( v ) );
+                }
+
+                // Drop a trailing partial triangle, and keep the front faces under a mirroring transform.
+                m_out.indices.resize( firstIndex + ( m_out.indices.size() - firstIndex ) / 3 * 3 );
+                if ( determinant < 0.f )
+                    for ( size_t i = firstIndex; i < m_out.indices.size(); i += 3 )
+                        std::swap( m_out.indices[ i + 1 ], m_out.indices[ i + 2 ] );
+
+                close_submesh( m_out, firstIndex );
+            }
+            return true;
+        }
+
+        const char* m_path;
+        MeshData& m_out;
+        MappedFile m_file { m_path, MappedFile::Access::Sequential };
+        Json m_root;
+        std::vector<Blob> m_buffers;
+        std::vector<std::unique_ptr<std::vector<uint8_t>>> m_decoded;
+        std::vector<std::unique_ptr<MappedFile>> m_external;
+        std::vector<uint8_t> m_missingNormals;
+};
+
+bool has_extension( const char* path, const char* extension )
+{
+    const size_t length = strlen( path ), extensionLength = strlen( extension );
+    if ( length < extensionLength )
+        return false;
+
+    const char* pSuffix = path + length - extensionLength;
+    for ( size_t i = 0; i < extensionLength; ++i )
+        if ( tolower( static_cast<unsigned char>( pSuffix[ i ] ) ) != extension[ i ] )
+            return false;
+    return true;
+}
+
+}
+
+bool import_obj( const char* path, MeshData& out )
+{
+    MappedFile file( path );
+    if ( !file.is_open() )
+        return false;
+
+    out = MeshData();
+    std::vector<Float3> positions;
+    std::vector<Float3> normals;
+    std::vector<uint8_t> missingNormals;
+    // ( position, normal + 1 ) -> vertex, so shared corners are stored once.
+    std::unordered_map<uint64_t, uint32_t> vertexIds;
+    std::vector<uint32_t> polygon;
+    uint32_t firstIndex = 0;
+
+    const std::string_view text = file.view();
+    std::string line;
+    size_t lineNumber = 0;
+    for ( size_t begin = 0; begin < text.size(); )
+    {
+        size_t end = text.find( '\n', begin );
+        if ( end == std::string_view::npos )
+            end = text.size();
+        line.assign( text.data() + begin, end - begin );
+        begin = end + 1;
+        ++lineNumber;
+
+        if ( !line.empty() && line.back() == '\r' )
+            line.pop_back();
+        const char* p = line.c_str();
+        while ( *p == ' ' || *p == '\t' )
+            ++p;
+
+        if ( p[0] == 'v' && ( p[1] == ' ' || p[1] == '\t' ) )
+        {
+            float v[3];
+            if ( !parse_floats( p + 2, v, 3 ) )
+            {
+                __builtin_printf("%s:%zu: malformed vertex. \n\n", path, lineNumber);
+                return false;
+            }
+            positions.push_back( { v[0], v[1], v[2] } );
+        }
+        else if ( p[0] == 'v' && p[1] == 'n' && ( p[2] == ' ' || p[2] == '\t' ) )
+        {
+            float n[3];
+            if ( !parse_floats( p + 3, n, 3 ) )
+            {
+                __builtin_printf("%s:%zu: malformed normal. \n\n", path, lineNumber);
+                return false;
+            }
+            normals.push_back( { n[0], n[1], n[2] } );
+        }
+        else if ( p[0] == 'f' && ( p[1] == ' ' || p[1] == '\t' ) )
+        {
+            polygon.clear();
+            const char* q = p + 2;
+            for ( ;; )
+            {
+                while ( *q == ' ' || *q == '\t' )
+                    ++q;
+                if ( *q == '\0' )
+                    break;
+
+                // v, v/vt, v//vn or v/vt/vn
+                char* pEnd;
+                const long position = resolve_index( strtol( q, &pEnd, 10 ), positions.size() );
+                if ( pEnd == q || position < 0 )
+                {
+                    __builtin_printf("%s:%zu: face refers to a missing vertex. \n\n", path, lineNumber);
+                    return false;
+                }
+                q = pEnd;
+
+                long normal = -1;
+                if ( *q == '/' )
+                {
+                    ++q;
+                    strtol( q, &pEnd, 10 );
+                    q = pEnd;
+                    if ( *q == '/' )
+                    {
+                        ++q;
+                        normal = resolve_index( strtol( q, &pEnd, 10 ), normals.size() );
+                        if ( pEnd == q || normal < 0 )
+                        {
+                            __builtin_printf("%s:%zu: face refers to a missing normal. \n\n", path, lineNumber);
+                            return false;
+                        }
+                        q = pEnd;
+                    }
+                }
+                while ( *q && *q != ' ' && *q != '\t' )
+                    ++q;
+
+                const uint64_t key = uint64_t( position ) << 32 | uint64_t( normal + 1 );
+                auto inserted = vertexIds.emplace( key, static_cast<uint32_t>( out.vertices.size() ) );
+                if ( inserted.second )
+                {
+                    const Float3& pos = positions[ position ];
+                    const Float3 n = normal >= 0 ? normals[ normal ] : Float3 { 0.f, 0.f, 0.f };
+                    out.vertices.push_back( { { pos.x, pos.y, pos.z }, { n.x, n.y, n.z } } );
+                    missingNormals.push_back( normal < 0 ? 1 : 0 );
+                }
+                polygon.push_back( inserted.first->second );
+            }
+
+            for ( size_t i = 1; i + 1 < polygon.size(); ++i )
+            {
+                out.indices.push_back( polygon[ 0 ] );
+                out.indices.push_back( polygon[ i ] );
+                out.indices.push_back( polygon[ i + 1 ] );
+            }
+        }
+        else if ( ( p[0] == 'o' || p[0] == 'g' ) && ( p[1] == ' ' || p[1] == '\t' || p[1] == '\0' ) )
+        {
+            close_submesh( out, firstIndex );
+        }
+        else if ( strncmp( p, "usemtl", 6 ) == 0 )
+        {
+            close_submesh( out, firstIndex );
+        }
+    }
+    close_submesh( out, firstIndex );
+
+    generate_normals( out, missingNormals );
+    return true;
+}
+
+bool import_gltf( const char* path, MeshData& out )
+{
+    out = MeshData();
+    return GltfImporter( path, out ).run();
+}
+
+bool import_mesh( const char* path, MeshData& out )
+{
+    if ( has_extension( path, ".obj" ) )
+        return import_obj( path, out );
+    if ( has_extension( path, ".gltf" ) || has_extension( path, ".glb" ) )
+        return import_gltf( path, out );
+
+    __builtin_printf("%s: unknown mesh format, expected .obj, .gltf or .glb. \n\n", path);
+    return false;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "mesh.hpp"
+
+// Importers producing MeshData for write_mesh(). Triangles keep their counter
+// clockwise front faces, vertices that come without a normal get the area
+// weighted normal of the faces around them.
+
+// Wavefront OBJ: positions, normals and polygons, which are fan triangulated.
+// Every `o`, `g` or `usemtl` starts a new submesh. Texture coordinates and
+// materials are ignored.
+bool import_obj( const char* path, MeshData& out );
+
+// glTF 2.0, either .gltf with external or data: URI buffers, or .glb. Each
+// triangle primitive reachable from the default scene becomes a submesh with
+// its node transforms applied. Files without scenes import every mesh as is.
+bool import_gltf( const char* path, MeshData& out );
+
+// Picks the importer by file extension.
+bool import_mesh( const char* path, MeshData& out );
@@ -0,0 +1,345 @@
+#include "mesh_optimize.hpp"
+#include "math_types.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+
+// Forsyth's scoring: recently used vertices and vertices with few triangles left score higher.
+constexpr size_t kCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+constexpr size_t kValenceTableSize = 32;
+
+// Post-transform FIFO the fetch analysis and the overdraw clustering simulate.
+constexpr size_t kFifoCacheSize = 16;
+
+constexpr uint32_t kNone = ~0u;
+
+struct ScoreTables
+{
+    float cache[ kCacheSize ];
+    float valence[ kValenceTableSize ];
+
+    ScoreTables()
+    {
+        for ( size_t i = 0; i < kCacheSize; ++i )
+            cache[ i ] = i < 3 ? kLastTriangleScore
+                               : std::pow( 1.f - float( i - 3 ) / float( kCacheSize - 3 ), kCacheDecayPower );
+        for ( size_t i = 0; i < kValenceTableSize; ++i )
+            valence[ i ] = i == 0 ? 0.f : kValenceBoostScale * std::pow( float( i ), -kValenceBoostPower );
+    }
+
+    float score( int cachePosition, uint32_t remaining ) const
+    {
+        if ( remaining == 0 )
+            return -1.f;
+        const float valenceScore = remaining < kValenceTableSize ? valence[ remaining ]
+                                                                 : kValenceBoostScale * std::pow( float( remaining ), -kValenceBoostPower );
+        return ( cachePosition >= 0 ? cache[ cachePosition ] : 0.f ) + valenceScore;
+    }
+};
+
+math::float3 position( const MeshData::Vertex& v )
+{
+    return { v.position[0], v.position[1], v.position[2] };
+}
+
+}
+
+VertexCacheStats analyze_vertex_cache( const uint32_t* pIndices, size_t indexCount, size_t vertexCount, size_t cacheSize )
+{
+    // A vertex is cached while fewer than cacheSize misses happened since its own.
+    std::vector<size_t> missedAt( vertexCount, 0 );
+    size_t misses = 0;
+    size_t referenced = 0;
+    for ( size_t i = 0; i < indexCount; ++i )
+    {
+        const uint32_t v = pIndices[ i ];
+        if ( missedAt[ v ] == 0 )
+            referenced++;
+        if ( missedAt[ v ] == 0 || misses - missedAt[ v ] >= cacheSize )
+            missedAt[ v ] = ++misses;
+    }
+
+    const size_t triangles = indexCount / 3;
+    return { triangles ? float( misses ) / triangles : 0.f, referenced ? float( misses ) / referenced : 0.f };
+}
+
+float analyze_vertex_fetch( const uint32_t* pIndices, size_t indexCount, size_t vertexCount, size_t vertexSize )
+{
+    constexpr size_t kLineSize = 64;
+    constexpr size_t kLineCacheSize = 64;
+
+    std::vector<size_t> missedAt( vertexCount, 0 );
+    std::vector<size_t> lineFetchedAt( ( vertexCount * vertexSize + kLineSize - 1 ) / kLineSize, 0 );
+    size_t misses = 0;
+    size_t lineFetches = 0;
+    size_t referenced = 0;
+    for ( size_t i = 0; i < indexCount; ++i )
+    {
+        const uint32_t v = pIndices[ i ];
+        if ( missedAt[ v ] == 0 )
+            referenced++;
+        else if ( misses - missedAt[ v ] < kFifoCacheSize )
+            continue;
+        missedAt[ v ] = ++misses;
+
+        // Only vertices that miss the post-transform cache are fetched.
+        for ( size_t line = v * vertexSize / kLineSize; line <= ( ( v + 1 ) * vertexSize - 1 ) / kLineSize; ++line )
+            if ( lineFetchedAt[ line ] == 0 || lineFetches - lineFetchedAt[ line ] >= kLineCacheSize )
+                lineFetchedAt[ line ] = ++lineFetches;
+    }
+
+    return referenced ? float( lineFetches * kLineSize ) / float( referenced * vertexSize ) : 0.f;
+}
+
+void optimize_vertex_cache( uint32_t* pIndices, size_t indexCount, size_t vertexCount )
+{
+    static const ScoreTables tables;
+
+    const size_t triangleCount = indexCount / 3;
+    if ( triangleCount < 2 )
+        return;
+
+    // Triangles around each vertex; the first `remaining` entries are not emitted yet.
+    std::vector<uint32_t> remaining( vertexCount, 0 );
+    for ( size_t i = 0; i < triangleCount * 3; ++i )
+        remaining[ pIndices[ i ] ]++;
+
+    std::vector<uint32_t> firstTriangle( vertexCount + 1, 0 );
+    for ( size_t v = 0; v < vertexCount; ++v )
+        firstTriangle[ v + 1 ] = firstTriangle[ v ] + remaining[ v ];
+
+    std::vector<uint32_t> adjacency( firstTriangle[ vertexCount ] );
+    std::vector<uint32_t> filled( vertexCount, 0 );
+    for ( size_t t = 0; t < triangleCount; ++t )
+        for ( size_t k = 0; k < 3; ++k )
+        {
+            const uint32_t v = pIndices[ t * 3 + k ];
+            adjacency[ firstTriangle[ v ] + filled[ v ]++ ] = static_cast<uint32_t>( t );
+        }
+
+    std::vector<int> cachePosition( vertexCount, -1 );
+    std::vector<float> vertexScore( vertexCount );
+    for ( size_t v = 0; v < vertexCount; ++v )
+        vertexScore[ v ] = tables.score( -1, remaining[ v ] );
+
+    std::vector<float> triangleScore( triangleCount );
+    for ( size_t t = 0; t < triangleCount; ++t )
+        triangleScore[ t ] = vertexScore[ pIndices[ t * 3 ] ] + vertexScore[ pIndices[ t * 3 + 1 ] ] + vertexScore[ pIndices[ t * 3 + 2 ] ];
+
+    std::vector<uint8_t> emitted( triangleCount, 0 );
+    std::vector<uint32_t> output;
+    output.reserve( triangleCount * 3 );
+
+    uint32_t cache[ kCacheSize + 3 ];
+    size_t cacheCount = 0;
+    size_t cursor = 0;
+
+    uint32_t best = static_cast<uint32_t>( std::max_element( triangleScore.begin(), triangleScore.end() ) - triangleScore.begin() );
+    for ( size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount )
+    {
+        if ( best == kNone )
+        {
+            // Nothing in the cache has triangles left, continue with the next one in input order.
+            while ( emitted[ cursor ] )
+                cursor++;
+            best = static_cast<uint32_t>( cursor );
+        }
+
+        emitted[ best ] = 1;
+        const uint32_t* pTriangle = pIndices + best * 3;
+        output.insert( output.end(), pTriangle, pTriangle + 3 );
+
+        for ( size_t k = 0; k < 3; ++k )
+        {
+            const uint32_t v = pTriangle[ k ];
+            uint32_t* pAdjacent = adjacency.data() + firstTriangle[ v ];
+            uint32_t* pEnd = pAdjacent + remaining[ v ];
+            uint32_t* pFound = std::find( pAdjacent, pEnd, best );
+            if ( pFound != pEnd )
+            {
+                *pFound = *( pEnd - 1 );
+                remaining[ v ]--;
+            }
+        }
+
+        // The triangle's vertices move to the front, the rest shift back and may fall out.
+        uint32_t newCache[ kCacheSize + 3 ];
+        size_t newCount = 0;
+        for ( size_t k = 0; k < 3; ++k )
+            if ( std::find( newCache, newCache + newCount, pTriangle[ k ] ) == newCache + newCount )
+                newCache[ newCount++ ] = pTriangle[ k ];
+        for ( size_t i = 0; i < cacheCount; ++i )
+            if ( std::find( newCache, newCache + newCount, cache[ i ] ) == newCache + newCount )
+                newCache[ newCount++ ] = cache[ i ];
+
+        for ( size_t i = 0; i < newCount; ++i )
+        {
+            const uint32_t v = newCache[ i ];
+            cachePosition[ v ] = i < kCacheSize ? static_cast<int>( i ) : -1;
+
+            const float score = tables.score( cachePosition[ v ], remaining[ v ] );
+            const float delta = score - vertexScore[ v ];
+            vertexScore[ v ] = score;
+            for ( uint32_t j = 0; j < remaining[ v ]; ++j )
+                triangleScore[ adjacency[ firstTriangle[ v ] + j ] ] += delta;
+        }
+
+        // Only triangles around cached vertices changed, the best one is among them.
+        best = kNone;
+        float bestScore = -1.f;
+        for ( size_t i = 0; i < std::min( newCount, kCacheSize ); ++i )
+        {
+            const uint32_t v = newCache[ i ];
+            for ( uint32_t j = 0; j < remaining[ v ]; ++j )
+            {
+                const uint32_t t = adjacency[ firstTriangle[ v ] + j ];
+                if ( triangleScore[ t ] > bestScore )
+                {
+                    bestScore = triangleScore[ t ];
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = std::min( newCount, kCacheSize );
+        std::copy( newCache, newCache + cacheCount, cache );
+    }
+
+    std::copy( output.begin(), output.end(), pIndices );
+}
+
+void optimize_overdraw( uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount, float threshold )
+{
+    const size_t triangleCount = indexCount / 3;
+    if ( triangleCount < 2 )
+        return;
+
+    // Clusters start where a triangle misses the cache with all three vertices.
+    std::vector<size_t> clusterStarts;
+    {
+        std::vector<size_t> missedAt( vertexCount, 0 );
+        size_t misses = 0;
+        for ( size_t t = 0; t < triangleCount; ++t )
+        {
+            size_t triangleMisses = 0;
+            for ( size_t k = 0; k < 3; ++k )
+            {
+                const uint32_t v = pIndices[ t * 3 + k ];
+                if ( missedAt[ v ] == 0 || misses - missedAt[ v ] >= kFifoCacheSize )
+                {
+                    missedAt[ v ] = ++misses;
+                    triangleMisses++;
+                }
+            }
+            if ( triangleMisses == 3 )
+                clusterStarts.push_back( t );
+        }
+    }
+
+    if ( clusterStarts.size() < 2 )
+        return;
+    clusterStarts.push_back( triangleCount );
+
+    struct Cluster
+    {
+        size_t begin;
+        size_t end;
+        float key;
+    };
+
+    std::vector<Cluster> clusters( clusterStarts.size() - 1 );
+    std::vector<math::float3> centroids( clusters.size() );
+    std::vector<math::float3> normals( clusters.size() );
+    math::float3 meshCentroid = { 0.f, 0.f, 0.f };
+    float meshArea = 0.f;
+
+    for ( size_t c = 0; c < clusters.size(); ++c )
+    {
+        clusters[ c ] = { clusterStarts[ c ], clusterStarts[ c + 1 ], 0.f };
+
+        math::float3 centroid = { 0.f, 0.f, 0.f };
+        math::float3 normal = { 0.f, 0.f, 0.f };
+        float area = 0.f;
+        for ( size_t t = clusters[ c ].begin; t < clusters[ c ].end; ++t )
+        {
+            const math::float3 a = position( pVertices[ pIndices[ t * 3 ] ] );
+            const math::float3 b = position( pVertices[ pIndices[ t * 3 + 1 ] ] );
+            const math::float3 cc = position( pVertices[ pIndices[ t * 3 + 2 ] ] );
+            const math::float3 n = math::cross( b - a, cc - a );
+            const float triangleArea = math::length( n );
+
+            centroid = centroid + ( a + b + cc ) * ( triangleArea / 3.f );
+            normal = normal + n;
+            area += triangleArea;
+        }
+
+        meshCentroid = meshCentroid + centroid;
+        meshArea += area;
+        centroids[ c ] = area > 0.f ? centroid * ( 1.f / area ) : centroid;
+        normals[ c ] = normal;
+    }
+
+    if ( meshArea <= 0.f )
+        return;
+    meshCentroid = meshCentroid * ( 1.f / meshArea );
+
+    for ( size_t c = 0; c < clusters.size(); ++c )
+    {
+        const float length = math::length( normals[ c ] );
+        clusters[ c ].key = length > 0.f ? math::dot( centroids[ c ] - meshCentroid, normals[ c ] ) / length : 0.f;
+    }
+
+    std::stable_sort( clusters.begin(), clusters.end(), []( const Cluster& a, const Cluster& b ) { return a.key > b.key; } );
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve( triangleCount * 3 );
+    for ( const Cluster& cluster : clusters )
+        sorted.insert( sorted.end(), pIndices + cluster.begin * 3, pIndices + cluster.end * 3 );
+
+    const float before = analyze_vertex_cache( pIndices, triangleCount * 3, vertexCount ).acmr;
+    const float after = analyze_vertex_cache( sorted.data(), sorted.size(), vertexCount ).acmr;
+    if ( after <= before * threshold )
+        std::copy( sorted.begin(), sorted.end(), pIndices );
+}
+
+void optimize_mesh( MeshData& mesh, float overdrawThreshold )
+{
+    std::vector<MeshSubmesh> ranges = mesh.submeshes;
+    if ( ranges.empty() )
+        ranges.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+
+    // Submeshes are drawn separately, so each is optimized on its own.
+    for ( const MeshSubmesh& range : ranges )
+    {
+        uint32_t* pIndices = mesh.indices.data() + range.indexOffset;
+        optimize_vertex_cache( pIndices, range.indexCount, mesh.vertices.size() );
+        optimize_overdraw( pIndices, range.indexCount, mesh.vertices.data(), mesh.vertices.size(), overdrawThreshold );
+    }
+
+    optimize_vertex_fetch( mesh );
+}
+
+void optimize_vertex_fetch( MeshData& mesh )
+{
+    std::vector<uint32_t> remap( mesh.vertices.size(), kNone );
+    uint32_t next = 0;
+    for ( uint32_t& index : mesh.indices )
+    {
+        if ( remap[ index ] == kNone )
+            remap[ index ] = next++;
+        index = remap[ index ];
+    }
+
+    std::vector<MeshData::Vertex> vertices( next );
+    for ( size_t v = 0; v < mesh.vertices.size(); ++v )
+        if ( remap[ v ] != kNone )
+            vertices[ remap[ v ] ] = mesh.vertices[ v ];
+    mesh.vertices.swap( vertices );
+}
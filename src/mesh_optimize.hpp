@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mesh.hpp"
+
+// Index and vertex reordering that makes a mesh cheaper to draw without
+// changing what it looks like. mesh_tool runs optimize_mesh() on import.
+
+struct VertexCacheStats
+{
+    // Transformed vertices per triangle, 0.5 at best and 3 at worst.
+    float acmr;
+    // Transformed vertices per referenced vertex, 1 at best.
+    float atvr;
+};
+
+// Simulates a FIFO post-transform cache of `cacheSize` entries.
+VertexCacheStats analyze_vertex_cache( const uint32_t* pIndices, size_t indexCount, size_t vertexCount, size_t cacheSize = 16 );
+
+// Bytes pulled through 64 byte lines per byte of referenced vertex data, 1 at best.
+float analyze_vertex_fetch( const uint32_t* pIndices, size_t indexCount, size_t vertexCount, size_t vertexSize );
+
+// Reorders triangles for a post-transform vertex cache, after Forsyth's
+// "Linear-Speed Vertex Cache Optimisation". Works in place.
+void optimize_vertex_cache( uint32_t* pIndices, size_t indexCount, size_t vertexCount );
+
+// Splits cache optimized triangles into clusters where the cache restarts and
+// draws the clusters facing outwards first, so they occlude the rest. Keeps
+// the cluster order only if the ACMR grows by at most `threshold` times.
+void optimize_overdraw( uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount, float threshold );
+
+// Renumbers the vertices in the order the indices first use them, dropping
+// vertices no triangle refers to. Leaves the triangle order alone.
+void optimize_vertex_fetch( MeshData& mesh );
+
+// Runs optimize_vertex_cache() and optimize_overdraw() on every submesh, then
+// optimize_vertex_fetch().
+void optimize_mesh( MeshData& mesh, float overdrawThreshold = 1.05f );
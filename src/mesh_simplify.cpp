@@ -0,0 +1,324 @@
+#include "mesh_simplify.hpp"
+#include "mesh_optimize.hpp"
+#include "math_types.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+
+// Squared distance to a set of planes as p^T A p + 2 b.p + c, summed with area
+// weights. The total weight turns the sum back into a mean squared distance.
+struct Quadric
+{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+Quadric plane_quadric( const math::float3& n, float d, float weight )
+{
+    const double w = weight;
+    return { w * n.x * n.x, w * n.x * n.y, w * n.x * n.z, w * n.y * n.y, w * n.y * n.z, w * n.z * n.z,
+             w * n.x * d, w * n.y * d, w * n.z * d,
+             w * d * d,
+             w };
+}
+
+void add( Quadric& q, const Quadric& r )
+{
+    q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02;
+    q.a11 += r.a11; q.a12 += r.a12; q.a22 += r.a22;
+    q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+    q.c += r.c;
+    q.weight += r.weight;
+}
+
+float quadric_error( const Quadric& q, const math::float3& p )
+{
+    if ( q.weight <= 0.0 )
+        return 0.f;
+
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+                   + 2.0 * ( q.a01 * x * y + q.a02 * x * z + q.a12 * y * z )
+                   + 2.0 * ( q.b0 * x + q.b1 * y + q.b2 * z )
+                   + q.c;
+    return static_cast<float>( std::sqrt( std::max( e, 0.0 ) / q.weight ) );
+}
+
+struct Collapse
+{
+    uint32_t from;
+    // The end point as the triangle with the edge names it, which picks the right side of a seam.
+    uint32_t to;
+    float error;
+};
+
+math::float3 position( const MeshData::Vertex& v )
+{
+    return { v.position[0], v.position[1], v.position[2] };
+}
+
+// Maps every vertex to the lowest numbered vertex at the same position.
+std::vector<uint32_t> weld_positions( const MeshData::Vertex* pVertices, size_t vertexCount )
+{
+    std::vector<uint32_t> order( vertexCount );
+    std::iota( order.begin(), order.end(), 0u );
+    auto less = [pVertices]( uint32_t a, uint32_t b ) {
+        const float* pa = pVertices[ a ].position;
+        const float* pb = pVertices[ b ].position;
+        return std::lexicographical_compare( pa, pa + 3, pb, pb + 3 );
+    };
+    std::stable_sort( order.begin(), order.end(), less );
+
+    std::vector<uint32_t> canonical( vertexCount );
+    for ( size_t i = 0; i < vertexCount; )
+    {
+        size_t end = i + 1;
+        while ( end < vertexCount && !less( order[ i ], order[ end ] ) )
+            end++;
+        for ( size_t k = i; k < end; ++k )
+            canonical[ order[ k ] ] = order[ i ];
+        i = end;
+    }
+    return canonical;
+}
+
+// Whether moving `from` onto `to` turns a remaining triangle around `from` over, or nearly: tilting
+// one by more than about 75 degrees tends to fold it onto its neighbours.
+bool flips( const Collapse& collapse, const uint32_t* pIndices, const uint32_t* pFan, size_t fanSize,
+            const MeshData::Vertex* pVertices, const uint32_t* pCanonical )
+{
+    const math::float3 target = position( pVertices[ collapse.to ] );
+    for ( size_t i = 0; i < fanSize; ++i )
+    {
+        const uint32_t* pTriangle = pIndices + pFan[ i ] * 3;
+        math::float3 before[3];
+        math::float3 after[3];
+        bool removed = false;
+        for ( int k = 0; k < 3; ++k )
+        {
+            removed |= pCanonical[ pTriangle[ k ] ] == pCanonical[ collapse.to ];
+            before[ k ] = position( pVertices[ pTriangle[ k ] ] );
+            after[ k ] = pTriangle[ k ] == collapse.from ? target : before[ k ];
+        }
+        if ( removed )
+            continue;
+
+        const math::float3 n0 = math::cross( before[1] - before[0], before[2] - before[0] );
+        const math::float3 n1 = math::cross( after[1] - after[0], after[2] - after[0] );
+        if ( math::dot( n0, n1 ) <= 0.25f * math::length( n0 ) * math::length( n1 ) )
+            return true;
+    }
+    return false;
+}
+
+}
+
+float simplify_mesh( const uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount,
+                     size_t targetIndexCount, float maxError, std::vector<uint32_t>& simplified )
+{
+    simplified.assign( pIndices, pIndices + indexCount / 3 * 3 );
+    if ( simplified.size() <= targetIndexCount )
+        return 0.f;
+
+    const std::vector<uint32_t> canonical = weld_positions( pVertices, vertexCount );
+
+    // Positions shared by several referenced vertices are seams, positions on an edge that does not have
+    // exactly two triangles are borders. Neither may move, or holes and smeared attributes appear.
+    std::vector<uint8_t> lockedPosition( vertexCount, 0 );
+    {
+        std::vector<uint32_t> firstUser( vertexCount, ~0u );
+        for ( uint32_t index : simplified )
+        {
+            uint32_t& user = firstUser[ canonical[ index ] ];
+            if ( user != ~0u && user != index )
+                lockedPosition[ canonical[ index ] ] = 1;
+            user = index;
+        }
+
+        std::vector<uint64_t> edges;
+        edges.reserve( simplified.size() );
+        for ( size_t i = 0; i < simplified.size(); i += 3 )
+        {
+            for ( int k = 0; k < 3; ++k )
+            {
+                const uint32_t a = canonical[ simplified[ i + k ] ];
+                const uint32_t b = canonical[ simplified[ i + ( k + 1 ) % 3 ] ];
+                edges.push_back( uint64_t( std::min( a, b ) ) << 32 | std::max( a, b ) );
+            }
+        }
+        std::sort( edges.begin(), edges.end() );
+        for ( size_t i = 0; i < edges.size(); )
+        {
+            size_t end = i + 1;
+            while ( end < edges.size() && edges[ end ] == edges[ i ] )
+                end++;
+            if ( end - i != 2 )
+            {
+                lockedPosition[ edges[ i ] >> 32 ] = 1;
+                lockedPosition[ edges[ i ] & 0xffffffffu ] = 1;
+            }
+            i = end;
+        }
+    }
+
+    std::vector<Quadric> quadrics( vertexCount, Quadric{} );
+    for ( size_t i = 0; i < simplified.size(); i += 3 )
+    {
+        const math::float3 a = position( pVertices[ simplified[ i + 0 ] ] );
+        const math::float3 b = position( pVertices[ simplified[ i + 1 ] ] );
+        const math::float3 c = position( pVertices[ simplified[ i + 2 ] ] );
+        const math::float3 n = math::cross( b - a, c - a );
+        const float length = math::length( n );
+        if ( length == 0.f )
+            continue;
+
+        const math::float3 normal = n * ( 1.f / length );
+        const Quadric q = plane_quadric( normal, -math::dot( normal, a ), length * 0.5f );
+        for ( int k = 0; k < 3; ++k )
+            add( quadrics[ canonical[ simplified[ i + k ] ] ], q );
+    }
+
+    // Each pass collapses the cheapest edges whose neighbourhoods do not overlap, so the flip test of one
+    // collapse never sees triangles another collapse of the same pass changed.
+    float resultError = 0.f;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap( vertexCount );
+    std::vector<uint8_t> touched( vertexCount );
+    std::vector<uint32_t> fanOffsets( vertexCount + 1 );
+    std::vector<uint32_t> fans;
+    while ( simplified.size() > targetIndexCount )
+    {
+        const size_t triangleCount = simplified.size() / 3;
+
+        std::fill( fanOffsets.begin(), fanOffsets.end(), 0u );
+        for ( uint32_t index : simplified )
+            fanOffsets[ index + 1 ]++;
+        for ( size_t v = 0; v < vertexCount; ++v )
+            fanOffsets[ v + 1 ] += fanOffsets[ v ];
+        fans.resize( simplified.size() );
+        {
+            std::vector<uint32_t> fill( fanOffsets.begin(), fanOffsets.end() - 1 );
+            for ( size_t i = 0; i < simplified.size(); ++i )
+                fans[ fill[ simplified[ i ] ]++ ] = static_cast<uint32_t>( i / 3 );
+        }
+
+        // An edge with both triangles is walked once each way, which covers both directions of collapse.
+        // Edges with fewer have locked end points.
+        collapses.clear();
+        for ( size_t i = 0; i < simplified.size(); i += 3 )
+        {
+            for ( int k = 0; k < 3; ++k )
+            {
+                const uint32_t a = simplified[ i + k ];
+                const uint32_t b = simplified[ i + ( k + 1 ) % 3 ];
+                if ( !lockedPosition[ canonical[ a ] ] )
+                    collapses.push_back( { a, b, quadric_error( quadrics[ canonical[ a ] ], position( pVertices[ b ] ) ) } );
+            }
+        }
+        std::sort( collapses.begin(), collapses.end(), []( const Collapse& x, const Collapse& y ) {
+            return x.error != y.error ? x.error < y.error : ( x.from != y.from ? x.from < y.from : x.to < y.to );
+        } );
+
+        // An interior collapse removes two triangles.
+        const size_t wanted = ( triangleCount - targetIndexCount / 3 + 1 ) / 2;
+        size_t collapsed = 0;
+        std::iota( remap.begin(), remap.end(), 0u );
+        std::fill( touched.begin(), touched.end(), 0 );
+        for ( const Collapse& collapse : collapses )
+        {
+            if ( collapsed == wanted || collapse.error > maxError )
+                break;
+            if ( touched[ collapse.from ] || touched[ collapse.to ] )
+                continue;
+
+            const uint32_t* pFan = fans.data() + fanOffsets[ collapse.from ];
+            const size_t fanSize = fanOffsets[ collapse.from + 1 ] - fanOffsets[ collapse.from ];
+            if ( flips( collapse, simplified.data(), pFan, fanSize, pVertices, canonical.data() ) )
+                continue;
+
+            remap[ collapse.from ] = collapse.to;
+            add( quadrics[ canonical[ collapse.to ] ], quadrics[ canonical[ collapse.from ] ] );
+            resultError = std::max( resultError, collapse.error );
+            collapsed++;
+
+            for ( size_t i = 0; i < fanSize; ++i )
+                for ( int k = 0; k < 3; ++k )
+                    touched[ simplified[ pFan[ i ] * 3 + k ] ] = 1;
+        }
+
+        if ( collapsed == 0 )
+            break;
+
+        size_t written = 0;
+        for ( size_t i = 0; i < simplified.size(); i += 3 )
+        {
+            const uint32_t a = remap[ simplified[ i + 0 ] ];
+            const uint32_t b = remap[ simplified[ i + 1 ] ];
+            const uint32_t c = remap[ simplified[ i + 2 ] ];
+            if ( canonical[ a ] == canonical[ b ] || canonical[ b ] == canonical[ c ] || canonical[ c ] == canonical[ a ] )
+                continue;
+
+            simplified[ written++ ] = a;
+            simplified[ written++ ] = b;
+            simplified[ written++ ] = c;
+        }
+        simplified.resize( written );
+    }
+
+    return resultError;
+}
+
+void build_lods( MeshData& mesh, size_t maxLods, float maxRelativeError )
+{
+    if ( mesh.submeshes.empty() )
+        mesh.submeshes.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+
+    // Level 0 is every index the submeshes cover.
+    uint32_t begin = UINT32_MAX;
+    uint32_t end = 0;
+    for ( const MeshSubmesh& submesh : mesh.submeshes )
+    {
+        begin = std::min( begin, submesh.indexOffset );
+        end = std::max( end, submesh.indexOffset + submesh.indexCount );
+    }
+
+    mesh.lods.clear();
+    mesh.lods.push_back( { begin, end - begin, 0, 0, 0.f, 0 } );
+
+    float radius = 0.f;
+    for ( const MeshData::Vertex& v : mesh.vertices )
+        radius = std::max( radius, math::length( position( v ) ) );
+
+    // Every level is simplified from level 0, so its error is measured against the original surface.
+    const std::vector<uint32_t> source( mesh.indices.begin() + begin, mesh.indices.begin() + end );
+    std::vector<uint32_t> simplified;
+    float error = 0.f;
+    for ( size_t level = 1; level < maxLods; ++level )
+    {
+        const size_t target = ( source.size() / 3 >> level ) * 3;
+        error = std::max( error, simplify_mesh( source.data(), source.size(), mesh.vertices.data(), mesh.vertices.size(),
+                                                target, maxRelativeError * radius, simplified ) );
+
+        // A level that saves less than a quarter of the triangles is not worth switching to.
+        const MeshLod& previous = mesh.lods.back();
+        if ( simplified.empty() || simplified.size() * 4 > size_t( previous.indexCount ) * 3 )
+            break;
+
+        optimize_vertex_cache( simplified.data(), simplified.size(), mesh.vertices.size() );
+        mesh.lods.push_back( { static_cast<uint32_t>( mesh.indices.size() ), static_cast<uint32_t>( simplified.size() ), 0, 0, error, 0 } );
+        mesh.indices.insert( mesh.indices.end(), simplified.begin(), simplified.end() );
+    }
+}
+
+size_t select_lod( const MeshLod* pLods, size_t lodCount, float toScreen, float maxScreenError )
+{
+    size_t lod = 0;
+    while ( lod + 1 < lodCount && pLods[ lod + 1 ].error * toScreen <= maxScreenError )
+        lod++;
+    return lod;
+}
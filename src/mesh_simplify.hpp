@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Quadric error simplification, after Garland and Heckbert's "Surface
+// Simplification Using Quadric Error Metrics". Edges collapse onto one of their
+// end points, so a simplified mesh indexes the original vertices and every
+// level of detail shares one vertex buffer. Vertices on open borders and on
+// attribute seams (several vertices at one position) never move.
+
+// Simplifies the triangles pIndices[ 0, indexCount ) towards targetIndexCount
+// indices, without collapses that move the surface by more than maxError (in
+// mesh units). Writes the result to `simplified` and returns the largest error
+// of the collapses made.
+float simplify_mesh( const uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount,
+                     size_t targetIndexCount, float maxError, std::vector<uint32_t>& simplified );
+
+// Appends up to maxLods - 1 levels, each with about half the triangles of the
+// one before, after the submeshes, which become level 0. Stops early once the
+// simplifier cannot reduce much further or would exceed maxRelativeError times
+// the mesh's radius. Fills mesh.lods.
+void build_lods( MeshData& mesh, size_t maxLods = kMeshMaxLods, float maxRelativeError = 0.1f );
+
+// The coarsest level whose error, times toScreen (the screen size of one mesh
+// unit where the mesh is seen), is at most maxScreenError. Errors grow with
+// the level; level 0 is always taken when no other qualifies.
+size_t select_lod( const MeshLod* pLods, size_t lodCount, float toScreen, float maxScreenError );
@@ -0,0 +1,307 @@
+#include "meshlet.hpp"
+#include "math_types.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+
+math::float3 position( const MeshData::Vertex& v )
+{
+    return { v.position[0], v.position[1], v.position[2] };
+}
+
+// Bounds of the meshlet's triangles, which the caller already placed at pIndices.
+Meshlet make_meshlet( const uint32_t* pIndices, uint32_t indexOffset, uint32_t triangleCount, uint32_t vertexCount,
+                      const MeshData::Vertex* pVertices )
+{
+    Meshlet meshlet = {};
+    meshlet.indexOffset = indexOffset;
+    meshlet.triangleCount = triangleCount;
+    meshlet.vertexCount = vertexCount;
+
+    // Sphere around the box center, looser than a minimal sphere but cheap and stable.
+    math::float3 boundsMin = position( pVertices[ pIndices[0] ] );
+    math::float3 boundsMax = boundsMin;
+    for ( uint32_t i = 1; i < triangleCount * 3; ++i )
+    {
+        const math::float3 p = position( pVertices[ pIndices[ i ] ] );
+        boundsMin = { std::min( boundsMin.x, p.x ), std::min( boundsMin.y, p.y ), std::min( boundsMin.z, p.z ) };
+        boundsMax = { std::max( boundsMax.x, p.x ), std::max( boundsMax.y, p.y ), std::max( boundsMax.z, p.z ) };
+    }
+    const math::float3 center = ( boundsMin + boundsMax ) * 0.5f;
+    float radius = 0.f;
+    for ( uint32_t i = 0; i < triangleCount * 3; ++i )
+        radius = std::max( radius, math::length( position( pVertices[ pIndices[ i ] ] ) - center ) );
+
+    meshlet.center[0] = center.x;
+    meshlet.center[1] = center.y;
+    meshlet.center[2] = center.z;
+    meshlet.radius = radius;
+
+    // The cone axis is the average of the unit face normals, its width the normal furthest from it.
+    // Faces are recomputed from the positions, vertex normals may be smoothed across edges.
+    math::float3 normals[ kMeshletMaxTriangles ];
+    uint32_t normalCount = 0;
+    math::float3 axis = { 0.f, 0.f, 0.f };
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+    {
+        const math::float3 a = position( pVertices[ pIndices[ t * 3 + 0 ] ] );
+        const math::float3 b = position( pVertices[ pIndices[ t * 3 + 1 ] ] );
+        const math::float3 c = position( pVertices[ pIndices[ t * 3 + 2 ] ] );
+        const math::float3 n = math::cross( b - a, c - a );
+        const float length = math::length( n );
+        if ( length == 0.f )
+            continue;
+
+        normals[ normalCount ] = n * ( 1.f / length );
+        axis = axis + normals[ normalCount ];
+        normalCount++;
+    }
+
+    const float axisLength = math::length( axis );
+    float minDot = 0.f;
+    if ( normalCount > 0 && axisLength > 1e-6f )
+    {
+        axis = axis * ( 1.f / axisLength );
+        minDot = 1.f;
+        for ( uint32_t i = 0; i < normalCount; ++i )
+            minDot = std::min( minDot, math::dot( normals[ i ], axis ) );
+    }
+
+    // A cone of 90 degrees or wider always has a face turned towards the eye.
+    if ( minDot <= 0.f )
+    {
+        meshlet.coneCutoff = 1.f;
+        return meshlet;
+    }
+
+    meshlet.coneAxis[0] = axis.x;
+    meshlet.coneAxis[1] = axis.y;
+    meshlet.coneAxis[2] = axis.z;
+    meshlet.coneCutoff = std::sqrt( 1.f - minDot * minDot );
+    return meshlet;
+}
+
+// Position of the cone axis along a Morton curve over its octahedral map, so
+// meshlets facing similar ways get similar keys. Meshlets without a cone go last.
+uint32_t facing_key( const Meshlet& meshlet )
+{
+    if ( meshlet.coneCutoff >= 1.f )
+        return UINT32_MAX;
+
+    const float* a = meshlet.coneAxis;
+    const float l1 = std::fabs( a[0] ) + std::fabs( a[1] ) + std::fabs( a[2] );
+    float u = a[0] / l1;
+    float v = a[1] / l1;
+    if ( a[2] < 0.f )
+    {
+        const float fu = ( 1.f - std::fabs( v ) ) * ( u >= 0.f ? 1.f : -1.f );
+        const float fv = ( 1.f - std::fabs( u ) ) * ( v >= 0.f ? 1.f : -1.f );
+        u = fu;
+        v = fv;
+    }
+
+    const uint32_t x = static_cast<uint32_t>( std::clamp( u * 0.5f + 0.5f, 0.f, 1.f ) * 255.f + 0.5f );
+    const uint32_t y = static_cast<uint32_t>( std::clamp( v * 0.5f + 0.5f, 0.f, 1.f ) * 255.f + 0.5f );
+    uint32_t key = 0;
+    for ( uint32_t bit = 0; bit < 8; ++bit )
+        key |= ( ( x >> bit ) & 1u ) << ( bit * 2 ) | ( ( y >> bit ) & 1u ) << ( bit * 2 + 1 );
+    return key;
+}
+
+}
+
+void build_meshlets( uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount,
+                     uint32_t baseIndex, std::vector<Meshlet>& meshlets )
+{
+    const uint32_t triangleCount = static_cast<uint32_t>( indexCount / 3 );
+
+    // Triangles around each vertex, as offsets into one array.
+    std::vector<uint32_t> adjacencyOffsets( vertexCount + 1, 0 );
+    for ( size_t i = 0; i < size_t( triangleCount ) * 3; ++i )
+        adjacencyOffsets[ pIndices[ i ] + 1 ]++;
+    for ( size_t v = 0; v < vertexCount; ++v )
+        adjacencyOffsets[ v + 1 ] += adjacencyOffsets[ v ];
+    std::vector<uint32_t> adjacency( adjacencyOffsets.back() );
+    {
+        std::vector<uint32_t> fill( adjacencyOffsets.begin(), adjacencyOffsets.end() - 1 );
+        for ( uint32_t t = 0; t < triangleCount; ++t )
+            for ( int k = 0; k < 3; ++k )
+                adjacency[ fill[ pIndices[ t * 3 + k ] ]++ ] = t;
+    }
+
+    std::vector<math::float3> faceNormals( triangleCount );
+    for ( uint32_t t = 0; t < triangleCount; ++t )
+    {
+        const math::float3 a = position( pVertices[ pIndices[ t * 3 + 0 ] ] );
+        const math::float3 n = math::cross( position( pVertices[ pIndices[ t * 3 + 1 ] ] ) - a,
+                                            position( pVertices[ pIndices[ t * 3 + 2 ] ] ) - a );
+        const float length = math::length( n );
+        faceNormals[ t ] = length > 0.f ? n * ( 1.f / length ) : math::float3{ 0.f, 0.f, 0.f };
+    }
+
+    // Grows each meshlet from its first triangle through shared vertices, preferring triangles that add
+    // the fewest vertices and then those facing the way the meshlet does, so the normal cones stay narrow.
+    std::vector<bool> emitted( triangleCount, false );
+    std::vector<uint32_t> order;
+    order.reserve( triangleCount );
+    std::vector<uint32_t> candidates;
+    // Triangles and distinct vertices of each meshlet, in order.
+    std::vector<std::pair<uint32_t, uint32_t>> counts;
+    // Meshlet each vertex was last added to.
+    std::vector<uint32_t> vertexMeshlet( vertexCount, ~0u );
+    uint32_t seed = 0;
+
+    while ( order.size() < triangleCount )
+    {
+        while ( emitted[ seed ] )
+            seed++;
+
+        const uint32_t first = static_cast<uint32_t>( order.size() );
+        const uint32_t meshlet = static_cast<uint32_t>( counts.size() );
+        uint32_t uniqueCount = 0;
+        math::float3 normalSum = { 0.f, 0.f, 0.f };
+        candidates.assign( 1, seed );
+
+        while ( order.size() - first < kMeshletMaxTriangles )
+        {
+            uint32_t best = ~0u;
+            uint32_t bestNew = 4;
+            float bestFacing = -INFINITY;
+            for ( uint32_t t : candidates )
+            {
+                if ( emitted[ t ] )
+                    continue;
+
+                uint32_t added = 0;
+                for ( int k = 0; k < 3; ++k )
+                    added += vertexMeshlet[ pIndices[ t * 3 + k ] ] != meshlet;
+                const float facing = math::dot( faceNormals[ t ], normalSum );
+                if ( added < bestNew || ( added == bestNew && facing > bestFacing ) )
+                {
+                    best = t;
+                    bestNew = added;
+                    bestFacing = facing;
+                }
+            }
+
+            if ( best == ~0u || uniqueCount + bestNew > kMeshletMaxVertices )
+                break;
+
+            emitted[ best ] = true;
+            order.push_back( best );
+            normalSum = normalSum + faceNormals[ best ];
+            for ( int k = 0; k < 3; ++k )
+            {
+                const uint32_t v = pIndices[ best * 3 + k ];
+                if ( vertexMeshlet[ v ] == meshlet )
+                    continue;
+
+                vertexMeshlet[ v ] = meshlet;
+                uniqueCount++;
+                for ( uint32_t a = adjacencyOffsets[ v ]; a < adjacencyOffsets[ v + 1 ]; ++a )
+                    if ( !emitted[ adjacency[ a ] ] )
+                        candidates.push_back( adjacency[ a ] );
+            }
+
+            // Triangles already taken only cost time in the scan.
+            candidates.erase( std::remove_if( candidates.begin(), candidates.end(), [&emitted]( uint32_t t ) { return emitted[ t ]; } ),
+                              candidates.end() );
+        }
+
+        counts.push_back( { static_cast<uint32_t>( order.size() ) - first, uniqueCount } );
+    }
+
+    std::vector<uint32_t> reordered( size_t( triangleCount ) * 3 );
+    for ( uint32_t i = 0; i < triangleCount; ++i )
+        for ( int k = 0; k < 3; ++k )
+            reordered[ i * 3 + k ] = pIndices[ order[ i ] * 3 + k ];
+    std::copy( reordered.begin(), reordered.end(), pIndices );
+
+    uint32_t first = 0;
+    for ( const std::pair<uint32_t, uint32_t>& count : counts )
+    {
+        meshlets.push_back( make_meshlet( pIndices + first * 3, baseIndex + first * 3, count.first, count.second, pVertices ) );
+        first += count.first;
+    }
+}
+
+void build_meshlets( MeshData& mesh )
+{
+    std::vector<MeshSubmesh> ranges = mesh.submeshes;
+    if ( ranges.empty() )
+        ranges.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+
+    mesh.meshlets.clear();
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> indices;
+    for ( const MeshSubmesh& range : ranges )
+    {
+        uint32_t* pIndices = mesh.indices.data() + range.indexOffset;
+        meshlets.clear();
+        build_meshlets( pIndices, range.indexCount, mesh.vertices.data(), mesh.vertices.size(), range.indexOffset, meshlets );
+
+        // Facing the same way, meshlets tend to be culled together, and neighbours in the index buffer merge into one draw.
+        std::stable_sort( meshlets.begin(), meshlets.end(), []( const Meshlet& a, const Meshlet& b ) {
+            return facing_key( a ) < facing_key( b );
+        } );
+
+        indices.clear();
+        for ( Meshlet& meshlet : meshlets )
+        {
+            const uint32_t* pFirst = mesh.indices.data() + meshlet.indexOffset;
+            meshlet.indexOffset = range.indexOffset + static_cast<uint32_t>( indices.size() );
+            indices.insert( indices.end(), pFirst, pFirst + meshlet.triangleCount * 3 );
+        }
+        std::copy( indices.begin(), indices.end(), pIndices );
+        mesh.meshlets.insert( mesh.meshlets.end(), meshlets.begin(), meshlets.end() );
+    }
+
+    // Only level 0 gets meshlets; coarser levels are small enough to draw whole.
+    if ( !mesh.lods.empty() )
+    {
+        mesh.lods[0].meshletOffset = 0;
+        mesh.lods[0].meshletCount = static_cast<uint32_t>( mesh.meshlets.size() );
+    }
+}
+
+bool meshlet_visible( const Meshlet& meshlet, const Frustum& frustum, const math::float3& eye )
+{
+    const math::float3 center = { meshlet.center[0], meshlet.center[1], meshlet.center[2] };
+    if ( !sphere_visible( frustum, center, meshlet.radius ) )
+        return false;
+
+    // Every face is turned away when, for each point p of the meshlet, the direction from the eye to p
+    // is within 90 degrees minus the cone's half angle of the axis: dot( p - eye, axis ) >= cutoff * length( p - eye ).
+    // Over the bounding sphere the left side is at least dot( center - eye, axis ) - radius and the
+    // right side at most cutoff * ( length( center - eye ) + radius ), so comparing those is conservative.
+    const math::float3 axis = { meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2] };
+    const math::float3 toCenter = center - eye;
+    return math::dot( toCenter, axis ) - meshlet.radius < meshlet.coneCutoff * ( math::length( toCenter ) + meshlet.radius );
+}
+
+size_t cull_meshlets( const Meshlet* pMeshlets, size_t count, const Frustum& frustum, const math::float3& eye,
+                      size_t mergeGap, std::vector<MeshletRange>& ranges )
+{
+    const size_t firstRange = ranges.size();
+    size_t lastVisible = 0;
+    size_t visible = 0;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const Meshlet& meshlet = pMeshlets[ i ];
+        if ( !meshlet_visible( meshlet, frustum, eye ) )
+            continue;
+
+        const uint32_t end = meshlet.indexOffset + meshlet.triangleCount * 3;
+        if ( ranges.size() > firstRange && i - lastVisible - 1 <= mergeGap )
+            ranges.back().indexCount = end - ranges.back().indexOffset;
+        else
+            ranges.push_back( { meshlet.indexOffset, end - meshlet.indexOffset } );
+
+        lastVisible = i;
+        visible++;
+    }
+    return visible;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "culling.hpp"
+#include "mesh.hpp"
+
+// Meshlets let dense meshes be culled below the granularity of a draw. Each one
+// is a run of consecutive triangles in the index buffer, so whatever survives
+// culling is drawn straight out of the buffer the renderer already uploaded.
+// mesh_tool builds them as the last step before writing a mesh.
+
+constexpr uint32_t kMeshletMaxVertices = 64;
+constexpr uint32_t kMeshletMaxTriangles = 124;
+
+// Groups the triangles in pIndices[ 0, indexCount ) into meshlets of connected,
+// similarly facing triangles, reorders them in place so every meshlet is one
+// run, and appends the meshlets with index offsets relative to pIndices plus
+// baseIndex. Meshlets are started in the existing triangle order, which keeps
+// most of a cache optimized order intact.
+void build_meshlets( uint32_t* pIndices, size_t indexCount, const MeshData::Vertex* pVertices, size_t vertexCount,
+                     uint32_t baseIndex, std::vector<Meshlet>& meshlets );
+
+// Rebuilds mesh.meshlets over the submeshes, without letting a meshlet cross
+// one, and points level 0 of mesh.lods at them.
+void build_meshlets( MeshData& mesh );
+
+struct MeshletRange
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+};
+
+// False when the meshlet is outside the frustum or all of its triangles face
+// away from the eye. Both are in mesh space.
+bool meshlet_visible( const Meshlet& meshlet, const Frustum& frustum, const math::float3& eye );
+
+// Appends the index ranges of the visible meshlets to `ranges`. Meshlets must
+// be in index order; visible ones separated by at most `mergeGap` culled ones
+// share a range, trading the culled triangles for fewer draws. Returns how
+// many meshlets were visible.
+size_t cull_meshlets( const Meshlet* pMeshlets, size_t count, const Frustum& frustum, const math::float3& eye,
+                      size_t mergeGap, std::vector<MeshletRange>& ranges );
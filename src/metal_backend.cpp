@@ -0,0 +1,350 @@
+#include "metal_backend.hpp"
+#include "shader_cache.hpp"
+#include "utility.hpp"
+#include <cassert>
+#include <dispatch/dispatch.h>
+
+namespace gpu
+{
+
+namespace
+{
+
+MTL::PixelFormat to_metal( PixelFormat format )
+{
+    switch ( format )
+    {
+        case PixelFormat::BGRA8Unorm_sRGB: return MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB;
+        case PixelFormat::Depth16Unorm:    return MTL::PixelFormat::PixelFormatDepth16Unorm;
+        case PixelFormat::Depth32Float:    return MTL::PixelFormat::PixelFormatDepth32Float;
+        case PixelFormat::Invalid:         break;
+    }
+    return MTL::PixelFormat::PixelFormatInvalid;
+}
+
+MTL::CompareFunction to_metal( CompareFunction compare )
+{
+    // Declared in the same order as MTL::CompareFunction.
+    return static_cast<MTL::CompareFunction>( compare );
+}
+
+MTL::CullMode to_metal( CullMode mode )
+{
+    switch ( mode )
+    {
+        case CullMode::None:  return MTL::CullModeNone;
+        case CullMode::Front: return MTL::CullModeFront;
+        case CullMode::Back:  return MTL::CullModeBack;
+    }
+    return MTL::CullModeNone;
+}
+
+class MetalBuffer : public Buffer
+{
+    public:
+        explicit MetalBuffer( MTL::Buffer* pBuffer ) : p_buffer( pBuffer ) { }
+        ~MetalBuffer() override { p_buffer->release(); }
+
+        void* contents() override { return p_buffer->contents(); }
+        size_t length() const override { return p_buffer->length(); }
+        void did_modify_range( size_t offset, size_t size ) override { p_buffer->didModifyRange( NS::Range::Make( offset, size ) ); }
+
+        MTL::Buffer* p_buffer;
+};
+
+class MetalPipeline : public Pipeline
+{
+    public:
+        explicit MetalPipeline( MTL::RenderPipelineState* pState ) : p_state( pState ) { }
+        ~MetalPipeline() override { p_state->release(); }
+
+        MTL::RenderPipelineState* p_state;
+};
+
+class MetalDepthStencilState : public DepthStencilState
+{
+    public:
+        explicit MetalDepthStencilState( MTL::DepthStencilState* pState ) : p_state( pState ) { }
+        ~MetalDepthStencilState() override { p_state->release(); }
+
+        MTL::DepthStencilState* p_state;
+};
+
+class MetalFence : public Fence
+{
+    public:
+        explicit MetalFence( size_t count ) : m_semaphore( dispatch_semaphore_create( count ) ) { }
+        ~MetalFence() override { dispatch_release( m_semaphore ); }
+
+        void wait() override { dispatch_semaphore_wait( m_semaphore, DISPATCH_TIME_FOREVER ); }
+        void signal() override { dispatch_semaphore_signal( m_semaphore ); }
+
+    private:
+        dispatch_semaphore_t m_semaphore;
+};
+
+// Wraps one MTL::CommandBuffer and its current render encoder, deletes itself on commit.
+class MetalCommandBuffer final : public CommandBuffer, public RenderEncoder
+{
+    public:
+        explicit MetalCommandBuffer( MTL::CommandBuffer* pCmd )
+            : p_cmd( pCmd->retain() )
+            , p_enc( nullptr )
+        { }
+
+        RenderEncoder* render_pass( Target& target ) override
+        {
+            MTK::View* pView = static_cast<MetalViewTarget&>( target ).view();
+            p_enc = p_cmd->renderCommandEncoder( pView->currentRenderPassDescriptor() );
+            return this;
+        }
+
+        void add_completed_handler( std::function<void()> handler ) override
+        {
+            p_cmd->addCompletedHandler( [handler]( MTL::CommandBuffer* ) { handler(); } );
+        }
+
+        void present( Target& target ) override
+        {
+            p_cmd->presentDrawable( static_cast<MetalViewTarget&>( target ).view()->currentDrawable() );
+        }
+
+        void commit() override
+        {
+            p_cmd->commit();
+            p_cmd->release();
+            delete this;
+        }
+
+        void set_pipeline( Pipeline* pPipeline ) override
+        {
+            p_enc->setRenderPipelineState( static_cast<MetalPipeline*>( pPipeline )->p_state );
+        }
+
+        void set_depth_stencil_state( DepthStencilState* pState ) override
+        {
+            p_enc->setDepthStencilState( static_cast<MetalDepthStencilState*>( pState )->p_state );
+        }
+
+        void set_vertex_buffer( Buffer* pBuffer, size_t offset, size_t index ) override
+        {
+            p_enc->setVertexBuffer( static_cast<MetalBuffer*>( pBuffer )->p_buffer, offset, index );
+        }
+
+        void set_cull_mode( CullMode mode ) override
+        {
+            p_enc->setCullMode( to_metal( mode ) );
+        }
+
+        void set_front_facing_winding( Winding winding ) override
+        {
+            p_enc->setFrontFacingWinding( winding == Winding::Clockwise ? MTL::Winding::WindingClockwise : MTL::Winding::WindingCounterClockwise );
+        }
+
+        void draw_indexed( size_t indexCount, IndexType indexType, Buffer* pIndexBuffer, size_t indexOffset, size_t instanceCount ) override
+        {
+            p_enc->drawIndexedPrimitives( MTL::PrimitiveType::PrimitiveTypeTriangle,
+                                          indexCount,
+                                          indexType == IndexType::UInt16 ? MTL::IndexType::IndexTypeUInt16 : MTL::IndexType::IndexTypeUInt32,
+                                          static_cast<MetalBuffer*>( pIndexBuffer )->p_buffer,
+                                          indexOffset,
+                                          instanceCount );
+        }
+
+        void end_encoding() override
+        {
+            p_enc->endEncoding();
+            p_enc = nullptr;
+        }
+
+    private:
+        MTL::CommandBuffer* p_cmd;
+        MTL::RenderCommandEncoder* p_enc;
+};
+
+}
+
+MetalDevice::MetalDevice( MTL::Device* pDevice )
+    : p_device( pDevice->retain() )
+    , p_cmdQ( p_device->newCommandQueue() )
+    , p_shaderLibrary( nullptr )
+{ }
+
+MetalDevice::~MetalDevice()
+{
+    if ( p_shaderLibrary )
+        p_shaderLibrary->release();
+
+    p_cmdQ->release();
+    p_device->release();
+}
+
+bool MetalDevice::load_program( const char* sourcePath, const char* const* functionNames, size_t functionCount,
+                                const ShaderMacro* pMacros, size_t macroCount )
+{
+    using NS::StringEncoding::UTF8StringEncoding;
+
+    // The source is only needed until the library exists, so compile straight from the mapping.
+    MappedFile shaderSrc( sourcePath );
+    if ( !shaderSrc.is_open() )
+    {
+        __builtin_printf("Failed to open shader source: %s \n\n", sourcePath);
+        return false;
+    }
+
+    // Spelled like the offline compile's command line, which keys the build time cache entry.
+    std::string options;
+    for ( size_t i = 0; i < macroCount; ++i )
+    {
+        if ( i > 0 )
+            options += ' ';
+        options += "-D";
+        options += pMacros[i].name;
+        options += '=';
+        options += pMacros[i].value;
+    }
+
+    NS::Error* pError {nullptr};
+    MTL::Library* pLibrary = nullptr;
+
+    // Prefer the library compiled at build time, it is only valid while the source and options are unchanged.
+    ShaderCache cache( SHADER_CACHE_DIR );
+    std::string libraryPath;
+    if ( cache.lookup( "program", ShaderCache::make_key( shaderSrc.view(), options ), libraryPath ) )
+    {
+        NS::URL* pUrl = NS::URL::fileURLWithPath( NS::String::string(libraryPath.c_str(), UTF8StringEncoding) );
+        pLibrary = p_device->newLibrary( pUrl, &pError );
+        if ( !pLibrary )
+        {
+            __builtin_printf("Loading cached shader library failed, compiling from source. \n");
+            __builtin_printf("%s \n\n", pError->localizedDescription()->utf8String());
+        }
+    }
+
+    if ( !pLibrary )
+    {
+        std::vector<NS::Object*> names( macroCount );
+        std::vector<NS::Object*> values( macroCount );
+        for ( size_t i = 0; i < macroCount; ++i )
+        {
+            names[i] = NS::String::string( pMacros[i].name, UTF8StringEncoding );
+            values[i] = NS::String::string( pMacros[i].value, UTF8StringEncoding );
+        }
+
+        MTL::CompileOptions* pOptions = MTL::CompileOptions::alloc()->init();
+        pOptions->setPreprocessorMacros( NS::Dictionary::dictionary( values.data(), names.data(), macroCount ) );
+
+        NS::String* pSource = NS::String::alloc()->init( const_cast<uint8_t*>( shaderSrc.data() ), shaderSrc.size(), UTF8StringEncoding, false );
+        pLibrary = p_device->newLibrary( pSource, pOptions, &pError );
+        pSource->release();
+        pOptions->release();
+    }
+
+    if ( !pLibrary )
+    {
+        __builtin_printf("Library creation from shader source failed. \n");
+        __builtin_printf("%s \n\n", pError->localizedDescription()->utf8String());
+        return false;
+    }
+
+    if ( p_shaderLibrary )
+        p_shaderLibrary->release();
+    p_shaderLibrary = pLibrary;
+    m_functionNames.assign( functionNames, functionNames + functionCount );
+    return true;
+}
+
+Buffer* MetalDevice::new_buffer( size_t length )
+{
+    return new MetalBuffer( p_device->newBuffer( length, MTL::ResourceStorageModeManaged ) );
+}
+
+Pipeline* MetalDevice::new_pipeline( const PipelineDesc& desc )
+{
+    using NS::StringEncoding::UTF8StringEncoding;
+
+    // May run on the pipeline cache's prewarm thread.
+    NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc()->init();
+    NS::Error* pError {nullptr};
+
+    MTL::FunctionConstantValues* pConstants = nullptr;
+    if ( desc.functionConstants )
+    {
+        pConstants = MTL::FunctionConstantValues::alloc()->init();
+        for ( NS::UInteger i = 0; i < 32; ++i )
+        {
+            const bool value = true;
+            if ( desc.functionConstants & ( 1u << i ) )
+                pConstants->setConstantValue( &value, MTL::DataTypeBool, i );
+        }
+    }
+
+    auto newFunction = [&]( uint16_t index ) -> MTL::Function* {
+        if ( index >= m_functionNames.size() )
+            return nullptr;
+        NS::String* pName = NS::String::string( m_functionNames[ index ].c_str(), UTF8StringEncoding );
+        return pConstants ? p_shaderLibrary->newFunction( pName, pConstants, &pError ) : p_shaderLibrary->newFunction( pName );
+    };
+
+    MTL::Function* fnVertex             = newFunction( desc.vertexFunction );
+    MTL::Function* fnFragment           = newFunction( desc.fragmentFunction );
+    MTL::RenderPipelineDescriptor* pRpd = MTL::RenderPipelineDescriptor::alloc()->init();
+
+    pRpd->setVertexFunction( fnVertex );
+    pRpd->setFragmentFunction( fnFragment );
+    pRpd->setSampleCount( desc.sampleCount );
+    pRpd->setDepthAttachmentPixelFormat( to_metal( static_cast<PixelFormat>( desc.depthFormat ) ) );
+
+    MTL::RenderPipelineColorAttachmentDescriptor* pColor = pRpd->colorAttachments()->object(0);
+    pColor->setPixelFormat( to_metal( static_cast<PixelFormat>( desc.colorFormat ) ) );
+    if ( desc.blend != PipelineDesc::Blend::Opaque )
+    {
+        const bool additive = desc.blend == PipelineDesc::Blend::Additive;
+        pColor->setBlendingEnabled( true );
+        pColor->setSourceRGBBlendFactor( MTL::BlendFactorSourceAlpha );
+        pColor->setDestinationRGBBlendFactor( additive ? MTL::BlendFactorOne : MTL::BlendFactorOneMinusSourceAlpha );
+        pColor->setSourceAlphaBlendFactor( MTL::BlendFactorOne );
+        pColor->setDestinationAlphaBlendFactor( additive ? MTL::BlendFactorOne : MTL::BlendFactorOneMinusSourceAlpha );
+    }
+
+    MTL::RenderPipelineState* pState = p_device->newRenderPipelineState( pRpd, &pError );
+    if ( !pState )
+    {
+        __builtin_printf("RenderPipelineState creation failed. \n");
+        __builtin_printf("%s \n\n", pError->localizedDescription()->utf8String());
+    }
+
+    if ( fnVertex )
+        fnVertex->release();
+    if ( fnFragment )
+        fnFragment->release();
+    if ( pConstants )
+        pConstants->release();
+    pRpd->release();
+    pool->release();
+
+    return pState ? new MetalPipeline( pState ) : nullptr;
+}
+
+DepthStencilState* MetalDevice::new_depth_stencil_state( CompareFunction compare, bool depthWrite )
+{
+    MTL::DepthStencilDescriptor* pDepthDesc = MTL::DepthStencilDescriptor::alloc()->init();
+    pDepthDesc->setDepthCompareFunction( to_metal( compare ) );
+    pDepthDesc->setDepthWriteEnabled( depthWrite );
+
+    MTL::DepthStencilState* pState = p_device->newDepthStencilState( pDepthDesc );
+    pDepthDesc->release();
+    return new MetalDepthStencilState( pState );
+}
+
+Fence* MetalDevice::new_fence( size_t count )
+{
+    return new MetalFence( count );
+}
+
+CommandBuffer* MetalDevice::command_buffer()
+{
+    return new MetalCommandBuffer( p_cmdQ->commandBuffer() );
+}
+
+}
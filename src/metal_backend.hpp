@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Metal/Metal.hpp>
+#include <MetalKit/MetalKit.hpp>
+
+#include <string>
+#include <vector>
+
+#include "backend.hpp"
+
+namespace gpu
+{
+
+// Renders into an MTK::View's current drawable. Wrap the view each frame,
+// inside drawInMTKView.
+class MetalViewTarget : public Target
+{
+    public:
+        explicit MetalViewTarget( MTK::View* pView ) : p_view( pView ) { }
+
+        MTK::View* view() const { return p_view; }
+
+    private:
+        MTK::View* p_view;
+};
+
+class MetalDevice : public Device
+{
+    public:
+        explicit MetalDevice( MTL::Device* pDevice );
+        ~MetalDevice() override;
+
+        MetalDevice( const MetalDevice& ) = delete;
+        MetalDevice& operator=( const MetalDevice& ) = delete;
+
+        bool load_program( const char* sourcePath, const char* const* functionNames, size_t functionCount,
+                           const ShaderMacro* pMacros, size_t macroCount ) override;
+
+        Buffer* new_buffer( size_t length ) override;
+        Pipeline* new_pipeline( const PipelineDesc& desc ) override;
+        DepthStencilState* new_depth_stencil_state( CompareFunction compare, bool depthWrite ) override;
+        Fence* new_fence( size_t count ) override;
+
+        CommandBuffer* command_buffer() override;
+
+    private:
+        MTL::Device* p_device;
+        MTL::CommandQueue* p_cmdQ;
+        MTL::Library* p_shaderLibrary;
+        std::vector<std::string> m_functionNames;
+};
+
+}
@@ -0,0 +1,401 @@
+#include "occlusion_buffer.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+uint64_t edge_key( uint32_t from, uint32_t to )
+{
+    return uint64_t( from ) << 32 | to;
+}
+
+}
+
+OcclusionBuffer::OcclusionBuffer( size_t width, size_t height )
+    : m_width( width )
+    , m_height( height )
+{
+    assert( width >= 8 && ( width & ( width - 1 ) ) == 0 && "width must be a power of two of at least 8" );
+    assert( height > 0 && ( height & ( height - 1 ) ) == 0 && "height must be a power of two" );
+
+    size_t offset = 0;
+    for ( size_t level = 0; ; ++level )
+    {
+        const size_t w = std::max<size_t>( width >> level, 1 );
+        const size_t h = std::max<size_t>( height >> level, 1 );
+        m_levelOffsets.push_back( offset );
+        offset += w * h;
+        if ( w == 1 && h == 1 )
+            break;
+    }
+    m_depths.resize( offset );
+    m_coverage.resize( width * height, 0.f );
+    m_farthest.resize( width * height, 0.f );
+    clear();
+}
+
+void OcclusionBuffer::clear()
+{
+    std::fill( m_depths.begin(), m_depths.end(), 1.f );
+    m_trianglesRasterized = 0;
+}
+
+void OcclusionBuffer::rasterize( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                                 const uint32_t* pIndices, size_t indexCount )
+{
+    PROFILE_ZONE( "OcclusionBuffer::rasterize" );
+    rasterize_triangles( clipTransform, pPositions, vertexCount, pIndices, indexCount, true );
+}
+
+void OcclusionBuffer::rasterize_scalar( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                                        const uint32_t* pIndices, size_t indexCount )
+{
+    rasterize_triangles( clipTransform, pPositions, vertexCount, pIndices, indexCount, false );
+}
+
+void OcclusionBuffer::rasterize_triangles( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                                           const uint32_t* pIndices, size_t indexCount, bool simd )
+{
+    // Screen x, y and depth, with clip z in w to find the vertices in front of the near plane.
+    const float halfWidth = 0.5f * m_width, halfHeight = 0.5f * m_height;
+    m_screen.resize( vertexCount );
+    for ( size_t v = 0; v < vertexCount; ++v )
+    {
+        const math::float4 p = clipTransform * math::float4{ pPositions[ 3 * v ], pPositions[ 3 * v + 1 ], pPositions[ 3 * v + 2 ], 1.f };
+        const float invW = 1.f / p.w;
+        m_screen[ v ] = { ( p.x * invW + 1.f ) * halfWidth, ( p.y * invW + 1.f ) * halfHeight, p.z * invW, p.z };
+    }
+
+    // Triangles reaching in front of the near plane, or behind the eye, are left out, as are those without
+    // area. Leaving one out only hides less.
+    m_triangles.clear();
+    for ( size_t i = 0; i + 2 < indexCount; i += 3 )
+    {
+        const math::float4& a = m_screen[ pIndices[ i ] ];
+        const math::float4& b = m_screen[ pIndices[ i + 1 ] ];
+        const math::float4& c = m_screen[ pIndices[ i + 2 ] ];
+        if ( a.w < 0.f || b.w < 0.f || c.w < 0.f )
+            continue;
+        const float area = ( b.x - a.x ) * ( c.y - a.y ) - ( c.x - a.x ) * ( b.y - a.y );
+        if ( std::fabs( area ) < 1e-6f )
+            continue;
+        m_triangles.push_back( { { pIndices[ i ], pIndices[ i + 1 ], pIndices[ i + 2 ] }, area > 0.f } );
+    }
+
+    // Directed edges, sorted, to find the edges two triangles facing the same way share from opposite
+    // directions: those lie on opposite sides of it, so the edge is inside their surface.
+    m_edges.clear();
+    for ( uint32_t t = 0; t < m_triangles.size(); ++t )
+        for ( int e = 0; e < 3; ++e )
+            m_edges.push_back( { edge_key( m_triangles[ t ].vertices[ e ], m_triangles[ t ].vertices[ ( e + 1 ) % 3 ] ), t } );
+    std::sort( m_edges.begin(), m_edges.end(), []( const Edge& a, const Edge& b ) { return a.key < b.key; } );
+    auto edge_inside = [&]( uint32_t from, uint32_t to, bool front ) {
+        auto find = [&]( uint64_t key ) {
+            return std::equal_range( m_edges.begin(), m_edges.end(), Edge{ key, 0 }, []( const Edge& a, const Edge& b ) { return a.key < b.key; } );
+        };
+        const auto forward = find( edge_key( from, to ) );
+        const auto backward = find( edge_key( to, from ) );
+        return forward.second - forward.first == 1 && backward.second - backward.first == 1
+            && m_triangles[ backward.first->triangle ].front == front;
+    };
+
+    // Each facing is a surface of its own: a pixel it covers is one whose center is inside it and that
+    // none of its outer edges cross, at the farthest depth any of its triangles has there.
+    for ( bool front : { true, false } )
+    {
+        size_t xBegin = m_width, xEnd = 0, yBegin = m_height, yEnd = 0;
+        for ( const Triangle& triangle : m_triangles )
+        {
+            if ( triangle.front != front )
+                continue;
+            const math::float4& a = m_screen[ triangle.vertices[0] ];
+            const math::float4& b = m_screen[ triangle.vertices[1] ];
+            const math::float4& c = m_screen[ triangle.vertices[2] ];
+            xBegin = std::min( xBegin, static_cast<size_t>( std::clamp( std::floor( std::min( { a.x, b.x, c.x } ) ), 0.f, float( m_width ) ) ) );
+            xEnd = std::max( xEnd, static_cast<size_t>( std::clamp( std::ceil( std::max( { a.x, b.x, c.x } ) ), 0.f, float( m_width ) ) ) );
+            yBegin = std::min( yBegin, static_cast<size_t>( std::clamp( std::floor( std::min( { a.y, b.y, c.y } ) ), 0.f, float( m_height ) ) ) );
+            yEnd = std::max( yEnd, static_cast<size_t>( std::clamp( std::ceil( std::max( { a.y, b.y, c.y } ) ), 0.f, float( m_height ) ) ) );
+        }
+        if ( xBegin >= xEnd || yBegin >= yEnd )
+            continue;
+
+        for ( const Triangle& triangle : m_triangles )
+            if ( triangle.front == front )
+                rasterize_triangle( m_screen[ triangle.vertices[0] ], m_screen[ triangle.vertices[ front ? 1 : 2 ] ], m_screen[ triangle.vertices[ front ? 2 : 1 ] ], simd );
+
+        for ( const Triangle& triangle : m_triangles )
+        {
+            if ( triangle.front != front )
+                continue;
+            for ( int e = 0; e < 3; ++e )
+            {
+                const uint32_t from = triangle.vertices[ e ], to = triangle.vertices[ ( e + 1 ) % 3 ];
+                if ( !edge_inside( from, to, front ) )
+                    uncover_edge( m_screen[ from ], m_screen[ to ] );
+            }
+        }
+
+        // Zeroed again on the way, for the next surface.
+        for ( size_t row = yBegin; row < yEnd; ++row )
+        {
+            float* pRow = m_depths.data() + row * m_width;
+            float* pCoverage = m_coverage.data() + row * m_width;
+            float* pFarthest = m_farthest.data() + row * m_width;
+            for ( size_t px = xBegin; px < xEnd; ++px )
+            {
+                pRow[ px ] = pCoverage[ px ] > 0.f ? std::min( pRow[ px ], pFarthest[ px ] ) : pRow[ px ];
+                pCoverage[ px ] = 0.f;
+                pFarthest[ px ] = 0.f;
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::rasterize_triangle( const math::float4& a, const math::float4& b, const math::float4& c, bool simd )
+{
+    // Counter-clockwise on the screen.
+    const float x[3] = { a.x, b.x, c.x }, y[3] = { a.y, b.y, c.y }, z[3] = { a.z, b.z, c.z };
+    const float area = ( x[1] - x[0] ) * ( y[2] - y[0] ) - ( x[2] - x[0] ) * ( y[1] - y[0] );
+
+    // A pixel is touched when its center is within the most a pixel corner can lie outside of the edges
+    // with the pixel still reaching inside, and covered when its center is inside, give or take rounding:
+    // outer edges uncover the pixels they cross afterwards anyway.
+    float edgeA[3], edgeB[3], edgeC[3], touch[3], inside[3];
+    for ( int e = 0; e < 3; ++e )
+    {
+        const int n = ( e + 1 ) % 3;
+        edgeA[e] = y[e] - y[n];
+        edgeB[e] = x[n] - x[e];
+        edgeC[e] = -( edgeA[e] * x[e] + edgeB[e] * y[e] );
+        touch[e] = -0.5f * ( std::fabs( edgeA[e] ) + std::fabs( edgeB[e] ) );
+        inside[e] = -1e-3f * ( std::fabs( edgeA[e] ) + std::fabs( edgeB[e] ) );
+    }
+
+    // The depth plane, at the farthest corner of each pixel.
+    const float dzdx = ( ( z[1] - z[0] ) * ( y[2] - y[0] ) - ( z[2] - z[0] ) * ( y[1] - y[0] ) ) / area;
+    const float dzdy = ( ( z[2] - z[0] ) * ( x[1] - x[0] ) - ( z[1] - z[0] ) * ( x[2] - x[0] ) ) / area;
+    const float slack = 0.5f * ( std::fabs( dzdx ) + std::fabs( dzdy ) );
+    const float zMax = std::max( { z[0], z[1], z[2] } );
+
+    // The pixels the triangle's bounds reach into.
+    const size_t xBegin = static_cast<size_t>( std::clamp( std::floor( std::min( { x[0], x[1], x[2] } ) ), 0.f, float( m_width ) ) );
+    const size_t xEnd = static_cast<size_t>( std::clamp( std::ceil( std::max( { x[0], x[1], x[2] } ) ), 0.f, float( m_width ) ) );
+    const size_t yBegin = static_cast<size_t>( std::clamp( std::floor( std::min( { y[0], y[1], y[2] } ) ), 0.f, float( m_height ) ) );
+    const size_t yEnd = static_cast<size_t>( std::clamp( std::ceil( std::max( { y[0], y[1], y[2] } ) ), 0.f, float( m_height ) ) );
+    if ( xBegin >= xEnd || yBegin >= yEnd )
+        return;
+    m_trianglesRasterized++;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 lanes = _mm256_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f );
+    const __m256 a0 = _mm256_set1_ps( edgeA[0] ), a1 = _mm256_set1_ps( edgeA[1] ), a2 = _mm256_set1_ps( edgeA[2] );
+    const __m256 t0 = _mm256_set1_ps( touch[0] ), t1 = _mm256_set1_ps( touch[1] ), t2 = _mm256_set1_ps( touch[2] );
+    const __m256 i0 = _mm256_set1_ps( inside[0] ), i1 = _mm256_set1_ps( inside[1] ), i2 = _mm256_set1_ps( inside[2] );
+    const __m256 zSlope = _mm256_set1_ps( dzdx );
+    const __m256 zLimit = _mm256_set1_ps( zMax );
+    const __m256 one = _mm256_set1_ps( 1.f );
+    const __m256 columnBegin = _mm256_set1_ps( float( xBegin ) ), columnEnd = _mm256_set1_ps( float( xEnd ) );
+#elif defined(__ARM_NEON)
+    const float32x4_t lanes = { 0.5f, 1.5f, 2.5f, 3.5f };
+    const float32x4_t zLimit = vdupq_n_f32( zMax );
+    const float32x4_t one = vdupq_n_f32( 1.f );
+    const float32x4_t columnBegin = vdupq_n_f32( float( xBegin ) ), columnEnd = vdupq_n_f32( float( xEnd ) );
+#endif
+
+    for ( size_t row = yBegin; row < yEnd; ++row )
+    {
+        const float py = row + 0.5f;
+        const float e0 = edgeB[0] * py + edgeC[0], e1 = edgeB[1] * py + edgeC[1], e2 = edgeB[2] * py + edgeC[2];
+        // Depth at px is zRow + dzdx * px.
+        const float zRow = z[0] + dzdy * ( py - y[0] ) - dzdx * x[0] + slack;
+        float* pCoverage = m_coverage.data() + row * m_width;
+        float* pFarthest = m_farthest.data() + row * m_width;
+
+        // The width is a multiple of the vector width, so whole vectors stay within the row; lanes outside
+        // the triangle's bounds are masked off, as the corners of thin triangles would touch them.
+#if defined(__AVX2__) && defined(__FMA__)
+        if ( simd )
+        {
+            const __m256 r0 = _mm256_set1_ps( e0 ), r1 = _mm256_set1_ps( e1 ), r2 = _mm256_set1_ps( e2 );
+            const __m256 zStart = _mm256_set1_ps( zRow );
+            for ( size_t px = xBegin & ~size_t( 7 ); px < xEnd; px += 8 )
+            {
+                const __m256 cx = _mm256_add_ps( _mm256_set1_ps( float( px ) ), lanes );
+                const __m256 d0 = _mm256_fmadd_ps( a0, cx, r0 ), d1 = _mm256_fmadd_ps( a1, cx, r1 ), d2 = _mm256_fmadd_ps( a2, cx, r2 );
+                __m256 touched = _mm256_and_ps( _mm256_cmp_ps( cx, columnBegin, _CMP_GT_OQ ), _mm256_cmp_ps( cx, columnEnd, _CMP_LT_OQ ) );
+                touched = _mm256_and_ps( touched, _mm256_cmp_ps( d0, t0, _CMP_GE_OQ ) );
+                touched = _mm256_and_ps( touched, _mm256_cmp_ps( d1, t1, _CMP_GE_OQ ) );
+                touched = _mm256_and_ps( touched, _mm256_cmp_ps( d2, t2, _CMP_GE_OQ ) );
+                if ( _mm256_movemask_ps( touched ) == 0 )
+                    continue;
+                __m256 covered = _mm256_cmp_ps( d0, i0, _CMP_GE_OQ );
+                covered = _mm256_and_ps( covered, _mm256_cmp_ps( d1, i1, _CMP_GE_OQ ) );
+                covered = _mm256_and_ps( covered, _mm256_cmp_ps( d2, i2, _CMP_GE_OQ ) );
+
+                const __m256 depth = _mm256_min_ps( _mm256_fmadd_ps( zSlope, cx, zStart ), zLimit );
+                const __m256 farthest = _mm256_loadu_ps( pFarthest + px );
+                _mm256_storeu_ps( pFarthest + px, _mm256_blendv_ps( farthest, _mm256_max_ps( farthest, depth ), touched ) );
+                _mm256_storeu_ps( pCoverage + px, _mm256_blendv_ps( _mm256_loadu_ps( pCoverage + px ), one, covered ) );
+            }
+            continue;
+        }
+#elif defined(__ARM_NEON)
+        if ( simd )
+        {
+            for ( size_t px = xBegin & ~size_t( 3 ); px < xEnd; px += 4 )
+            {
+                const float32x4_t cx = vaddq_f32( vdupq_n_f32( float( px ) ), lanes );
+                const float32x4_t d0 = vfmaq_n_f32( vdupq_n_f32( e0 ), cx, edgeA[0] );
+                const float32x4_t d1 = vfmaq_n_f32( vdupq_n_f32( e1 ), cx, edgeA[1] );
+                const float32x4_t d2 = vfmaq_n_f32( vdupq_n_f32( e2 ), cx, edgeA[2] );
+                uint32x4_t touched = vandq_u32( vcgtq_f32( cx, columnBegin ), vcltq_f32( cx, columnEnd ) );
+                touched = vandq_u32( touched, vcgeq_f32( d0, vdupq_n_f32( touch[0] ) ) );
+                touched = vandq_u32( touched, vcgeq_f32( d1, vdupq_n_f32( touch[1] ) ) );
+                touched = vandq_u32( touched, vcgeq_f32( d2, vdupq_n_f32( touch[2] ) ) );
+                if ( vmaxvq_u32( touched ) == 0 )
+                    continue;
+                uint32x4_t covered = vcgeq_f32( d0, vdupq_n_f32( inside[0] ) );
+                covered = vandq_u32( covered, vcgeq_f32( d1, vdupq_n_f32( inside[1] ) ) );
+                covered = vandq_u32( covered, vcgeq_f32( d2, vdupq_n_f32( inside[2] ) ) );
+
+                const float32x4_t depth = vminq_f32( vfmaq_n_f32( vdupq_n_f32( zRow ), cx, dzdx ), zLimit );
+                const float32x4_t farthest = vld1q_f32( pFarthest + px );
+                vst1q_f32( pFarthest + px, vbslq_f32( touched, vmaxq_f32( farthest, depth ), farthest ) );
+                vst1q_f32( pCoverage + px, vbslq_f32( covered, one, vld1q_f32( pCoverage + px ) ) );
+            }
+            continue;
+        }
+#endif
+        for ( size_t px = xBegin; px < xEnd; ++px )
+        {
+            const float cx = px + 0.5f;
+            const float d0 = edgeA[0] * cx + e0, d1 = edgeA[1] * cx + e1, d2 = edgeA[2] * cx + e2;
+            if ( d0 < touch[0] || d1 < touch[1] || d2 < touch[2] )
+                continue;
+            pFarthest[ px ] = std::max( pFarthest[ px ], std::min( zRow + dzdx * cx, zMax ) );
+            if ( d0 >= inside[0] && d1 >= inside[1] && d2 >= inside[2] )
+                pCoverage[ px ] = 1.f;
+        }
+    }
+}
+
+void OcclusionBuffer::uncover_edge( const math::float4& a, const math::float4& b )
+{
+    // Row by row, the pixels the part of the edge within the row reaches into, with a little to spare.
+    constexpr float kSpare = 1e-3f;
+    const float yMin = std::min( a.y, b.y ), yMax = std::max( a.y, b.y );
+    const float xMin = std::min( a.x, b.x ), xMax = std::max( a.x, b.x );
+    const float rowBegin = std::clamp( std::floor( yMin - kSpare ), 0.f, float( m_height ) );
+    const float rowEnd = std::clamp( std::floor( yMax + kSpare ) + 1.f, 0.f, float( m_height ) );
+    const float dxdy = b.y != a.y ? ( b.x - a.x ) / ( b.y - a.y ) : 0.f;
+
+    for ( size_t row = static_cast<size_t>( rowBegin ); row < static_cast<size_t>( rowEnd ); ++row )
+    {
+        float left = xMin, right = xMax;
+        if ( b.y != a.y )
+        {
+            const float x0 = a.x + ( std::clamp( float( row ), yMin, yMax ) - a.y ) * dxdy;
+            const float x1 = a.x + ( std::clamp( float( row + 1 ), yMin, yMax ) - a.y ) * dxdy;
+            left = std::max( std::min( x0, x1 ), xMin );
+            right = std::min( std::max( x0, x1 ), xMax );
+        }
+        const float begin = std::clamp( std::floor( left - kSpare ), 0.f, float( m_width ) );
+        const float end = std::clamp( std::floor( right + kSpare ) + 1.f, 0.f, float( m_width ) );
+        float* pCoverage = m_coverage.data() + row * m_width;
+        std::fill( pCoverage + static_cast<size_t>( begin ), pCoverage + static_cast<size_t>( end ), 0.f );
+    }
+}
+
+void OcclusionBuffer::build_hierarchy()
+{
+    PROFILE_ZONE( "OcclusionBuffer::build_hierarchy" );
+
+    for ( size_t level = 1; level < m_levelOffsets.size(); ++level )
+    {
+        const size_t sourceWidth = std::max<size_t>( m_width >> ( level - 1 ), 1 );
+        const size_t sourceHeight = std::max<size_t>( m_height >> ( level - 1 ), 1 );
+        const size_t w = std::max<size_t>( m_width >> level, 1 );
+        const size_t h = std::max<size_t>( m_height >> level, 1 );
+        const float* pSource = m_depths.data() + m_levelOffsets[ level - 1 ];
+        float* pLevel = m_depths.data() + m_levelOffsets[ level ];
+
+        for ( size_t ty = 0; ty < h; ++ty )
+        {
+            const float* pRow0 = pSource + std::min( 2 * ty, sourceHeight - 1 ) * sourceWidth;
+            const float* pRow1 = pSource + std::min( 2 * ty + 1, sourceHeight - 1 ) * sourceWidth;
+            for ( size_t tx = 0; tx < w; ++tx )
+            {
+                const size_t x0 = std::min( 2 * tx, sourceWidth - 1 ), x1 = std::min( 2 * tx + 1, sourceWidth - 1 );
+                pLevel[ ty * w + tx ] = std::max( { pRow0[ x0 ], pRow0[ x1 ], pRow1[ x0 ], pRow1[ x1 ] } );
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::box_visible( const math::float4x4& clipTransform, const math::float3& boundsMin, const math::float3& boundsMax ) const
+{
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    float nearest = INFINITY;
+    for ( int corner = 0; corner < 8; ++corner )
+    {
+        const math::float4 p = clipTransform * math::float4{ corner & 1 ? boundsMax.x : boundsMin.x,
+                                                             corner & 2 ? boundsMax.y : boundsMin.y,
+                                                             corner & 4 ? boundsMax.z : boundsMin.z, 1.f };
+        if ( p.z < 0.f )
+            return true;
+
+        const float invW = 1.f / p.w;
+        const float sx = ( p.x * invW + 1.f ) * 0.5f * m_width;
+        const float sy = ( p.y * invW + 1.f ) * 0.5f * m_height;
+        minX = std::min( minX, sx );
+        maxX = std::max( maxX, sx );
+        minY = std::min( minY, sy );
+        maxY = std::max( maxY, sy );
+        nearest = std::min( nearest, p.z * invW );
+    }
+    if ( maxX < 0.f || maxY < 0.f || minX >= m_width || minY >= m_height )
+        return true;
+
+    const size_t x0 = static_cast<size_t>( std::clamp( minX, 0.f, float( m_width - 1 ) ) );
+    const size_t x1 = static_cast<size_t>( std::clamp( maxX, 0.f, float( m_width - 1 ) ) );
+    const size_t y0 = static_cast<size_t>( std::clamp( minY, 0.f, float( m_height - 1 ) ) );
+    const size_t y1 = static_cast<size_t>( std::clamp( maxY, 0.f, float( m_height - 1 ) ) );
+
+    // The finest level where the rectangle touches at most 2x2 texels.
+    size_t level = 0;
+    while ( level + 1 < m_levelOffsets.size() && ( ( x1 >> level ) - ( x0 >> level ) > 1 || ( y1 >> level ) - ( y0 >> level ) > 1 ) )
+        level++;
+
+    const size_t w = std::max<size_t>( m_width >> level, 1 );
+    const float* pLevel = m_depths.data() + m_levelOffsets[ level ];
+    for ( size_t ty = y0 >> level; ty <= y1 >> level; ++ty )
+        for ( size_t tx = x0 >> level; tx <= x1 >> level; ++tx )
+            if ( nearest <= pLevel[ ty * w + tx ] )
+                return true;
+    return false;
+}
+
+size_t OcclusionBuffer::cull_spheres( const math::float4x4& clipTransform,
+                                      const float* x, const float* y, const float* z, const float* radius,
+                                      uint32_t* pIndices, size_t count ) const
+{
+    size_t visible = 0;
+    for ( size_t k = 0; k < count; ++k )
+    {
+        const uint32_t i = pIndices[ k ];
+        const math::float3 center = { x[ i ], y[ i ], z[ i ] };
+        const math::float3 extent = { radius[ i ], radius[ i ], radius[ i ] };
+        if ( box_visible( clipTransform, center - extent, center + extent ) )
+            pIndices[ visible++ ] = i;
+    }
+    return visible;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "math_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Small depth buffer that occluder meshes are rasterized into on the CPU, so
+// that instances hidden behind them can be dropped before they are uploaded
+// and drawn.
+//
+// Both sides err towards drawing: an occluder only covers the pixels it covers
+// entirely, at the farthest depth it has in them, and a box is only hidden when
+// its nearest corner lies behind every pixel its screen rectangle touches.
+// Depths are z / w of Metal clip space, 0 at the near plane and 1 at the far
+// one. Above the full resolution level sit levels of half the resolution each,
+// holding the farthest depth of the four texels below, so that a box of any
+// size is tested against at most 2x2 texels.
+class OcclusionBuffer
+{
+    public:
+        // Powers of two, the width at least 8.
+        OcclusionBuffer( size_t width, size_t height );
+
+        size_t width() const { return m_width; }
+        size_t height() const { return m_height; }
+        size_t level_count() const { return m_levelOffsets.size(); }
+        // Of level 0, row by row from the bottom of the screen.
+        const float* depths() const { return m_depths.data(); }
+        size_t triangles_rasterized() const { return m_trianglesRasterized; }
+
+        // Starts over with every pixel at the far plane.
+        void clear();
+
+        // Rasterizes an occluder's triangles, given as x, y, z positions and
+        // transformed by clipTransform. Triangles reaching in front of the near
+        // plane are skipped; both windings are drawn. The triangles facing the
+        // same way are one surface where they share edges, by vertex index, so
+        // that the pixels along those are covered too.
+        void rasterize( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                        const uint32_t* pIndices, size_t indexCount );
+
+        // Plain scalar version of rasterize, kept as the correctness reference.
+        void rasterize_scalar( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                               const uint32_t* pIndices, size_t indexCount );
+
+        // Fills in the coarser levels. After the occluders, before the tests.
+        void build_hierarchy();
+
+        // Whether some of the box, transformed by clipTransform, may be in front
+        // of the occluders. Boxes reaching in front of the near plane or off the
+        // screen entirely always are.
+        bool box_visible( const math::float4x4& clipTransform, const math::float3& boundsMin, const math::float3& boundsMax ) const;
+
+        // Keeps the instances of pIndices[ 0, count ) whose spheres' boxes are
+        // visible, in order, and returns how many. The x/y/z/radius streams are
+        // indexed by the instance indices.
+        size_t cull_spheres( const math::float4x4& clipTransform,
+                             const float* x, const float* y, const float* z, const float* radius,
+                             uint32_t* pIndices, size_t count ) const;
+
+    private:
+        struct Triangle
+        {
+            uint32_t vertices[3];
+            // Counter-clockwise on the screen.
+            bool front;
+        };
+
+        struct Edge
+        {
+            uint64_t key;
+            uint32_t triangle;
+        };
+
+        void rasterize_triangles( const math::float4x4& clipTransform, const float* pPositions, size_t vertexCount,
+                                  const uint32_t* pIndices, size_t indexCount, bool simd );
+        // Into m_coverage and m_farthest, the vertices counter-clockwise.
+        void rasterize_triangle( const math::float4& a, const math::float4& b, const math::float4& c, bool simd );
+        // Clears the coverage of every pixel the edge crosses.
+        void uncover_edge( const math::float4& a, const math::float4& b );
+
+        size_t m_width;
+        size_t m_height;
+        // Every level, level 0 first, each row by row.
+        std::vector<float> m_depths;
+        std::vector<size_t> m_levelOffsets;
+        size_t m_trianglesRasterized = 0;
+        // Scratch of rasterize(): vertices on the screen, the triangles drawn and their edges, and per
+        // pixel of level 0 whether the surface being drawn covers it and its farthest depth there, zero
+        // between surfaces.
+        std::vector<math::float4> m_screen;
+        std::vector<Triangle> m_triangles;
+        std::vector<Edge> m_edges;
+        std::vector<float> m_coverage;
+        std::vector<float> m_farthest;
+};
@@ -0,0 +1,130 @@
+#include "packing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+float sign_not_zero( float f )
+{
+    return f >= 0.f ? 1.f : -1.f;
+}
+
+uint32_t quantize_unorm10( float f )
+{
+    return static_cast<uint32_t>( std::lround( std::min( std::max( f, 0.f ), 1.f ) * 1023.f ) );
+}
+
+}
+
+uint8_t quantize_unorm8( float f )
+{
+    return static_cast<uint8_t>( std::lround( std::min( std::max( f, 0.f ), 1.f ) * 255.f ) );
+}
+
+int16_t quantize_snorm16( float f )
+{
+    return static_cast<int16_t>( std::lround( std::min( std::max( f, -1.f ), 1.f ) * 32767.f ) );
+}
+
+float dequantize_snorm16( int16_t s )
+{
+    return std::max( s / 32767.f, -1.f );
+}
+
+uint16_t float_to_half( float f )
+{
+    uint32_t bits;
+    memcpy( &bits, &f, sizeof(bits) );
+
+    const uint32_t sign = ( bits >> 16 ) & 0x8000u;
+    const uint32_t magnitude = bits & 0x7fffffffu;
+
+    if ( magnitude >= 0x7f800000u )
+        return static_cast<uint16_t>( sign | 0x7c00u | ( magnitude > 0x7f800000u ? 0x200u : 0u ) );
+    if ( magnitude >= 0x477ff000u )
+        return static_cast<uint16_t>( sign | 0x7c00u );
+
+    if ( magnitude < 0x38800000u )
+    {
+        // Subnormal half, the float's mantissa shifts out with rounding.
+        if ( magnitude < 0x33000000u )
+            return static_cast<uint16_t>( sign );
+        const uint32_t exponent = magnitude >> 23;
+        const uint32_t mantissa = ( magnitude & 0x7fffffu ) | 0x800000u;
+        const uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ( ( 1u << shift ) - 1 );
+        const uint32_t halfway = 1u << ( shift - 1 );
+        if ( rest > halfway || ( rest == halfway && ( half & 1u ) ) )
+            half++;
+        return static_cast<uint16_t>( sign | half );
+    }
+
+    uint32_t half = ( magnitude - 0x38000000u ) >> 13;
+    const uint32_t rest = magnitude & 0x1fffu;
+    if ( rest > 0x1000u || ( rest == 0x1000u && ( half & 1u ) ) )
+        half++;
+    return static_cast<uint16_t>( sign | half );
+}
+
+float half_to_float( uint16_t h )
+{
+    const uint32_t sign = static_cast<uint32_t>( h & 0x8000u ) << 16;
+    const uint32_t exponent = ( h >> 10 ) & 0x1fu;
+    const uint32_t mantissa = h & 0x3ffu;
+
+    float f;
+    if ( exponent == 0 )
+    {
+        f = std::ldexp( static_cast<float>( mantissa ), -24 );
+        return sign ? -f : f;
+    }
+
+    const uint32_t bits = exponent == 0x1f ? sign | 0x7f800000u | ( mantissa << 13 )
+                                           : sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+    memcpy( &f, &bits, sizeof(f) );
+    return f;
+}
+
+uint32_t encode_octahedral( const float n[3] )
+{
+    const float l1 = std::fabs( n[0] ) + std::fabs( n[1] ) + std::fabs( n[2] );
+    float u = l1 > 0.f ? n[0] / l1 : 0.f;
+    float v = l1 > 0.f ? n[1] / l1 : 0.f;
+    if ( n[2] < 0.f )
+    {
+        const float fu = ( 1.f - std::fabs( v ) ) * sign_not_zero( u );
+        const float fv = ( 1.f - std::fabs( u ) ) * sign_not_zero( v );
+        u = fu;
+        v = fv;
+    }
+    return uint32_t( uint16_t( quantize_snorm16( u ) ) ) | uint32_t( uint16_t( quantize_snorm16( v ) ) ) << 16;
+}
+
+void decode_octahedral( uint32_t packed, float n[3] )
+{
+    const float u = dequantize_snorm16( static_cast<int16_t>( packed & 0xffffu ) );
+    const float v = dequantize_snorm16( static_cast<int16_t>( packed >> 16 ) );
+    n[2] = 1.f - std::fabs( u ) - std::fabs( v );
+    const float t = std::max( -n[2], 0.f );
+    n[0] = u + ( u >= 0.f ? -t : t );
+    n[1] = v + ( v >= 0.f ? -t : t );
+    const float scale = 1.f / std::sqrt( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] );
+    for ( int k = 0; k < 3; ++k )
+        n[ k ] *= scale;
+}
+
+uint32_t encode_unorm10_10_10_2( const float n[3] )
+{
+    return quantize_unorm10( n[0] * 0.5f + 0.5f )
+         | quantize_unorm10( n[1] * 0.5f + 0.5f ) << 10
+         | quantize_unorm10( n[2] * 0.5f + 0.5f ) << 20;
+}
+
+void decode_unorm10_10_10_2( uint32_t packed, float n[3] )
+{
+    for ( int k = 0; k < 3; ++k )
+        n[ k ] = ( ( packed >> ( 10 * k ) ) & 0x3ffu ) / 1023.f * 2.f - 1.f;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Conversions between float and the small encodings the GPU formats use. Each
+// decode matches what the Metal shaders do with the same bits. Octahedral
+// normals are decoded to unit length: off the octahedron's corners they come
+// out up to sqrt( 3 ) times shorter, and interpolating vectors of different
+// lengths bends the normal the fragment shader renormalizes. 10:10:10:2 ones
+// are within a step of unit length and left to the fragment shader.
+
+// Clamped to [0, 1] and [-1, 1], rounded to nearest.
+uint8_t quantize_unorm8( float f );
+int16_t quantize_snorm16( float f );
+float dequantize_snorm16( int16_t s );
+
+// IEEE binary16, round to nearest even. Inputs beyond the half range become infinity.
+uint16_t float_to_half( float f );
+float half_to_float( uint16_t h );
+
+// A unit vector projected onto the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one, as snorm16 x in the low and y in the high
+// half: unpack_snorm2x16_to_float in Metal. Decoding unfolds and normalizes.
+uint32_t encode_octahedral( const float n[3] );
+void decode_octahedral( uint32_t packed, float n[3] );
+
+// A vector in [-1, 1] as 10 bit unorms of n * 0.5 + 0.5, x in the lowest bits
+// and the 2 bit w zero: unpack_unorm10a2_to_float in Metal.
+uint32_t encode_unorm10_10_10_2( const float n[3] );
+void decode_unorm10_10_10_2( uint32_t packed, float n[3] );
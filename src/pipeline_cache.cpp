@@ -0,0 +1,20 @@
+#include "pipeline_cache.hpp"
+#include <cstring>
+
+bool PipelineDesc::operator==( const PipelineDesc& other ) const
+{
+    return memcmp( this, &other, sizeof(PipelineDesc) ) == 0;
+}
+
+size_t PipelineDescHash::operator()( const PipelineDesc& desc ) const
+{
+    // FNV-1a over the raw bytes, PipelineDesc has no padding.
+    const unsigned char* pBytes = reinterpret_cast<const unsigned char*>( &desc );
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for ( size_t i = 0; i < sizeof(PipelineDesc); ++i )
+    {
+        hash ^= pBytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return static_cast<size_t>( hash );
+}
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "profiler.hpp"
+
+// Compact, hashable description of a render pipeline. Functions are referred
+// to by index into the table passed to gpu::Device::load_program(), pixel
+// formats are gpu::PixelFormat values.
+struct PipelineDesc
+{
+    enum class Blend : uint8_t
+    {
+        Opaque,
+        Alpha,
+        Additive
+    };
+
+    uint16_t vertexFunction = 0;
+    uint16_t fragmentFunction = 0;
+    uint16_t colorFormat = 0;
+    uint16_t depthFormat = 0;
+    Blend blend = Blend::Opaque;
+    uint8_t sampleCount = 1;
+    uint16_t reserved = 0;
+    // Bit i set defines bool function constant i as true.
+    uint32_t functionConstants = 0;
+
+    bool operator==( const PipelineDesc& other ) const;
+};
+
+static_assert( sizeof(PipelineDesc) == 16, "keep PipelineDesc free of implicit padding" );
+
+struct PipelineDescHash
+{
+    size_t operator()( const PipelineDesc& desc ) const;
+};
+
+// Deduplicating cache of compiled pipeline states.
+//
+// acquire() returns the state for a descriptor, compiling it on the calling
+// thread the first time. prewarm() queues the compile on a background thread
+// instead; a later acquire() of the same descriptor waits for that compile
+// rather than starting another one. The cache owns every state it returns.
+//
+// A compile that throws or returns a null state is not cached: whoever waited
+// for it gets the exception or the null state, the next acquire() tries again.
+template <typename State>
+class PipelineCache
+{
+    public:
+        using CompileFn = std::function<State( const PipelineDesc& )>;
+        using ReleaseFn = std::function<void( State )>;
+
+        struct Stats
+        {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t compiles;
+            uint64_t compileNanoseconds;
+        };
+
+        PipelineCache( CompileFn compile, ReleaseFn release );
+        ~PipelineCache();
+
+        PipelineCache( const PipelineCache& ) = delete;
+        PipelineCache& operator=( const PipelineCache& ) = delete;
+
+        State acquire( const PipelineDesc& desc );
+        void prewarm( const PipelineDesc& desc );
+
+        // Waits for pending prewarms and releases every state. Must not overlap acquire().
+        void clear();
+
+        Stats stats() const;
+        size_t size() const;
+
+    private:
+        State compile( const PipelineDesc& desc );
+        // Compiles into the promise of a new entry, dropping the entry when the compile fails.
+        void fulfill( const PipelineDesc& desc, std::promise<State>& promise );
+        void worker_main();
+
+        CompileFn m_compile;
+        ReleaseFn m_release;
+
+        mutable std::mutex m_mutex;
+        std::unordered_map<PipelineDesc, std::shared_future<State>, PipelineDescHash> m_states;
+
+        std::deque<std::pair<PipelineDesc, std::promise<State>>> m_prewarmQueue;
+        std::condition_variable m_prewarmWake;
+        std::condition_variable m_prewarmIdle;
+        size_t m_prewarmBusy;
+        bool m_running;
+        std::thread m_worker;
+
+        std::atomic<uint64_t> m_hits;
+        std::atomic<uint64_t> m_misses;
+        std::atomic<uint64_t> m_compiles;
+        std::atomic<uint64_t> m_compileNanoseconds;
+};
+
+template <typename State>
+PipelineCache<State>::PipelineCache( CompileFn compile, ReleaseFn release )
+    : m_compile( std::move( compile ) )
+    , m_release( std::move( release ) )
+    , m_prewarmBusy( 0 )
+    , m_running( true )
+    , m_hits( 0 )
+    , m_misses( 0 )
+    , m_compiles( 0 )
+    , m_compileNanoseconds( 0 )
+{
+    m_worker = std::thread( &PipelineCache::worker_main, this );
+}
+
+template <typename State>
+PipelineCache<State>::~PipelineCache()
+{
+    clear();
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_running = false;
+    }
+    m_prewarmWake.notify_all();
+    m_worker.join();
+}
+
+template <typename State>
+State PipelineCache<State>::acquire( const PipelineDesc& desc )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    auto it = m_states.find( desc );
+    if ( it != m_states.end() )
+    {
+        std::shared_future<State> state = it->second;
+        lock.unlock();
+
+        m_hits.fetch_add( 1, std::memory_order_relaxed );
+        return state.get();
+    }
+
+    std::promise<State> promise;
+    std::shared_future<State> state = promise.get_future().share();
+    m_states.emplace( desc, state );
+    lock.unlock();
+
+    m_misses.fetch_add( 1, std::memory_order_relaxed );
+    fulfill( desc, promise );
+    return state.get();
+}
+
+template <typename State>
+void PipelineCache<State>::prewarm( const PipelineDesc& desc )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( m_states.count( desc ) )
+            return;
+
+        std::promise<State> promise;
+        m_states.emplace( desc, promise.get_future().share() );
+        m_prewarmQueue.emplace_back( desc, std::move( promise ) );
+    }
+    m_prewarmWake.notify_one();
+}
+
+template <typename State>
+void PipelineCache<State>::clear()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_prewarmIdle.wait( lock, [this]() { return m_prewarmQueue.empty() && m_prewarmBusy == 0; } );
+
+    auto states = std::move( m_states );
+    m_states.clear();
+    lock.unlock();
+
+    for ( auto& entry : states )
+    {
+        // A compile that failed while being cleared is not cached, there is nothing to release.
+        State state = State();
+        try
+        {
+            state = entry.second.get();
+        }
+        catch ( ... )
+        {
+        }
+        if ( state != State() )
+            m_release( state );
+    }
+}
+
+template <typename State>
+typename PipelineCache<State>::Stats PipelineCache<State>::stats() const
+{
+    return { m_hits.load( std::memory_order_relaxed ),
+             m_misses.load( std::memory_order_relaxed ),
+             m_compiles.load( std::memory_order_relaxed ),
+             m_compileNanoseconds.load( std::memory_order_relaxed ) };
+}
+
+template <typename State>
+size_t PipelineCache<State>::size() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_states.size();
+}
+
+template <typename State>
+State PipelineCache<State>::compile( const PipelineDesc& desc )
+{
+    PROFILE_ZONE( "compile pipeline" );
+
+    const auto start = std::chrono::steady_clock::now();
+    State state = m_compile( desc );
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    m_compiles.fetch_add( 1, std::memory_order_relaxed );
+    m_compileNanoseconds.fetch_add( std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count(), std::memory_order_relaxed );
+    return state;
+}
+
+template <typename State>
+void PipelineCache<State>::fulfill( const PipelineDesc& desc, std::promise<State>& promise )
+{
+    State state = State();
+    try
+    {
+        state = compile( desc );
+    }
+    catch ( ... )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_states.erase( desc );
+        }
+        promise.set_exception( std::current_exception() );
+        return;
+    }
+
+    if ( state == State() )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_states.erase( desc );
+    }
+    promise.set_value( state );
+}
+
+template <typename State>
+void PipelineCache<State>::worker_main()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_prewarmWake.wait( lock, [this]() { return !m_running || !m_prewarmQueue.empty(); } );
+        if ( m_prewarmQueue.empty() )
+            return;
+
+        auto job = std::move( m_prewarmQueue.front() );
+        m_prewarmQueue.pop_front();
+        m_prewarmBusy++;
+        lock.unlock();
+
+        fulfill( job.first, job.second );
+
+        lock.lock();
+        m_prewarmBusy--;
+        m_prewarmIdle.notify_all();
+    }
+}
@@ -0,0 +1,216 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+constexpr size_t kRingCapacity = size_t( 1 ) << 14;
+
+struct Event
+{
+    // Atomic so the exporter may read a ring while its thread keeps recording.
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> end;
+};
+
+struct ThreadRing
+{
+    uint32_t threadId;
+    std::string threadName;
+    std::atomic<uint64_t> head { 0 };
+    Event events[ kRingCapacity ];
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+
+    std::mutex frameMutex;
+    uint64_t lastFrameNs = 0;
+    bool frameStarted = false;
+    uint64_t frameCount = 0;
+    uint64_t frameNs[ profiler::kFrameHistory ];
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+const std::chrono::steady_clock::time_point& epoch()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return start;
+}
+
+thread_local ThreadRing* tl_pRing = nullptr;
+
+ThreadRing& local_ring()
+{
+    if ( !tl_pRing )
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock( reg.mutex );
+        reg.rings.push_back( std::make_unique<ThreadRing>() );
+        tl_pRing = reg.rings.back().get();
+        tl_pRing->threadId = static_cast<uint32_t>( reg.rings.size() );
+    }
+    return *tl_pRing;
+}
+
+void write_json_string( FILE* pFile, const char* s )
+{
+    fputc( '"', pFile );
+    for ( ; *s; ++s )
+    {
+        if ( *s == '"' || *s == '\\' )
+            fputc( '\\', pFile );
+        fputc( *s, pFile );
+    }
+    fputc( '"', pFile );
+}
+
+}
+
+uint64_t profiler::now_ns()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - epoch();
+    return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( elapsed ).count() );
+}
+
+void profiler::set_thread_name( const char* name )
+{
+    ThreadRing& ring = local_ring();
+    std::lock_guard<std::mutex> lock( registry().mutex );
+    ring.threadName = name;
+}
+
+void profiler::record( const char* name, uint64_t startNs, uint64_t endNs )
+{
+    ThreadRing& ring = local_ring();
+    const uint64_t head = ring.head.load( std::memory_order_relaxed );
+
+    // Orders the previous record's head store before the stores that overwrite a slot; pairs with the
+    // acquire fence in write_chrome_trace, which then sees the head move past any slot it read torn.
+    std::atomic_thread_fence( std::memory_order_release );
+
+    Event& event = ring.events[ head & ( kRingCapacity - 1 ) ];
+    event.name.store( name, std::memory_order_relaxed );
+    event.start.store( startNs, std::memory_order_relaxed );
+    event.end.store( endNs, std::memory_order_relaxed );
+
+    ring.head.store( head + 1, std::memory_order_release );
+}
+
+void profiler::frame_mark()
+{
+    const uint64_t now = now_ns();
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock( reg.frameMutex );
+    if ( reg.frameStarted )
+    {
+        reg.frameNs[ reg.frameCount % kFrameHistory ] = now - reg.lastFrameNs;
+        reg.frameCount++;
+    }
+    reg.frameStarted = true;
+    reg.lastFrameNs = now;
+}
+
+profiler::FrameSummary profiler::frame_summary()
+{
+    std::vector<uint64_t> frames;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock( reg.frameMutex );
+        const size_t count = static_cast<size_t>( std::min<uint64_t>( reg.frameCount, kFrameHistory ) );
+        frames.assign( reg.frameNs, reg.frameNs + count );
+    }
+
+    FrameSummary summary = { frames.size(), 0.0, 0.0, 0.0, 0.0 };
+    if ( frames.empty() )
+        return summary;
+
+    // Nearest rank percentiles.
+    std::sort( frames.begin(), frames.end() );
+    auto percentile = [&frames]( double p ) {
+        const size_t rank = static_cast<size_t>( p * ( frames.size() - 1 ) + 0.5 );
+        return frames[ rank ] * 1e-6;
+    };
+    summary.p50Ms = percentile( 0.50 );
+    summary.p95Ms = percentile( 0.95 );
+    summary.p99Ms = percentile( 0.99 );
+    summary.maxMs = frames.back() * 1e-6;
+    return summary;
+}
+
+bool profiler::write_chrome_trace( const char* path )
+{
+    FILE* pFile = fopen( path, "w" );
+    if ( !pFile )
+    {
+        __builtin_printf("Failed to open %s for writing. \n\n", path);
+        return false;
+    }
+
+    fputs( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", pFile );
+    bool first = true;
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+    for ( const std::unique_ptr<ThreadRing>& pRing : reg.rings )
+    {
+        if ( !pRing->threadName.empty() )
+        {
+            fprintf( pFile, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", pRing->threadId );
+            write_json_string( pFile, pRing->threadName.c_str() );
+            fputs( "}}", pFile );
+            first = false;
+        }
+
+        // Copy what the ring holds, then drop whatever the owner may have overwritten meanwhile.
+        const uint64_t head = pRing->head.load( std::memory_order_acquire );
+        const uint64_t begin = head > kRingCapacity ? head - kRingCapacity : 0;
+
+        std::vector<std::pair<const char*, std::pair<uint64_t, uint64_t>>> events;
+        events.reserve( static_cast<size_t>( head - begin ) );
+        for ( uint64_t i = begin; i < head; ++i )
+        {
+            const Event& event = pRing->events[ i & ( kRingCapacity - 1 ) ];
+            events.push_back( { event.name.load( std::memory_order_relaxed ),
+                                { event.start.load( std::memory_order_relaxed ), event.end.load( std::memory_order_relaxed ) } } );
+        }
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+        const uint64_t headAfter = pRing->head.load( std::memory_order_relaxed );
+        const uint64_t firstIntact = headAfter + 1 > kRingCapacity ? headAfter + 1 - kRingCapacity : 0;
+
+        for ( uint64_t i = std::max( begin, firstIntact ); i < head; ++i )
+        {
+            const auto& event = events[ static_cast<size_t>( i - begin ) ];
+            fprintf( pFile, "%s{\"ph\":\"X\",\"name\":", first ? "" : ",\n" );
+            write_json_string( pFile, event.first );
+            fprintf( pFile, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                     pRing->threadId, event.second.first * 1e-3, ( event.second.second - event.second.first ) * 1e-3 );
+            first = false;
+        }
+    }
+
+    fputs( "\n]}\n", pFile );
+    if ( fclose( pFile ) != 0 )
+    {
+        __builtin_printf("Failed to write %s. \n\n", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Scoped CPU zones and frame timing.
+//
+//   void Renderer::draw( ... )
+//   {
+//       PROFILE_FRAME();
+//       PROFILE_ZONE( "Renderer::draw" );
+//       ...
+//   }
+//
+// Each thread records into its own fixed size ring, so recording takes no
+// locks; once a ring is full the oldest zones are overwritten. Zone names must
+// be string literals, only the pointer is kept. Building with
+// PROFILER_ENABLED=0 (the ENABLE_PROFILER CMake option) compiles the macros
+// out; the export functions still exist and report nothing.
+namespace profiler
+{
+
+struct FrameSummary
+{
+    size_t frames;
+    double p50Ms;
+    double p95Ms;
+    double p99Ms;
+    double maxMs;
+};
+
+// Nanoseconds since the profiler's first use.
+uint64_t now_ns();
+
+// Shown as the thread's name in the trace.
+void set_thread_name( const char* name );
+
+void record( const char* name, uint64_t startNs, uint64_t endNs );
+
+// Marks the start of a frame. The time between marks feeds frame_summary().
+void frame_mark();
+
+// Percentiles over the last kFrameHistory frames.
+constexpr size_t kFrameHistory = 512;
+FrameSummary frame_summary();
+
+// Writes every zone still held in the thread rings as Chrome trace event
+// JSON, which chrome://tracing and Perfetto open directly.
+bool write_chrome_trace( const char* path );
+
+class Zone
+{
+    public:
+        explicit Zone( const char* name ) : m_name( name ), m_start( now_ns() ) { }
+        ~Zone() { record( m_name, m_start, now_ns() ); }
+
+        Zone( const Zone& ) = delete;
+        Zone& operator=( const Zone& ) = delete;
+
+    private:
+        const char* m_name;
+        uint64_t m_start;
+};
+
+}
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#if PROFILER_ENABLED
+#define PROFILE_CONCAT_IMPL( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_IMPL( a, b )
+#define PROFILE_ZONE( name ) profiler::Zone PROFILE_CONCAT( profileZone, __LINE__ )( name )
+#define PROFILE_FRAME() profiler::frame_mark()
+#define PROFILE_THREAD( name ) profiler::set_thread_name( name )
+#else
+#define PROFILE_ZONE( name ) do { } while ( 0 )
+#define PROFILE_FRAME() do { } while ( 0 )
+#define PROFILE_THREAD( name ) do { } while ( 0 )
+#endif
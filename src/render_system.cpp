@@ -0,0 +1,107 @@
+#include "render_system.hpp"
+#include "culling.hpp"
+#include "job_system.hpp"
+#include "math.hpp"
+#include "profiler.hpp"
+
+namespace
+{
+
+void pack( const TransformComponent& transform, const ColorComponent& color, PackedInstance& out )
+{
+    const math::float4x4 world = math::make_trs( transform.position, transform.rotation, transform.scale );
+    pack_instance( reinterpret_cast<const float*>( &world ), &color.color.x, out );
+}
+
+void pack( const TransformComponent& transform, const ColorComponent& color, CompactInstance& out )
+{
+    pack_instance_compact( &transform.position.x, &transform.rotation.x, &transform.scale.x, &color.color.x, out );
+}
+
+}
+
+RenderSystem::RenderSystem( EntityWorld& world )
+    : m_world( world )
+    , m_transform( world.register_component<TransformComponent>() )
+    , m_color( world.register_component<ColorComponent>() )
+    , m_bounds( world.register_component<BoundsComponent>() )
+    , m_mesh( world.register_component<MeshComponent>() )
+{ }
+
+EntityWorld::ComponentMask RenderSystem::renderable_mask() const
+{
+    return EntityWorld::mask( m_transform ) | EntityWorld::mask( m_color ) | EntityWorld::mask( m_bounds ) | EntityWorld::mask( m_mesh );
+}
+
+size_t RenderSystem::fill_instances( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, PackedInstance* pOut )
+{
+    return fill( jobs, frustum, mesh, pOut );
+}
+
+size_t RenderSystem::fill_instances( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, CompactInstance* pOut )
+{
+    return fill( jobs, frustum, mesh, pOut );
+}
+
+template<typename Instance>
+size_t RenderSystem::fill( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, Instance* pOut )
+{
+    PROFILE_ZONE( "RenderSystem::fill_instances" );
+
+    m_chunks.clear();
+    m_world.query( renderable_mask(), m_chunks );
+
+    m_rowOffsets.resize( m_chunks.size() );
+    m_passed.resize( m_chunks.size() );
+    size_t rowCount = 0;
+    for ( size_t c = 0; c < m_chunks.size(); ++c )
+    {
+        m_rowOffsets[ c ] = rowCount;
+        rowCount += m_chunks[ c ].count;
+    }
+    m_rows.resize( rowCount );
+
+    // Culling first, so that the output can be written densely and in a fixed order.
+    jobs.parallel_for( m_chunks.size(), 1, [&]( size_t begin, size_t end ) {
+        for ( size_t c = begin; c < end; ++c )
+        {
+            const EntityWorld::Chunk& chunk = m_chunks[ c ];
+            const TransformComponent* pTransforms = chunk.get<TransformComponent>( m_transform );
+            const BoundsComponent* pBounds = chunk.get<BoundsComponent>( m_bounds );
+            const MeshComponent* pMeshes = chunk.get<MeshComponent>( m_mesh );
+            uint32_t* pRows = m_rows.data() + m_rowOffsets[ c ];
+
+            size_t passed = 0;
+            for ( size_t row = 0; row < chunk.count; ++row )
+            {
+                if ( pMeshes[ row ].mesh == mesh && sphere_visible( frustum, pTransforms[ row ].position, pBounds[ row ].radius ) )
+                    pRows[ passed++ ] = static_cast<uint32_t>( row );
+            }
+            m_passed[ c ] = passed;
+        }
+    } );
+
+    size_t instanceCount = 0;
+    for ( size_t& passed : m_passed )
+    {
+        const size_t count = passed;
+        passed = instanceCount;
+        instanceCount += count;
+    }
+
+    jobs.parallel_for( m_chunks.size(), 1, [&]( size_t begin, size_t end ) {
+        for ( size_t c = begin; c < end; ++c )
+        {
+            const EntityWorld::Chunk& chunk = m_chunks[ c ];
+            const TransformComponent* pTransforms = chunk.get<TransformComponent>( m_transform );
+            const ColorComponent* pColors = chunk.get<ColorComponent>( m_color );
+            const uint32_t* pRows = m_rows.data() + m_rowOffsets[ c ];
+
+            const size_t first = m_passed[ c ];
+            const size_t count = ( c + 1 < m_chunks.size() ? m_passed[ c + 1 ] : instanceCount ) - first;
+            for ( size_t k = 0; k < count; ++k )
+                pack( pTransforms[ pRows[ k ] ], pColors[ pRows[ k ] ], pOut[ first + k ] );
+        }
+    } );
+    return instanceCount;
+}
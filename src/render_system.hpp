@@ -0,0 +1,73 @@
+#pragma once
+
+#include "entity_world.hpp"
+#include "instance_store.hpp"
+#include "math_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Frustum;
+
+// Components of a renderable entity.
+struct TransformComponent
+{
+    math::float3 position;
+    math::quat rotation;
+    math::float3 scale;
+};
+
+struct ColorComponent
+{
+    math::float4 color;
+};
+
+// Sphere around the position that encloses the scaled mesh.
+struct BoundsComponent
+{
+    float radius;
+};
+
+struct MeshComponent
+{
+    uint32_t mesh;
+};
+
+// Turns every entity with all four components into instance data for the
+// shaders, chunk by chunk on the job system.
+class RenderSystem
+{
+    public:
+        // Registers the components with `world`, which must outlive the system.
+        explicit RenderSystem( EntityWorld& world );
+
+        EntityWorld::ComponentId transform_component() const { return m_transform; }
+        EntityWorld::ComponentId color_component() const { return m_color; }
+        EntityWorld::ComponentId bounds_component() const { return m_bounds; }
+        EntityWorld::ComponentId mesh_component() const { return m_mesh; }
+        EntityWorld::ComponentMask renderable_mask() const;
+
+        // Packs the entities showing `mesh` whose bounds intersect the frustum
+        // densely into pOut, in query order, and returns how many it wrote. pOut
+        // needs room for every renderable entity.
+        size_t fill_instances( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, PackedInstance* pOut );
+        size_t fill_instances( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, CompactInstance* pOut );
+
+    private:
+        template<typename Instance>
+        size_t fill( JobSystem& jobs, const Frustum& frustum, uint32_t mesh, Instance* pOut );
+
+        EntityWorld& m_world;
+        EntityWorld::ComponentId m_transform;
+        EntityWorld::ComponentId m_color;
+        EntityWorld::ComponentId m_bounds;
+        EntityWorld::ComponentId m_mesh;
+
+        // Scratch of fill(), per chunk of the query: where its rows start in m_rows,
+        // how many of them passed, and then where its instances start in the output.
+        std::vector<EntityWorld::Chunk> m_chunks;
+        std::vector<size_t> m_rowOffsets;
+        std::vector<size_t> m_passed;
+        std::vector<uint32_t> m_rows;
+};
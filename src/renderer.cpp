@@ -1,84 +1,179 @@
 #include "renderer.hpp"
-#include "utility.hpp"
 #include "math.hpp"
+#include "culling.hpp"
+#include "mesh.hpp"
+#include "mesh_simplify.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// Offsets bound with setVertexBuffer must be 256 byte aligned for constant data on macOS.
+constexpr size_t kFrameAlignment = 256;
+
+constexpr math::float3 kObjectPosition = { 0.f, 0.f, -10.f };
+
+// Half the diagonal of the unit cube in build_buffers().
+constexpr float kCubeRadius = 0.8660254f;
+
+#if INSTANCE_FORMAT_COMPACT
+using GpuInstance = CompactInstance;
+#else
+using GpuInstance = PackedInstance;
+#endif
+
+static_assert( sizeof(GpuInstance) == sizeof(shader_types::InstanceData), "GpuInstance out of sync with InstanceData" );
+
+enum ShaderFunction : uint16_t
+{
+    kMainVertex,
+    kMainFragment
+};
+
+constexpr const char* kShaderFunctionNames[] = { "main_vertex", "main_fragment" };
+
+#define SHADER_MACRO_STRING( x ) #x
+#define SHADER_MACRO_VALUE( x ) SHADER_MACRO_STRING( x )
+
+// In the order CMake passes them to the offline compile, which keys the shader cache.
+constexpr gpu::ShaderMacro kShaderMacros[] = {
+#if INSTANCE_FORMAT_COMPACT
+    { "INSTANCE_FORMAT_COMPACT", "1" },
+#else
+    { "INSTANCE_FORMAT_COMPACT", "0" },
+#endif
+    { "VERTEX_FORMAT", SHADER_MACRO_VALUE( VERTEX_FORMAT ) }
+};
+
+// Snorm16 positions leave the vertex shader in units of the mesh radius.
+constexpr bool kSnormPositions = shader_types::kVertexFormat == MeshVertexFormat::Snorm16Octahedral
+                              || shader_types::kVertexFormat == MeshVertexFormat::Snorm16_1010102;
+
+PipelineDesc main_pipeline_desc()
+{
+    PipelineDesc desc;
+    desc.vertexFunction = kMainVertex;
+    desc.fragmentFunction = kMainFragment;
+    desc.colorFormat = static_cast<uint16_t>( gpu::PixelFormat::BGRA8Unorm_sRGB );
+    desc.depthFormat = static_cast<uint16_t>( gpu::PixelFormat::Depth16Unorm );
+    return desc;
+}
+
+constexpr size_t align_up( size_t size, size_t alignment )
+{
+    return ( size + alignment - 1 ) & ~( alignment - 1 );
+}
+
+math::float4x4 instance_transform( const InstanceStore& store, size_t i )
+{
+    using S = InstanceStore::Stream;
 
-Renderer::Renderer( MTL::Device* pDevice )
-    : p_device( pDevice->retain() )
-    , p_cmdQ( p_device->newCommandQueue() )
+    const math::float3 position = { store.stream( S::PositionX )[ i ], store.stream( S::PositionY )[ i ], store.stream( S::PositionZ )[ i ] };
+    const math::quat rotation = { store.stream( S::RotationX )[ i ], store.stream( S::RotationY )[ i ], store.stream( S::RotationZ )[ i ], store.stream( S::RotationW )[ i ] };
+    const math::float3 scale = { store.stream( S::ScaleX )[ i ], store.stream( S::ScaleY )[ i ], store.stream( S::ScaleZ )[ i ] };
+    return math::make_trs( position, rotation, scale );
+}
+
+// The coarsest level whose error, seen from the origin of view space, projects to at most maxScreenError.
+// The error is measured where it looks largest, at the point of the bounds nearest the eye.
+uint8_t select_instance_lod( const MeshLod* pLods, size_t lodCount, const InstanceStore& store, size_t i,
+                             const math::float4x4& viewTransform, float projectionScale, float maxScreenError )
+{
+    using S = InstanceStore::Stream;
+
+    const math::float4 position = viewTransform * math::float4 { store.stream( S::PositionX )[ i ], store.stream( S::PositionY )[ i ], store.stream( S::PositionZ )[ i ], 1.f };
+    const float distance = math::length( position.xyz() ) - store.stream( S::BoundingRadius )[ i ];
+    if ( distance <= 0.f )
+        return 0;
+
+    const float scale = std::max( { store.stream( S::ScaleX )[ i ], store.stream( S::ScaleY )[ i ], store.stream( S::ScaleZ )[ i ] } );
+    return static_cast<uint8_t>( select_lod( pLods, lodCount, scale * projectionScale / distance, maxScreenError ) );
+}
+
+}
+
+Renderer::Renderer( gpu::Device* pDevice, const char* meshPath )
+    : p_device( pDevice )
+    , m_meshPath( meshPath ? meshPath : "" )
+    , m_frameRing( frame_ring_capacity(), Renderer::kMaxFramesInFlight )
+    , m_occlusion( Renderer::kOcclusionSize, Renderer::kOcclusionSize )
+    , m_frameIndex( 0 )
+    , m_uploads( Renderer::kMaxFramesInFlight, Renderer::kUploadMergeGap )
+    , m_uploadStats {}
+    , m_cullStats {}
+    , m_sceneStats {}
+    , m_pipelines( [this]( const PipelineDesc& desc ) { return p_device->new_pipeline( desc ); },
+                   []( gpu::Pipeline* pState ) { if ( pState ) pState->release(); } )
 { 
-    m_frame = 0;
+    PROFILE_ZONE( "Renderer::Renderer" );
+
     m_angle = 0.f;
-    m_semaphore = dispatch_semaphore_create(Renderer::kMaxFramesInFlight);
+    p_frameFence = p_device->new_fence(Renderer::kMaxFramesInFlight);
 
     build_shaders();
     build_buffers();
     build_depth_stencil_states();
+    build_instances();
+
+    // Compiled on the cache's thread while the buffers and instances were built.
+    p_pipelineState = m_pipelines.acquire( main_pipeline_desc() );
+    assert( p_pipelineState );
 }
 
 Renderer::~Renderer()
 {
-    p_depthStencilState->release();
+    // Buffers may only go once the GPU is done with every frame in flight.
+    for ( size_t i = 0; i < kMaxFramesInFlight; ++i )
+        p_frameFence->wait();
+    p_frameFence->release();
 
-    for (size_t i = 0; i < Renderer::kMaxFramesInFlight; ++i)
-    {
-        p_instanceBuffer[i]->release();
-        p_cameraBuffer[i]->release();
-    }
+    p_depthStencilState->release();
 
+    p_frameBuffer->release();
+    for ( gpu::Buffer* pBuffer : p_instanceBuffers )
+        pBuffer->release();
     p_indexBuffer->release();
 
-    p_shaderLibrary->release();
+    m_pipelines.clear();
 
     p_vertexPositions->release();
-    p_pipelineState->release();
-
-    p_cmdQ->release();
-    p_device->release();
 }
 
 void Renderer::build_shaders()
 {
-    using NS::StringEncoding::UTF8StringEncoding;
+    PROFILE_ZONE( "Renderer::build_shaders" );
 
-    m_shaderSrc = Utility::read_source("shader/program.metal");
-    const char* shaderSrc = m_shaderSrc.data();
-
-    NS::Error* pError {nullptr};
-    p_shaderLibrary = p_device->newLibrary( NS::String::string(shaderSrc, UTF8StringEncoding), nullptr, &pError );
-    if ( !p_shaderLibrary )
-    {
-        __builtin_printf("Library creation from shader source failed. \n");
-        __builtin_printf("%s \n\n", pError->localizedDescription()->utf8String());
+    if ( !p_device->load_program( "shader/program.metal",
+                                  kShaderFunctionNames, sizeof(kShaderFunctionNames) / sizeof(kShaderFunctionNames[0]),
+                                  kShaderMacros, sizeof(kShaderMacros) / sizeof(kShaderMacros[0]) ) )
         assert( false );
-    }
 
-    MTL::Function* fnVertex             = p_shaderLibrary->newFunction( NS::String::string("main_vertex", UTF8StringEncoding) );
-    MTL::Function* fnFragment           = p_shaderLibrary->newFunction( NS::String::string("main_fragment", UTF8StringEncoding) );
-    MTL::RenderPipelineDescriptor* pRpd = MTL::RenderPipelineDescriptor::alloc()->init();
+    m_pipelines.prewarm( main_pipeline_desc() );
+}
+
+void Renderer::build_buffers()
+{
+    PROFILE_ZONE( "Renderer::build_buffers" );
+
+    p_frameBuffer = p_device->new_buffer( m_frameRing.capacity() );
 
-    pRpd->setVertexFunction( fnVertex );
-    pRpd->setFragmentFunction( fnFragment );
-    pRpd->colorAttachments()->object(0)->setPixelFormat( MTL::PixelFormat::PixelFormatBGRA8Unorm_sRGB );
-    pRpd->setDepthAttachmentPixelFormat( MTL::PixelFormat::PixelFormatDepth16Unorm );
+    for ( gpu::Buffer*& pBuffer : p_instanceBuffers )
+        pBuffer = p_device->new_buffer( kNumInstances * sizeof(shader_types::InstanceData) );
 
-    p_pipelineState = p_device->newRenderPipelineState( pRpd, &pError );
-    if ( !p_pipelineState )
+    if ( !m_meshPath.empty() )
     {
-        __builtin_printf("RenderPipelineState creation failed. \n");
-        __builtin_printf("%s \n\n", pError->localizedDescription()->utf8String());
-        assert( false );
+        if ( load_mesh( m_meshPath.c_str() ) )
+            return;
+        __builtin_printf("Could not load %s, drawing the cube instead. \n\n", m_meshPath.c_str());
     }
 
-    fnVertex->release();
-    fnFragment->release();
-    pRpd->release();
-}
-
-void Renderer::build_buffers()
-{
     constexpr float s = 0.5f;
 
-    constexpr shader_types::VertexData verts[] = {
+    constexpr MeshData::Vertex verts[] = {
         //   Positions          Normals
         { { -s, -s, +s }, { 0.f,  0.f,  1.f } },
         { { +s, -s, +s }, { 0.f,  0.f,  1.f } },
@@ -120,132 +215,458 @@ void Renderer::build_buffers()
         20, 21, 22, 22, 23, 20, /* bottom */
     };
 
-    constexpr size_t vertexDataSize = sizeof( verts );
+    constexpr size_t vertexCount = sizeof( verts ) / sizeof( verts[0] );
+    constexpr size_t vertexDataSize = vertexCount * sizeof(shader_types::VertexData);
     constexpr size_t indexDataSize = sizeof( indices );
 
-    p_vertexPositions = p_device->newBuffer( vertexDataSize, MTL::ResourceStorageModeManaged );
-    p_indexBuffer = p_device->newBuffer( indexDataSize, MTL::ResourceStorageModeManaged );
+    p_vertexPositions = p_device->new_buffer( vertexDataSize );
+    p_indexBuffer = p_device->new_buffer( indexDataSize );
 
-    memcpy( p_vertexPositions->contents(), verts, vertexDataSize );
+    m_positionScale = kSnormPositions ? kCubeRadius : 1.f;
+    encode_vertices( verts, vertexCount, shader_types::kVertexFormat, m_positionScale, p_vertexPositions->contents() );
     memcpy( p_indexBuffer->contents(), indices, indexDataSize );
 
-    p_vertexPositions->didModifyRange( NS::Range::Make( 0, p_vertexPositions->length() ) );
-    p_indexBuffer->didModifyRange( NS::Range::Make( 0, p_indexBuffer->length() ) );
+    p_vertexPositions->did_modify_range( 0, p_vertexPositions->length() );
+    p_indexBuffer->did_modify_range( 0, p_indexBuffer->length() );
+
+    m_indexType = gpu::IndexType::UInt16;
+    m_meshRadius = kCubeRadius / m_positionScale;
+    m_lods.assign( 1, { 0, sizeof( indices ) / sizeof( indices[0] ), 0, 0, 0.f, 0 } );
+
+    m_occluderPositions.clear();
+    for ( const MeshData::Vertex& vertex : verts )
+        for ( float coordinate : vertex.position )
+            m_occluderPositions.push_back( coordinate / m_positionScale );
+    m_occluderIndices.assign( indices, indices + sizeof( indices ) / sizeof( indices[0] ) );
+}
 
-    for (size_t i = 0; i < Renderer::kMaxFramesInFlight; ++i)
+bool Renderer::load_mesh( const char* path )
+{
+    const MeshFile mesh( path );
+    if ( !mesh.is_valid() )
+        return false;
+
+    const MeshHeader& header = mesh.header();
+    if ( header.indexCount == 0 || header.bounds.radius <= 0.f )
+    {
+        __builtin_printf("%s has nothing to draw. \n\n", path);
+        return false;
+    }
+
+    // The sections are laid out the way the buffers want them, so this is one copy out of the page cache
+    // unless the vertices are in another format than the shaders were built for. They are decoded once
+    // either way, for the occluder's positions.
+    p_vertexPositions = p_device->new_buffer( size_t( header.vertexCount ) * sizeof(shader_types::VertexData) );
+    p_indexBuffer = p_device->new_buffer( mesh.index_data_size() );
+
+    m_positionScale = kSnormPositions ? header.bounds.radius : 1.f;
+    const MeshVertexFormat format = static_cast<MeshVertexFormat>( header.vertexFormat );
+    std::vector<MeshData::Vertex> vertices( header.vertexCount );
+    decode_vertices( mesh.vertex_data(), vertices.size(), format, header.bounds.radius, vertices.data() );
+    if ( format == shader_types::kVertexFormat )
+        memcpy( p_vertexPositions->contents(), mesh.vertex_data(), mesh.vertex_data_size() );
+    else
+        encode_vertices( vertices.data(), vertices.size(), shader_types::kVertexFormat, m_positionScale, p_vertexPositions->contents() );
+    memcpy( p_indexBuffer->contents(), mesh.index_data(), mesh.index_data_size() );
+
+    p_vertexPositions->did_modify_range( 0, p_vertexPositions->length() );
+    p_indexBuffer->did_modify_range( 0, p_indexBuffer->length() );
+
+    m_indexType = header.indexSize == 2 ? gpu::IndexType::UInt16 : gpu::IndexType::UInt32;
+    m_meshlets.assign( mesh.meshlets(), mesh.meshlets() + header.meshletCount );
+    if ( header.lodCount > 0 )
+        m_lods.assign( mesh.lods(), mesh.lods() + header.lodCount );
+    else
+        m_lods.assign( 1, { 0, header.indexCount, 0, header.meshletCount, 0.f, 0 } );
+
+    // Everything the instances see is in the units the vertex shader outputs.
+    const float toUnits = 1.f / m_positionScale;
+    m_meshRadius = header.bounds.radius * toUnits;
+    for ( Meshlet& meshlet : m_meshlets )
+    {
+        for ( float& c : meshlet.center )
+            c *= toUnits;
+        meshlet.radius *= toUnits;
+    }
+    for ( MeshLod& lod : m_lods )
+        lod.error *= toUnits;
+
+    // Level 0 is the mesh itself, so it hides nothing that the mesh doesn't.
+    m_occluderPositions.clear();
+    m_occluderPositions.reserve( vertices.size() * 3 );
+    for ( const MeshData::Vertex& vertex : vertices )
+        for ( float coordinate : vertex.position )
+            m_occluderPositions.push_back( coordinate * toUnits );
+    const MeshLod& full = m_lods[0];
+    m_occluderIndices.resize( full.indexCount );
+    for ( uint32_t k = 0; k < full.indexCount; ++k )
     {
-        p_instanceBuffer[i] = p_device->newBuffer( kMaxFramesInFlight * kNumInstances * sizeof(shader_types::InstanceData), MTL::ResourceStorageModeManaged );
-        p_cameraBuffer[i] = p_device->newBuffer( kMaxFramesInFlight * sizeof(shader_types::CameraData), MTL::ResourceStorageModeManaged );
+        const uint32_t i = full.indexOffset + k;
+        m_occluderIndices[ k ] = header.indexSize == 2 ? static_cast<const uint16_t*>( mesh.index_data() )[ i ]
+                                                       : static_cast<const uint32_t*>( mesh.index_data() )[ i ];
     }
+    return true;
 }
 
-void Renderer::build_depth_stencil_states()
+size_t Renderer::frame_ring_capacity()
 {
-    MTL::DepthStencilDescriptor* pDepthDesc = MTL::DepthStencilDescriptor::alloc()->init();
-    pDepthDesc->setDepthCompareFunction( MTL::CompareFunction::CompareFunctionLess );
-    pDepthDesc->setDepthWriteEnabled(true);
+    const size_t frameBytes = align_up( kNumInstances * sizeof(uint32_t), kFrameAlignment )
+                            + align_up( sizeof(shader_types::CameraData), kFrameAlignment );
 
-    p_depthStencilState = p_device->newDepthStencilState( pDepthDesc );
-    pDepthDesc->release();
+    // One spare frame covers the padding lost when an allocation wraps around.
+    return ( kMaxFramesInFlight + 1 ) * frameBytes;
 }
 
-void Renderer::draw( MTK::View* pView )
+void Renderer::build_depth_stencil_states()
 {
-    using simd::float4x4, simd::float4;
+    p_depthStencilState = p_device->new_depth_stencil_state( gpu::CompareFunction::Less, true );
+}
 
-    NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc()->init();
+void Renderer::build_instances()
+{
+    PROFILE_ZONE( "Renderer::build_instances" );
 
-    m_frame = (m_frame + 1) % Renderer::kMaxFramesInFlight;
-    MTL::Buffer* pCurrentFrame = p_instanceBuffer[m_frame];
+    constexpr float scl = 0.2f;
+    // Meshes are fitted into the cube's bounding sphere, so any of them fills the grid the same way.
+    const float meshScale = scl * kCubeRadius / m_meshRadius;
+
+    m_instances.resize( kNumInstances );
+    m_visibleInstances.resize( kNumInstances );
+    m_chunkVisible.resize( ( kNumInstances + kInstanceGrain - 1 ) / kInstanceGrain );
+    m_chunkRanges.resize( m_chunkVisible.size() );
+    m_uploads.resize( kNumInstances );
+    m_instanceRanges.resize( m_meshlets.empty() ? 0 : kNumInstances );
+    m_instanceMeshlets.resize( m_meshlets.empty() ? 0 : kNumInstances );
+    m_instanceLods.resize( kNumInstances );
+    m_instanceNodes.resize( kNumInstances );
+
+    constexpr math::quat identity = { 0.f, 0.f, 0.f, 1.f };
+    m_scene.clear();
+    const SceneGraph::Node root = m_scene.add_node( SceneGraph::kNoParent, kObjectPosition, identity, { 1.f, 1.f, 1.f } );
+    SceneGraph::Node row = SceneGraph::kNoParent;
+    for (size_t i = 0; i < kNumInstances; ++i)
+    {
+        const size_t ix = i % kInstanceRows;
+        const size_t iy = ( i / kInstanceRows ) % kInstanceRows;
+        const size_t iz = i / ( kInstanceRows * kInstanceRows );
 
-    MTL::CommandBuffer* pCmd = p_cmdQ->commandBuffer();
+        float x = ((float)ix - (float)kInstanceRows/2.f) * (2.f * scl) + scl;
+        float y = ((float)iy - (float)kInstanceColumns/2.f) * (2.f * scl) + scl;
+        float z = ((float)iz - (float)kInstanceDepth/2.f) * (2.f * scl);
+        if ( ix == 0 )
+            row = m_scene.add_node( root, { 0.f, y, z }, identity, { 1.f, 1.f, 1.f } );
+        m_instanceNodes[ i ] = m_scene.add_node( row, { x, 0.f, 0.f }, identity, { meshScale, meshScale, meshScale } );
+        m_scene.bind_instance( m_instanceNodes[ i ], static_cast<uint32_t>( i ), m_meshRadius );
 
-    dispatch_semaphore_wait( m_semaphore, DISPATCH_TIME_FOREVER );
-    pCmd->addCompletedHandler( [this] (MTL::CommandBuffer* pCmd) {
-        dispatch_semaphore_signal( this->m_semaphore );
-    } );
+        float iDivNumInstances = i / (float)kNumInstances;
+        float r = iDivNumInstances;
+        float g = 1.0f - r;
+        float b = sinf( M_PI * 2.0f * iDivNumInstances );
+        m_instances.set_color( i, r, g, b, 1.0f );
+    }
+}
+
+void Renderer::draw( gpu::Target& target )
+{
+    PROFILE_FRAME();
+    PROFILE_ZONE( "Renderer::draw" );
+
+    {
+        PROFILE_ZONE( "wait for frame" );
+        p_frameFence->wait();
+    }
+    m_frameRing.begin_frame();
+
+    FrameRing::Allocation visibleAlloc;
+    FrameRing::Allocation cameraAlloc;
+    if ( !m_frameRing.allocate( kNumInstances * sizeof(uint32_t), kFrameAlignment, visibleAlloc )
+         || !m_frameRing.allocate( sizeof(shader_types::CameraData), kFrameAlignment, cameraAlloc ) )
+    {
+        // The ring is sized for kMaxFramesInFlight frames, so this means the
+        // throttling above was bypassed. Drop the frame rather than write over
+        // memory the GPU may still be reading.
+        __builtin_printf("Frame ring exhausted (%zu of %zu bytes in use), skipping frame. \n",
+                         m_frameRing.bytes_in_use(), m_frameRing.capacity());
+        m_frameRing.abandon_frame();
+        p_frameFence->signal();
+        return;
+    }
+
+    // The fence guarantees the GPU is done with the copy written kMaxFramesInFlight frames ago.
+    const size_t copy = m_frameIndex;
+    m_frameIndex = ( m_frameIndex + 1 ) % kMaxFramesInFlight;
+    gpu::Buffer* pInstanceBuffer = p_instanceBuffers[ copy ];
+    auto pInstanceData = reinterpret_cast<GpuInstance*>( pInstanceBuffer->contents() );
 
     m_angle += 0.002f;
-    constexpr float scl = 0.2f;
 
-    auto pInstanceData = reinterpret_cast<shader_types::InstanceData *>(pCurrentFrame->contents());
+    auto pFrameData = reinterpret_cast<uint8_t*>( p_frameBuffer->contents() );
+
+    // Orbit the whole grid around objectPosition. This goes in the camera's world
+    // transform so that it does not dirty every instance.
+    const math::float3 objectPosition = kObjectPosition;
+    math::quat orbit            = math::make_quat_Y_rotate(-m_angle) * math::make_quat_X_rotate(m_angle * 0.5f);
+    math::float4x4 fullRotation = math::mul_affine( math::make_trs( objectPosition, orbit, { 1.f, 1.f, 1.f } ),
+                                                    math::make_translate( -objectPosition ) );
+
+    auto pCameraData = reinterpret_cast<shader_types::CameraData*>( pFrameData + cameraAlloc.offset );
+    pCameraData->perspectiveTransform = math::make_perspective( 45.f * M_PI / 180.f, 1.f, 0.01f, 500.f );
+    pCameraData->worldTransform = fullRotation;
+    pCameraData->worldNormalTransform = math::discard_translation(pCameraData->worldTransform);
+    p_frameBuffer->did_modify_range( cameraAlloc.offset, cameraAlloc.size );
 
-    simd::float3 objectPosition = { 0.f, 0.f, -10.f };
-    simd::float4x4 rt           = math::make_translate(objectPosition);
-    simd::float4x4 rr1          = math::make_Y_rotate(-m_angle);
-    simd::float4x4 rr2          = math::make_X_rotate(m_angle * 0.5f);
-    simd::float4x4 rtInv        = math::make_translate( {-objectPosition.x, -objectPosition.y, -objectPosition.z} );
-    simd::float4x4 fullRotation = rt * rr1 * rr2 * rtInv;
+    const math::float4x4 clipTransform = pCameraData->perspectiveTransform * pCameraData->worldTransform;
+    const Frustum frustum = make_frustum( clipTransform );
 
-    size_t ix = 0;
-    size_t iy = 0;
-    size_t iz = 0;
-    for (size_t i = 0; i < Renderer::kNumInstances; ++i)
+    // Instances are packed without a parent, the camera applies fullRotation.
+#if !INSTANCE_FORMAT_COMPACT
+    const math::float4x4 identity = math::make_identity();
+    const float* pParent = reinterpret_cast<const float*>( &identity );
+#endif
+
+    const float angle = m_angle;
+    const float projectionScale = pCameraData->perspectiveTransform.columns[1].y;
     {
-        if ( ix == kInstanceRows )
+        PROFILE_ZONE( "animate scene" );
+        m_jobs.parallel_for( kNumInstances, kInstanceGrain, [&]( size_t begin, size_t end ) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t ix = i % kInstanceRows;
+                const size_t iy = ( i / kInstanceRows ) % kInstanceRows;
+
+                math::quat q = math::make_quat_Y_rotate( angle * cosf((float) iy) ) * math::make_quat_Z_rotate( angle * sinf((float) ix) );
+                m_scene.set_local_rotation( m_instanceNodes[ i ], q );
+            }
+        } );
+
+        SceneStats sceneStats = {};
+        sceneStats.nodesUpdated = m_scene.update( m_jobs, &m_instances, kInstanceGrain );
+        sceneStats.nodes = m_scene.size();
+        sceneStats.levels = m_scene.level_count();
+        m_sceneStats = sceneStats;
+    }
+    {
+        PROFILE_ZONE( "cull instances" );
+        m_jobs.parallel_for( kNumInstances, kInstanceGrain, [&]( size_t begin, size_t end ) {
+            m_chunkVisible[ begin / kInstanceGrain ] = cull_spheres( frustum,
+                                                                     m_instances.stream( InstanceStore::PositionX ) + begin,
+                                                                     m_instances.stream( InstanceStore::PositionY ) + begin,
+                                                                     m_instances.stream( InstanceStore::PositionZ ) + begin,
+                                                                     m_instances.stream( InstanceStore::BoundingRadius ) + begin,
+                                                                     end - begin, static_cast<uint32_t>( begin ),
+                                                                     m_visibleInstances.data() + begin );
+        } );
+    }
+
+    size_t inFrustumCount = 0;
+    for ( size_t visible : m_chunkVisible )
+        inFrustumCount += visible;
+
+    // The instances that cover the most of the screen are drawn into the occlusion buffer, the rest are tested
+    // against it before anything is packed for them.
+    const bool occlusion = !m_occluderIndices.empty();
+    if ( occlusion )
+    {
+        PROFILE_ZONE( "rasterize occluders" );
+
+        m_occluders.clear();
+        for ( size_t chunk = 0; chunk < m_chunkVisible.size(); ++chunk )
+            m_occluders.insert( m_occluders.end(), m_visibleInstances.begin() + chunk * kInstanceGrain,
+                                m_visibleInstances.begin() + chunk * kInstanceGrain + m_chunkVisible[ chunk ] );
+
+        auto projected_size = [&]( uint32_t i ) {
+            const math::float4 center = fullRotation * math::float4{ m_instances.stream( InstanceStore::PositionX )[ i ],
+                                                                     m_instances.stream( InstanceStore::PositionY )[ i ],
+                                                                     m_instances.stream( InstanceStore::PositionZ )[ i ], 1.f };
+            return m_instances.stream( InstanceStore::BoundingRadius )[ i ] / std::max( -center.z, 1e-3f );
+        };
+        if ( m_occluders.size() > kMaxOccluders )
         {
-            ix = 0;
-            iy += 1;
+            std::nth_element( m_occluders.begin(), m_occluders.begin() + kMaxOccluders, m_occluders.end(),
+                              [&]( uint32_t a, uint32_t b ) { return projected_size( a ) > projected_size( b ); } );
+            m_occluders.resize( kMaxOccluders );
         }
 
-        if ( iy == kInstanceRows )
+        m_occlusion.clear();
+        for ( uint32_t i : m_occluders )
+            m_occlusion.rasterize( clipTransform * instance_transform( m_instances, i ), m_occluderPositions.data(), m_occluderPositions.size() / 3,
+                                   m_occluderIndices.data(), m_occluderIndices.size() );
+        m_occlusion.build_hierarchy();
+    }
+
+    {
+        PROFILE_ZONE( "update instances" );
+        m_jobs.parallel_for( kNumInstances, kInstanceGrain, [&]( size_t begin, size_t end ) {
+            PROFILE_ZONE( "update instance chunk" );
+
+            const size_t chunk = begin / kInstanceGrain;
+            uint32_t* pVisible = m_visibleInstances.data() + begin;
+            if ( occlusion )
+                m_chunkVisible[ chunk ] = m_occlusion.cull_spheres( clipTransform,
+                                                                    m_instances.stream( InstanceStore::PositionX ),
+                                                                    m_instances.stream( InstanceStore::PositionY ),
+                                                                    m_instances.stream( InstanceStore::PositionZ ),
+                                                                    m_instances.stream( InstanceStore::BoundingRadius ),
+                                                                    pVisible, m_chunkVisible[ chunk ] );
+
+            // Only visible instances that changed since this copy was last written get packed.
+            std::vector<UploadTracker::Range>& ranges = m_chunkRanges[ chunk ];
+            ranges.clear();
+            m_uploads.collect( copy, m_instances.generations(), pVisible, m_chunkVisible[ chunk ], ranges );
+            for ( const UploadTracker::Range& range : ranges )
+            {
+#if INSTANCE_FORMAT_COMPACT
+                pack_instances_compact( m_instances, range.begin, range.end, pInstanceData + range.begin );
+#else
+                pack_instances( m_instances, pParent, range.begin, range.end, pInstanceData + range.begin );
+#endif
+            }
+
+            for ( size_t k = 0; k < m_chunkVisible[ chunk ]; ++k )
+                m_instanceLods[ pVisible[ k ] ] = select_instance_lod( m_lods.data(), m_lods.size(), m_instances, pVisible[ k ],
+                                                                       fullRotation, projectionScale, kLodMaxScreenError );
+        } );
+    }
+
+    // Each chunk compacted in place, gather the survivors into the visible list the shader indexes through,
+    // sorted by level of detail so that each level's instances are one run of it.
+    auto pVisibleData = reinterpret_cast<uint32_t*>( pFrameData + visibleAlloc.offset );
+    size_t lodOffsets[ kMeshMaxLods + 1 ] = {};
+    UploadStats stats = {};
+    for (size_t chunk = 0; chunk < m_chunkVisible.size(); ++chunk)
+    {
+        const uint32_t* pVisible = m_visibleInstances.data() + chunk * kInstanceGrain;
+        for ( size_t k = 0; k < m_chunkVisible[ chunk ]; ++k )
+            lodOffsets[ m_instanceLods[ pVisible[ k ] ] + 1 ]++;
+
+        for ( const UploadTracker::Range& range : m_chunkRanges[ chunk ] )
         {
-            iy = 0;
-            iz += 1;
+            const size_t bytes = ( range.end - range.begin ) * sizeof(shader_types::InstanceData);
+            pInstanceBuffer->did_modify_range( range.begin * sizeof(shader_types::InstanceData), bytes );
+            stats.instancesPacked += range.end - range.begin;
+            stats.rangesFlagged++;
+            stats.bytesUploaded += bytes;
         }
+    }
 
-        simd::float4x4 scale = math::make_scale( (simd::float3){ scl, scl, scl } );
-        simd::float4x4 zrot = math::make_Z_rotate( m_angle * sinf((float) ix));
-        simd::float4x4 yrot = math::make_Y_rotate( m_angle * cosf((float) iy));
+    for ( size_t level = 0; level < kMeshMaxLods; ++level )
+        lodOffsets[ level + 1 ] += lodOffsets[ level ];
+    const size_t visibleCount = lodOffsets[ kMeshMaxLods ];
 
-        float x = ((float)ix - (float)kInstanceRows/2.f) * (2.f * scl) + scl;
-        float y = ((float)iy - (float)kInstanceColumns/2.f) * (2.f * scl) + scl;
-        float z = ((float)iz - (float)kInstanceDepth/2.f) * (2.f * scl);
-        float4x4 translate = math::make_translate( math::add( objectPosition, { x, y, z } ) );
+    size_t lodFill[ kMeshMaxLods ];
+    std::copy( lodOffsets, lodOffsets + kMeshMaxLods, lodFill );
+    for (size_t chunk = 0; chunk < m_chunkVisible.size(); ++chunk)
+    {
+        const uint32_t* pVisible = m_visibleInstances.data() + chunk * kInstanceGrain;
+        for ( size_t k = 0; k < m_chunkVisible[ chunk ]; ++k )
+            pVisibleData[ lodFill[ m_instanceLods[ pVisible[ k ] ] ]++ ] = pVisible[ k ];
+    }
 
-        pInstanceData[ i ].instanceTransform = fullRotation * translate * yrot * zrot * scale;
-        pInstanceData[ i ].instanceNormalTransform = math::discard_translation( pInstanceData[ i ].instanceTransform );
+    if ( visibleCount > 0 )
+        p_frameBuffer->did_modify_range( visibleAlloc.offset, visibleCount * sizeof(uint32_t) );
 
-        float iDivNumInstances = i / (float)kNumInstances;
-        float r = iDivNumInstances;
-        float g = 1.0f - r;
-        float b = sinf( M_PI * 2.0f * iDivNumInstances );
-        pInstanceData[ i ].instanceColor = (float4){ r, g, b, 1.0f };
+    stats.rangesFlagged += visibleCount > 0 ? 2 : 1;
+    stats.bytesUploaded += visibleCount * sizeof(uint32_t) + cameraAlloc.size;
+    m_uploadStats = stats;
 
-        ix++;
+    CullStats cullStats = {};
+    cullStats.instancesVisible = visibleCount;
+    cullStats.instancesOccluded = inFrustumCount - visibleCount;
+    cullStats.occluderTriangles = occlusion ? m_occlusion.triangles_rasterized() : 0;
+    for ( size_t level = 0; level < m_lods.size(); ++level )
+    {
+        const size_t count = lodOffsets[ level + 1 ] - lodOffsets[ level ];
+        cullStats.instancesPerLod[ level ] = count;
+        cullStats.meshletsTested += count * m_lods[ level ].meshletCount;
+        cullStats.drawCalls += count > 0 && m_lods[ level ].meshletCount == 0 ? 1 : 0;
     }
-    pCurrentFrame->didModifyRange(NS::Range::Make(0, pCurrentFrame->length()));
-
-    MTL::Buffer* pCurrentCamera = p_cameraBuffer[ m_frame ];
-    auto pCameraData = reinterpret_cast<shader_types::CameraData*>( pCurrentCamera->contents() );
-    pCameraData->perspectiveTransform = math::make_perspective( 45.f * M_PI / 180.f, 1.f, 0.01f, 500.f );
-    pCameraData->worldTransform = math::make_identity();
-    pCameraData->worldNormalTransform = math::discard_translation(pCameraData->worldTransform);
-    pCurrentCamera->didModifyRange(NS::Range::Make(0, sizeof(shader_types::CameraData)));
+    if ( !m_meshlets.empty() )
+    {
+        PROFILE_ZONE( "cull meshlets" );
+
+        // Meshlet bounds are in mesh space, so the frustum and the eye are brought there instead, once per instance.
+        m_jobs.parallel_for( visibleCount, kMeshletCullGrain, [&]( size_t begin, size_t end ) {
+            for ( size_t slot = begin; slot < end; ++slot )
+            {
+                const MeshLod& lod = m_lods[ m_instanceLods[ pVisibleData[ slot ] ] ];
+                m_instanceRanges[ slot ].clear();
+                m_instanceMeshlets[ slot ] = 0;
+                if ( lod.meshletCount == 0 )
+                    continue;
+
+                const math::float4x4 instanceTransform = instance_transform( m_instances, pVisibleData[ slot ] );
+                const Frustum meshFrustum = make_frustum( clipTransform * instanceTransform );
+                const math::float3 eye = math::inverse_affine( math::mul_affine( fullRotation, instanceTransform ) ).columns[3].xyz();
+
+                m_instanceMeshlets[ slot ] = cull_meshlets( m_meshlets.data() + lod.meshletOffset, lod.meshletCount, meshFrustum, eye,
+                                                              kMeshletMergeGap, m_instanceRanges[ slot ] );
+            }
+        } );
+
+        for ( size_t slot = 0; slot < visibleCount; ++slot )
+        {
+            cullStats.meshletsVisible += m_instanceMeshlets[ slot ];
+            cullStats.drawCalls += m_instanceRanges[ slot ].size();
+        }
+    }
+    m_cullStats = cullStats;
 
+    gpu::CommandBuffer* pCmd = p_device->command_buffer();
+    {
+        PROFILE_ZONE( "encode" );
+        gpu::RenderEncoder* pEnc = pCmd->render_pass( target );
 
-    MTL::RenderPassDescriptor* pRpd = pView->currentRenderPassDescriptor();
-    MTL::RenderCommandEncoder* pEnc = pCmd->renderCommandEncoder(pRpd);
+        pEnc->set_pipeline( p_pipelineState );
+        pEnc->set_depth_stencil_state( p_depthStencilState );
 
-    pEnc->setRenderPipelineState(p_pipelineState);
-    pEnc->setDepthStencilState(p_depthStencilState);
+        pEnc->set_vertex_buffer( p_vertexPositions, 0, 0 );
+        pEnc->set_vertex_buffer( pInstanceBuffer, 0, 1 );
+        pEnc->set_vertex_buffer( p_frameBuffer, cameraAlloc.offset, 2 );
 
-    pEnc->setVertexBuffer( p_vertexPositions, 0, 0 );
-    pEnc->setVertexBuffer( pCurrentFrame, 0, 1);
-    pEnc->setVertexBuffer( pCurrentCamera, 0, 2 );
+        pEnc->set_cull_mode( gpu::CullMode::Back );
+        pEnc->set_front_facing_winding( gpu::Winding::CounterClockwise );
 
-    pEnc->setCullMode( MTL::CullModeBack );
-    pEnc->setFrontFacingWinding( MTL::Winding::WindingCounterClockwise );
+        // Offsetting the visible list makes instance 0 the first one a draw covers: a level's whole run of
+        // instances in one instanced draw, or a single instance per draw of its meshlet ranges.
+        const size_t indexSize = m_indexType == gpu::IndexType::UInt16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        for ( size_t level = 0; level < m_lods.size(); ++level )
+        {
+            const MeshLod& lod = m_lods[ level ];
+            const size_t first = lodOffsets[ level ];
+            const size_t count = lodOffsets[ level + 1 ] - first;
+            if ( count == 0 )
+                continue;
+
+            if ( lod.meshletCount == 0 )
+            {
+                pEnc->set_vertex_buffer( p_frameBuffer, visibleAlloc.offset + first * sizeof(uint32_t), 3 );
+                pEnc->draw_indexed( lod.indexCount, m_indexType, p_indexBuffer, lod.indexOffset * indexSize, count );
+                continue;
+            }
+
+            for ( size_t slot = first; slot < first + count; ++slot )
+            {
+                if ( m_instanceRanges[ slot ].empty() )
+                    continue;
+
+                pEnc->set_vertex_buffer( p_frameBuffer, visibleAlloc.offset + slot * sizeof(uint32_t), 3 );
+                for ( const MeshletRange& range : m_instanceRanges[ slot ] )
+                    pEnc->draw_indexed( range.indexCount, m_indexType, p_indexBuffer, range.indexOffset * indexSize, 1 );
+            }
+        }
 
-    pEnc->drawIndexedPrimitives( MTL::PrimitiveType::PrimitiveTypeTriangle,
-                                 6 * 6, MTL::IndexType::IndexTypeUInt16,
-                                 p_indexBuffer,
-                                 0,
-                                 kNumInstances );
+        pEnc->end_encoding();
+    }
 
-    pEnc->endEncoding();
-    pCmd->presentDrawable(pView->currentDrawable());
-    pCmd->commit();
+    const uint64_t fence = m_frameRing.end_frame();
+    pCmd->add_completed_handler( [this, fence]() {
+        this->m_frameRing.signal( fence );
+        this->p_frameFence->signal();
+    } );
 
-    pool->release();
+    {
+        PROFILE_ZONE( "submit" );
+        pCmd->present( target );
+        pCmd->commit();
+    }
 }
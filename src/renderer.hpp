@@ -1,67 +1,191 @@
-#include <Metal/Metal.hpp>
-#include <MetalKit/MetalKit.hpp>
-#include <simd/simd.h>
+#pragma once
+
+#include "backend.hpp"
+#include "math_types.hpp"
+
+#include "frame_ring.hpp"
+#include "instance_store.hpp"
+#include "job_system.hpp"
+#include "meshlet.hpp"
+#include "occlusion_buffer.hpp"
+#include "pipeline_cache.hpp"
+#include "scene_graph.hpp"
+#include "upload_tracker.hpp"
+
+#include <string>
+#include <vector>
 
 class Renderer
 {
     public:
-        Renderer( MTL::Device* pDevice );
+        // What the last draw() handed to the GPU.
+        struct UploadStats
+        {
+            size_t instancesPacked;
+            size_t rangesFlagged;
+            size_t bytesUploaded;
+        };
+
+        // What the last draw() culled. Meshlets are only tested for levels of detail that have them.
+        struct CullStats
+        {
+            size_t instancesVisible;
+            // In the frustum but behind the occluders.
+            size_t instancesOccluded;
+            size_t occluderTriangles;
+            size_t instancesPerLod[kMeshMaxLods];
+            size_t meshletsTested;
+            size_t meshletsVisible;
+            size_t drawCalls;
+        };
+
+        // What the last draw() recomputed of the scene graph.
+        struct SceneStats
+        {
+            size_t nodes;
+            size_t levels;
+            size_t nodesUpdated;
+        };
+
+        // The device must outlive the renderer. Instances show the cube, or the
+        // mesh container at meshPath (see mesh.hpp) scaled to the cube's size.
+        Renderer( gpu::Device* pDevice, const char* meshPath = nullptr );
         ~Renderer();
 
-        void draw( MTK::View* pView );
+        void draw( gpu::Target& target );
         void build_shaders();
         void build_buffers();
         void build_depth_stencil_states();
+        void build_instances();
+
+        const UploadStats& upload_stats() const { return m_uploadStats; }
+        const CullStats& cull_stats() const { return m_cullStats; }
+        const SceneStats& scene_stats() const { return m_sceneStats; }
+        PipelineCache<gpu::Pipeline*>::Stats pipeline_stats() const { return m_pipelines.stats(); }
 
     private:
-        MTL::Device* p_device;
-        MTL::CommandQueue* p_cmdQ;
+        static size_t frame_ring_capacity();
+        bool load_mesh( const char* path );
 
-        MTL::RenderPipelineState* p_pipelineState;
-        MTL::Buffer* p_vertexPositions;
+        gpu::Device* p_device;
 
-        MTL::Library* p_shaderLibrary;
+        gpu::Pipeline* p_pipelineState;
+        gpu::Buffer* p_vertexPositions;
 
-        int m_frame;
         float m_angle;
-        dispatch_semaphore_t m_semaphore;
+        gpu::Fence* p_frameFence;
 
         static constexpr size_t kInstanceRows = 10;
         static constexpr size_t kInstanceColumns = 10;
         static constexpr size_t kInstanceDepth = 10;
-        static constexpr size_t kMaxFramesInFlight = kInstanceRows * kInstanceColumns * kInstanceDepth;
+        static constexpr size_t kMaxFramesInFlight = 3;
         static constexpr size_t kNumInstances = 32;
+        static constexpr size_t kInstanceGrain = 1024;
+        static constexpr size_t kUploadMergeGap = 4;
+        static constexpr size_t kMeshletCullGrain = 4;
+        static constexpr size_t kMeshletMergeGap = 2;
+        // The occlusion buffer is square, the view's aspect is 1. The occluders are the visible instances
+        // that look largest.
+        static constexpr size_t kOcclusionSize = 128;
+        static constexpr size_t kMaxOccluders = 8;
+        // Largest simplification error an instance may show, in normalized device coordinates (about a pixel at 1000 pixels).
+        static constexpr float kLodMaxScreenError = 0.002f;
+
+        gpu::Buffer* p_indexBuffer;
+        std::string m_meshPath;
+        gpu::IndexType m_indexType;
+        // Bounding sphere radius around the mesh origin, in the units of the vertex shader's positions.
+        float m_meshRadius;
+        // What the vertex shader's positions are in units of: 1, or the radius for snorm16 formats.
+        float m_positionScale;
+        // At least level 0. Visible instances are drawn in one instanced draw per level, except on levels
+        // with meshlets, where each one is drawn as the ranges its meshlets leave.
+        std::vector<MeshLod> m_lods;
+        std::vector<Meshlet> m_meshlets;
+        std::vector<std::vector<MeshletRange>> m_instanceRanges;
+        std::vector<size_t> m_instanceMeshlets;
+        // Indexed by instance, valid for the visible ones.
+        std::vector<uint8_t> m_instanceLods;
 
-        MTL::Buffer* p_indexBuffer;
-        MTL::Buffer* p_instanceBuffer[kMaxFramesInFlight];
+        gpu::DepthStencilState* p_depthStencilState;
 
-        MTL::DepthStencilState* p_depthStencilState;
-        MTL::Buffer* p_cameraBuffer[kMaxFramesInFlight];
+        gpu::Buffer* p_frameBuffer;
+        FrameRing m_frameRing;
+        JobSystem m_jobs;
+        InstanceStore m_instances;
+        // Instances hang off one node per row under the grid's root node; the graph writes their world transforms to m_instances.
+        SceneGraph m_scene;
+        std::vector<SceneGraph::Node> m_instanceNodes;
+        std::vector<uint32_t> m_visibleInstances;
+        std::vector<size_t> m_chunkVisible;
 
-        std::string m_shaderSrc;
+        OcclusionBuffer m_occlusion;
+        // The mesh as x, y, z positions in the vertex shader's units and the triangles of level 0. Simplified
+        // levels may stick out of the mesh, which would hide instances that show.
+        std::vector<float> m_occluderPositions;
+        std::vector<uint32_t> m_occluderIndices;
+        std::vector<uint32_t> m_occluders;
+
+        // Persistent instance data, one copy per frame in flight, indexed by instance.
+        gpu::Buffer* p_instanceBuffers[kMaxFramesInFlight];
+        size_t m_frameIndex;
+        UploadTracker m_uploads;
+        std::vector<std::vector<UploadTracker::Range>> m_chunkRanges;
+        UploadStats m_uploadStats;
+        CullStats m_cullStats;
+        SceneStats m_sceneStats;
+        PipelineCache<gpu::Pipeline*> m_pipelines;
 };
 
+// The MeshVertexFormat the vertex buffer holds, chosen at build time. The shaders are compiled with the same value.
+#ifndef VERTEX_FORMAT
+#define VERTEX_FORMAT 0
+#endif
+
+// Must lay out like the structs of the same name in shader/program.metal; the build
+// generates static_asserts that check it with shader_layout_tool.
 namespace shader_types
 {
 
+constexpr MeshVertexFormat kVertexFormat = static_cast<MeshVertexFormat>( VERTEX_FORMAT );
+
+#if VERTEX_FORMAT == 0
 struct VertexData
 {
-    simd::float4 position;
-    simd::float3 normal;
+    math::float3 position;
+    math::float3 normal;
 };
+#else
+// Encoded with encode_vertices(), see MeshVertexFormat.
+struct VertexData
+{
+#if VERTEX_FORMAT == 1 || VERTEX_FORMAT == 2
+    uint16_t position[4];
+#else
+    int16_t position[4];
+#endif
+    uint32_t normal;
+};
+#endif
+
+static_assert( sizeof(VertexData) == mesh_vertex_stride( kVertexFormat ), "VertexData is one vertex in kVertexFormat" );
 
+#if INSTANCE_FORMAT_COMPACT
+using InstanceData = CompactInstance;
+#else
 struct InstanceData
 {
-    simd::float4x4 instanceTransform;
-    simd::float4 instanceColor;
-    simd::float3x3 instanceNormalTransform;
+    math::float4x4 instanceTransform;
+    math::float4 instanceColor;
+    math::float3x3 instanceNormalTransform;
 };
+#endif
 
 struct CameraData
 {
-    simd::float4x4 perspectiveTransform;
-    simd::float4x4 worldTransform;
-    simd::float3x3 worldNormalTransform;
+    math::float4x4 perspectiveTransform;
+    math::float4x4 worldTransform;
+    math::float3x3 worldNormalTransform;
 };
 
 }
@@ -0,0 +1,201 @@
+#include "scene_graph.hpp"
+#include "instance_store.hpp"
+#include "job_system.hpp"
+#include "math.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <type_traits>
+
+SceneGraph::SceneGraph()
+    : m_sorted( true )
+    , m_updateCount( 0 )
+{ }
+
+void SceneGraph::clear()
+{
+    m_slots.clear();
+    m_nodes.clear();
+    m_parents.clear();
+    m_depths.clear();
+    m_positions.clear();
+    m_rotations.clear();
+    m_scales.clear();
+    m_world.clear();
+    m_instances.clear();
+    m_boundingRadii.clear();
+    m_dirty.clear();
+    m_updated.clear();
+    m_levelOffsets.clear();
+    m_sorted = true;
+}
+
+SceneGraph::Node SceneGraph::add_node( Node parent, const math::float3& position, const math::quat& rotation, const math::float3& scale )
+{
+    assert( parent == kNoParent || parent < m_slots.size() );
+
+    const uint32_t slot = static_cast<uint32_t>( m_nodes.size() );
+    const uint32_t parentSlot = parent == kNoParent ? kNoParent : m_slots[ parent ];
+    const uint32_t depth = parent == kNoParent ? 0 : m_depths[ parentSlot ] + 1;
+    const Node node = static_cast<Node>( m_slots.size() );
+
+    // Appending keeps the order while the new node is at least as deep as the last one.
+    if ( slot > 0 && depth < m_depths.back() )
+        m_sorted = false;
+    if ( m_sorted )
+    {
+        if ( m_levelOffsets.empty() )
+            m_levelOffsets.push_back( 0 );
+        if ( depth + 1 == m_levelOffsets.size() )
+            m_levelOffsets.push_back( slot + 1 );
+        else
+            m_levelOffsets.back() = slot + 1;
+    }
+
+    m_slots.push_back( slot );
+    m_nodes.push_back( node );
+    m_parents.push_back( parentSlot );
+    m_depths.push_back( depth );
+    m_positions.push_back( position );
+    m_rotations.push_back( rotation );
+    m_scales.push_back( scale );
+    m_world.push_back( math::make_identity() );
+    m_instances.push_back( kNoInstance );
+    m_boundingRadii.push_back( 0.f );
+    m_dirty.push_back( 1 );
+    m_updated.push_back( 0 );
+    return node;
+}
+
+void SceneGraph::bind_instance( Node node, uint32_t instance, float boundingRadius )
+{
+    const uint32_t slot = m_slots[ node ];
+    m_instances[ slot ] = instance;
+    m_boundingRadii[ slot ] = boundingRadius;
+    m_dirty[ slot ] = 1;
+}
+
+void SceneGraph::set_local_position( Node node, const math::float3& position )
+{
+    const uint32_t slot = m_slots[ node ];
+    m_positions[ slot ] = position;
+    m_dirty[ slot ] = 1;
+}
+
+void SceneGraph::set_local_rotation( Node node, const math::quat& rotation )
+{
+    const uint32_t slot = m_slots[ node ];
+    m_rotations[ slot ] = rotation;
+    m_dirty[ slot ] = 1;
+}
+
+void SceneGraph::set_local_scale( Node node, const math::float3& scale )
+{
+    const uint32_t slot = m_slots[ node ];
+    m_scales[ slot ] = scale;
+    m_dirty[ slot ] = 1;
+}
+
+SceneGraph::Node SceneGraph::parent( Node node ) const
+{
+    const uint32_t parentSlot = m_parents[ m_slots[ node ] ];
+    return parentSlot == kNoParent ? kNoParent : m_nodes[ parentSlot ];
+}
+
+void SceneGraph::sort_levels()
+{
+    PROFILE_ZONE( "SceneGraph::sort_levels" );
+
+    const size_t count = m_nodes.size();
+    const uint32_t levels = count == 0 ? 0 : *std::max_element( m_depths.begin(), m_depths.end() ) + 1;
+    m_levelOffsets.assign( levels + 1, 0 );
+    for ( uint32_t depth : m_depths )
+        m_levelOffsets[ depth + 1 ]++;
+    for ( uint32_t level = 0; level < levels; ++level )
+        m_levelOffsets[ level + 1 ] += m_levelOffsets[ level ];
+
+    std::vector<uint32_t> fill( m_levelOffsets.begin(), m_levelOffsets.end() - 1 );
+    std::vector<uint32_t> moved( count );
+    for ( size_t slot = 0; slot < count; ++slot )
+        moved[ slot ] = fill[ m_depths[ slot ] ]++;
+
+    auto permute = [&]( auto& values ) {
+        std::remove_reference_t<decltype( values )> sorted( count );
+        for ( size_t slot = 0; slot < count; ++slot )
+            sorted[ moved[ slot ] ] = values[ slot ];
+        values.swap( sorted );
+    };
+    permute( m_nodes );
+    permute( m_parents );
+    permute( m_depths );
+    permute( m_positions );
+    permute( m_rotations );
+    permute( m_scales );
+    permute( m_world );
+    permute( m_instances );
+    permute( m_boundingRadii );
+    permute( m_dirty );
+    permute( m_updated );
+
+    for ( size_t slot = 0; slot < count; ++slot )
+    {
+        if ( m_parents[ slot ] != kNoParent )
+            m_parents[ slot ] = moved[ m_parents[ slot ] ];
+        m_slots[ m_nodes[ slot ] ] = static_cast<uint32_t>( slot );
+    }
+    m_sorted = true;
+}
+
+size_t SceneGraph::update( JobSystem& jobs, InstanceStore* pStore, size_t grain )
+{
+    PROFILE_ZONE( "SceneGraph::update" );
+
+    if ( !m_sorted )
+        sort_levels();
+
+    // 0 marks never recomputed, so the count skips it when it wraps.
+    if ( ++m_updateCount == 0 )
+    {
+        std::fill( m_updated.begin(), m_updated.end(), 0 );
+        m_updateCount = 1;
+    }
+    const uint32_t stamp = m_updateCount;
+
+    std::atomic<size_t> recomputed( 0 );
+    for ( size_t level = 0; level < level_count(); ++level )
+    {
+        const size_t levelBegin = m_levelOffsets[ level ];
+        const size_t levelEnd = m_levelOffsets[ level + 1 ];
+        jobs.parallel_for( levelEnd - levelBegin, grain, [&]( size_t begin, size_t end ) {
+            size_t count = 0;
+            for ( size_t slot = levelBegin + begin; slot < levelBegin + end; ++slot )
+            {
+                const uint32_t parentSlot = m_parents[ slot ];
+                const bool parentUpdated = parentSlot != kNoParent && m_updated[ parentSlot ] == stamp;
+                if ( !m_dirty[ slot ] && !parentUpdated )
+                    continue;
+
+                const math::float4x4 local = math::make_trs( m_positions[ slot ], m_rotations[ slot ], m_scales[ slot ] );
+                m_world[ slot ] = parentSlot == kNoParent ? local : math::mul_affine( m_world[ parentSlot ], local );
+                m_dirty[ slot ] = 0;
+                m_updated[ slot ] = stamp;
+                count++;
+
+                const uint32_t instance = m_instances[ slot ];
+                if ( !pStore || instance == kNoInstance )
+                    continue;
+
+                math::float3 position, scale;
+                math::quat rotation;
+                math::decompose_trs( m_world[ slot ], position, rotation, scale );
+                pStore->set_position( instance, position.x, position.y, position.z );
+                pStore->set_rotation( instance, rotation.x, rotation.y, rotation.z, rotation.w );
+                pStore->set_scale( instance, scale.x, scale.y, scale.z );
+                pStore->set_bounding_radius( instance, m_boundingRadii[ slot ] * std::max( { scale.x, scale.y, scale.z } ) );
+            }
+            recomputed.fetch_add( count, std::memory_order_relaxed );
+        } );
+    }
+    return recomputed.load( std::memory_order_relaxed );
+}
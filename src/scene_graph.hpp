@@ -0,0 +1,89 @@
+#pragma once
+
+#include "math_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class InstanceStore;
+class JobSystem;
+
+// Parent/child transform hierarchy in flat arrays sorted by depth: parents come
+// before their children and the nodes of each level are one contiguous run, so
+// world matrices can be computed level by level with the nodes of a level in
+// parallel.
+//
+// Setting a local transform marks the node dirty. update() recomputes the world
+// matrix of every dirty node and of everything below one, and leaves the rest
+// of the tree alone. Nodes bound to an instance write their new world transform
+// to the InstanceStore, which bumps the instance's generation and so gets it
+// uploaded.
+class SceneGraph
+{
+    public:
+        using Node = uint32_t;
+        static constexpr Node kNoParent = UINT32_MAX;
+
+        SceneGraph();
+
+        // Discards every node.
+        void clear();
+
+        // The parent must already exist. Nodes keep their handle for the lifetime of
+        // the graph; where they are stored changes when a node is added to a level
+        // above the deepest one, and is settled by the next update().
+        Node add_node( Node parent, const math::float3& position, const math::quat& rotation, const math::float3& scale );
+
+        // From the next update() on, `instance` takes this node's world position,
+        // rotation and scale, and as bounding radius `boundingRadius` (a sphere
+        // around the node's origin in its local space) times its largest world scale.
+        // World transforms must be free of shear for this, see math::decompose_trs.
+        void bind_instance( Node node, uint32_t instance, float boundingRadius );
+
+        // Calls for different nodes may run concurrently, but not during update().
+        void set_local_position( Node node, const math::float3& position );
+        void set_local_rotation( Node node, const math::quat& rotation );
+        void set_local_scale( Node node, const math::float3& scale );
+
+        size_t size() const { return m_slots.size(); }
+        size_t level_count() const { return m_levelOffsets.empty() ? 0 : m_levelOffsets.size() - 1; }
+        Node parent( Node node ) const;
+
+        // As of the last update().
+        const math::float4x4& world_transform( Node node ) const { return m_world[ m_slots[ node ] ]; }
+
+        // Recomputes the dirty subtrees, `grain` nodes of a level per job, and writes
+        // the bound instances among them to pStore (may be null). Returns the number
+        // of nodes recomputed.
+        size_t update( JobSystem& jobs, InstanceStore* pStore, size_t grain = 1024 );
+
+    private:
+        static constexpr uint32_t kNoInstance = UINT32_MAX;
+
+        // Stable counting sort of the slots by depth.
+        void sort_levels();
+
+        // Indexed by node handle.
+        std::vector<uint32_t> m_slots;
+
+        // Indexed by slot. Parents are slots too.
+        std::vector<Node> m_nodes;
+        std::vector<uint32_t> m_parents;
+        std::vector<uint32_t> m_depths;
+        std::vector<math::float3> m_positions;
+        std::vector<math::quat> m_rotations;
+        std::vector<math::float3> m_scales;
+        std::vector<math::float4x4> m_world;
+        std::vector<uint32_t> m_instances;
+        std::vector<float> m_boundingRadii;
+        // Set by the setters, cleared when update() recomputes the node.
+        std::vector<uint8_t> m_dirty;
+        // The update() that last recomputed the node; a child is recomputed when its parent was in the same one.
+        std::vector<uint32_t> m_updated;
+
+        // Level l is the slots [ m_levelOffsets[ l ], m_levelOffsets[ l + 1 ] ).
+        std::vector<uint32_t> m_levelOffsets;
+        bool m_sorted;
+        uint32_t m_updateCount;
+};
@@ -0,0 +1,143 @@
+#include "shader_cache.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+
+constexpr const char* kExtension = ".metallib";
+constexpr size_t kKeyLength = 16;
+
+uint64_t fnv1a( uint64_t hash, std::string_view bytes )
+{
+    for ( unsigned char c : bytes )
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool is_key( std::string_view s )
+{
+    if ( s.size() != kKeyLength )
+        return false;
+
+    for ( char c : s )
+    {
+        if ( !( ( c >= '0' && c <= '9' ) || ( c >= 'a' && c <= 'f' ) ) )
+            return false;
+    }
+    return true;
+}
+
+}
+
+ShaderCache::ShaderCache( std::string directory )
+    : m_directory( std::move( directory ) )
+{ }
+
+std::string ShaderCache::make_key( std::string_view source, std::string_view options )
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = fnv1a( hash, source );
+    hash = fnv1a( hash, std::string_view( "\0", 1 ) );
+    hash = fnv1a( hash, options );
+
+    char key[ kKeyLength + 1 ];
+    snprintf( key, sizeof(key), "%016llx", static_cast<unsigned long long>( hash ) );
+    return key;
+}
+
+std::string ShaderCache::entry_path( std::string_view name, std::string_view key ) const
+{
+    std::string path = m_directory;
+    path += '/';
+    path += name;
+    path += '-';
+    path += key;
+    path += kExtension;
+    return path;
+}
+
+bool ShaderCache::lookup( std::string_view name, std::string_view key, std::string& outPath ) const
+{
+    std::string path = entry_path( name, key );
+
+    std::error_code err;
+    if ( !std::filesystem::is_regular_file( path, err ) )
+        return false;
+
+    outPath = std::move( path );
+    return true;
+}
+
+bool ShaderCache::store( std::string_view name, std::string_view key, const void* pData, size_t size ) const
+{
+    std::error_code err;
+    std::filesystem::create_directories( m_directory, err );
+    if ( err )
+    {
+        __builtin_printf("Failed to create shader cache directory: %s \n", m_directory.c_str());
+        __builtin_printf("%s \n\n", err.message().c_str());
+        return false;
+    }
+
+    // Write to a temporary first so a reader never sees a partial library.
+    const std::string path = entry_path( name, key );
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file( tmpPath, std::ios::binary | std::ios::trunc );
+        file.write( static_cast<const char*>( pData ), static_cast<std::streamsize>( size ) );
+        if ( !file )
+        {
+            __builtin_printf("Failed to write shader cache entry: %s \n\n", tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::filesystem::rename( tmpPath, path, err );
+    if ( err )
+    {
+        __builtin_printf("Failed to write shader cache entry: %s \n", path.c_str());
+        __builtin_printf("%s \n\n", err.message().c_str());
+        return false;
+    }
+
+    invalidate( name, key );
+    return true;
+}
+
+size_t ShaderCache::invalidate( std::string_view name, std::string_view keepKey ) const
+{
+    std::error_code err;
+    std::filesystem::directory_iterator it( m_directory, err );
+    if ( err )
+        return 0;
+
+    size_t removed = 0;
+    const std::string_view extension( kExtension );
+    for ( const auto& entry : it )
+    {
+        const std::string fileName = entry.path().filename().string();
+        const std::string_view file( fileName );
+
+        // Match exactly `<name>-<key>.metallib` so `program` never removes `program-foo` entries.
+        if ( file.size() != name.size() + 1 + kKeyLength + extension.size()
+          || file.substr( 0, name.size() ) != name
+          || file[ name.size() ] != '-'
+          || file.substr( file.size() - extension.size() ) != extension )
+            continue;
+
+        const std::string_view key = file.substr( name.size() + 1, kKeyLength );
+        if ( !is_key( key ) || key == keepKey )
+            continue;
+
+        if ( std::filesystem::remove( entry.path(), err ) )
+            removed++;
+    }
+
+    return removed;
+}
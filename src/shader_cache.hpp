@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// On-disk cache of precompiled shader libraries.
+//
+// Entries are stored as `<directory>/<name>-<key>.metallib` where the key is a
+// hash of the shader source and the options it was compiled with. A library
+// whose source changed simply misses the cache and is compiled from source.
+class ShaderCache
+{
+    public:
+        explicit ShaderCache( std::string directory );
+
+        static std::string make_key( std::string_view source, std::string_view options = {} );
+
+        std::string entry_path( std::string_view name, std::string_view key ) const;
+        bool lookup( std::string_view name, std::string_view key, std::string& outPath ) const;
+
+        // Writes the entry and drops every other entry of the same name.
+        bool store( std::string_view name, std::string_view key, const void* pData, size_t size ) const;
+        size_t invalidate( std::string_view name, std::string_view keepKey = {} ) const;
+
+        const std::string& directory() const { return m_directory; }
+
+    private:
+        std::string m_directory;
+};
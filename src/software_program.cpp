@@ -0,0 +1,112 @@
+#include "software_rasterizer.hpp"
+#include "renderer.hpp"
+#include "mesh.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// C++ versions of the functions in shader/program.metal, keep them in sync.
+namespace
+{
+
+enum Varying
+{
+    kColorR, kColorG, kColorB,
+    kNormalX, kNormalY, kNormalZ,
+    kVaryingCount
+};
+
+void main_vertex( const gpu::HeadlessDraw& draw, uint32_t vertexId, uint32_t instanceId, SoftwareVertex& out )
+{
+    const gpu::HeadlessDraw::Binding& vertexData = draw.vertexBuffers[0];
+    const gpu::HeadlessDraw::Binding& instanceData = draw.vertexBuffers[1];
+    const gpu::HeadlessDraw::Binding& cameraData = draw.vertexBuffers[2];
+    const gpu::HeadlessDraw::Binding& visibleInstances = draw.vertexBuffers[3];
+
+    assert( ( vertexId + 1 ) * sizeof(shader_types::VertexData) <= vertexData.size );
+    assert( ( instanceId + 1 ) * sizeof(uint32_t) <= visibleInstances.size );
+    assert( sizeof(shader_types::CameraData) <= cameraData.size );
+
+    const uint32_t instanceIndex = reinterpret_cast<const uint32_t*>( visibleInstances.pData )[ instanceId ];
+    assert( ( instanceIndex + 1 ) * sizeof(shader_types::InstanceData) <= instanceData.size );
+
+    // vertex_position and vertex_normal: snorm16 positions stay in units of the mesh radius, like the shader's.
+    MeshData::Vertex vd;
+    decode_vertices( reinterpret_cast<const shader_types::VertexData*>( vertexData.pData ) + vertexId, 1, shader_types::kVertexFormat, 1.f, &vd );
+    const auto& camera = *reinterpret_cast<const shader_types::CameraData*>( cameraData.pData );
+
+#if INSTANCE_FORMAT_COMPACT
+    // Expanding builds the transform the shader applies piecewise.
+    PackedInstance expanded;
+    unpack_instance( reinterpret_cast<const CompactInstance*>( instanceData.pData )[ instanceIndex ], expanded );
+    math::float4x4 instanceTransform;
+    math::float4 instanceColor;
+    math::float3x3 instanceNormalTransform;
+    memcpy( &instanceTransform, expanded.transform, sizeof(instanceTransform) );
+    memcpy( &instanceColor, expanded.color, sizeof(instanceColor) );
+    memcpy( &instanceNormalTransform, expanded.normalTransform, sizeof(instanceNormalTransform) );
+#else
+    const auto& instance = reinterpret_cast<const shader_types::InstanceData*>( instanceData.pData )[ instanceIndex ];
+    const math::float4x4& instanceTransform = instance.instanceTransform;
+    const math::float4& instanceColor = instance.instanceColor;
+    const math::float3x3& instanceNormalTransform = instance.instanceNormalTransform;
+#endif
+
+    math::float4 pos = { vd.position[0], vd.position[1], vd.position[2], 1.f };
+    pos = instanceTransform * pos;
+    pos = camera.perspectiveTransform * camera.worldTransform * pos;
+    out.position = pos;
+
+    math::float3 normal = instanceNormalTransform * math::float3 { vd.normal[0], vd.normal[1], vd.normal[2] };
+    normal = camera.worldNormalTransform * normal;
+
+    out.varyings[ kColorR ] = instanceColor.x;
+    out.varyings[ kColorG ] = instanceColor.y;
+    out.varyings[ kColorB ] = instanceColor.z;
+    out.varyings[ kNormalX ] = normal.x;
+    out.varyings[ kNormalY ] = normal.y;
+    out.varyings[ kNormalZ ] = normal.z;
+}
+
+bool main_vertex_bounds( const gpu::HeadlessDraw& draw, uint32_t maxIndex )
+{
+    const gpu::HeadlessDraw::Binding& vertexData = draw.vertexBuffers[0];
+    const gpu::HeadlessDraw::Binding& instanceData = draw.vertexBuffers[1];
+    const gpu::HeadlessDraw::Binding& cameraData = draw.vertexBuffers[2];
+    const gpu::HeadlessDraw::Binding& visibleInstances = draw.vertexBuffers[3];
+
+    // Instances are read through the visible list, whose binding offset is the draw's first instance.
+    if ( maxIndex >= vertexData.size / sizeof(shader_types::VertexData)
+      || draw.instanceCount > visibleInstances.size / sizeof(uint32_t)
+      || cameraData.size < sizeof(shader_types::CameraData) )
+        return false;
+
+    const size_t instanceCount = instanceData.size / sizeof(shader_types::InstanceData);
+    const uint32_t* pVisible = reinterpret_cast<const uint32_t*>( visibleInstances.pData );
+    for ( size_t i = 0; i < draw.instanceCount; ++i )
+    {
+        if ( pVisible[ i ] >= instanceCount )
+            return false;
+    }
+    return true;
+}
+
+// The Metal version works in half precision, this one in float.
+math::float4 main_fragment( const float* varyings )
+{
+    const math::float3 color = { varyings[ kColorR ], varyings[ kColorG ], varyings[ kColorB ] };
+    const math::float3 l = math::normalize( math::float3{ 1.0f, 1.0f, 0.8f } );
+    const math::float3 n = math::normalize( math::float3{ varyings[ kNormalX ], varyings[ kNormalY ], varyings[ kNormalZ ] } );
+
+    const float ndotl = std::min( std::max( math::dot( n, l ), 0.f ), 1.f );
+    const math::float3 lit = color * 0.1f + color * ndotl;
+    return { lit.x, lit.y, lit.z, 1.f };
+}
+
+}
+
+void register_program_functions( SoftwareRasterizer& rasterizer )
+{
+    rasterizer.register_vertex_function( "main_vertex", main_vertex, kVaryingCount, main_vertex_bounds );
+    rasterizer.register_fragment_function( "main_fragment", main_fragment );
+}
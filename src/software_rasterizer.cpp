@@ -0,0 +1,636 @@
+#include "software_rasterizer.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+// Vertices snap to 1/256 of a pixel before edge setup.
+constexpr int kSubpixelBits = 8;
+constexpr int64_t kSubpixel = int64_t( 1 ) << kSubpixelBits;
+
+// Snapped coordinates stay within +-2^29 subpixels, 2M pixels, so that edge functions of any
+// pixel on a target up to 64K wide are exact in int64. Triangles reaching further are clipped
+// to this guard band first, which only happens close to the near plane.
+constexpr int64_t kGuardBand = int64_t( 1 ) << 29;
+
+// Each of the near plane and the four guard band planes can add a vertex.
+constexpr size_t kMaxClipVertices = 3 + 5;
+constexpr size_t kMaxSplitTriangles = kMaxClipVertices - 2;
+// Triangles set up in parallel get room for what the near plane alone can split them into.
+// The rare ones the guard band splits further are set up again while binning.
+constexpr size_t kSlotTriangles = 2;
+constexpr uint8_t kDeferred = 0xff;
+
+// Vertices and triangles per job. Work is split across instances and within them, so draws
+// of a single instance (e.g. meshlet ranges) still spread over the workers.
+constexpr size_t kVertexGrain = 1024;
+constexpr size_t kTriangleGrain = 256;
+
+constexpr size_t kSrgbTableSize = 4096;
+
+// Edge functions of four horizontally adjacent pixels at a time, as int64.
+#if defined(__SSE2__)
+
+struct Lanes
+{
+    struct V { __m128i lo, hi; };
+    static constexpr size_t kWidth = 4;
+
+    static V splat( int64_t i ) { return { _mm_set1_epi64x( i ), _mm_set1_epi64x( i ) }; }
+    // i * step in lane i.
+    static V ramp( int64_t step ) { return { _mm_set_epi64x( step, 0 ), _mm_set_epi64x( 3 * step, 2 * step ) }; }
+    static V add( V a, V b ) { return { _mm_add_epi64( a.lo, b.lo ), _mm_add_epi64( a.hi, b.hi ) }; }
+    static void store( V a, int64_t* p )
+    {
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( p ), a.lo );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( p + 2 ), a.hi );
+    }
+
+    // Bit i set when lane i is negative, read off the sign bits.
+    static int negative( V a )
+    {
+        return _mm_movemask_pd( _mm_castsi128_pd( a.lo ) ) | _mm_movemask_pd( _mm_castsi128_pd( a.hi ) ) << 2;
+    }
+};
+
+#elif defined(__ARM_NEON)
+
+struct Lanes
+{
+    struct V { int64x2_t lo, hi; };
+    static constexpr size_t kWidth = 4;
+
+    static V splat( int64_t i ) { return { vdupq_n_s64( i ), vdupq_n_s64( i ) }; }
+    static V ramp( int64_t step )
+    {
+        const int64_t r[4] = { 0, step, 2 * step, 3 * step };
+        return { vld1q_s64( r ), vld1q_s64( r + 2 ) };
+    }
+    static V add( V a, V b ) { return { vaddq_s64( a.lo, b.lo ), vaddq_s64( a.hi, b.hi ) }; }
+    static void store( V a, int64_t* p ) { vst1q_s64( p, a.lo ); vst1q_s64( p + 2, a.hi ); }
+
+    static int negative( V a )
+    {
+        const uint64x2_t lo = vshrq_n_u64( vreinterpretq_u64_s64( a.lo ), 63 );
+        const uint64x2_t hi = vshrq_n_u64( vreinterpretq_u64_s64( a.hi ), 63 );
+        return static_cast<int>( vgetq_lane_u64( lo, 0 ) | vgetq_lane_u64( lo, 1 ) << 1
+                               | vgetq_lane_u64( hi, 0 ) << 2 | vgetq_lane_u64( hi, 1 ) << 3 );
+    }
+};
+
+#else
+
+struct Lanes
+{
+    struct V { int64_t v[4]; };
+    static constexpr size_t kWidth = 4;
+
+    static V splat( int64_t i ) { return { { i, i, i, i } }; }
+    static V ramp( int64_t step ) { return { { 0, step, 2 * step, 3 * step } }; }
+    static V add( V a, V b ) { return { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } }; }
+    static void store( V a, int64_t* p ) { for ( int i = 0; i < 4; ++i ) p[i] = a.v[i]; }
+
+    static int negative( V a )
+    {
+        int mask = 0;
+        for ( int i = 0; i < 4; ++i )
+            mask |= ( a.v[i] < 0 ) << i;
+        return mask;
+    }
+};
+
+#endif
+
+bool depth_passes( gpu::CompareFunction compare, float fragment, float stored )
+{
+    switch ( compare )
+    {
+        case gpu::CompareFunction::Never:        return false;
+        case gpu::CompareFunction::Less:         return fragment < stored;
+        case gpu::CompareFunction::Equal:        return fragment == stored;
+        case gpu::CompareFunction::LessEqual:    return fragment <= stored;
+        case gpu::CompareFunction::Greater:      return fragment > stored;
+        case gpu::CompareFunction::NotEqual:     return fragment != stored;
+        case gpu::CompareFunction::GreaterEqual: return fragment >= stored;
+        case gpu::CompareFunction::Always:       return true;
+    }
+    return true;
+}
+
+const uint8_t* srgb_table()
+{
+    static const std::vector<uint8_t> table = []() {
+        std::vector<uint8_t> t( kSrgbTableSize );
+        for ( size_t i = 0; i < kSrgbTableSize; ++i )
+        {
+            const float c = i / float( kSrgbTableSize - 1 );
+            const float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf( c, 1.f / 2.4f ) - 0.055f;
+            t[i] = static_cast<uint8_t>( s * 255.f + 0.5f );
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+uint32_t encode_bgra8_srgb( const math::float4& color )
+{
+    const uint8_t* pTable = srgb_table();
+    auto channel = [pTable]( float c ) {
+        c = std::min( std::max( c, 0.f ), 1.f );
+        return static_cast<uint32_t>( pTable[ static_cast<size_t>( c * ( kSrgbTableSize - 1 ) + 0.5f ) ] );
+    };
+    const uint32_t a = static_cast<uint32_t>( std::min( std::max( color.w, 0.f ), 1.f ) * 255.f + 0.5f );
+    return ( a << 24 ) | ( channel( color.x ) << 16 ) | ( channel( color.y ) << 8 ) | channel( color.z );
+}
+
+// Sutherland-Hodgman against dot( plane, position ) >= 0. New vertices are interpolated from the
+// inside end of an edge, so triangles sharing the edge get the same one.
+size_t clip_polygon( const SoftwareVertex* pIn, size_t count, size_t varyingCount, const math::float4& plane, SoftwareVertex* pOut )
+{
+    auto distance = [&plane]( const SoftwareVertex& v ) { return math::dot( plane, v.position ); };
+
+    size_t out = 0;
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const SoftwareVertex& a = pIn[ i ];
+        const SoftwareVertex& b = pIn[ ( i + 1 ) % count ];
+        const float da = distance( a );
+        const float db = distance( b );
+        const bool aInside = da >= 0.f;
+        const bool bInside = db >= 0.f;
+
+        if ( aInside )
+            pOut[ out++ ] = a;
+
+        if ( aInside != bInside )
+        {
+            const SoftwareVertex& from = aInside ? a : b;
+            const SoftwareVertex& to = aInside ? b : a;
+            const float dFrom = aInside ? da : db;
+            const float dTo = aInside ? db : da;
+            const float t = dFrom / ( dFrom - dTo );
+
+            SoftwareVertex& v = pOut[ out++ ];
+            v.position = from.position + ( to.position - from.position ) * t;
+            for ( size_t k = 0; k < varyingCount; ++k )
+                v.varyings[ k ] = from.varyings[ k ] + ( to.varyings[ k ] - from.varyings[ k ] ) * t;
+        }
+    }
+    return out;
+}
+
+// a / b rounded down, for b > 0.
+int64_t floor_div( int64_t a, int64_t b )
+{
+    return a >= 0 ? a / b : -( ( -a + b - 1 ) / b );
+}
+
+}
+
+SoftwareRasterizer::SoftwareRasterizer( JobSystem& jobs )
+    : m_jobs( jobs )
+    , m_tilesX( 0 )
+    , m_tilesY( 0 )
+    , m_vertexCount( 0 )
+    , m_triangleCount( 0 )
+    , m_culledCount( 0 )
+    , m_clippedCount( 0 )
+    , m_binCount( 0 )
+    , m_coveredCount( 0 )
+    , m_shadedCount( 0 )
+{ }
+
+void SoftwareRasterizer::register_vertex_function( const char* name, VertexFn fn, size_t varyingCount, BoundsFn bounds )
+{
+    assert( varyingCount <= SoftwareVertex::kMaxVaryings );
+    m_vertexFunctions[ name ] = { fn, varyingCount, bounds };
+}
+
+void SoftwareRasterizer::register_fragment_function( const char* name, FragmentFn fn )
+{
+    m_fragmentFunctions[ name ] = fn;
+}
+
+SoftwareRasterizer::Stats SoftwareRasterizer::stats() const
+{
+    return { m_vertexCount.load( std::memory_order_relaxed ),
+             m_triangleCount.load( std::memory_order_relaxed ),
+             m_culledCount.load( std::memory_order_relaxed ),
+             m_clippedCount.load( std::memory_order_relaxed ),
+             m_binCount.load( std::memory_order_relaxed ),
+             m_coveredCount.load( std::memory_order_relaxed ),
+             m_shadedCount.load( std::memory_order_relaxed ) };
+}
+
+void SoftwareRasterizer::reset_stats()
+{
+    for ( std::atomic<uint64_t>* pCounter : { &m_vertexCount, &m_triangleCount, &m_culledCount, &m_clippedCount,
+                                              &m_binCount, &m_coveredCount, &m_shadedCount } )
+        pCounter->store( 0, std::memory_order_relaxed );
+}
+
+void SoftwareRasterizer::draw( gpu::HeadlessTarget& target, const gpu::HeadlessDraw& draw )
+{
+    PROFILE_ZONE( "SoftwareRasterizer::draw" );
+
+    auto vertexIt = m_vertexFunctions.find( draw.vertexFunction );
+    auto fragmentIt = m_fragmentFunctions.find( draw.fragmentFunction );
+    if ( vertexIt == m_vertexFunctions.end() || fragmentIt == m_fragmentFunctions.end() )
+    {
+        __builtin_printf("No software implementation of %s / %s, draw skipped. \n", draw.vertexFunction, draw.fragmentFunction);
+        return;
+    }
+
+    const VertexFunction vertex = vertexIt->second;
+    const FragmentFn fragment = fragmentIt->second;
+    const size_t triangleCount = draw.indexCount / 3;
+    if ( triangleCount == 0 || draw.instanceCount == 0 )
+        return;
+
+    auto index = [&draw]( size_t i ) -> uint32_t {
+        return draw.indexType == gpu::IndexType::UInt16 ? reinterpret_cast<const uint16_t*>( draw.pIndices )[ i ]
+                                                        : reinterpret_cast<const uint32_t*>( draw.pIndices )[ i ];
+    };
+
+    // Shade every vertex the indices refer to once per instance. Storage covers the lowest to the highest
+    // index, so draws of part of a mesh (e.g. the ranges meshlet culling leaves) stay cheap.
+    uint32_t minIndex = UINT32_MAX;
+    uint32_t maxIndex = 0;
+    for ( size_t i = 0; i < triangleCount * 3; ++i )
+    {
+        minIndex = std::min( minIndex, index( i ) );
+        maxIndex = std::max( maxIndex, index( i ) );
+    }
+    if ( !vertex.bounds( draw, maxIndex ) )
+    {
+        __builtin_printf("%s would read outside its buffers (%u vertices, %zu instances), draw skipped. \n",
+                         draw.vertexFunction, maxIndex + 1, draw.instanceCount);
+        return;
+    }
+    const size_t vertexCount = size_t( maxIndex - minIndex ) + 1;
+
+    m_referenced.assign( vertexCount, 0 );
+    size_t referencedCount = 0;
+    for ( size_t i = 0; i < triangleCount * 3; ++i )
+    {
+        uint8_t& referenced = m_referenced[ index( i ) - minIndex ];
+        referencedCount += !referenced;
+        referenced = 1;
+    }
+
+    m_vertices.resize( draw.instanceCount * vertexCount );
+    m_jobs.parallel_for( draw.instanceCount * vertexCount, kVertexGrain, [&]( size_t begin, size_t end ) {
+        PROFILE_ZONE( "shade vertices" );
+        for ( size_t slot = begin; slot < end; ++slot )
+        {
+            const size_t v = slot % vertexCount;
+            if ( m_referenced[ v ] )
+                vertex.fn( draw, minIndex + static_cast<uint32_t>( v ), static_cast<uint32_t>( slot / vertexCount ), m_vertices[ slot ] );
+        }
+    } );
+
+    auto setup = [&]( size_t slot, Triangle* pOut, size_t maxTriangles, uint64_t& culled, uint64_t& clipped ) {
+        const size_t t = slot % triangleCount;
+        const SoftwareVertex* pVertices = m_vertices.data() + slot / triangleCount * vertexCount;
+        const SoftwareVertex corners[3] = { pVertices[ index( t * 3 + 0 ) - minIndex ],
+                                            pVertices[ index( t * 3 + 1 ) - minIndex ],
+                                            pVertices[ index( t * 3 + 2 ) - minIndex ] };
+        return setup_triangle( corners, vertex.varyingCount, draw, target, pOut, maxTriangles, culled, clipped );
+    };
+
+    // Clip, cull and set up triangles. Every source triangle gets kSlotTriangles slots so order is kept.
+    m_triangles.resize( draw.instanceCount * triangleCount * kSlotTriangles );
+    m_triangleCounts.resize( draw.instanceCount * triangleCount );
+    std::atomic<uint64_t> culled( 0 );
+    std::atomic<uint64_t> clipped( 0 );
+    m_jobs.parallel_for( draw.instanceCount * triangleCount, kTriangleGrain, [&]( size_t begin, size_t end ) {
+        PROFILE_ZONE( "set up triangles" );
+        uint64_t localCulled = 0;
+        uint64_t localClipped = 0;
+        for ( size_t slot = begin; slot < end; ++slot )
+        {
+            const size_t count = setup( slot, m_triangles.data() + slot * kSlotTriangles, kSlotTriangles, localCulled, localClipped );
+            m_triangleCounts[ slot ] = count > kSlotTriangles ? kDeferred : static_cast<uint8_t>( count );
+        }
+        culled.fetch_add( localCulled, std::memory_order_relaxed );
+        clipped.fetch_add( localClipped, std::memory_order_relaxed );
+    } );
+
+    // Bin in submission order.
+    m_tilesX = ( target.width() + kTileSize - 1 ) / kTileSize;
+    m_tilesY = ( target.height() + kTileSize - 1 ) / kTileSize;
+    m_bins.resize( m_tilesX * m_tilesY );
+    for ( std::vector<uint32_t>& bin : m_bins )
+        bin.clear();
+
+    uint64_t bins = 0;
+    uint64_t deferredCulled = 0;
+    uint64_t deferredClipped = 0;
+    for ( size_t slot = 0; slot < m_triangleCounts.size(); ++slot )
+    {
+        size_t first = slot * kSlotTriangles;
+        size_t count = m_triangleCounts[ slot ];
+        if ( count == kDeferred )
+        {
+            first = m_triangles.size();
+            m_triangles.resize( first + kMaxSplitTriangles );
+            count = setup( slot, m_triangles.data() + first, kMaxSplitTriangles, deferredCulled, deferredClipped );
+            m_triangles.resize( first + count );
+        }
+
+        for ( size_t k = 0; k < count; ++k )
+        {
+            const uint32_t triangleIndex = static_cast<uint32_t>( first + k );
+            const Triangle& tri = m_triangles[ triangleIndex ];
+            for ( size_t ty = tri.minY / kTileSize; ty <= tri.maxY / kTileSize; ++ty )
+            {
+                for ( size_t tx = tri.minX / kTileSize; tx <= tri.maxX / kTileSize; ++tx )
+                    m_bins[ ty * m_tilesX + tx ].push_back( triangleIndex );
+            }
+            bins += ( tri.maxY / kTileSize - tri.minY / kTileSize + 1 ) * ( tri.maxX / kTileSize - tri.minX / kTileSize + 1 );
+        }
+    }
+
+    std::atomic<uint64_t> covered( 0 );
+    std::atomic<uint64_t> shaded( 0 );
+    m_jobs.parallel_for( m_bins.size(), 1, [&]( size_t begin, size_t end ) {
+        PROFILE_ZONE( "raster tiles" );
+        uint64_t localCovered = 0;
+        uint64_t localShaded = 0;
+        for ( size_t tile = begin; tile < end; ++tile )
+            raster_tile( tile, target, draw, fragment, vertex.varyingCount, localCovered, localShaded );
+        covered.fetch_add( localCovered, std::memory_order_relaxed );
+        shaded.fetch_add( localShaded, std::memory_order_relaxed );
+    } );
+
+    m_vertexCount.fetch_add( draw.instanceCount * referencedCount, std::memory_order_relaxed );
+    m_triangleCount.fetch_add( draw.instanceCount * triangleCount, std::memory_order_relaxed );
+    m_culledCount.fetch_add( culled.load( std::memory_order_relaxed ) + deferredCulled, std::memory_order_relaxed );
+    m_clippedCount.fetch_add( clipped.load( std::memory_order_relaxed ) + deferredClipped, std::memory_order_relaxed );
+    m_binCount.fetch_add( bins, std::memory_order_relaxed );
+    m_coveredCount.fetch_add( covered.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    m_shadedCount.fetch_add( shaded.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+}
+
+size_t SoftwareRasterizer::setup_triangle( const SoftwareVertex* pClip, size_t varyingCount,
+                                           const gpu::HeadlessDraw& draw, const gpu::HeadlessTarget& target,
+                                           Triangle* pOut, size_t maxTriangles, uint64_t& culled, uint64_t& clipped ) const
+{
+    const math::float4& p0 = pClip[0].position;
+    const math::float4& p1 = pClip[1].position;
+    const math::float4& p2 = pClip[2].position;
+
+    // Trivially outside one of the clip planes.
+    if ( ( p0.x >  p0.w && p1.x >  p1.w && p2.x >  p2.w ) || ( p0.x < -p0.w && p1.x < -p1.w && p2.x < -p2.w )
+      || ( p0.y >  p0.w && p1.y >  p1.w && p2.y >  p2.w ) || ( p0.y < -p0.w && p1.y < -p1.w && p2.y < -p2.w )
+      || ( p0.z >  p0.w && p1.z >  p1.w && p2.z >  p2.w ) || ( p0.z < 0.f && p1.z < 0.f && p2.z < 0.f ) )
+    {
+        culled++;
+        return 0;
+    }
+
+    const size_t width = target.width();
+    const size_t height = target.height();
+
+    // Within the guard band when -g * w <= x <= g * w, and the same for y, see kGuardBand.
+    const float guardX = float( 2.0 * kGuardBand / double( width * kSubpixel ) - 1.0 );
+    const float guardY = float( 2.0 * kGuardBand / double( height * kSubpixel ) - 1.0 );
+    auto outside_guard_band = [guardX, guardY]( const math::float4& p ) {
+        return fabsf( p.x ) > guardX * p.w || fabsf( p.y ) > guardY * p.w;
+    };
+
+    // Unclipped triangles, nearly all of them, are read in place.
+    SoftwareVertex buffers[2][ kMaxClipVertices ];
+    const SoftwareVertex* pPolygon = pClip;
+    size_t polygonCount = 3;
+    auto clip = [&]( const math::float4& plane ) {
+        SoftwareVertex* pOut = pPolygon == buffers[0] ? buffers[1] : buffers[0];
+        polygonCount = clip_polygon( pPolygon, polygonCount, varyingCount, plane, pOut );
+        pPolygon = pOut;
+    };
+
+    const bool nearClip = p0.z < 0.f || p1.z < 0.f || p2.z < 0.f;
+    if ( nearClip )
+        clip( { 0.f, 0.f, 1.f, 0.f } );
+
+    const bool guardClip = std::any_of( pPolygon, pPolygon + polygonCount, [&]( const SoftwareVertex& v ) {
+        return outside_guard_band( v.position );
+    } );
+    if ( guardClip )
+    {
+        clip( { 1.f, 0.f, 0.f, guardX } );
+        clip( { -1.f, 0.f, 0.f, guardX } );
+        clip( { 0.f, 1.f, 0.f, guardY } );
+        clip( { 0.f, -1.f, 0.f, guardY } );
+    }
+    // Nothing is counted for a triangle that is set up again with more room.
+    if ( polygonCount > maxTriangles + 2 )
+        return polygonCount - 2;
+    clipped += nearClip || guardClip;
+
+    // Project to the screen, y down like Metal's viewport, and snap to the nearest subpixel.
+    auto snap = []( double subpixels ) {
+        const double clamped = std::clamp( subpixels, double( -kGuardBand ), double( kGuardBand ) );
+        return static_cast<int32_t>( clamped + ( clamped >= 0.0 ? 0.5 : -0.5 ) );
+    };
+    int32_t sx[ kMaxClipVertices ], sy[ kMaxClipVertices ];
+    float sz[ kMaxClipVertices ], invW[ kMaxClipVertices ];
+    for ( size_t i = 0; i < polygonCount; ++i )
+    {
+        const math::float4& p = pPolygon[ i ].position;
+        invW[ i ] = 1.f / p.w;
+        sx[ i ] = snap( ( p.x * invW[ i ] * 0.5 + 0.5 ) * double( width * kSubpixel ) );
+        sy[ i ] = snap( ( 0.5 - p.y * invW[ i ] * 0.5 ) * double( height * kSubpixel ) );
+        sz[ i ] = p.z * invW[ i ];
+    }
+
+    size_t emitted = 0;
+    for ( size_t fan = 1; fan + 1 < polygonCount; ++fan )
+    {
+        const size_t corner[3] = { 0, fan, fan + 1 };
+        Triangle& tri = pOut[ emitted ];
+
+        for ( size_t i = 0; i < 3; ++i )
+        {
+            tri.x[ i ] = sx[ corner[ i ] ];
+            tri.y[ i ] = sy[ corner[ i ] ];
+            tri.z[ i ] = sz[ corner[ i ] ];
+            tri.invW[ i ] = invW[ corner[ i ] ];
+            for ( size_t k = 0; k < varyingCount; ++k )
+                tri.varyings[ i ][ k ] = pPolygon[ corner[ i ] ].varyings[ k ] * invW[ corner[ i ] ];
+        }
+
+        // Edge k runs from vertex k + 1 to k + 2. Swapping the ends negates its function
+        // exactly, so two triangles sharing an edge agree on every pixel along it.
+        for ( size_t k = 0; k < 3; ++k )
+        {
+            const size_t a = ( k + 1 ) % 3;
+            const size_t b = ( k + 2 ) % 3;
+            tri.edgeA[ k ] = tri.y[ a ] - tri.y[ b ];
+            tri.edgeB[ k ] = tri.x[ b ] - tri.x[ a ];
+        }
+
+        // Twice the area, edge 0's function at vertex 0. Positive is clockwise on screen since y points down.
+        const int64_t area = int64_t( tri.x[1] - tri.x[0] ) * ( tri.y[2] - tri.y[0] )
+                           - int64_t( tri.x[2] - tri.x[0] ) * ( tri.y[1] - tri.y[0] );
+        const bool front = draw.winding == gpu::Winding::CounterClockwise ? area < 0 : area > 0;
+        if ( area == 0
+          || ( draw.cullMode == gpu::CullMode::Back && !front )
+          || ( draw.cullMode == gpu::CullMode::Front && front ) )
+        {
+            culled++;
+            continue;
+        }
+
+        if ( area < 0 )
+        {
+            for ( size_t k = 0; k < 3; ++k )
+            {
+                tri.edgeA[ k ] = -tri.edgeA[ k ];
+                tri.edgeB[ k ] = -tri.edgeB[ k ];
+            }
+        }
+        tri.invArea = float( 1.0 / double( area < 0 ? -area : area ) );
+
+        // Top-left fill rule: pixels exactly on a top or left edge belong to this triangle,
+        // other edges need their function to be at least 1.
+        for ( size_t k = 0; k < 3; ++k )
+        {
+            const bool topLeft = tri.edgeA[ k ] > 0 || ( tri.edgeA[ k ] == 0 && tri.edgeB[ k ] > 0 );
+            tri.bias[ k ] = topLeft ? 0 : 1;
+        }
+
+        // Pixels whose centers, at ( x + 0.5, y + 0.5 ), are within the bounds.
+        const int64_t half = kSubpixel / 2;
+        const int64_t minX = std::min( { tri.x[0], tri.x[1], tri.x[2] } );
+        const int64_t maxX = std::max( { tri.x[0], tri.x[1], tri.x[2] } );
+        const int64_t minY = std::min( { tri.y[0], tri.y[1], tri.y[2] } );
+        const int64_t maxY = std::max( { tri.y[0], tri.y[1], tri.y[2] } );
+        tri.minX = static_cast<int>( std::max<int64_t>( 0, -floor_div( half - minX, kSubpixel ) ) );
+        tri.minY = static_cast<int>( std::max<int64_t>( 0, -floor_div( half - minY, kSubpixel ) ) );
+        tri.maxX = static_cast<int>( std::min<int64_t>( int64_t( width ) - 1, floor_div( maxX - half, kSubpixel ) ) );
+        tri.maxY = static_cast<int>( std::min<int64_t>( int64_t( height ) - 1, floor_div( maxY - half, kSubpixel ) ) );
+        if ( tri.minX > tri.maxX || tri.minY > tri.maxY )
+        {
+            culled++;
+            continue;
+        }
+
+        emitted++;
+    }
+
+    return emitted;
+}
+
+void SoftwareRasterizer::raster_tile( size_t tile, gpu::HeadlessTarget& target, const gpu::HeadlessDraw& draw,
+                                      FragmentFn fragment, size_t varyingCount,
+                                      uint64_t& covered, uint64_t& shaded ) const
+{
+    const std::vector<uint32_t>& bin = m_bins[ tile ];
+    if ( bin.empty() )
+        return;
+
+    const int tileX0 = static_cast<int>( ( tile % m_tilesX ) * kTileSize );
+    const int tileY0 = static_cast<int>( ( tile / m_tilesX ) * kTileSize );
+    const int tileX1 = std::min( tileX0 + static_cast<int>( kTileSize ), static_cast<int>( target.width() ) ) - 1;
+    const int tileY1 = std::min( tileY0 + static_cast<int>( kTileSize ), static_cast<int>( target.height() ) ) - 1;
+
+    const size_t pitch = target.width();
+    uint32_t* pColor = target.color();
+    float* pDepth = target.depth();
+    const bool quantizeDepth = static_cast<gpu::PixelFormat>( draw.pipeline.depthFormat ) == gpu::PixelFormat::Depth16Unorm;
+
+    for ( uint32_t triangleIndex : bin )
+    {
+        const Triangle& tri = m_triangles[ triangleIndex ];
+
+        const int x0 = std::max( tri.minX, tileX0 ) & ~int( Lanes::kWidth - 1 );
+        const int x1 = std::min( tri.maxX, tileX1 );
+        const int y0 = std::max( tri.minY, tileY0 );
+        const int y1 = std::min( tri.maxY, tileY1 );
+
+        // Edge functions step by A per subpixel right and B per subpixel down, with the bias of the
+        // fill rule taken off so that a pixel is inside when none of them is negative.
+        const int64_t half = kSubpixel / 2;
+        int64_t rowStart[3];
+        Lanes::V ramp[3], quadStep[3];
+        for ( size_t k = 0; k < 3; ++k )
+        {
+            const size_t a = ( k + 1 ) % 3;
+            rowStart[ k ] = int64_t( tri.edgeA[ k ] ) * ( int64_t( x0 ) * kSubpixel + half - tri.x[ a ] )
+                          + int64_t( tri.edgeB[ k ] ) * ( int64_t( y0 ) * kSubpixel + half - tri.y[ a ] ) - tri.bias[ k ];
+            ramp[ k ] = Lanes::ramp( int64_t( tri.edgeA[ k ] ) * kSubpixel );
+            quadStep[ k ] = Lanes::splat( int64_t( tri.edgeA[ k ] ) * kSubpixel * int64_t( Lanes::kWidth ) );
+        }
+
+        for ( int y = y0; y <= y1; ++y )
+        {
+            Lanes::V e[3];
+            for ( size_t k = 0; k < 3; ++k )
+            {
+                e[ k ] = Lanes::add( Lanes::splat( rowStart[ k ] ), ramp[ k ] );
+                rowStart[ k ] += int64_t( tri.edgeB[ k ] ) * kSubpixel;
+            }
+
+            for ( int x = x0; x <= x1; x += static_cast<int>( Lanes::kWidth ) )
+            {
+                const Lanes::V e0 = e[0], e1 = e[1], e2 = e[2];
+                for ( size_t k = 0; k < 3; ++k )
+                    e[ k ] = Lanes::add( e[ k ], quadStep[ k ] );
+
+                int mask = ~( Lanes::negative( e0 ) | Lanes::negative( e1 ) | Lanes::negative( e2 ) );
+
+                // Drop lanes past the tile or the triangle's bounds.
+                const int valid = std::min( x1 - x + 1, static_cast<int>( Lanes::kWidth ) );
+                mask &= ( 1 << valid ) - 1;
+                if ( !mask )
+                    continue;
+
+                int64_t w0[4], w1[4], w2[4];
+                Lanes::store( e0, w0 );
+                Lanes::store( e1, w1 );
+                Lanes::store( e2, w2 );
+
+                for ( ; mask; mask &= mask - 1 )
+                {
+                    const int lane = __builtin_ctz( mask );
+                    covered++;
+
+                    // Barycentrics from the exact edge functions, which sum to twice the area.
+                    const float l0 = float( w0[ lane ] + tri.bias[0] ) * tri.invArea;
+                    const float l1 = float( w1[ lane ] + tri.bias[1] ) * tri.invArea;
+                    const float l2 = float( w2[ lane ] + tri.bias[2] ) * tri.invArea;
+
+                    float z = l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2];
+                    if ( z < 0.f || z > 1.f )
+                        continue;
+                    if ( quantizeDepth )
+                        z = roundf( z * 65535.f ) / 65535.f;
+
+                    const size_t pixel = size_t( y ) * pitch + size_t( x + lane );
+                    if ( !depth_passes( draw.depthCompare, z, pDepth[ pixel ] ) )
+                        continue;
+
+                    const float w = 1.f / ( l0 * tri.invW[0] + l1 * tri.invW[1] + l2 * tri.invW[2] );
+                    float varyings[ SoftwareVertex::kMaxVaryings ];
+                    for ( size_t k = 0; k < varyingCount; ++k )
+                        varyings[ k ] = ( l0 * tri.varyings[0][ k ] + l1 * tri.varyings[1][ k ] + l2 * tri.varyings[2][ k ] ) * w;
+
+                    pColor[ pixel ] = encode_bgra8_srgb( fragment( varyings ) );
+                    if ( draw.depthWrite )
+                        pDepth[ pixel ] = z;
+                    shaded++;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "headless_backend.hpp"
+#include "job_system.hpp"
+#include "math_types.hpp"
+
+// Output of a software vertex function: clip space position plus varyings
+// that are interpolated perspective correct.
+struct SoftwareVertex
+{
+    static constexpr size_t kMaxVaryings = 8;
+
+    math::float4 position;
+    float varyings[ kMaxVaryings ];
+};
+
+// CPU implementation of the fixed function pipeline the Metal shaders run in,
+// meant as the reference output and workload measure for HeadlessDevice:
+//
+//   SoftwareRasterizer rasterizer( jobs );
+//   register_program_functions( rasterizer );
+//   device.set_draw_handler( [&]( auto& target, auto& draw ) { rasterizer.draw( target, draw ); } );
+//
+// Vertices are shaded per instance in parallel, triangles are clipped against
+// the near plane and a guard band, culled and binned into kTileSize tiles, then
+// the tiles are rasterized in parallel. Positions are snapped to 1/256 pixel and
+// edge functions are evaluated exactly in 64 bit integers, SIMD where
+// available, so triangles sharing an edge neither leave a crack nor both cover
+// a pixel on it. Each tile processes its
+// triangles in submission order, so the output is deterministic. Depth uses
+// the pipeline's depth format (Depth16Unorm is quantized) and color is written
+// as BGRA8Unorm_sRGB.
+class SoftwareRasterizer
+{
+    public:
+        using VertexFn = void (*)( const gpu::HeadlessDraw& draw, uint32_t vertexId, uint32_t instanceId, SoftwareVertex& out );
+        // Whether every read the vertex function makes for vertices [ 0, maxIndex ] and
+        // instances [ 0, draw.instanceCount ) stays inside the draw's buffers.
+        using BoundsFn = bool (*)( const gpu::HeadlessDraw& draw, uint32_t maxIndex );
+        // Returns linear color, before the sRGB encode.
+        using FragmentFn = math::float4 (*)( const float* varyings );
+
+        static constexpr size_t kTileSize = 64;
+
+        struct Stats
+        {
+            uint64_t vertices;
+            uint64_t triangles;
+            uint64_t trianglesCulled;
+            uint64_t trianglesClipped;
+            uint64_t tileBins;
+            // Fragments inside a triangle, before the depth test.
+            uint64_t fragmentsCovered;
+            uint64_t fragmentsShaded;
+        };
+
+        explicit SoftwareRasterizer( JobSystem& jobs );
+
+        SoftwareRasterizer( const SoftwareRasterizer& ) = delete;
+        SoftwareRasterizer& operator=( const SoftwareRasterizer& ) = delete;
+
+        // Functions are matched to pipelines by name, like in a Metal library. Draws
+        // whose bounds check fails are skipped before any vertex is shaded.
+        void register_vertex_function( const char* name, VertexFn fn, size_t varyingCount, BoundsFn bounds );
+        void register_fragment_function( const char* name, FragmentFn fn );
+
+        // Draw handler for HeadlessDevice, runs on its queue thread.
+        void draw( gpu::HeadlessTarget& target, const gpu::HeadlessDraw& draw );
+
+        Stats stats() const;
+        void reset_stats();
+
+    private:
+        struct VertexFunction
+        {
+            VertexFn fn;
+            size_t varyingCount;
+            BoundsFn bounds;
+        };
+
+        // Screen space triangle ready for rasterization, x and y in 1/256 pixels.
+        // Edge k is opposite vertex k and positive inside, its function at a point
+        // edgeA * ( x - x[k+1] ) + edgeB * ( y - y[k+1] ); bias is 1 for edges that
+        // don't own the pixels exactly on them. Varyings are premultiplied by 1 / w.
+        struct Triangle
+        {
+            int32_t x[3];
+            int32_t y[3];
+            float z[3];
+            float invW[3];
+            float varyings[3][ SoftwareVertex::kMaxVaryings ];
+
+            int32_t edgeA[3];
+            int32_t edgeB[3];
+            int32_t bias[3];
+            // Of twice the area, the sum of the edge functions.
+            float invArea;
+
+            int minX, minY, maxX, maxY;
+        };
+
+        // Returns how many triangles were written to pOut, or, when clipping split
+        // the triangle into more than maxTriangles, how many it needs, with nothing
+        // written or counted.
+        size_t setup_triangle( const SoftwareVertex* pClip, size_t varyingCount,
+                               const gpu::HeadlessDraw& draw, const gpu::HeadlessTarget& target,
+                               Triangle* pOut, size_t maxTriangles, uint64_t& culled, uint64_t& clipped ) const;
+        void raster_tile( size_t tile, gpu::HeadlessTarget& target, const gpu::HeadlessDraw& draw,
+                          FragmentFn fragment, size_t varyingCount,
+                          uint64_t& covered, uint64_t& shaded ) const;
+
+        JobSystem& m_jobs;
+        std::unordered_map<std::string, VertexFunction> m_vertexFunctions;
+        std::unordered_map<std::string, FragmentFn> m_fragmentFunctions;
+
+        // Scratch reused between draws.
+        std::vector<SoftwareVertex> m_vertices;
+        // Which vertices of the shaded range the draw's indices refer to.
+        std::vector<uint8_t> m_referenced;
+        std::vector<Triangle> m_triangles;
+        std::vector<uint8_t> m_triangleCounts;
+        std::vector<std::vector<uint32_t>> m_bins;
+        size_t m_tilesX;
+        size_t m_tilesY;
+
+        std::atomic<uint64_t> m_vertexCount;
+        std::atomic<uint64_t> m_triangleCount;
+        std::atomic<uint64_t> m_culledCount;
+        std::atomic<uint64_t> m_clippedCount;
+        std::atomic<uint64_t> m_binCount;
+        std::atomic<uint64_t> m_coveredCount;
+        std::atomic<uint64_t> m_shadedCount;
+};
+
+// Registers C++ ports of the functions in shader/program.metal.
+void register_program_functions( SoftwareRasterizer& rasterizer );
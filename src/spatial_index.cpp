@@ -0,0 +1,44 @@
+#include "spatial_index.hpp"
+#include "instance_store.hpp"
+#include <algorithm>
+#include <cmath>
+
+math::float4 instance_sphere( const InstanceStore& store, size_t i )
+{
+    using S = InstanceStore::Stream;
+    return { store.stream( S::PositionX )[ i ], store.stream( S::PositionY )[ i ], store.stream( S::PositionZ )[ i ], store.stream( S::BoundingRadius )[ i ] };
+}
+
+float ray_sphere( const SpatialIndex::Ray& ray, const math::float4& sphere )
+{
+    const math::float3 oc = ray.origin - sphere.xyz();
+    const float b = math::dot( oc, ray.direction );
+    const float c = math::dot( oc, oc ) - sphere.w * sphere.w;
+    if ( c <= 0.f )
+        return 0.f;
+    const float discriminant = b * b - c;
+    if ( b > 0.f || discriminant < 0.f )
+        return -1.f;
+    return -b - std::sqrt( discriminant );
+}
+
+float ray_box( const SpatialIndex::Ray& ray, const math::float3& invDirection, const math::float3& boundsMin, const math::float3& boundsMax, float maxDistance )
+{
+    const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    const float inv[3] = { invDirection.x, invDirection.y, invDirection.z };
+    const float min[3] = { boundsMin.x, boundsMin.y, boundsMin.z };
+    const float max[3] = { boundsMax.x, boundsMax.y, boundsMax.z };
+    float tNear = 0.f;
+    float tFar = maxDistance;
+    for ( int k = 0; k < 3; ++k )
+    {
+        float t0 = ( min[k] - origin[k] ) * inv[k];
+        float t1 = ( max[k] - origin[k] ) * inv[k];
+        if ( t0 > t1 )
+            std::swap( t0, t1 );
+        // NaN from 0 * infinity, a ray in the slab's plane, must not reject the box.
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tNear <= tFar ? tNear : -1.f;
+}
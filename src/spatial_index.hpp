@@ -0,0 +1,63 @@
+#pragma once
+
+#include "math_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+class InstanceStore;
+struct Frustum;
+
+// Something that finds instances by their bounding spheres faster than testing
+// every one: the culling interface the spatial structures share. Instances are
+// the ones of an InstanceStore, by index; positions and bounding radii are read
+// from it.
+class SpatialIndex
+{
+    public:
+        struct Ray
+        {
+            math::float3 origin;
+            // Normalized.
+            math::float3 direction;
+            float maxDistance;
+        };
+
+        struct RayHit
+        {
+            uint32_t instance;
+            float distance;
+        };
+
+        virtual ~SpatialIndex() = default;
+
+        virtual const char* name() const = 0;
+
+        // Indexes every instance of the store, from scratch.
+        virtual void build( const InstanceStore& store ) = 0;
+
+        // The instances in pMoved[ 0, count ) changed position or bounding radius
+        // since the last build or update. The number of instances must not change.
+        virtual void update( const InstanceStore& store, const uint32_t* pMoved, size_t count ) = 0;
+
+        // Writes the instances whose spheres intersect the frustum to pVisible, in
+        // no particular order, and returns how many. pVisible needs room for every
+        // instance.
+        virtual size_t cull( const Frustum& frustum, uint32_t* pVisible ) const = 0;
+
+        // The nearest sphere the ray enters (or starts in) within maxDistance.
+        virtual bool raycast( const Ray& ray, RayHit& hit ) const = 0;
+};
+
+// Shared by the implementations.
+
+// The instance's bounding sphere as ( x, y, z, radius ).
+math::float4 instance_sphere( const InstanceStore& store, size_t i );
+
+// Distance along the ray at which it enters the sphere, 0 if it starts inside
+// it, negative if it misses it.
+float ray_sphere( const SpatialIndex::Ray& ray, const math::float4& sphere );
+
+// Distance along the ray at which it enters the box, 0 if it starts inside it,
+// negative if it misses it within maxDistance. invDirection is 1 / direction.
+float ray_box( const SpatialIndex::Ray& ray, const math::float3& invDirection, const math::float3& boundsMin, const math::float3& boundsMax, float maxDistance );
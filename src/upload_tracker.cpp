@@ -0,0 +1,65 @@
+#include "upload_tracker.hpp"
+#include <algorithm>
+#include <cassert>
+
+UploadTracker::UploadTracker( size_t copies, size_t mergeGap )
+    : m_copies( copies )
+    , m_mergeGap( mergeGap )
+    , m_count( 0 )
+{ }
+
+void UploadTracker::resize( size_t count )
+{
+    m_count = count;
+    m_written.assign( m_copies * m_count, 0 );
+}
+
+void UploadTracker::invalidate()
+{
+    std::fill( m_written.begin(), m_written.end(), 0 );
+}
+
+size_t UploadTracker::collect( size_t copy, const uint32_t* pGenerations,
+                               const uint32_t* pIndices, size_t count,
+                               std::vector<Range>& outRanges )
+{
+    assert( copy < m_copies );
+    uint32_t* pWritten = m_written.data() + copy * m_count;
+
+    const size_t firstRange = outRanges.size();
+    bool open = false;
+    Range range = { 0, 0 };
+
+    for ( size_t k = 0; k < count; ++k )
+    {
+        const uint32_t i = pIndices[ k ];
+        assert( i < m_count );
+        if ( pWritten[ i ] == pGenerations[ i ] )
+            continue;
+
+        if ( open && i - range.end <= m_mergeGap )
+        {
+            range.end = i + 1;
+            continue;
+        }
+
+        if ( open )
+            outRanges.push_back( range );
+        range = { i, i + 1 };
+        open = true;
+    }
+
+    if ( open )
+        outRanges.push_back( range );
+
+    // Everything inside a range gets packed, including the up to date instances merged into it.
+    size_t covered = 0;
+    for ( size_t r = firstRange; r < outRanges.size(); ++r )
+    {
+        for ( uint32_t i = outRanges[ r ].begin; i < outRanges[ r ].end; ++i )
+            pWritten[ i ] = pGenerations[ i ];
+        covered += outRanges[ r ].end - outRanges[ r ].begin;
+    }
+
+    return covered;
+}
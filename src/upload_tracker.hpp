@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Remembers which generation of every instance each copy of a multi-buffered
+// instance buffer holds.
+//
+// The renderer keeps one persistent copy per frame in flight and writes them
+// round robin, so an instance that changed once is rewritten into each copy in
+// turn and afterwards left alone. collect() turns the instances that are out of
+// date in a copy into contiguous ranges, which are what gets packed and flagged
+// with didModifyRange.
+class UploadTracker
+{
+    public:
+        struct Range
+        {
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        // Instances stale in a copy are merged into one range when at most
+        // `mergeGap` up to date instances separate them; rewriting a few extra
+        // instances is cheaper than flagging many tiny ranges.
+        UploadTracker( size_t copies, size_t mergeGap );
+
+        // Every instance becomes stale in every copy.
+        void resize( size_t count );
+        void invalidate();
+
+        // Appends the ranges covering those of pIndices (ascending) whose
+        // generation differs from what `copy` holds, and records them as
+        // written. Returns the number of instances the ranges cover. Calls for
+        // disjoint index sets may run concurrently.
+        size_t collect( size_t copy, const uint32_t* pGenerations,
+                        const uint32_t* pIndices, size_t count,
+                        std::vector<Range>& outRanges );
+
+        size_t copies() const { return m_copies; }
+        size_t size() const { return m_count; }
+
+    private:
+        size_t m_copies;
+        size_t m_mergeGap;
+        size_t m_count;
+
+        // m_written[ copy * m_count + i ] is the generation of instance i in that copy, 0 if never written.
+        std::vector<uint32_t> m_written;
+};
@@ -1,27 +1,162 @@
 #include "utility.hpp"
-#include <fstream>
-#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 
-std::string Utility::read_source(const char* filepath)
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define UTILITY_HAS_MMAP 1
+#endif
+
+MappedFile::MappedFile()
+    : p_data( nullptr )
+    , m_size( 0 )
+    , m_open( false )
+    , m_mapped( false )
+{ }
+
+MappedFile::MappedFile( const char* filepath, Access access )
+    : MappedFile()
+{
+#if UTILITY_HAS_MMAP
+    int fd = open( filepath, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        __builtin_printf("Failed to load file: %s \n", filepath);
+        __builtin_printf("%s \n\n", strerror( errno ));
+        return;
+    }
+
+    struct stat info;
+    if ( fstat( fd, &info ) == 0 && S_ISREG( info.st_mode ) && info.st_size > 0 )
+    {
+        void* pMap = mmap( nullptr, static_cast<size_t>( info.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( pMap != MAP_FAILED )
+        {
+            p_data = pMap;
+            m_size = static_cast<size_t>( info.st_size );
+            m_open = true;
+            m_mapped = true;
+            advise( access );
+        }
+    }
+    close( fd );
+
+    if ( m_open )
+        return;
+#endif
+
+    // Empty files (mmap rejects zero length), pipes, procfs or no mmap: fall back to one read.
+    m_open = read_whole( filepath );
+}
+
+MappedFile::~MappedFile()
+{
+    reset();
+}
+
+MappedFile::MappedFile( MappedFile&& other ) noexcept
+    : p_data( std::exchange( other.p_data, nullptr ) )
+    , m_size( std::exchange( other.m_size, 0 ) )
+    , m_open( std::exchange( other.m_open, false ) )
+    , m_mapped( std::exchange( other.m_mapped, false ) )
+{ }
+
+MappedFile& MappedFile::operator=( MappedFile&& other ) noexcept
+{
+    if ( this != &other )
+    {
+        reset();
+        p_data = std::exchange( other.p_data, nullptr );
+        m_size = std::exchange( other.m_size, 0 );
+        m_open = std::exchange( other.m_open, false );
+        m_mapped = std::exchange( other.m_mapped, false );
+    }
+    return *this;
+}
+
+void MappedFile::advise( Access access ) const
 {
-    std::string buffer;
+#if UTILITY_HAS_MMAP
+    if ( !m_mapped )
+        return;
 
-    std::ifstream fileHandler;
-    fileHandler.exceptions( std::ifstream::badbit | std::ifstream::failbit );
+    int advice = MADV_NORMAL;
+    switch ( access )
+    {
+        case Access::Normal:     advice = MADV_NORMAL;     break;
+        case Access::Sequential: advice = MADV_SEQUENTIAL; break;
+        case Access::Random:     advice = MADV_RANDOM;     break;
+        case Access::WillNeed:   advice = MADV_WILLNEED;   break;
+    }
+    madvise( p_data, m_size, advice );
+#else
+    (void)access;
+#endif
+}
 
-    try 
+bool MappedFile::read_whole( const char* filepath )
+{
+    FILE* pFile = fopen( filepath, "rb" );
+    if ( !pFile )
     {
-        fileHandler.open(filepath);
-        std::stringstream sstream;
-        sstream << fileHandler.rdbuf();
-        buffer = sstream.str();
+        __builtin_printf("Failed to load file: %s \n\n", filepath);
+        return false;
     }
-    catch (std::ifstream::failure err)
+
+    // Size may be unknown (pipes), so grow the buffer until EOF.
+    size_t capacity = 1 << 16;
+    uint8_t* pBuffer = static_cast<uint8_t*>( malloc( capacity ) );
+    size_t size = 0;
+    while ( pBuffer )
     {
-        __builtin_printf("Failed to load file: %s \n", filepath);
-        __builtin_printf("%s \n\n", err.what());
+        size += fread( pBuffer + size, 1, capacity - size, pFile );
+        if ( size < capacity )
+            break;
+
+        capacity *= 2;
+        uint8_t* pGrown = static_cast<uint8_t*>( realloc( pBuffer, capacity ) );
+        if ( !pGrown )
+            free( pBuffer );
+        pBuffer = pGrown;
     }
 
-    return buffer;
+    const bool ok = pBuffer && !ferror( pFile );
+    fclose( pFile );
+    if ( !ok )
+    {
+        __builtin_printf("Failed to load file: %s \n\n", filepath);
+        free( pBuffer );
+        return false;
+    }
+
+    p_data = pBuffer;
+    m_size = size;
+    return true;
+}
+
+void MappedFile::reset()
+{
+#if UTILITY_HAS_MMAP
+    if ( m_mapped )
+        munmap( p_data, m_size );
+    else
+#endif
+        free( p_data );
+
+    p_data = nullptr;
+    m_size = 0;
+    m_open = false;
+    m_mapped = false;
 }
 
+std::string Utility::read_source(const char* filepath)
+{
+    MappedFile file( filepath );
+    return std::string( file.view() );
+}
@@ -1,6 +1,52 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+
+// Read-only view of a whole file, memory-mapped where the platform allows and
+// read into a single heap buffer otherwise. The view stays valid for the
+// lifetime of the object.
+class MappedFile
+{
+    public:
+        enum class Access
+        {
+            Normal,
+            Sequential,
+            Random,
+            WillNeed
+        };
+
+        MappedFile();
+        explicit MappedFile( const char* filepath, Access access = Access::Sequential );
+        ~MappedFile();
+
+        MappedFile( MappedFile&& other ) noexcept;
+        MappedFile& operator=( MappedFile&& other ) noexcept;
+        MappedFile( const MappedFile& ) = delete;
+        MappedFile& operator=( const MappedFile& ) = delete;
+
+        bool is_open() const { return m_open; }
+        bool is_mapped() const { return m_mapped; }
+
+        const uint8_t* data() const { return static_cast<const uint8_t*>( p_data ); }
+        size_t size() const { return m_size; }
+        std::string_view view() const { return { static_cast<const char*>( p_data ), m_size }; }
+
+        // Passes an access pattern hint to the kernel, no-op for non-mapped files.
+        void advise( Access access ) const;
+
+    private:
+        bool read_whole( const char* filepath );
+        void reset();
+
+        void* p_data;
+        size_t m_size;
+        bool m_open;
+        bool m_mapped;
+};
 
 struct Utility
 {
@@ -1,13 +1,32 @@
 #include "view_delegate.hpp"
+#include "profiler.hpp"
+#include <cstdlib>
 
 ViewDelegate::ViewDelegate(MTL::Device* pDevice)
-    : _pRenderer(new Renderer(pDevice))
+    : _pDevice(new gpu::MetalDevice(pDevice))
+    , _pRenderer(new Renderer(_pDevice))
 { }
 
 ViewDelegate::~ViewDelegate()
-{ delete _pRenderer; }
+{
+    delete _pRenderer;
+    delete _pDevice;
+
+    profiler::FrameSummary frames = profiler::frame_summary();
+    __builtin_printf("frame time over the last %zu frames: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms \n",
+                     frames.frames, frames.p50Ms, frames.p95Ms, frames.p99Ms);
+
+    // e.g. PROFILE_TRACE=trace.json ./build/MetalApp
+    if ( const char* tracePath = getenv("PROFILE_TRACE") )
+        profiler::write_chrome_trace( tracePath );
+}
 
 void ViewDelegate::drawInMTKView(MTK::View* pView)
 {
-    _pRenderer->draw(pView);
+    NS::AutoreleasePool* pPool = NS::AutoreleasePool::alloc()->init();
+
+    gpu::MetalViewTarget target(pView);
+    _pRenderer->draw(target);
+
+    pPool->release();
 }
@@ -1,3 +1,4 @@
+#include "metal_backend.hpp"
 #include "renderer.hpp"
 
 class ViewDelegate : public MTK::ViewDelegate
@@ -8,5 +9,6 @@ class ViewDelegate : public MTK::ViewDelegate
         void drawInMTKView(MTK::View* pView) override;
 
     private:
+        gpu::MetalDevice* _pDevice;
         Renderer* _pRenderer;
 };
@@ -0,0 +1,288 @@
+#include "headless_backend.hpp"
+#include "math.hpp"
+#include "renderer.hpp"
+#include "software_rasterizer.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Renders the renderer's cube through HeadlessDevice with the software ports
+// of the program's functions and the state the renderer draws with: Depth16,
+// CompareFunction::Less, back faces culled with counter-clockwise fronts, sRGB
+// color. The camera looks down -z at axis aligned cubes, so every face seen
+// head on has a Lambert color and a depth that can be worked out exactly;
+// the checks compare pixels against those and against each other.
+namespace
+{
+
+constexpr size_t kSize = 64;
+constexpr size_t kCenter = kSize / 2;
+constexpr size_t kMaxCubes = 4;
+
+// The renderer's camera, without the orbit.
+const math::float4x4 kProjection = math::make_perspective( 45.f * float( M_PI ) / 180.f, 1.f, 0.01f, 500.f );
+
+// The program's light; faces facing the camera have a normal of +z in view space.
+const float kFacingLight = 0.8f / std::sqrt( 1.f + 1.f + 0.64f );
+
+struct Cube
+{
+    math::float3 position;
+    float size;
+    math::float3 color;
+};
+
+// Expected color of a face whose normal makes `ndotl` with the light, the way main_fragment and the
+// sRGB encode compute it, as a packed BGRA8 pixel.
+uint32_t lambert( const math::float3& color, float ndotl )
+{
+    auto channel = []( float c ) {
+        const float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf( c, 1.f / 2.4f ) - 0.055f;
+        return static_cast<uint32_t>( s * 255.f + 0.5f );
+    };
+    const math::float3 lit = color * 0.1f + color * ndotl;
+    return 0xff000000u | channel( lit.x ) << 16 | channel( lit.y ) << 8 | channel( lit.z );
+}
+
+// Within one step per channel, the rasterizer looks its sRGB values up in a table.
+bool same_color( uint32_t a, uint32_t b )
+{
+    for ( int shift = 0; shift < 32; shift += 8 )
+    {
+        const int difference = int( a >> shift & 0xff ) - int( b >> shift & 0xff );
+        if ( difference < -1 || difference > 1 )
+            return false;
+    }
+    return true;
+}
+
+// Depth16 value of a point at view space depth z, on the axis.
+float depth16( float z )
+{
+    const math::float4 clip = kProjection * math::float4 { 0.f, 0.f, z, 1.f };
+    return std::round( clip.z / clip.w * 65535.f ) / 65535.f;
+}
+
+struct Scene
+{
+    gpu::HeadlessDevice device;
+    gpu::HeadlessTarget target { kSize, kSize };
+    JobSystem jobs { 1 };
+    SoftwareRasterizer rasterizer { jobs };
+    gpu::Pipeline* pPipeline = nullptr;
+    gpu::DepthStencilState* pDepthState = nullptr;
+
+    gpu::Buffer* pVertices = nullptr;
+    gpu::Buffer* pIndices = nullptr;
+    gpu::Buffer* pInstances = nullptr;
+    gpu::Buffer* pCamera = nullptr;
+    gpu::Buffer* pVisible = nullptr;
+    // Snorm16 positions leave the vertex function in units of the cube's radius.
+    float positionScale = 1.f;
+
+    Scene()
+    {
+        register_program_functions( rasterizer );
+        device.set_draw_handler( [this]( gpu::HeadlessTarget& drawTarget, const gpu::HeadlessDraw& draw ) {
+            rasterizer.draw( drawTarget, draw );
+        } );
+        target.set_clear_color( 0xff000000 );
+
+        const char* functionNames[] = { "main_vertex", "main_fragment" };
+        CHECK( device.load_program( "shader/program.metal", functionNames, 2, nullptr, 0 ) );
+        PipelineDesc desc;
+        desc.vertexFunction = 0;
+        desc.fragmentFunction = 1;
+        desc.colorFormat = static_cast<uint16_t>( gpu::PixelFormat::BGRA8Unorm_sRGB );
+        desc.depthFormat = static_cast<uint16_t>( gpu::PixelFormat::Depth16Unorm );
+        pPipeline = device.new_pipeline( desc );
+        CHECK( pPipeline );
+        pDepthState = device.new_depth_stencil_state( gpu::CompareFunction::Less, true );
+
+        build_cube();
+
+        pInstances = device.new_buffer( kMaxCubes * sizeof(shader_types::InstanceData) );
+        pVisible = device.new_buffer( kMaxCubes * sizeof(uint32_t) );
+        for ( uint32_t i = 0; i < kMaxCubes; ++i )
+            static_cast<uint32_t*>( pVisible->contents() )[ i ] = i;
+
+        pCamera = device.new_buffer( sizeof(shader_types::CameraData) );
+        auto pCameraData = static_cast<shader_types::CameraData*>( pCamera->contents() );
+        pCameraData->perspectiveTransform = kProjection;
+        pCameraData->worldTransform = math::make_identity();
+        pCameraData->worldNormalTransform = math::discard_translation( pCameraData->worldTransform );
+    }
+
+    ~Scene()
+    {
+        device.wait_idle();
+        for ( gpu::Object* pObject : { static_cast<gpu::Object*>( pPipeline ), static_cast<gpu::Object*>( pDepthState ),
+                                       static_cast<gpu::Object*>( pVertices ), static_cast<gpu::Object*>( pIndices ),
+                                       static_cast<gpu::Object*>( pInstances ), static_cast<gpu::Object*>( pCamera ),
+                                       static_cast<gpu::Object*>( pVisible ) } )
+            if ( pObject )
+                pObject->release();
+    }
+
+    // The unit cube of Renderer::build_buffers().
+    void build_cube()
+    {
+        constexpr float s = 0.5f;
+        constexpr MeshData::Vertex verts[] = {
+            { { -s, -s, +s }, { 0.f,  0.f,  1.f } }, { { +s, -s, +s }, { 0.f,  0.f,  1.f } },
+            { { +s, +s, +s }, { 0.f,  0.f,  1.f } }, { { -s, +s, +s }, { 0.f,  0.f,  1.f } },
+            { { +s, -s, +s }, { 1.f,  0.f,  0.f } }, { { +s, -s, -s }, { 1.f,  0.f,  0.f } },
+            { { +s, +s, -s }, { 1.f,  0.f,  0.f } }, { { +s, +s, +s }, { 1.f,  0.f,  0.f } },
+            { { +s, -s, -s }, { 0.f,  0.f, -1.f } }, { { -s, -s, -s }, { 0.f,  0.f, -1.f } },
+            { { -s, +s, -s }, { 0.f,  0.f, -1.f } }, { { +s, +s, -s }, { 0.f,  0.f, -1.f } },
+            { { -s, -s, -s }, { -1.f, 0.f,  0.f } }, { { -s, -s, +s }, { -1.f, 0.f,  0.f } },
+            { { -s, +s, +s }, { -1.f, 0.f,  0.f } }, { { -s, +s, -s }, { -1.f, 0.f,  0.f } },
+            { { -s, +s, +s }, { 0.f,  1.f,  0.f } }, { { +s, +s, +s }, { 0.f,  1.f,  0.f } },
+            { { +s, +s, -s }, { 0.f,  1.f,  0.f } }, { { -s, +s, -s }, { 0.f,  1.f,  0.f } },
+            { { -s, -s, -s }, { 0.f, -1.f,  0.f } }, { { +s, -s, -s }, { 0.f, -1.f,  0.f } },
+            { { +s, -s, +s }, { 0.f, -1.f,  0.f } }, { { -s, -s, +s }, { 0.f, -1.f,  0.f } },
+        };
+        constexpr uint16_t indices[] = {
+             0,  1,  2,  2,  3,  0,
+             4,  5,  6,  6,  7,  4,
+             8,  9, 10, 10, 11,  8,
+            12, 13, 14, 14, 15, 12,
+            16, 17, 18, 18, 19, 16,
+            20, 21, 22, 22, 23, 20,
+        };
+        constexpr size_t vertexCount = sizeof(verts) / sizeof(verts[0]);
+
+        const bool snorm = shader_types::kVertexFormat == MeshVertexFormat::Snorm16Octahedral
+                        || shader_types::kVertexFormat == MeshVertexFormat::Snorm16_1010102;
+        positionScale = snorm ? 0.8660254f : 1.f;
+        pVertices = device.new_buffer( vertexCount * sizeof(shader_types::VertexData) );
+        encode_vertices( verts, vertexCount, shader_types::kVertexFormat, positionScale, pVertices->contents() );
+        pIndices = device.new_buffer( sizeof(indices) );
+        memcpy( pIndices->contents(), indices, sizeof(indices) );
+    }
+
+    void set_cube( size_t i, const Cube& cube )
+    {
+        const float scale = cube.size * positionScale;
+        const float color[4] = { cube.color.x, cube.color.y, cube.color.z, 1.f };
+#if INSTANCE_FORMAT_COMPACT
+        const float position[3] = { cube.position.x, cube.position.y, cube.position.z };
+        const float rotation[4] = { 0.f, 0.f, 0.f, 1.f };
+        const float scales[3] = { scale, scale, scale };
+        pack_instance_compact( position, rotation, scales, color, static_cast<CompactInstance*>( pInstances->contents() )[ i ] );
+#else
+        const math::float4x4 world = math::make_trs( cube.position, math::quat { 0.f, 0.f, 0.f, 1.f }, { scale, scale, scale } );
+        pack_instance( reinterpret_cast<const float*>( &world ), color, static_cast<PackedInstance*>( pInstances->contents() )[ i ] );
+#endif
+    }
+
+    // Draws the cubes one draw each, in order, in a pass that clears the target.
+    void draw( const std::vector<Cube>& cubes, gpu::CullMode cullMode = gpu::CullMode::Back,
+               gpu::Winding winding = gpu::Winding::CounterClockwise )
+    {
+        for ( size_t i = 0; i < cubes.size(); ++i )
+            set_cube( i, cubes[ i ] );
+
+        gpu::CommandBuffer* pCmd = device.command_buffer();
+        gpu::RenderEncoder* pEnc = pCmd->render_pass( target );
+        pEnc->set_pipeline( pPipeline );
+        pEnc->set_depth_stencil_state( pDepthState );
+        pEnc->set_cull_mode( cullMode );
+        pEnc->set_front_facing_winding( winding );
+        pEnc->set_vertex_buffer( pVertices, 0, 0 );
+        pEnc->set_vertex_buffer( pInstances, 0, 1 );
+        pEnc->set_vertex_buffer( pCamera, 0, 2 );
+        for ( size_t i = 0; i < cubes.size(); ++i )
+        {
+            pEnc->set_vertex_buffer( pVisible, i * sizeof(uint32_t), 3 );
+            pEnc->draw_indexed( 36, gpu::IndexType::UInt16, pIndices, 0, 1 );
+        }
+        pEnc->end_encoding();
+        pCmd->commit();
+        device.wait_idle();
+    }
+
+    uint32_t pixel( size_t x, size_t y ) const { return target.color()[ y * kSize + x ]; }
+    float depth( size_t x, size_t y ) const { return target.depth()[ y * kSize + x ]; }
+};
+
+// In front, its front face at z = -2.5 covers the middle half of the target.
+const Cube kNear = { { 0.f, 0.f, -3.f }, 1.f, { 0.8f, 0.4f, 0.2f } };
+// Behind, its front face at z = -4 covers all of it.
+const Cube kFar = { { 0.f, 0.f, -6.f }, 4.f, { 0.2f, 0.6f, 0.9f } };
+
+void test_faces()
+{
+    Scene scene;
+    scene.draw( { kFar, kNear } );
+
+    // The near cube's front face in the middle, the far one's around it, both lit head on.
+    CHECK( same_color( scene.pixel( kCenter, kCenter ), lambert( kNear.color, kFacingLight ) ) );
+    CHECK( same_color( scene.pixel( kCenter + 10, kCenter - 10 ), lambert( kNear.color, kFacingLight ) ) );
+    CHECK( same_color( scene.pixel( 0, 0 ), lambert( kFar.color, kFacingLight ) ) );
+    CHECK( same_color( scene.pixel( 4, kCenter ), lambert( kFar.color, kFacingLight ) ) );
+    CHECK( same_color( scene.pixel( kSize - 1, kSize - 1 ), lambert( kFar.color, kFacingLight ) ) );
+    CHECK( scene.depth( kCenter, kCenter ) == depth16( -2.5f ) );
+    CHECK( scene.depth( 0, 0 ) == depth16( -4.f ) );
+
+    // The side faces turn away from a camera inside their span and are culled: the near cube's front face
+    // spans 16.55 to 47.45 pixels each way, the centers of pixels 17 to 46, and that is all it covers.
+    size_t nearPixels = 0;
+    for ( size_t y = 0; y < kSize; ++y )
+        for ( size_t x = 0; x < kSize; ++x )
+            nearPixels += scene.pixel( x, y ) == scene.pixel( kCenter, kCenter );
+    CHECK( nearPixels == 30 * 30 );
+}
+
+void test_depth_order()
+{
+    // Drawn after the near cube, the far one loses the depth test wherever they overlap.
+    Scene first;
+    first.draw( { kFar, kNear } );
+    Scene second;
+    second.draw( { kNear, kFar } );
+    CHECK( memcmp( first.target.color(), second.target.color(), kSize * kSize * sizeof(uint32_t) ) == 0 );
+    CHECK( memcmp( first.target.depth(), second.target.depth(), kSize * kSize * sizeof(float) ) == 0 );
+}
+
+void test_depth16()
+{
+    // A millimeter behind the near cube's front face, well within one Depth16 step at this distance. In
+    // Depth32Float the nearer face drawn second would win; quantized, the two are equal and Less keeps the first.
+    const Cube behind = { { 0.f, 0.f, -3.001f }, 1.f, { 0.1f, 0.9f, 0.1f } };
+    CHECK( depth16( -2.501f ) == depth16( -2.5f ) );
+
+    Scene scene;
+    scene.draw( { behind, kNear } );
+    CHECK( same_color( scene.pixel( kCenter, kCenter ), lambert( behind.color, kFacingLight ) ) );
+    CHECK( scene.depth( kCenter, kCenter ) == depth16( -2.5f ) );
+}
+
+void test_culling()
+{
+    // With clockwise fronts the faces facing the camera are the culled ones, the near cube's back face at
+    // z = -3.5 shows through, facing away from the light.
+    Scene scene;
+    scene.draw( { kNear }, gpu::CullMode::Back, gpu::Winding::Clockwise );
+    CHECK( same_color( scene.pixel( kCenter, kCenter ), lambert( kNear.color, 0.f ) ) );
+    CHECK( scene.depth( kCenter, kCenter ) == depth16( -3.5f ) );
+    CHECK( scene.pixel( 0, 0 ) == 0xff000000u );
+
+    // Without culling the front face is nearer and wins.
+    scene.draw( { kNear }, gpu::CullMode::None );
+    CHECK( same_color( scene.pixel( kCenter, kCenter ), lambert( kNear.color, kFacingLight ) ) );
+    CHECK( scene.depth( kCenter, kCenter ) == depth16( -2.5f ) );
+}
+
+}
+
+int main()
+{
+    test_faces();
+    test_depth_order();
+    test_depth16();
+    test_culling();
+    return test_result();
+}
@@ -0,0 +1,107 @@
+#include "culling.hpp"
+#include "math.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+Frustum test_frustum()
+{
+    const math::float4x4 view = math::make_translate( { 0.f, 0.f, -20.f } );
+    return make_frustum( math::make_perspective( 45.f * M_PI / 180.f, 1.5f, 0.5f, 100.f ) * view );
+}
+
+// How far the sphere is from the nearest plane it could cross, to leave out
+// spheres where the kernel's fused multiply-adds may round the other way.
+float boundary_distance( const Frustum& frustum, float x, float y, float z, float radius )
+{
+    float nearest = INFINITY;
+    for ( const math::float4& plane : frustum.planes )
+        nearest = std::min( nearest, std::fabs( plane.x * x + plane.y * y + plane.z * z + plane.w + radius ) );
+    return nearest;
+}
+
+void test_planes()
+{
+    const Frustum frustum = test_frustum();
+    for ( const math::float4& plane : frustum.planes )
+        CHECK( std::fabs( math::length( plane.xyz() ) - 1.f ) < 1e-5f );
+
+    // The camera sits at z = 20 looking down -z, the near plane 0.5 and the far plane 100 in front of it.
+    CHECK( sphere_visible( frustum, { 0.f, 0.f, 0.f }, 0.f ) );
+    CHECK( sphere_visible( frustum, { 0.f, 0.f, 19.f }, 0.f ) );
+    CHECK( !sphere_visible( frustum, { 0.f, 0.f, 19.8f }, 0.f ) );
+    CHECK( sphere_visible( frustum, { 0.f, 0.f, 19.8f }, 0.5f ) );
+    CHECK( !sphere_visible( frustum, { 0.f, 0.f, -81.f }, 0.f ) );
+    CHECK( !sphere_visible( frustum, { 0.f, 0.f, 25.f }, 1.f ) );
+    CHECK( !sphere_visible( frustum, { 30.f, 0.f, 0.f }, 1.f ) );
+    CHECK( !sphere_visible( frustum, { 0.f, -30.f, 0.f }, 1.f ) );
+    CHECK( sphere_visible( frustum, { 0.f, -30.f, 0.f }, 25.f ) );
+}
+
+void test_boxes()
+{
+    const Frustum frustum = test_frustum();
+    CHECK( aabb_visible( frustum, { -1.f, -1.f, -1.f }, { 1.f, 1.f, 1.f } ) );
+    CHECK( !aabb_visible( frustum, { 30.f, -1.f, -1.f }, { 32.f, 1.f, 1.f } ) );
+    CHECK( classify_aabb( frustum, { -1.f, -1.f, -1.f }, { 1.f, 1.f, 1.f } ) == Containment::Inside );
+    CHECK( classify_aabb( frustum, { -1.f, -1.f, -1.f }, { 40.f, 1.f, 1.f } ) == Containment::Intersecting );
+    CHECK( classify_aabb( frustum, { 30.f, -1.f, -1.f }, { 32.f, 1.f, 1.f } ) == Containment::Outside );
+    CHECK( classify_aabb( frustum, { -1.f, -1.f, 30.f }, { 1.f, 1.f, 32.f } ) == Containment::Outside );
+}
+
+// cull_spheres, SIMD where the build has it, against sphere_visible one by one.
+void test_cull_spheres()
+{
+    const Frustum frustum = test_frustum();
+    std::mt19937 random( 7 );
+    std::uniform_real_distribution<float> coordinate( -60.f, 30.f );
+    std::uniform_real_distribution<float> size( 0.f, 3.f );
+
+    // Counts that leave every possible remainder after the 8 and 4 wide loops.
+    for ( size_t count : { size_t( 0 ), size_t( 1 ), size_t( 7 ), size_t( 8 ), size_t( 13 ), size_t( 4099 ) } )
+    {
+        std::vector<float> x( count ), y( count ), z( count ), radius( count );
+        for ( size_t i = 0; i < count; ++i )
+        {
+            x[i] = coordinate( random );
+            y[i] = coordinate( random );
+            z[i] = coordinate( random );
+            radius[i] = size( random );
+        }
+
+        const uint32_t baseIndex = 1000;
+        std::vector<uint32_t> visible( count );
+        const size_t visibleCount = cull_spheres( frustum, x.data(), y.data(), z.data(), radius.data(), count, baseIndex, visible.data() );
+        CHECK( visibleCount <= count );
+        if ( count > 1000 )
+            CHECK( visibleCount > count / 10 && visibleCount < count - count / 10 );
+
+        // In order, each index once, and exactly the spheres the scalar test keeps.
+        size_t k = 0;
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const bool expected = sphere_visible( frustum, { x[i], y[i], z[i] }, radius[i] );
+            const bool kept = k < visibleCount && visible[ k ] == baseIndex + i;
+            if ( kept )
+                k++;
+            if ( boundary_distance( frustum, x[i], y[i], z[i], radius[i] ) > 1e-4f )
+                CHECK( kept == expected );
+        }
+        CHECK( k == visibleCount );
+    }
+}
+
+}
+
+int main()
+{
+    test_planes();
+    test_boxes();
+    test_cull_spheres();
+    return test_result();
+}
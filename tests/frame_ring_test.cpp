@@ -0,0 +1,139 @@
+#include "frame_ring.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+
+struct Region
+{
+    size_t begin;
+    size_t end;
+    uint64_t fence;
+};
+
+bool overlaps( const FrameRing::Allocation& a, const Region& b )
+{
+    return a.offset < b.end && b.begin < a.offset + a.size;
+}
+
+void test_alignment_and_wrap()
+{
+    FrameRing ring( 1024, 2 );
+
+    ring.begin_frame();
+    FrameRing::Allocation a, b;
+    CHECK( ring.allocate( 100, 64, a ) );
+    CHECK( ring.allocate( 100, 64, b ) );
+    CHECK( a.offset == 0 );
+    CHECK( b.offset == 128 );
+    ring.signal( ring.end_frame() );
+
+    // The second allocation doesn't fit before the end of the buffer and goes to the front.
+    ring.begin_frame();
+    FrameRing::Allocation c, d;
+    CHECK( ring.allocate( 700, 64, c ) );
+    CHECK( c.offset == 256 );
+    CHECK( ring.allocate( 200, 64, d ) );
+    CHECK( d.offset == 0 );
+    CHECK( d.offset + d.size <= ring.capacity() );
+    ring.signal( ring.end_frame() );
+}
+
+void test_exhaustion()
+{
+    FrameRing ring( 1024, 2 );
+
+    // The first frame is never signalled, its memory stays taken.
+    ring.begin_frame();
+    FrameRing::Allocation a;
+    CHECK( ring.allocate( 600, 16, a ) );
+    ring.end_frame();
+
+    ring.begin_frame();
+    FrameRing::Allocation b;
+    CHECK( !ring.allocate( 600, 16, b ) );
+    CHECK( !ring.allocate( 2048, 16, b ) );
+    CHECK( !ring.allocate( 0, 16, b ) );
+    CHECK( ring.allocate( 400, 16, b ) );
+    CHECK( !ring.allocate( 32, 16, b ) );
+
+    // Abandoning hands back what the frame got so far, the in-flight frame keeps its memory.
+    ring.abandon_frame();
+    CHECK( ring.bytes_in_use() == 600 );
+    CHECK( ring.frames_in_flight() == 1 );
+
+    ring.begin_frame();
+    CHECK( ring.allocate( 400, 16, b ) );
+    CHECK( !overlaps( b, { a.offset, a.offset + a.size, 0 } ) );
+    ring.end_frame();
+}
+
+// Many frames of varying sizes with the GPU lagging behind: nothing handed out
+// may overlap a region whose frame hasn't completed, and the ring never holds
+// more than its capacity.
+void test_no_reuse_in_flight()
+{
+    const size_t framesInFlight = 3;
+    FrameRing ring( 4096, framesInFlight );
+
+    std::vector<Region> live;
+    std::vector<uint64_t> submitted;
+    uint32_t seed = 1;
+    size_t allocations = 0;
+    for ( int frame = 0; frame < 2000; ++frame )
+    {
+        // The GPU finishes the oldest frame once the CPU is as far ahead as allowed.
+        if ( submitted.size() == framesInFlight )
+        {
+            ring.signal( submitted.front() );
+            submitted.erase( submitted.begin() );
+        }
+        const uint64_t completed = ring.completed_fence();
+        live.erase( std::remove_if( live.begin(), live.end(), [completed]( const Region& r ) { return r.fence <= completed; } ),
+                    live.end() );
+
+        ring.begin_frame();
+        std::vector<Region> frameRegions;
+        const int count = 1 + frame % 4;
+        for ( int k = 0; k < count; ++k )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            const size_t size = 1 + ( seed >> 8 ) % 400;
+            FrameRing::Allocation alloc;
+            if ( !ring.allocate( size, 16, alloc ) )
+                continue;
+
+            allocations++;
+            CHECK( alloc.offset % 16 == 0 );
+            CHECK( alloc.offset + alloc.size <= ring.capacity() );
+            for ( const Region& r : live )
+                CHECK( !overlaps( alloc, r ) );
+            for ( const Region& r : frameRegions )
+                CHECK( !overlaps( alloc, r ) );
+            frameRegions.push_back( { alloc.offset, alloc.offset + alloc.size, 0 } );
+        }
+        CHECK( ring.bytes_in_use() <= ring.capacity() );
+
+        const uint64_t fence = ring.end_frame();
+        for ( Region& r : frameRegions )
+            r.fence = fence;
+        live.insert( live.end(), frameRegions.begin(), frameRegions.end() );
+        submitted.push_back( fence );
+    }
+
+    CHECK( allocations > 4000 );
+    CHECK( ring.high_water_mark() <= ring.capacity() );
+}
+
+}
+
+int main()
+{
+    test_alignment_and_wrap();
+    test_exhaustion();
+    test_no_reuse_in_flight();
+    return test_result();
+}
@@ -0,0 +1,178 @@
+#include "headless_backend.hpp"
+#include "renderer.hpp"
+#include "software_rasterizer.hpp"
+#include "test.hpp"
+
+#include <cstring>
+
+// Draws through HeadlessDevice with the software versions of the program's
+// functions, checking that draws which would read outside their buffers are
+// dropped instead of executed. The buffers are zeroed, the draws that do run
+// don't cover any pixels; the rasterizer's triangle count tells them apart.
+namespace
+{
+
+struct Scene
+{
+    gpu::HeadlessDevice device;
+    gpu::HeadlessTarget target { 64, 64 };
+    JobSystem jobs { 1 };
+    SoftwareRasterizer rasterizer { jobs };
+    gpu::Pipeline* pPipeline = nullptr;
+
+    // 3 vertices, 1 instance, the camera and a visible list of one.
+    gpu::Buffer* pVertices = nullptr;
+    gpu::Buffer* pInstances = nullptr;
+    gpu::Buffer* pCamera = nullptr;
+    gpu::Buffer* pVisible = nullptr;
+    gpu::Buffer* pIndices = nullptr;
+
+    Scene()
+    {
+        register_program_functions( rasterizer );
+        device.set_draw_handler( [this]( gpu::HeadlessTarget& drawTarget, const gpu::HeadlessDraw& draw ) {
+            rasterizer.draw( drawTarget, draw );
+        } );
+
+        const char* functionNames[] = { "main_vertex", "main_fragment" };
+        CHECK( device.load_program( "shader/program.metal", functionNames, 2, nullptr, 0 ) );
+        PipelineDesc desc;
+        desc.vertexFunction = 0;
+        desc.fragmentFunction = 1;
+        desc.colorFormat = static_cast<uint16_t>( gpu::PixelFormat::BGRA8Unorm_sRGB );
+        desc.depthFormat = static_cast<uint16_t>( gpu::PixelFormat::Depth32Float );
+        pPipeline = device.new_pipeline( desc );
+        CHECK( pPipeline );
+
+        pVertices = zeroed( 3 * sizeof(shader_types::VertexData) );
+        pInstances = zeroed( sizeof(shader_types::InstanceData) );
+        pCamera = zeroed( sizeof(shader_types::CameraData) );
+        pVisible = zeroed( sizeof(uint32_t) );
+        pIndices = zeroed( 6 * sizeof(uint16_t) );
+        set_indices( 0, 1, 2 );
+    }
+
+    ~Scene()
+    {
+        device.wait_idle();
+        for ( gpu::Object* pObject : { static_cast<gpu::Object*>( pPipeline ), static_cast<gpu::Object*>( pVertices ),
+                                       static_cast<gpu::Object*>( pInstances ), static_cast<gpu::Object*>( pCamera ),
+                                       static_cast<gpu::Object*>( pVisible ), static_cast<gpu::Object*>( pIndices ) } )
+            if ( pObject )
+                pObject->release();
+    }
+
+    gpu::Buffer* zeroed( size_t length )
+    {
+        gpu::Buffer* pBuffer = device.new_buffer( length );
+        memset( pBuffer->contents(), 0, length );
+        return pBuffer;
+    }
+
+    void set_indices( uint16_t a, uint16_t b, uint16_t c )
+    {
+        auto pData = static_cast<uint16_t*>( pIndices->contents() );
+        pData[0] = a;
+        pData[1] = b;
+        pData[2] = c;
+    }
+
+    // Draws one triangle with the standard bindings, `bind` may change them
+    // afterwards. Returns how many triangles reached the rasterizer.
+    template<typename Fn>
+    uint64_t draw( size_t instanceCount, size_t indexOffset, Fn&& bind )
+    {
+        rasterizer.reset_stats();
+        gpu::CommandBuffer* pCmd = device.command_buffer();
+        gpu::RenderEncoder* pEnc = pCmd->render_pass( target );
+        pEnc->set_pipeline( pPipeline );
+        pEnc->set_vertex_buffer( pVertices, 0, 0 );
+        pEnc->set_vertex_buffer( pInstances, 0, 1 );
+        pEnc->set_vertex_buffer( pCamera, 0, 2 );
+        pEnc->set_vertex_buffer( pVisible, 0, 3 );
+        bind( pEnc );
+        pEnc->draw_indexed( 3, gpu::IndexType::UInt16, pIndices, indexOffset, instanceCount );
+        pEnc->end_encoding();
+        pCmd->commit();
+        device.wait_idle();
+        return rasterizer.stats().triangles;
+    }
+
+    uint64_t draw( size_t instanceCount = 1, size_t indexOffset = 0 )
+    {
+        return draw( instanceCount, indexOffset, []( gpu::RenderEncoder* ) { } );
+    }
+};
+
+void test_in_bounds()
+{
+    Scene scene;
+    CHECK( scene.draw() == 1 );
+    // The last three indices of the buffer.
+    CHECK( scene.draw( 1, 3 * sizeof(uint16_t) ) == 1 );
+}
+
+void test_index_range()
+{
+    Scene scene;
+    const uint64_t drawsBefore = scene.device.stats().drawCalls;
+    // Two indices past the end of the buffer, the draw isn't even recorded.
+    CHECK( scene.draw( 1, 5 * sizeof(uint16_t) ) == 0 );
+    CHECK( scene.draw( 1, 100 ) == 0 );
+    CHECK( scene.device.stats().drawCalls == drawsBefore );
+}
+
+void test_vertex_reads()
+{
+    Scene scene;
+    scene.set_indices( 0, 1, 3 );
+    CHECK( scene.draw() == 0 );
+    scene.set_indices( 0, 1, 2 );
+
+    // The vertex buffer bound one vertex in leaves vertex 2 outside it.
+    CHECK( scene.draw( 1, 0, [&]( gpu::RenderEncoder* pEnc ) {
+        pEnc->set_vertex_buffer( scene.pVertices, sizeof(shader_types::VertexData), 0 );
+    } ) == 0 );
+}
+
+void test_instance_reads()
+{
+    Scene scene;
+    // More instances than the visible list holds.
+    CHECK( scene.draw( 2 ) == 0 );
+
+    // A visible index past the instance buffer.
+    static_cast<uint32_t*>( scene.pVisible->contents() )[0] = 1;
+    CHECK( scene.draw() == 0 );
+    static_cast<uint32_t*>( scene.pVisible->contents() )[0] = 0;
+
+    // Starting the visible list past its only entry.
+    CHECK( scene.draw( 1, 0, [&]( gpu::RenderEncoder* pEnc ) {
+        pEnc->set_vertex_buffer( scene.pVisible, sizeof(uint32_t), 3 );
+    } ) == 0 );
+}
+
+void test_bindings()
+{
+    Scene scene;
+    // An offset past the buffer unbinds the slot, the camera is then missing.
+    CHECK( scene.draw( 1, 0, [&]( gpu::RenderEncoder* pEnc ) {
+        pEnc->set_vertex_buffer( scene.pCamera, sizeof(shader_types::CameraData) + 1, 2 );
+    } ) == 0 );
+    // A slot that doesn't exist is ignored.
+    CHECK( scene.draw( 1, 0, [&]( gpu::RenderEncoder* pEnc ) {
+        pEnc->set_vertex_buffer( scene.pCamera, 0, gpu::HeadlessDraw::kMaxVertexBuffers );
+    } ) == 1 );
+}
+
+}
+
+int main()
+{
+    test_in_bounds();
+    test_index_range();
+    test_vertex_reads();
+    test_instance_reads();
+    test_bindings();
+    return test_result();
+}
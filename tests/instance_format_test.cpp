@@ -0,0 +1,228 @@
+#include "instance_store.hpp"
+#include "math.hpp"
+#include "packing.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Packs random instances in both formats and checks that what the shader
+// rebuilds from the compact one stays within the bounds CompactInstance
+// documents, against the full format as the reference. The full format's SIMD
+// path is checked against pack_instances_scalar, for ranges and gathers that
+// start and end off the batch boundaries.
+namespace
+{
+
+constexpr float kColorError = 1.f / 510.f;
+constexpr float kRotationError = 1.f / 65534.f;
+constexpr float kScaleError = 1.f / 2048.f;
+// Rounding of the float math on top of the quantization.
+constexpr float kSlack = 1e-5f;
+
+struct Instance
+{
+    float position[3];
+    float rotation[4];
+    float scale[3];
+    float color[4];
+};
+
+std::vector<Instance> random_instances( size_t count )
+{
+    std::mt19937 random( 3 );
+    std::uniform_real_distribution<float> coordinate( -500.f, 500.f );
+    std::normal_distribution<float> gaussian;
+    std::uniform_real_distribution<float> logScale( -3.f, 3.f );
+    // A little beyond [0, 1] to exercise the clamp.
+    std::uniform_real_distribution<float> channel( -0.1f, 1.1f );
+
+    std::vector<Instance> instances( count );
+    for ( Instance& instance : instances )
+    {
+        float q[4] = { gaussian( random ), gaussian( random ), gaussian( random ), gaussian( random ) };
+        const float length = std::sqrt( q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3] );
+        for ( int k = 0; k < 4; ++k )
+            instance.rotation[k] = q[k] / length;
+        for ( int k = 0; k < 3; ++k )
+        {
+            instance.position[k] = coordinate( random );
+            instance.scale[k] = std::exp2( logScale( random ) );
+        }
+        for ( int k = 0; k < 4; ++k )
+            instance.color[k] = channel( random );
+    }
+    return instances;
+}
+
+void fill_store( const std::vector<Instance>& instances, InstanceStore& store )
+{
+    store.resize( instances.size() );
+    for ( size_t i = 0; i < instances.size(); ++i )
+    {
+        const Instance& instance = instances[ i ];
+        store.set_position( i, instance.position[0], instance.position[1], instance.position[2] );
+        store.set_rotation( i, instance.rotation[0], instance.rotation[1], instance.rotation[2], instance.rotation[3] );
+        store.set_scale( i, instance.scale[0], instance.scale[1], instance.scale[2] );
+        store.set_color( i, instance.color[0], instance.color[1], instance.color[2], instance.color[3] );
+    }
+}
+
+void test_components()
+{
+    for ( const Instance& instance : random_instances( 10000 ) )
+    {
+        CompactInstance compact;
+        pack_instance_compact( instance.position, instance.rotation, instance.scale, instance.color, compact );
+
+        for ( int k = 0; k < 3; ++k )
+            CHECK( compact.position[k] == instance.position[k] );
+        for ( int k = 0; k < 4; ++k )
+        {
+            const float clamped = std::min( std::max( instance.color[k], 0.f ), 1.f );
+            CHECK( std::fabs( ( ( compact.color >> ( 8 * k ) ) & 0xff ) / 255.f - clamped ) <= kColorError + kSlack );
+            CHECK( std::fabs( dequantize_snorm16( compact.rotation[k] ) - instance.rotation[k] ) <= kRotationError + kSlack );
+        }
+        for ( int k = 0; k < 3; ++k )
+            CHECK( std::fabs( half_to_float( compact.scale[k] ) - instance.scale[k] ) <= instance.scale[k] * kScaleError );
+    }
+}
+
+void test_unpacked_transform()
+{
+    const std::vector<Instance> instances = random_instances( 10000 );
+    InstanceStore store;
+    fill_store( instances, store );
+
+    const float identity[16] = { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f };
+    std::vector<PackedInstance> full( instances.size() );
+    std::vector<CompactInstance> compact( instances.size() );
+    pack_instances( store, identity, size_t( 0 ), instances.size(), full.data() );
+    pack_instances_compact( store, 0, instances.size(), compact.data() );
+
+    // With each component off by at most kRotationError the quaternion moves by at most twice that,
+    // renormalizing at most doubles it, and a rotation matrix entry moves by at most 4 times as much.
+    const float rotationMatrixError = 4.f * 2.f * 2.f * kRotationError;
+
+    size_t failures = 0;
+    for ( size_t i = 0; i < instances.size(); ++i )
+    {
+        PackedInstance unpacked;
+        unpack_instance( compact[ i ], unpacked );
+        const PackedInstance& reference = full[ i ];
+
+        // Columns 0-2 are the scaled rotation axes, column 3 the translation.
+        for ( int column = 0; column < 3; ++column )
+        {
+            const float scale = instances[ i ].scale[ column ];
+            const float bound = scale * ( rotationMatrixError + kScaleError + kSlack );
+            for ( int row = 0; row < 4; ++row )
+            {
+                failures += std::fabs( unpacked.transform[ column * 4 + row ] - reference.transform[ column * 4 + row ] ) > bound;
+                if ( row < 3 )
+                    failures += std::fabs( unpacked.normalTransform[ column * 4 + row ] - reference.normalTransform[ column * 4 + row ] ) > bound;
+            }
+        }
+        for ( int row = 0; row < 4; ++row )
+            failures += unpacked.transform[ 12 + row ] != reference.transform[ 12 + row ];
+        for ( int k = 0; k < 4; ++k )
+        {
+            const float clamped = std::min( std::max( reference.color[k], 0.f ), 1.f );
+            failures += std::fabs( unpacked.color[k] - clamped ) > kColorError + kSlack;
+        }
+    }
+    CHECK( failures == 0 );
+}
+
+void test_pack_matches_single()
+{
+    // The store path quantizes exactly like the single instance one.
+    const std::vector<Instance> instances = random_instances( 100 );
+    InstanceStore store;
+    fill_store( instances, store );
+
+    std::vector<CompactInstance> packed( instances.size() );
+    pack_instances_compact( store, 0, instances.size(), packed.data() );
+    for ( size_t i = 0; i < instances.size(); ++i )
+    {
+        const Instance& instance = instances[ i ];
+        CompactInstance single;
+        pack_instance_compact( instance.position, instance.rotation, instance.scale, instance.color, single );
+        CHECK( memcmp( &single, &packed[ i ], sizeof(single) ) == 0 );
+    }
+}
+
+bool matches( const PackedInstance& packed, const PackedInstance& reference )
+{
+    // The SIMD path fuses multiply-adds the scalar one rounds separately: a few ulps of the
+    // largest entry the sums go through.
+    float largest = 1.f;
+    for ( float f : reference.transform )
+        largest = std::max( largest, std::fabs( f ) );
+    const float bound = 1e-5f * largest;
+
+    bool same = true;
+    for ( int k = 0; k < 16; ++k )
+        same = same && std::fabs( packed.transform[k] - reference.transform[k] ) <= bound;
+    for ( int k = 0; k < 4; ++k )
+        same = same && packed.color[k] == reference.color[k];
+    // Columns of three, padded to four.
+    for ( int column = 0; column < 3; ++column )
+        for ( int row = 0; row < 3; ++row )
+            same = same && std::fabs( packed.normalTransform[ column * 4 + row ] - reference.normalTransform[ column * 4 + row ] ) <= bound;
+    return same;
+}
+
+void test_pack_matches_scalar()
+{
+    const std::vector<Instance> instances = random_instances( 1000 );
+    InstanceStore store;
+    fill_store( instances, store );
+    const math::float4x4 parent = math::make_trs( { 3.f, -40.f, 7.5f }, math::float3 { 0.3f, 1.1f, -0.4f }, { 1.5f, 0.5f, 2.f } );
+    const float* pParent = reinterpret_cast<const float*>( &parent );
+
+    // Whole batches, ranges starting and ending inside one, and ranges shorter than a batch.
+    const size_t ranges[][2] = { { 0, 1000 }, { 0, 5 }, { 3, 11 }, { 5, 6 }, { 1, 8 }, { 8, 16 }, { 13, 997 }, { 992, 1000 }, { 7, 7 } };
+    std::vector<PackedInstance> packed( instances.size() );
+    std::vector<PackedInstance> reference( instances.size() );
+    for ( const auto& range : ranges )
+    {
+        const size_t count = range[1] - range[0];
+        pack_instances( store, pParent, range[0], range[1], packed.data() );
+        pack_instances_scalar( store, pParent, range[0], range[1], reference.data() );
+        size_t failures = 0;
+        for ( size_t i = 0; i < count; ++i )
+            failures += !matches( packed[ i ], reference[ i ] );
+        CHECK( failures == 0 );
+    }
+
+    // Gathers of shuffled indices, repeats included, of counts around the batch size.
+    std::mt19937 random( 5 );
+    std::uniform_int_distribution<uint32_t> index( 0, static_cast<uint32_t>( instances.size() - 1 ) );
+    for ( size_t count : { 0u, 1u, 7u, 8u, 9u, 15u, 100u, 1000u } )
+    {
+        std::vector<uint32_t> indices( count );
+        for ( uint32_t& i : indices )
+            i = index( random );
+        pack_instances( store, pParent, indices.data(), count, packed.data() );
+        pack_instances_scalar( store, pParent, indices.data(), count, reference.data() );
+        size_t failures = 0;
+        for ( size_t i = 0; i < count; ++i )
+            failures += !matches( packed[ i ], reference[ i ] );
+        CHECK( failures == 0 );
+    }
+}
+
+}
+
+int main()
+{
+    test_components();
+    test_unpacked_transform();
+    test_pack_matches_single();
+    test_pack_matches_scalar();
+    return test_result();
+}
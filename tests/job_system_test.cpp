@@ -0,0 +1,131 @@
+#include "job_system.hpp"
+#include "test.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Runs parallel_for over several sizes and grains, nested inside itself too,
+// and checks that every index is visited exactly once, whether the caller,
+// the owner of a queue or a thief ran its chunk. Then chains jobs through a
+// JobCounter dependency and checks they start only after it is done.
+namespace
+{
+
+// One counter per index, how many times it was visited.
+struct Visits
+{
+    std::unique_ptr<std::atomic<int>[]> counts;
+    size_t size;
+
+    explicit Visits( size_t count )
+        : counts( new std::atomic<int>[ count ] )
+        , size( count )
+    {
+        for ( size_t i = 0; i < count; ++i )
+            counts[ i ].store( 0, std::memory_order_relaxed );
+    }
+
+    void visit( size_t begin, size_t end )
+    {
+        for ( size_t i = begin; i < end; ++i )
+            counts[ i ].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    size_t wrong() const
+    {
+        size_t wrong = 0;
+        for ( size_t i = 0; i < size; ++i )
+            wrong += counts[ i ].load( std::memory_order_relaxed ) != 1;
+        return wrong;
+    }
+};
+
+void test_parallel_for( JobSystem& jobs )
+{
+    for ( size_t count : { 0u, 1u, 7u, 64u, 65u, 1000u, 100000u } )
+        for ( size_t grain : { 0u, 1u, 3u, 64u, 1024u } )
+        {
+            Visits visits( count );
+            std::atomic<size_t> calls( 0 );
+            jobs.parallel_for( count, grain, [&]( size_t begin, size_t end ) {
+                CHECK( begin < end && end <= count );
+                visits.visit( begin, end );
+                calls.fetch_add( 1, std::memory_order_relaxed );
+            } );
+            CHECK( visits.wrong() == 0 );
+
+            // One call per chunk of the grain, or a single one when everything fits in it.
+            const size_t step = grain > 0 ? grain : 1;
+            const size_t chunks = count == 0 ? 0 : count <= step || jobs.thread_count() == 1 ? 1 : ( count + step - 1 ) / step;
+            CHECK( calls.load() == chunks );
+        }
+}
+
+constexpr size_t kOuter = 24;
+constexpr size_t kInner = 1000;
+
+void test_nested( JobSystem& jobs )
+{
+    // Every outer chunk runs a parallel_for of its own, waiting inside a job.
+    Visits visits( kOuter * kInner );
+    jobs.parallel_for( kOuter, 1, [&]( size_t begin, size_t end ) {
+        for ( size_t outer = begin; outer < end; ++outer )
+            jobs.parallel_for( kInner, 37, [&visits, outer]( size_t innerBegin, size_t innerEnd ) {
+                visits.visit( outer * kInner + innerBegin, outer * kInner + innerEnd );
+            } );
+    } );
+    CHECK( visits.wrong() == 0 );
+}
+
+void test_dependency( JobSystem& jobs )
+{
+    // The second batch depends on the first and must see all of it done.
+    constexpr int kJobs = 64;
+    JobCounter first;
+    JobCounter second;
+    std::atomic<int> firstDone( 0 );
+    std::atomic<int> early( 0 );
+    std::atomic<int> secondDone( 0 );
+    for ( int i = 0; i < kJobs; ++i )
+        jobs.run( first, [&firstDone]() {
+            std::this_thread::yield();
+            firstDone.fetch_add( 1, std::memory_order_relaxed );
+        } );
+    for ( int i = 0; i < kJobs; ++i )
+        jobs.run( second, [&]() {
+            early.fetch_add( firstDone.load( std::memory_order_relaxed ) != kJobs, std::memory_order_relaxed );
+            secondDone.fetch_add( 1, std::memory_order_relaxed );
+        }, &first );
+
+    jobs.wait( second );
+    CHECK( first.done() && second.done() );
+    CHECK( firstDone.load() == kJobs );
+    CHECK( secondDone.load() == kJobs );
+    CHECK( early.load() == 0 );
+
+    // A dependency that is already done doesn't hold anything back.
+    JobCounter third;
+    jobs.run( third, [&secondDone]() { secondDone.fetch_add( 1, std::memory_order_relaxed ); }, &first );
+    jobs.wait( third );
+    CHECK( secondDone.load() == kJobs + 1 );
+}
+
+}
+
+int main()
+{
+    // Without workers (0 on a single core machine) everything runs on the caller; with them,
+    // chunks are stolen.
+    for ( size_t workers : { 0u, 1u, 3u } )
+    {
+        JobSystem jobs( workers );
+        if ( workers == 0 && jobs.thread_count() > 1 )
+            continue;
+        test_parallel_for( jobs );
+        test_nested( jobs );
+        test_dependency( jobs );
+    }
+    return test_result();
+}
@@ -0,0 +1,142 @@
+#include "mesh.hpp"
+#include "test.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Writes small meshes with write_mesh and maps them back with MeshFile,
+// including files damaged after writing: an index past the last vertex in any
+// stream must be caught by one side or the other, not drawn.
+namespace
+{
+
+namespace fs = std::filesystem;
+
+std::string read_file( const fs::path& path )
+{
+    std::ifstream file( path, std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+}
+
+void write_file( const fs::path& path, const std::string& contents )
+{
+    std::ofstream( path, std::ios::binary ) << contents;
+}
+
+// A strip of quads along x, `vertexCount` vertices, as one submesh. A coarser
+// level of detail and a meshlet follow the submesh's indices.
+MeshData make_strip( uint32_t vertexCount )
+{
+    MeshData mesh;
+    for ( uint32_t i = 0; i < vertexCount; ++i )
+        mesh.vertices.push_back( { { float( i / 2 ), float( i % 2 ), 0.f }, { 0.f, 0.f, 1.f } } );
+    for ( uint32_t i = 0; i + 3 < vertexCount; i += 2 )
+        mesh.indices.insert( mesh.indices.end(), { i, i + 2, i + 1, i + 1, i + 2, i + 3 } );
+    mesh.submeshes.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+
+    const uint32_t lodOffset = static_cast<uint32_t>( mesh.indices.size() );
+    const uint32_t last = vertexCount - 1;
+    mesh.indices.insert( mesh.indices.end(), { 0, last - 1, 1, 1, last - 1, last } );
+    mesh.lods.push_back( { 0, lodOffset, 0, 1, 0.f, 0 } );
+    mesh.lods.push_back( { lodOffset, 6, 0, 0, 1.f, 0 } );
+
+    Meshlet meshlet = {};
+    meshlet.triangleCount = 2;
+    meshlet.vertexCount = 4;
+    meshlet.coneCutoff = 1.f;
+    mesh.meshlets.push_back( meshlet );
+    return mesh;
+}
+
+void test_round_trip( const fs::path& root )
+{
+    for ( uint32_t vertexCount : { 8u, 70000u } )
+    {
+        const MeshData mesh = make_strip( vertexCount );
+        const std::string path = ( root / "strip.mesh" ).string();
+        CHECK( write_mesh( path.c_str(), mesh ) );
+
+        const MeshFile file( path.c_str() );
+        CHECK( file.is_valid() );
+        if ( !file.is_valid() )
+            continue;
+        CHECK( file.header().indexSize == ( vertexCount <= 0x10000 ? 2u : 4u ) );
+        CHECK( file.header().indexCount == mesh.indices.size() );
+        CHECK( file.header().lodCount == 2 );
+        CHECK( file.header().meshletCount == 1 );
+        for ( size_t i = 0; i < mesh.indices.size(); ++i )
+        {
+            const uint32_t index = file.header().indexSize == 2 ? static_cast<const uint16_t*>( file.index_data() )[ i ]
+                                                                : static_cast<const uint32_t*>( file.index_data() )[ i ];
+            CHECK( index == mesh.indices[ i ] );
+        }
+    }
+}
+
+void test_write_rejects_indices( const fs::path& root )
+{
+    const std::string path = ( root / "bad.mesh" ).string();
+
+    // Past the last vertex in the submesh, and in the level of detail only the LOD table refers to.
+    MeshData mesh = make_strip( 8 );
+    mesh.indices[ 4 ] = 8;
+    CHECK( !write_mesh( path.c_str(), mesh ) );
+
+    mesh = make_strip( 8 );
+    mesh.indices.back() = 8;
+    CHECK( !write_mesh( path.c_str(), mesh ) );
+
+    // Ranges outside the index array.
+    mesh = make_strip( 8 );
+    mesh.lods[1].indexCount = 7;
+    CHECK( !write_mesh( path.c_str(), mesh ) );
+
+    mesh = make_strip( 8 );
+    mesh.meshlets[0].indexOffset = static_cast<uint32_t>( mesh.indices.size() ) - 3;
+    CHECK( !write_mesh( path.c_str(), mesh ) );
+}
+
+void test_load_rejects_indices( const fs::path& root )
+{
+    for ( uint32_t vertexCount : { 8u, 70000u } )
+    {
+        const fs::path path = root / "damaged.mesh";
+        const MeshData mesh = make_strip( vertexCount );
+        CHECK( write_mesh( path.string().c_str(), mesh ) );
+        const std::string good = read_file( path );
+        MeshHeader header;
+        memcpy( &header, good.data(), sizeof(header) );
+
+        // The last index, in the level of detail, set to the vertex count.
+        std::string damaged = good;
+        memcpy( &damaged[ header.indexOffset + size_t( header.indexCount - 1 ) * header.indexSize ], &vertexCount, header.indexSize );
+        write_file( path, damaged );
+        CHECK( !MeshFile( path.string().c_str() ).is_valid() );
+
+        // Cut off inside the index data.
+        write_file( path, good.substr( 0, good.size() - 1 ) );
+        CHECK( !MeshFile( path.string().c_str() ).is_valid() );
+
+        write_file( path, good );
+        CHECK( MeshFile( path.string().c_str() ).is_valid() );
+    }
+}
+
+}
+
+int main()
+{
+    const fs::path root = fs::temp_directory_path() / "mesh_file_test";
+    fs::remove_all( root );
+    fs::create_directories( root );
+
+    test_round_trip( root );
+    test_write_rejects_indices( root );
+    test_load_rejects_indices( root );
+
+    fs::remove_all( root );
+    return test_result();
+}
@@ -0,0 +1,230 @@
+#include "math.hpp"
+#include "mesh_import.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Imports the fixtures in tests/data and compares them with what their files
+// spell out: OBJ negative indices and polygon fans, a .gltf with a base64
+// buffer, interleaved attributes and a node hierarchy that mirrors one of its
+// instances, and a .glb without a scene. Then damages them, or writes small
+// broken files, and checks the importers refuse them.
+namespace
+{
+
+namespace fs = std::filesystem;
+
+constexpr float kEpsilon = 1e-5f;
+
+std::string read_file( const fs::path& path )
+{
+    std::ifstream file( path, std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+}
+
+void write_file( const fs::path& path, const std::string& contents )
+{
+    std::ofstream( path, std::ios::binary ) << contents;
+}
+
+math::float3 position( const MeshData& mesh, uint32_t v )
+{
+    const float* p = mesh.vertices[ v ].position;
+    return { p[0], p[1], p[2] };
+}
+
+math::float3 normal( const MeshData& mesh, uint32_t v )
+{
+    const float* n = mesh.vertices[ v ].normal;
+    return { n[0], n[1], n[2] };
+}
+
+bool near( const math::float3& a, const math::float3& b )
+{
+    return math::length( a - b ) <= kEpsilon;
+}
+
+// Every triangle wound counter-clockwise around the normals of its corners.
+bool fronts_match_normals( const MeshData& mesh )
+{
+    for ( size_t i = 0; i < mesh.indices.size(); i += 3 )
+    {
+        const uint32_t* t = &mesh.indices[ i ];
+        const math::float3 a = position( mesh, t[0] );
+        const math::float3 face = math::cross( position( mesh, t[1] ) - a, position( mesh, t[2] ) - a );
+        for ( int k = 0; k < 3; ++k )
+            if ( math::dot( face, normal( mesh, t[ k ] ) ) <= 0.f )
+                return false;
+    }
+    return true;
+}
+
+void test_obj()
+{
+    MeshData mesh;
+    CHECK( import_mesh( "tests/data/polygons.obj", mesh ) );
+
+    // The quad's four corners, the back triangle's three with another normal, the pentagon's five.
+    CHECK( mesh.vertices.size() == 12 );
+    CHECK( mesh.indices.size() == 6 + 3 + 9 );
+    CHECK( mesh.submeshes.size() == 2 );
+    if ( mesh.vertices.size() != 12 || mesh.indices.size() != 18 || mesh.submeshes.size() != 2 )
+        return;
+    CHECK( mesh.submeshes[0].indexOffset == 0 && mesh.submeshes[0].indexCount == 9 );
+    CHECK( mesh.submeshes[1].indexOffset == 9 && mesh.submeshes[1].indexCount == 9 );
+
+    // -4 to -1 are the four positions before the face, -1 the only normal so far.
+    const uint32_t quad[] = { 0, 1, 2, 0, 2, 3 };
+    CHECK( memcmp( mesh.indices.data(), quad, sizeof(quad) ) == 0 );
+    CHECK( near( position( mesh, 0 ), { 0.f, 0.f, 0.f } ) && near( position( mesh, 2 ), { 1.f, 1.f, 0.f } ) );
+    CHECK( near( position( mesh, 3 ), { 0.f, 1.f, 0.f } ) );
+    for ( uint32_t v = 0; v < 4; ++v )
+        CHECK( near( normal( mesh, v ), { 0.f, 0.f, 1.f } ) );
+
+    // Same positions as the quad's corners, another normal, so new vertices.
+    const uint32_t back[] = { 4, 5, 6 };
+    CHECK( memcmp( mesh.indices.data() + 6, back, sizeof(back) ) == 0 );
+    CHECK( near( position( mesh, 4 ), { 1.f, 1.f, 0.f } ) && near( position( mesh, 6 ), { 0.f, 0.f, 0.f } ) );
+    for ( uint32_t v = 4; v < 7; ++v )
+        CHECK( near( normal( mesh, v ), { 0.f, 0.f, -1.f } ) );
+
+    // Fanned from its first corner, normals generated from the faces.
+    const uint32_t fan[] = { 7, 8, 9, 7, 9, 10, 7, 10, 11 };
+    CHECK( memcmp( mesh.indices.data() + 9, fan, sizeof(fan) ) == 0 );
+    CHECK( near( position( mesh, 11 ), { -1.f, 1.f, 1.f } ) );
+    for ( uint32_t v = 7; v < 12; ++v )
+        CHECK( near( normal( mesh, v ), { 0.f, 0.f, 1.f } ) );
+
+    CHECK( fronts_match_normals( mesh ) );
+}
+
+void test_gltf()
+{
+    MeshData mesh;
+    CHECK( import_mesh( "tests/data/hierarchy.gltf", mesh ) );
+
+    // The triangle once per node reachable from the scene; node 3 isn't.
+    CHECK( mesh.vertices.size() == 6 );
+    CHECK( mesh.indices.size() == 6 );
+    CHECK( mesh.submeshes.size() == 2 );
+    if ( mesh.vertices.size() != 6 || mesh.indices.size() != 6 )
+        return;
+
+    // Root: translate ( 10, 0, 0 ) of scale 2. Node 1 moves the triangle up by one before the scale.
+    CHECK( near( position( mesh, 0 ), { 10.f, 2.f, 0.f } ) );
+    CHECK( near( position( mesh, 1 ), { 12.f, 2.f, 0.f } ) );
+    CHECK( near( position( mesh, 2 ), { 10.f, 4.f, 0.f } ) );
+    // Node 2 mirrors x, which flips the winding back to counter-clockwise and the normal's x.
+    CHECK( near( position( mesh, 3 ), { 10.f, 0.f, 0.f } ) );
+    CHECK( near( position( mesh, 4 ), { 8.f, 0.f, 0.f } ) );
+    CHECK( near( position( mesh, 5 ), { 10.f, 2.f, 0.f } ) );
+
+    const uint32_t indices[] = { 0, 1, 2, 3, 5, 4 };
+    CHECK( memcmp( mesh.indices.data(), indices, sizeof(indices) ) == 0 );
+    for ( uint32_t v = 0; v < 3; ++v )
+    {
+        // Read with the view's byteStride of 24, the normal 12 bytes into each vertex.
+        CHECK( near( normal( mesh, v ), { 0.6f, 0.f, 0.8f } ) );
+        CHECK( near( normal( mesh, v + 3 ), { -0.6f, 0.f, 0.8f } ) );
+    }
+    CHECK( fronts_match_normals( mesh ) );
+}
+
+void test_glb()
+{
+    MeshData mesh;
+    CHECK( import_mesh( "tests/data/triangle.glb", mesh ) );
+
+    // No scene, so the mesh as is; the line primitive is skipped, normals come from the face.
+    CHECK( mesh.vertices.size() == 3 );
+    CHECK( mesh.indices.size() == 3 );
+    CHECK( mesh.submeshes.size() == 1 );
+    if ( mesh.vertices.size() != 3 || mesh.indices.size() != 3 )
+        return;
+    CHECK( mesh.indices[0] == 0 && mesh.indices[1] == 1 && mesh.indices[2] == 2 );
+    CHECK( near( position( mesh, 2 ), { 0.f, 0.f, -1.f } ) );
+    for ( uint32_t v = 0; v < 3; ++v )
+        CHECK( near( normal( mesh, v ), { 0.f, 1.f, 0.f } ) );
+    CHECK( fronts_match_normals( mesh ) );
+}
+
+bool imports( const fs::path& path, const std::string& contents )
+{
+    write_file( path, contents );
+    MeshData mesh;
+    return import_mesh( path.string().c_str(), mesh );
+}
+
+void test_malformed( const fs::path& root )
+{
+    const fs::path obj = root / "bad.obj";
+    CHECK( imports( obj, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n" ) );
+    CHECK( !imports( obj, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 4\n" ) );
+    CHECK( !imports( obj, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -4 -3 -2\n" ) );
+    CHECK( !imports( obj, "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1//1 2//1 3//1\n" ) );
+    CHECK( !imports( obj, "v 0 0\n" ) );
+
+    // A triangle in a 36 byte buffer, then variations that break it.
+    const fs::path gltf = root / "bad.gltf";
+    const std::string buffer = "\"buffers\":[{\"byteLength\":36,\"uri\":\"data:application/octet-stream;base64,"
+                               "AAAAAAAAAAAAAAAAAACAPwAAAAAAAAAAAAAAAAAAgD8AAAAA\"}]";
+    const std::string views = "\"bufferViews\":[{\"buffer\":0,\"byteLength\":36}]";
+    const std::string meshes = "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0}}]}]";
+    auto file = [&]( const std::string& accessors, const std::string& rest ) {
+        return "{" + buffer + "," + views + ",\"accessors\":[" + accessors + "]," + meshes + rest + "}";
+    };
+    const std::string positions = "{\"bufferView\":0,\"componentType\":5126,\"count\":3,\"type\":\"VEC3\"}";
+    CHECK( imports( gltf, file( positions, "" ) ) );
+    // Four positions don't fit in the buffer.
+    CHECK( !imports( gltf, file( "{\"bufferView\":0,\"componentType\":5126,\"count\":4,\"type\":\"VEC3\"}", "" ) ) );
+    // Not the type the attribute needs.
+    CHECK( !imports( gltf, file( "{\"bufferView\":0,\"componentType\":5126,\"count\":3,\"type\":\"VEC2\"}", "" ) ) );
+    // A node that is its own child.
+    CHECK( !imports( gltf, file( positions, ",\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0,\"children\":[0]}]" ) ) );
+    // Cut short.
+    const std::string good = file( positions, "" );
+    CHECK( !imports( gltf, good.substr( 0, good.size() - 1 ) ) );
+    // A data URI that isn't base64.
+    std::string text = good;
+    text.replace( text.find( ";base64" ), 7, "" );
+    CHECK( !imports( gltf, text ) );
+
+    const fs::path glb = root / "bad.glb";
+    const std::string binary = read_file( "tests/data/triangle.glb" );
+    CHECK( imports( glb, binary ) );
+    // glTF 1.0 binaries.
+    std::string damaged = binary;
+    damaged[4] = 1;
+    CHECK( !imports( glb, damaged ) );
+    // A JSON chunk longer than the file leaves nothing to parse.
+    damaged = binary;
+    damaged[12] = '\xff';
+    damaged[13] = '\xff';
+    CHECK( !imports( glb, damaged ) );
+    // The byte index past the three positions.
+    damaged = binary;
+    damaged[ damaged.size() - 2 ] = 3;
+    CHECK( !imports( glb, damaged ) );
+}
+
+}
+
+int main()
+{
+    const fs::path root = fs::temp_directory_path() / "mesh_import_test";
+    fs::remove_all( root );
+    fs::create_directories( root );
+
+    test_obj();
+    test_gltf();
+    test_glb();
+    test_malformed( root );
+
+    fs::remove_all( root );
+    return test_result();
+}
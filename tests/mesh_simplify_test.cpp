@@ -0,0 +1,210 @@
+#include "math.hpp"
+#include "mesh_simplify.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Simplifies a closed sphere and a flat grid with an open border and checks
+// what the simplifier promises: no holes, flips or moved borders, errors
+// within the limit, and levels of detail that halve the triangles. Then picks
+// levels for known screen sizes.
+namespace
+{
+
+math::float3 position( const MeshData::Vertex& v )
+{
+    return { v.position[0], v.position[1], v.position[2] };
+}
+
+// Unit sphere, counter-clockwise seen from outside. The poles and the seam at phi = 0 are
+// welded, so the mesh is closed without attribute seams.
+MeshData make_sphere( uint32_t rings, uint32_t segments )
+{
+    MeshData mesh;
+    mesh.vertices.push_back( { { 0.f, 1.f, 0.f }, { 0.f, 1.f, 0.f } } );
+    for ( uint32_t ring = 1; ring < rings; ++ring )
+        for ( uint32_t segment = 0; segment < segments; ++segment )
+        {
+            const float theta = float( M_PI ) * ring / rings;
+            const float phi = 2.f * float( M_PI ) * segment / segments;
+            const float p[3] = { sinf( theta ) * cosf( phi ), cosf( theta ), -sinf( theta ) * sinf( phi ) };
+            mesh.vertices.push_back( { { p[0], p[1], p[2] }, { p[0], p[1], p[2] } } );
+        }
+    const uint32_t south = static_cast<uint32_t>( mesh.vertices.size() );
+    mesh.vertices.push_back( { { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f } } );
+
+    auto vertex = [segments]( uint32_t ring, uint32_t segment ) { return 1 + ( ring - 1 ) * segments + segment % segments; };
+    for ( uint32_t segment = 0; segment < segments; ++segment )
+    {
+        mesh.indices.insert( mesh.indices.end(), { 0, vertex( 1, segment ), vertex( 1, segment + 1 ) } );
+        for ( uint32_t ring = 1; ring + 1 < rings; ++ring )
+        {
+            const uint32_t a = vertex( ring, segment ), b = vertex( ring, segment + 1 );
+            const uint32_t c = vertex( ring + 1, segment ), d = vertex( ring + 1, segment + 1 );
+            mesh.indices.insert( mesh.indices.end(), { b, a, c, b, c, d } );
+        }
+        mesh.indices.insert( mesh.indices.end(), { vertex( rings - 1, segment + 1 ), vertex( rings - 1, segment ), south } );
+    }
+    return mesh;
+}
+
+// `cells` by `cells` unit squares in the z = 0 plane, facing +z.
+MeshData make_grid( uint32_t cells )
+{
+    MeshData mesh;
+    for ( uint32_t y = 0; y <= cells; ++y )
+        for ( uint32_t x = 0; x <= cells; ++x )
+            mesh.vertices.push_back( { { float( x ), float( y ), 0.f }, { 0.f, 0.f, 1.f } } );
+    for ( uint32_t y = 0; y < cells; ++y )
+        for ( uint32_t x = 0; x < cells; ++x )
+        {
+            const uint32_t i = y * ( cells + 1 ) + x;
+            mesh.indices.insert( mesh.indices.end(), { i, i + 1, i + cells + 2, i, i + cells + 2, i + cells + 1 } );
+        }
+    return mesh;
+}
+
+math::float3 face_normal( const MeshData& mesh, const uint32_t* p )
+{
+    const math::float3 a = position( mesh.vertices[ p[0] ] );
+    return math::cross( position( mesh.vertices[ p[1] ] ) - a, position( mesh.vertices[ p[2] ] ) - a );
+}
+
+// Directed edges minus their reverses: empty for a closed, consistently wound surface.
+std::map<std::pair<uint32_t, uint32_t>, int> open_edges( const uint32_t* pIndices, size_t indexCount )
+{
+    std::map<std::pair<uint32_t, uint32_t>, int> edges;
+    for ( size_t i = 0; i < indexCount; i += 3 )
+        for ( int k = 0; k < 3; ++k )
+        {
+            const uint32_t a = pIndices[ i + k ], b = pIndices[ i + ( k + 1 ) % 3 ];
+            edges[ { std::min( a, b ), std::max( a, b ) } ] += a < b ? 1 : -1;
+        }
+    for ( auto it = edges.begin(); it != edges.end(); )
+        it = it->second == 0 ? edges.erase( it ) : std::next( it );
+    return edges;
+}
+
+void test_sphere()
+{
+    const MeshData mesh = make_sphere( 32, 64 );
+    CHECK( open_edges( mesh.indices.data(), mesh.indices.size() ).empty() );
+
+    for ( float maxError : { 0.01f, 0.05f, 1.f } )
+    {
+        std::vector<uint32_t> simplified;
+        const size_t target = mesh.indices.size() / 8 / 3 * 3;
+        const float error = simplify_mesh( mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), mesh.vertices.size(),
+                                           target, maxError, simplified );
+        CHECK( error <= maxError );
+        CHECK( simplified.size() % 3 == 0 && simplified.size() < mesh.indices.size() );
+        CHECK( simplified.size() >= target );
+        // With a generous limit the target is reached, give or take a collapse per pass.
+        if ( maxError == 1.f )
+            CHECK( simplified.size() <= target + 6 );
+
+        // Still closed and wound the same way, every triangle facing out and not degenerate.
+        CHECK( open_edges( simplified.data(), simplified.size() ).empty() );
+        size_t inward = 0;
+        for ( size_t i = 0; i < simplified.size(); i += 3 )
+        {
+            CHECK( simplified[ i ] < mesh.vertices.size() && simplified[ i + 1 ] < mesh.vertices.size() && simplified[ i + 2 ] < mesh.vertices.size() );
+            const math::float3 center = position( mesh.vertices[ simplified[ i ] ] );
+            inward += math::dot( face_normal( mesh, &simplified[ i ] ), center ) <= 0.f;
+        }
+        CHECK( inward == 0 );
+    }
+}
+
+void test_grid()
+{
+    // Flat, so it collapses without error down to what its locked border allows, keeping the area.
+    const MeshData mesh = make_grid( 16 );
+    std::vector<uint32_t> simplified;
+    const float error = simplify_mesh( mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), mesh.vertices.size(),
+                                       0, 0.f, simplified );
+    CHECK( error == 0.f );
+    CHECK( simplified.size() < mesh.indices.size() / 4 );
+
+    float area = 0.f;
+    for ( size_t i = 0; i < simplified.size(); i += 3 )
+    {
+        const math::float3 n = face_normal( mesh, &simplified[ i ] );
+        CHECK( n.z > 0.f );
+        area += 0.5f * n.z;
+    }
+    CHECK( std::fabs( area - 256.f ) < 1e-3f );
+
+    // The border is still all there: each of its unit edges is an open edge of the result.
+    const auto edges = open_edges( simplified.data(), simplified.size() );
+    size_t borderLength = 0;
+    for ( const auto& edge : edges )
+        borderLength += size_t( math::length( position( mesh.vertices[ edge.first.second ] ) - position( mesh.vertices[ edge.first.first ] ) ) + 0.5f );
+    CHECK( borderLength == 64 );
+}
+
+void test_build_lods()
+{
+    MeshData mesh = make_sphere( 64, 128 );
+    const size_t fullIndexCount = mesh.indices.size();
+    build_lods( mesh );
+
+    CHECK( mesh.submeshes.size() == 1 );
+    CHECK( mesh.lods.size() > 2 && mesh.lods.size() <= kMeshMaxLods );
+    if ( mesh.lods.empty() )
+        return;
+    CHECK( mesh.lods[0].indexOffset == 0 && mesh.lods[0].indexCount == fullIndexCount );
+    CHECK( mesh.lods[0].error == 0.f );
+
+    uint32_t next = static_cast<uint32_t>( fullIndexCount );
+    for ( size_t level = 1; level < mesh.lods.size(); ++level )
+    {
+        const MeshLod& lod = mesh.lods[ level ];
+        const MeshLod& previous = mesh.lods[ level - 1 ];
+        CHECK( lod.indexOffset == next );
+        next = lod.indexOffset + lod.indexCount;
+        // About half the triangles of the level before, never less than a quarter saved.
+        CHECK( lod.indexCount * 4 <= previous.indexCount * 3 );
+        CHECK( lod.indexCount >= ( fullIndexCount / 3 >> level ) * 3 );
+        CHECK( lod.error >= previous.error && lod.error <= 0.1f );
+        CHECK( open_edges( mesh.indices.data() + lod.indexOffset, lod.indexCount ).empty() );
+    }
+    CHECK( next == mesh.indices.size() );
+}
+
+void test_select_lod()
+{
+    const MeshLod lods[] = {
+        { 0, 0, 0, 0, 0.f, 0 },
+        { 0, 0, 0, 0, 0.01f, 0 },
+        { 0, 0, 0, 0, 0.04f, 0 },
+        { 0, 0, 0, 0, 0.2f, 0 },
+    };
+
+    // Up close every level's error is too large, far away the coarsest is good enough.
+    CHECK( select_lod( lods, 4, 1000.f, 1.f ) == 0 );
+    CHECK( select_lod( lods, 4, 1.f, 1.f ) == 3 );
+    // The last level whose error still fits, inclusive.
+    CHECK( select_lod( lods, 4, 100.f, 1.f ) == 1 );
+    CHECK( select_lod( lods, 4, 25.f, 1.f ) == 2 );
+    CHECK( select_lod( lods, 4, 24.f, 1.f ) == 2 );
+    CHECK( select_lod( lods, 4, 5.f, 1.f ) == 3 );
+    CHECK( select_lod( lods, 4, 10.f, 2.f ) == 3 );
+    // Never past the levels given.
+    CHECK( select_lod( lods, 2, 1.f, 1.f ) == 1 );
+    CHECK( select_lod( lods, 1, 1.f, 1.f ) == 0 );
+}
+
+}
+
+int main()
+{
+    test_sphere();
+    test_grid();
+    test_build_lods();
+    test_select_lod();
+    return test_result();
+}
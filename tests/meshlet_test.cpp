@@ -0,0 +1,223 @@
+#include "math.hpp"
+#include "meshlet.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <set>
+#include <vector>
+
+// Builds meshlets over a sphere split into two submeshes and checks their
+// limits, bounds and index order, then culls them from random views: every
+// triangle of a culled meshlet must be outside the frustum or facing away, and
+// the merged ranges must cover every visible meshlet.
+namespace
+{
+
+math::float3 position( const MeshData::Vertex& v )
+{
+    return { v.position[0], v.position[1], v.position[2] };
+}
+
+// Unit sphere, counter-clockwise seen from outside; the northern and southern
+// halves are separate submeshes.
+MeshData make_sphere( uint32_t rings, uint32_t segments )
+{
+    MeshData mesh;
+    for ( uint32_t ring = 0; ring <= rings; ++ring )
+        for ( uint32_t segment = 0; segment <= segments; ++segment )
+        {
+            const float theta = float( M_PI ) * ring / rings;
+            const float phi = 2.f * float( M_PI ) * segment / segments;
+            const float p[3] = { sinf( theta ) * cosf( phi ), cosf( theta ), -sinf( theta ) * sinf( phi ) };
+            mesh.vertices.push_back( { { p[0], p[1], p[2] }, { p[0], p[1], p[2] } } );
+        }
+
+    for ( uint32_t ring = 0; ring < rings; ++ring )
+    {
+        if ( ring == rings / 2 )
+            mesh.submeshes.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+        for ( uint32_t segment = 0; segment < segments; ++segment )
+        {
+            const uint32_t i = ring * ( segments + 1 ) + segment;
+            const uint32_t below = i + segments + 1;
+            if ( ring > 0 )
+                mesh.indices.insert( mesh.indices.end(), { i, below, i + 1 } );
+            if ( ring + 1 < rings )
+                mesh.indices.insert( mesh.indices.end(), { i + 1, below, below + 1 } );
+        }
+    }
+    const uint32_t split = mesh.submeshes[0].indexCount;
+    mesh.submeshes.push_back( { split, static_cast<uint32_t>( mesh.indices.size() ) - split, {}, 0 } );
+    return mesh;
+}
+
+// A triangle rotated to start at its smallest index, so reordering can be told from rewinding.
+std::array<uint32_t, 3> canonical( const uint32_t* p )
+{
+    const size_t first = std::min_element( p, p + 3 ) - p;
+    return { p[ first ], p[ ( first + 1 ) % 3 ], p[ ( first + 2 ) % 3 ] };
+}
+
+std::multiset<std::array<uint32_t, 3>> triangles( const uint32_t* pIndices, size_t indexCount )
+{
+    std::multiset<std::array<uint32_t, 3>> set;
+    for ( size_t i = 0; i < indexCount; i += 3 )
+        set.insert( canonical( pIndices + i ) );
+    return set;
+}
+
+void test_build()
+{
+    MeshData mesh = make_sphere( 48, 96 );
+    const MeshData original = mesh;
+    build_meshlets( mesh );
+    CHECK( !mesh.meshlets.empty() );
+
+    // Each submesh keeps its triangles and winding, only their order changes.
+    for ( const MeshSubmesh& submesh : original.submeshes )
+        CHECK( triangles( mesh.indices.data() + submesh.indexOffset, submesh.indexCount )
+            == triangles( original.indices.data() + submesh.indexOffset, submesh.indexCount ) );
+
+    // Meshlets are consecutive runs in index order covering everything, none crossing a submesh.
+    uint32_t next = 0;
+    for ( const Meshlet& meshlet : mesh.meshlets )
+    {
+        CHECK( meshlet.indexOffset == next );
+        next = meshlet.indexOffset + meshlet.triangleCount * 3;
+        CHECK( meshlet.triangleCount > 0 && meshlet.triangleCount <= kMeshletMaxTriangles );
+        for ( const MeshSubmesh& submesh : original.submeshes )
+            CHECK( meshlet.indexOffset >= submesh.indexOffset + submesh.indexCount || next <= submesh.indexOffset
+                || ( meshlet.indexOffset >= submesh.indexOffset && next <= submesh.indexOffset + submesh.indexCount ) );
+
+        const std::set<uint32_t> vertices( mesh.indices.begin() + meshlet.indexOffset, mesh.indices.begin() + next );
+        CHECK( vertices.size() == meshlet.vertexCount );
+        CHECK( meshlet.vertexCount <= kMeshletMaxVertices );
+
+        const math::float3 center = { meshlet.center[0], meshlet.center[1], meshlet.center[2] };
+        for ( uint32_t v : vertices )
+            CHECK( math::length( position( mesh.vertices[ v ] ) - center ) <= meshlet.radius * 1.0001f );
+    }
+    CHECK( next == mesh.indices.size() );
+}
+
+void test_culling()
+{
+    MeshData mesh = make_sphere( 48, 96 );
+    build_meshlets( mesh );
+
+    std::mt19937 random( 5 );
+    std::uniform_real_distribution<float> offset( -2.f, 2.f );
+    std::uniform_real_distribution<float> distance( 1.5f, 6.f );
+    std::uniform_real_distribution<float> angle( 0.f, 2.f * float( M_PI ) );
+    const math::float4x4 projection = math::make_perspective( 60.f * float( M_PI ) / 180.f, 1.f, 0.1f, 100.f );
+
+    size_t culled = 0;
+    size_t visible = 0;
+    size_t wrong = 0;
+    for ( int view = 0; view < 200; ++view )
+    {
+        // Looking down -z from a random point, the sphere turned by a random angle instead of the camera.
+        const math::float3 eye = { offset( random ), offset( random ), distance( random ) };
+        const math::float4x4 world = math::make_Y_rotate( angle( random ) );
+        const math::float4x4 clip = projection * math::make_translate( { -eye.x, -eye.y, -eye.z } ) * world;
+        const Frustum frustum = make_frustum( clip );
+        const math::float4 eyeInMesh = math::inverse_affine( world ) * math::float4 { eye.x, eye.y, eye.z, 1.f };
+        const math::float3 meshEye = { eyeInMesh.x, eyeInMesh.y, eyeInMesh.z };
+
+        std::vector<MeshletRange> ranges;
+        const size_t visibleCount = cull_meshlets( mesh.meshlets.data(), mesh.meshlets.size(), frustum, meshEye, 0, ranges );
+        std::vector<MeshletRange> merged;
+        CHECK( cull_meshlets( mesh.meshlets.data(), mesh.meshlets.size(), frustum, meshEye, 2, merged ) == visibleCount );
+        CHECK( merged.size() <= ranges.size() );
+
+        size_t counted = 0;
+        size_t rangeIndices = 0;
+        for ( const MeshletRange& range : ranges )
+            rangeIndices += range.indexCount;
+        size_t visibleIndices = 0;
+        for ( const Meshlet& meshlet : mesh.meshlets )
+        {
+            const uint32_t begin = meshlet.indexOffset;
+            const uint32_t end = begin + meshlet.triangleCount * 3;
+            if ( meshlet_visible( meshlet, frustum, meshEye ) )
+            {
+                counted++;
+                visibleIndices += end - begin;
+                for ( const std::vector<MeshletRange>* pRanges : { &ranges, &merged } )
+                    CHECK( std::any_of( pRanges->begin(), pRanges->end(), [&]( const MeshletRange& r ) {
+                        return r.indexOffset <= begin && end <= r.indexOffset + r.indexCount;
+                    } ) );
+                continue;
+            }
+
+            // Conservative: no triangle of a culled meshlet could have been drawn.
+            for ( uint32_t i = begin; i < end; i += 3 )
+            {
+                const math::float3 a = position( mesh.vertices[ mesh.indices[ i + 0 ] ] );
+                const math::float3 b = position( mesh.vertices[ mesh.indices[ i + 1 ] ] );
+                const math::float3 c = position( mesh.vertices[ mesh.indices[ i + 2 ] ] );
+                const math::float3 toTriangle = a - meshEye;
+                const bool facingAway = math::dot( math::cross( b - a, c - a ), toTriangle ) >= -1e-6f;
+                bool outside = false;
+                for ( const math::float4& plane : frustum.planes )
+                {
+                    auto distance_to = [&plane]( const math::float3& p ) { return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w; };
+                    outside = outside || ( distance_to( a ) < 0.f && distance_to( b ) < 0.f && distance_to( c ) < 0.f );
+                }
+                wrong += !facingAway && !outside;
+            }
+            culled++;
+        }
+        CHECK( counted == visibleCount );
+        // Without merging the ranges hold exactly the visible meshlets.
+        CHECK( rangeIndices == visibleIndices );
+        visible += visibleCount;
+    }
+    CHECK( wrong == 0 );
+    CHECK( culled > 0 );
+    CHECK( visible > 0 );
+}
+
+void test_merge_gap()
+{
+    // Visible, culled, culled, visible, culled x3, visible: a gap of two merges, a gap of three doesn't.
+    std::vector<Meshlet> meshlets( 8 );
+    const bool visible[8] = { true, false, false, true, false, false, false, true };
+    for ( uint32_t i = 0; i < 8; ++i )
+    {
+        Meshlet& meshlet = meshlets[ i ];
+        meshlet.indexOffset = i * 30;
+        meshlet.triangleCount = 10;
+        meshlet.coneCutoff = 1.f;
+        meshlet.radius = 0.5f;
+        meshlet.center[2] = visible[ i ] ? -5.f : 5.f;
+    }
+    const Frustum frustum = make_frustum( math::make_perspective( 1.f, 1.f, 0.1f, 100.f ) );
+    const math::float3 eye = { 0.f, 0.f, 0.f };
+
+    std::vector<MeshletRange> ranges;
+    CHECK( cull_meshlets( meshlets.data(), meshlets.size(), frustum, eye, 2, ranges ) == 3 );
+    CHECK( ranges.size() == 2 );
+    if ( ranges.size() == 2 )
+    {
+        CHECK( ranges[0].indexOffset == 0 && ranges[0].indexCount == 120 );
+        CHECK( ranges[1].indexOffset == 210 && ranges[1].indexCount == 30 );
+    }
+
+    ranges.clear();
+    CHECK( cull_meshlets( meshlets.data(), meshlets.size(), frustum, eye, 0, ranges ) == 3 );
+    CHECK( ranges.size() == 3 );
+}
+
+}
+
+int main()
+{
+    test_build();
+    test_culling();
+    test_merge_gap();
+    return test_result();
+}
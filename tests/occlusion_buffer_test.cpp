@@ -0,0 +1,287 @@
+#include "math.hpp"
+#include "occlusion_buffer.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Rasterizes occluders in view space, looking down -z, and tests boxes
+// against them: behind an occluder that fills the screen every box is hidden,
+// while boxes that reach past its edge, sit in front of it or cross the near
+// plane are not. Random triangles and boxes are checked against the exact depth
+// of the triangles at points across each hidden box's screen rectangle, and
+// the SIMD rasterizer against the scalar one.
+namespace
+{
+
+constexpr size_t kSize = 128;
+
+math::float4x4 test_projection()
+{
+    return math::make_perspective( 60.f * M_PI / 180.f, 1.f, 0.1f, 100.f );
+}
+
+struct Mesh
+{
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+
+    void add_triangle( const math::float3& a, const math::float3& b, const math::float3& c )
+    {
+        for ( const math::float3& p : { a, b, c } )
+        {
+            indices.push_back( static_cast<uint32_t>( positions.size() / 3 ) );
+            positions.insert( positions.end(), { p.x, p.y, p.z } );
+        }
+    }
+
+    // A rectangle facing the camera at depth z, as two triangles sharing a diagonal.
+    void add_rectangle( float x0, float y0, float x1, float y1, float z )
+    {
+        const uint32_t first = static_cast<uint32_t>( positions.size() / 3 );
+        positions.insert( positions.end(), { x0, y0, z, x1, y0, z, x1, y1, z, x0, y1, z } );
+        indices.insert( indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 } );
+    }
+
+    void rasterize( OcclusionBuffer& buffer, bool simd = true ) const
+    {
+        if ( simd )
+            buffer.rasterize( test_projection(), positions.data(), positions.size() / 3, indices.data(), indices.size() );
+        else
+            buffer.rasterize_scalar( test_projection(), positions.data(), positions.size() / 3, indices.data(), indices.size() );
+    }
+};
+
+bool box_visible( const OcclusionBuffer& buffer, const math::float3& center, float extent )
+{
+    const math::float3 half = { extent, extent, extent };
+    return buffer.box_visible( test_projection(), center - half, center + half );
+}
+
+void test_full_screen()
+{
+    // At z = -10 the view is about 11.5 across; the rectangle reaches well past it.
+    Mesh wall;
+    wall.add_rectangle( -20.f, -20.f, 20.f, 20.f, -10.f );
+    OcclusionBuffer buffer( kSize, kSize );
+    wall.rasterize( buffer );
+    buffer.build_hierarchy();
+    CHECK( std::all_of( buffer.depths(), buffer.depths() + kSize * kSize, []( float depth ) { return depth < 1.f; } ) );
+
+    // Small and large boxes anywhere behind it, some reaching off the screen.
+    std::mt19937 random( 3 );
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+    size_t shown = 0;
+    for ( int k = 0; k < 1000; ++k )
+    {
+        const float extent = 0.01f + unit( random ) * 5.f;
+        const float z = -10.5f - extent - unit( random ) * 60.f;
+        const float reach = -z * 0.7f;
+        shown += box_visible( buffer, { ( unit( random ) - 0.5f ) * reach, ( unit( random ) - 0.5f ) * reach, z }, extent );
+    }
+    CHECK( shown == 0 );
+}
+
+void test_edges()
+{
+    // Covers about the middle third of the screen.
+    Mesh wall;
+    wall.add_rectangle( -2.f, -2.f, 2.f, 2.f, -10.f );
+    OcclusionBuffer buffer( kSize, kSize );
+    wall.rasterize( buffer );
+    buffer.build_hierarchy();
+
+    CHECK( !box_visible( buffer, { 0.f, 0.f, -20.f }, 1.f ) );
+    CHECK( !box_visible( buffer, { 1.f, -1.f, -40.f }, 3.f ) );
+    // Poking out past the right edge, or the bottom one, or entirely beside it.
+    CHECK( box_visible( buffer, { 3.5f, 0.f, -20.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 0.f, -3.5f, -20.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 6.f, 0.f, -20.f }, 1.f ) );
+    // In front of it, through it, across the near plane, behind the eye and off the screen.
+    CHECK( box_visible( buffer, { 0.f, 0.f, -5.f }, 0.5f ) );
+    CHECK( box_visible( buffer, { 0.f, 0.f, -10.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 0.f, 0.f, 0.f }, 0.5f ) );
+    CHECK( box_visible( buffer, { 0.f, 0.f, 10.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 100.f, 0.f, -20.f }, 1.f ) );
+
+    // A second rectangle to the right, with vertices of its own, hides boxes behind it but not one poking
+    // out above it. Texels the seam between the two crosses stay at the far plane.
+    wall.add_rectangle( 2.f, -2.f, 6.f, 2.f, -10.f );
+    buffer.clear();
+    wall.rasterize( buffer );
+    buffer.build_hierarchy();
+    CHECK( !box_visible( buffer, { 9.f, 0.f, -30.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 9.f, 6.f, -30.f }, 1.f ) );
+    CHECK( box_visible( buffer, { 4.f, 0.f, -20.f }, 0.5f ) );
+}
+
+struct ScreenTriangle
+{
+    float x[3], y[3], z[3];
+};
+
+// The triangles as the buffer sees them, minus the ones it skips at the near plane.
+std::vector<ScreenTriangle> project( const Mesh& mesh )
+{
+    std::vector<ScreenTriangle> triangles;
+    for ( size_t i = 0; i < mesh.indices.size(); i += 3 )
+    {
+        ScreenTriangle triangle;
+        bool skipped = false;
+        for ( int v = 0; v < 3; ++v )
+        {
+            const float* p = &mesh.positions[ 3 * mesh.indices[ i + v ] ];
+            const math::float4 clip = test_projection() * math::float4{ p[0], p[1], p[2], 1.f };
+            skipped = skipped || clip.z < 0.f;
+            triangle.x[v] = ( clip.x / clip.w + 1.f ) * 0.5f * kSize;
+            triangle.y[v] = ( clip.y / clip.w + 1.f ) * 0.5f * kSize;
+            triangle.z[v] = clip.z / clip.w;
+        }
+        if ( !skipped )
+            triangles.push_back( triangle );
+    }
+    return triangles;
+}
+
+// Nearest depth of the triangles at a point of the screen, 1 where none covers it.
+float depth_at( const std::vector<ScreenTriangle>& triangles, float px, float py )
+{
+    float nearest = 1.f;
+    for ( const ScreenTriangle& t : triangles )
+    {
+        const float area = ( t.x[1] - t.x[0] ) * ( t.y[2] - t.y[0] ) - ( t.x[2] - t.x[0] ) * ( t.y[1] - t.y[0] );
+        if ( std::fabs( area ) < 1e-6f )
+            continue;
+        float weights[3];
+        for ( int v = 0; v < 3; ++v )
+        {
+            const int a = ( v + 1 ) % 3, b = ( v + 2 ) % 3;
+            weights[v] = ( ( t.x[b] - t.x[a] ) * ( py - t.y[a] ) - ( px - t.x[a] ) * ( t.y[b] - t.y[a] ) ) / area;
+        }
+        if ( weights[0] < -1e-4f || weights[1] < -1e-4f || weights[2] < -1e-4f )
+            continue;
+        nearest = std::min( nearest, weights[0] * t.z[0] + weights[1] * t.z[1] + weights[2] * t.z[2] );
+    }
+    return nearest;
+}
+
+// Whether the box is behind the triangles at points spread over its screen rectangle, the part on the screen.
+bool hidden_at_samples( const std::vector<ScreenTriangle>& triangles, const math::float3& center, float extent )
+{
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY, nearest = INFINITY;
+    for ( int corner = 0; corner < 8; ++corner )
+    {
+        const math::float4 clip = test_projection() * math::float4{ center.x + ( corner & 1 ? extent : -extent ),
+                                                                    center.y + ( corner & 2 ? extent : -extent ),
+                                                                    center.z + ( corner & 4 ? extent : -extent ), 1.f };
+        const float sx = ( clip.x / clip.w + 1.f ) * 0.5f * kSize, sy = ( clip.y / clip.w + 1.f ) * 0.5f * kSize;
+        minX = std::min( minX, sx );
+        maxX = std::max( maxX, sx );
+        minY = std::min( minY, sy );
+        maxY = std::max( maxY, sy );
+        nearest = std::min( nearest, clip.z / clip.w );
+    }
+
+    constexpr int kSamples = 9;
+    for ( int j = 0; j < kSamples; ++j )
+        for ( int i = 0; i < kSamples; ++i )
+        {
+            const float px = std::clamp( minX + ( maxX - minX ) * i / ( kSamples - 1 ), 0.f, float( kSize ) );
+            const float py = std::clamp( minY + ( maxY - minY ) * j / ( kSamples - 1 ), 0.f, float( kSize ) );
+            if ( depth_at( triangles, px, py ) > nearest + 1e-5f )
+                return false;
+        }
+    return true;
+}
+
+// Loose triangles, and quads of two triangles sharing a diagonal, folded along it and not always convex.
+Mesh random_occluders( std::mt19937& random, size_t count )
+{
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+    Mesh mesh;
+    for ( size_t k = 0; k < count; ++k )
+    {
+        // Some cross the near plane or reach behind the eye.
+        const float z = -1.f - unit( random ) * 30.f;
+        const math::float3 center = { ( unit( random ) - 0.5f ) * -z, ( unit( random ) - 0.5f ) * -z, z };
+        const float size = 1.f + unit( random ) * 10.f;
+        if ( k % 2 == 0 )
+        {
+            auto corner = [&]() { return center + math::float3{ unit( random ) - 0.5f, unit( random ) - 0.5f, ( unit( random ) - 0.5f ) * 0.5f } * size; };
+            const math::float3 a = corner(), b = corner(), c = corner();
+            mesh.add_triangle( a, b, c );
+            continue;
+        }
+
+        const uint32_t first = static_cast<uint32_t>( mesh.positions.size() / 3 );
+        for ( int corner = 0; corner < 4; ++corner )
+        {
+            const float angle = ( corner + unit( random ) * 0.8f ) * 0.5f * M_PI;
+            const float distance = 0.5f * size * ( 0.3f + unit( random ) );
+            const math::float3 p = center + math::float3{ std::cos( angle ) * distance, std::sin( angle ) * distance, ( unit( random ) - 0.5f ) * size };
+            mesh.positions.insert( mesh.positions.end(), { p.x, p.y, p.z } );
+        }
+        mesh.indices.insert( mesh.indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 } );
+    }
+    return mesh;
+}
+
+void test_random()
+{
+    std::mt19937 random( 11 );
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+    size_t hidden = 0, wrong = 0;
+    for ( int scene = 0; scene < 8; ++scene )
+    {
+        const Mesh occluders = random_occluders( random, 48 );
+        OcclusionBuffer buffer( kSize, kSize );
+        occluders.rasterize( buffer );
+        buffer.build_hierarchy();
+        const std::vector<ScreenTriangle> triangles = project( occluders );
+
+        for ( int k = 0; k < 500; ++k )
+        {
+            const float z = -0.5f - unit( random ) * 50.f;
+            const math::float3 center = { ( unit( random ) - 0.5f ) * -z, ( unit( random ) - 0.5f ) * -z, z };
+            const float extent = 0.05f + unit( random ) * 2.f;
+            if ( box_visible( buffer, center, extent ) )
+                continue;
+            hidden++;
+            wrong += !hidden_at_samples( triangles, center, extent );
+        }
+    }
+    CHECK( hidden > 100 );
+    CHECK( wrong == 0 );
+}
+
+void test_simd_matches_scalar()
+{
+    std::mt19937 random( 19 );
+    for ( int scene = 0; scene < 8; ++scene )
+    {
+        const Mesh occluders = random_occluders( random, 64 );
+        OcclusionBuffer simd( kSize, kSize ), scalar( kSize, kSize );
+        occluders.rasterize( simd, true );
+        occluders.rasterize( scalar, false );
+        CHECK( simd.triangles_rasterized() == scalar.triangles_rasterized() );
+
+        // Fused multiply-adds round the depths a little differently.
+        size_t differ = 0;
+        for ( size_t i = 0; i < kSize * kSize; ++i )
+            differ += std::fabs( simd.depths()[ i ] - scalar.depths()[ i ] ) > 1e-5f;
+        CHECK( differ == 0 );
+    }
+}
+
+}
+
+int main()
+{
+    test_full_screen();
+    test_edges();
+    test_random();
+    test_simd_matches_scalar();
+    return test_result();
+}
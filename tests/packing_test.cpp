@@ -0,0 +1,204 @@
+#include "math.hpp"
+#include "mesh.hpp"
+#include "packing.hpp"
+#include "test.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Checks the encodings of packing.hpp against what they promise: halves round
+// to nearest even over every value, snorm16 and the normal encodings stay
+// within what their steps allow, octahedral normals come back at unit length,
+// and the bits sit where the Metal unpack functions expect them. Then round
+// trips whole vertex arrays through each MeshVertexFormat.
+namespace
+{
+
+constexpr float kSnormStep = 1.f / 32767.f;
+constexpr float kUnorm10Step = 1.f / 1023.f;
+// Each of u and v off by at most half a step moves the unfolded point by at most one and a half
+// steps in x and y and one in z, sqrt( 5.5 ) in all. The point is at least 1 / sqrt( 3 ) from the
+// origin, and normalizing a vector that long moves it by at most twice the distance over the length.
+const float kOctahedralError = 2.f * std::sqrt( 5.5f * 3.f ) * kSnormStep;
+// Rounding of the float math on top of the quantization.
+constexpr float kSlack = 1e-6f;
+
+float bits_to_float( uint32_t bits )
+{
+    float f;
+    memcpy( &f, &bits, sizeof(f) );
+    return f;
+}
+
+std::vector<math::float3> random_directions( size_t count )
+{
+    std::mt19937 random( 11 );
+    std::normal_distribution<float> gaussian;
+    std::vector<math::float3> directions = {
+        { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f },
+        // On the fold of the octahedron and next to it.
+        { 0.6f, 0.8f, 0.f }, { -0.8f, 0.6f, 0.f }, { 0.6f, -0.8f, -1e-7f }, { -0.6f, -0.8f, 1e-7f },
+    };
+    while ( directions.size() < count )
+    {
+        const math::float3 d = { gaussian( random ), gaussian( random ), gaussian( random ) };
+        const float length = math::length( d );
+        if ( length > 0.f )
+            directions.push_back( d * ( 1.f / length ) );
+    }
+    return directions;
+}
+
+void test_half()
+{
+    // Every half but NaN survives a round trip through float, NaN stays NaN.
+    for ( uint32_t h = 0; h <= 0xffff; ++h )
+    {
+        const float f = half_to_float( static_cast<uint16_t>( h ) );
+        if ( ( h & 0x7c00u ) == 0x7c00u && ( h & 0x3ffu ) )
+            CHECK( std::isnan( f ) && std::isnan( half_to_float( float_to_half( f ) ) ) );
+        else
+            CHECK( float_to_half( f ) == h );
+    }
+
+    // Between two neighboring finite halves, floats round to the nearer one and ties to the even one.
+    for ( uint32_t h = 0; h < 0x7bff; ++h )
+    {
+        const float low = half_to_float( static_cast<uint16_t>( h ) );
+        const float high = half_to_float( static_cast<uint16_t>( h + 1 ) );
+        const float middle = ( low + high ) * 0.5f;
+        uint32_t middleBits;
+        memcpy( &middleBits, &middle, sizeof(middleBits) );
+        CHECK( float_to_half( middle ) == ( h & 1u ? h + 1 : h ) );
+        CHECK( float_to_half( bits_to_float( middleBits - 1 ) ) == h );
+        CHECK( float_to_half( bits_to_float( middleBits + 1 ) ) == h + 1 );
+        CHECK( float_to_half( -middle ) == ( 0x8000u | ( h & 1u ? h + 1 : h ) ) );
+    }
+
+    // 65504 is the largest half; from half a step above it everything is infinity.
+    CHECK( float_to_half( 65504.f ) == 0x7bff );
+    CHECK( float_to_half( 65519.99f ) == 0x7bff );
+    CHECK( float_to_half( 65520.f ) == 0x7c00 );
+    CHECK( float_to_half( -1e30f ) == 0xfc00 );
+    CHECK( float_to_half( INFINITY ) == 0x7c00 );
+    // Below half the smallest subnormal, zero with the sign kept.
+    CHECK( float_to_half( 1e-8f ) == 0x0000 );
+    CHECK( float_to_half( -1e-8f ) == 0x8000 );
+}
+
+void test_snorm16()
+{
+    for ( int32_t s = -32767; s <= 32767; ++s )
+        CHECK( quantize_snorm16( dequantize_snorm16( static_cast<int16_t>( s ) ) ) == s );
+    // -32768 is another -1, as in Metal.
+    CHECK( dequantize_snorm16( INT16_MIN ) == -1.f );
+    CHECK( quantize_snorm16( 2.f ) == 32767 && quantize_snorm16( -2.f ) == -32767 );
+
+    std::mt19937 random( 13 );
+    std::uniform_real_distribution<float> value( -1.f, 1.f );
+    for ( int i = 0; i < 100000; ++i )
+    {
+        const float f = value( random );
+        CHECK( std::fabs( dequantize_snorm16( quantize_snorm16( f ) ) - f ) <= 0.5f * kSnormStep + kSlack );
+    }
+}
+
+void test_octahedral()
+{
+    // +z is the center of the map, +x and +y its corners, x in the low half.
+    const float z[3] = { 0.f, 0.f, 1.f }, x[3] = { 1.f, 0.f, 0.f }, y[3] = { 0.f, 1.f, 0.f };
+    CHECK( encode_octahedral( z ) == 0u );
+    CHECK( encode_octahedral( x ) == 0x00007fffu );
+    CHECK( encode_octahedral( y ) == 0x7fff0000u );
+
+    size_t failures = 0;
+    for ( const math::float3& d : random_directions( 100000 ) )
+    {
+        const float n[3] = { d.x, d.y, d.z };
+        float decoded[3];
+        decode_octahedral( encode_octahedral( n ), decoded );
+        const math::float3 out = { decoded[0], decoded[1], decoded[2] };
+        failures += std::fabs( math::length( out ) - 1.f ) > kSlack;
+        failures += math::length( out - d ) > kOctahedralError;
+    }
+    CHECK( failures == 0 );
+}
+
+void test_unorm10_10_10_2()
+{
+    const float low[3] = { -1.f, -1.f, -1.f }, high[3] = { 1.f, 1.f, 1.f }, beyond[3] = { 2.f, -2.f, 0.f };
+    CHECK( encode_unorm10_10_10_2( low ) == 0u );
+    CHECK( encode_unorm10_10_10_2( high ) == 0x3fffffffu );
+    // Clamped, x in the lowest bits, 511.5 rounding up for 0.
+    CHECK( encode_unorm10_10_10_2( beyond ) == ( 0x3ffu | 0u << 10 | 512u << 20 ) );
+
+    size_t failures = 0;
+    for ( const math::float3& d : random_directions( 100000 ) )
+    {
+        const float n[3] = { d.x, d.y, d.z };
+        const uint32_t packed = encode_unorm10_10_10_2( n );
+        failures += ( packed >> 30 ) != 0;
+        float decoded[3];
+        decode_unorm10_10_10_2( packed, decoded );
+        for ( int k = 0; k < 3; ++k )
+            failures += std::fabs( decoded[ k ] - n[ k ] ) > kUnorm10Step + kSlack;
+    }
+    CHECK( failures == 0 );
+}
+
+void test_vertex_formats()
+{
+    // Positions inside a radius of 3, as mesh_tool would scale snorm16 ones.
+    constexpr float kRadius = 3.f;
+    const std::vector<math::float3> directions = random_directions( 1000 );
+    std::mt19937 random( 17 );
+    std::uniform_real_distribution<float> coordinate( -kRadius / 2.f, kRadius / 2.f );
+    std::vector<MeshData::Vertex> vertices;
+    for ( const math::float3& d : directions )
+        vertices.push_back( { { coordinate( random ), coordinate( random ), coordinate( random ) }, { d.x, d.y, d.z } } );
+
+    for ( uint32_t f = 0; f < static_cast<uint32_t>( MeshVertexFormat::Count ); ++f )
+    {
+        const MeshVertexFormat format = static_cast<MeshVertexFormat>( f );
+        std::vector<uint8_t> encoded( vertices.size() * mesh_vertex_stride( format ) );
+        std::vector<MeshData::Vertex> decoded( vertices.size() );
+        encode_vertices( vertices.data(), vertices.size(), format, kRadius, encoded.data() );
+        decode_vertices( encoded.data(), vertices.size(), format, kRadius, decoded.data() );
+
+        const bool exact = format == MeshVertexFormat::Float32;
+        const bool half = format == MeshVertexFormat::HalfOctahedral || format == MeshVertexFormat::Half1010102;
+        const bool octahedral = format == MeshVertexFormat::HalfOctahedral || format == MeshVertexFormat::Snorm16Octahedral;
+        size_t failures = 0;
+        for ( size_t i = 0; i < vertices.size(); ++i )
+        {
+            const MeshData::Vertex& in = vertices[ i ];
+            const MeshData::Vertex& out = decoded[ i ];
+            for ( int k = 0; k < 3; ++k )
+            {
+                // Half keeps 11 significant bits, snorm16 is in steps of the radius.
+                const float bound = exact ? 0.f : half ? std::fabs( in.position[ k ] ) / 2048.f
+                                                       : 0.5f * kSnormStep * kRadius + kSlack;
+                failures += std::fabs( out.position[ k ] - in.position[ k ] ) > bound;
+            }
+
+            const float bound = exact ? 0.f : octahedral ? kOctahedralError : kUnorm10Step + kSlack;
+            for ( int k = 0; k < 3; ++k )
+                failures += std::fabs( out.normal[ k ] - in.normal[ k ] ) > bound;
+        }
+        CHECK( failures == 0 );
+    }
+}
+
+}
+
+int main()
+{
+    test_half();
+    test_snorm16();
+    test_octahedral();
+    test_unorm10_10_10_2();
+    test_vertex_formats();
+    return test_result();
+}
@@ -0,0 +1,235 @@
+#include "pipeline_cache.hpp"
+#include "test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Drives PipelineCache with a fake compiler that hands out numbered states and
+// counts compiles and releases per state: every field of the descriptor takes
+// part in hashing and equality, concurrent acquires of one descriptor compile
+// it once, prewarmed descriptors are hits, clear() releases each state once,
+// and failed or null compiles are not cached.
+namespace
+{
+
+// States are 1, 2, 3... in compile order, 0 is the null state.
+struct FakeCompiler
+{
+    std::atomic<int> next { 0 };
+    std::atomic<int> compiles { 0 };
+    std::chrono::milliseconds delay { 0 };
+    // A compile of a descriptor with this fragment function throws, or returns 0.
+    uint16_t throwFragment = 0xffff;
+    uint16_t nullFragment = 0xffff;
+
+    std::mutex mutex;
+    std::map<int, int> releases;
+
+    int compile( const PipelineDesc& desc )
+    {
+        compiles.fetch_add( 1 );
+        std::this_thread::sleep_for( delay );
+        if ( desc.fragmentFunction == throwFragment )
+            throw std::runtime_error( "compile failed" );
+        if ( desc.fragmentFunction == nullFragment )
+            return 0;
+        return next.fetch_add( 1 ) + 1;
+    }
+
+    void release( int state )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        releases[ state ]++;
+    }
+
+    // Each of states 1 to `count` released exactly once, nothing else.
+    bool released_once( int count )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        if ( releases.size() != size_t( count ) )
+            return false;
+        for ( int state = 1; state <= count; ++state )
+            if ( releases[ state ] != 1 )
+                return false;
+        return true;
+    }
+};
+
+using Cache = PipelineCache<int>;
+
+Cache make_cache( FakeCompiler& compiler )
+{
+    return Cache( [&compiler]( const PipelineDesc& desc ) { return compiler.compile( desc ); },
+                  [&compiler]( int state ) { compiler.release( state ); } );
+}
+
+PipelineDesc make_desc( uint16_t fragment )
+{
+    PipelineDesc desc;
+    desc.vertexFunction = 1;
+    desc.fragmentFunction = fragment;
+    desc.colorFormat = 80;
+    desc.depthFormat = 252;
+    return desc;
+}
+
+void test_hash_equality()
+{
+    const PipelineDesc base = make_desc( 2 );
+    const PipelineDescHash hash;
+    CHECK( base == make_desc( 2 ) );
+    CHECK( hash( base ) == hash( make_desc( 2 ) ) );
+
+    // Changing any one field makes another descriptor, with another hash.
+    std::vector<PipelineDesc> changed( 8, base );
+    changed[0].vertexFunction = 3;
+    changed[1].fragmentFunction = 3;
+    changed[2].colorFormat = 81;
+    changed[3].depthFormat = 260;
+    changed[4].blend = PipelineDesc::Blend::Alpha;
+    changed[5].sampleCount = 4;
+    changed[6].reserved = 1;
+    changed[7].functionConstants = 1u << 31;
+    for ( const PipelineDesc& desc : changed )
+    {
+        CHECK( !( desc == base ) );
+        CHECK( hash( desc ) != hash( base ) );
+    }
+}
+
+void test_concurrent_acquire()
+{
+    // Every thread asks while the first compile is still running.
+    FakeCompiler compiler;
+    compiler.delay = std::chrono::milliseconds( 50 );
+    Cache cache = make_cache( compiler );
+
+    constexpr int kThreads = 8;
+    std::vector<int> states( kThreads, -1 );
+    std::vector<std::thread> threads;
+    for ( int i = 0; i < kThreads; ++i )
+        threads.emplace_back( [&cache, &states, i]() { states[ i ] = cache.acquire( make_desc( 2 ) ); } );
+    for ( std::thread& thread : threads )
+        thread.join();
+
+    CHECK( compiler.compiles.load() == 1 );
+    for ( int state : states )
+        CHECK( state == 1 );
+
+    const Cache::Stats stats = cache.stats();
+    CHECK( stats.misses == 1 && stats.hits == kThreads - 1 );
+    CHECK( stats.compiles == 1 );
+    // The compile slept for 50 ms, the counter saw at least that.
+    CHECK( stats.compileNanoseconds >= 50000000u );
+    CHECK( cache.size() == 1 );
+}
+
+void test_prewarm()
+{
+    FakeCompiler compiler;
+    compiler.delay = std::chrono::milliseconds( 10 );
+    Cache cache = make_cache( compiler );
+
+    // The acquire waits for the compile prewarm queued instead of starting its own.
+    cache.prewarm( make_desc( 2 ) );
+    cache.prewarm( make_desc( 3 ) );
+    CHECK( cache.acquire( make_desc( 3 ) ) > 0 );
+    CHECK( cache.acquire( make_desc( 2 ) ) > 0 );
+    // Already there, nothing to do.
+    cache.prewarm( make_desc( 2 ) );
+    cache.clear();
+
+    const Cache::Stats stats = cache.stats();
+    CHECK( compiler.compiles.load() == 2 );
+    CHECK( stats.compiles == 2 );
+    CHECK( stats.hits == 2 && stats.misses == 0 );
+}
+
+void test_clear()
+{
+    FakeCompiler compiler;
+    {
+        Cache cache = make_cache( compiler );
+        for ( uint16_t fragment = 0; fragment < 5; ++fragment )
+        {
+            cache.acquire( make_desc( fragment ) );
+            cache.acquire( make_desc( fragment ) );
+        }
+        cache.prewarm( make_desc( 5 ) );
+        CHECK( cache.size() == 6 );
+
+        // Waits for the prewarm, then releases the six states once each.
+        cache.clear();
+        CHECK( cache.size() == 0 );
+        CHECK( compiler.released_once( 6 ) );
+
+        // Compiled again after a clear, and released by the destructor.
+        CHECK( cache.acquire( make_desc( 0 ) ) == 7 );
+        CHECK( compiler.compiles.load() == 7 );
+    }
+    CHECK( compiler.released_once( 7 ) );
+}
+
+void test_failures()
+{
+    FakeCompiler compiler;
+    compiler.throwFragment = 8;
+    compiler.nullFragment = 9;
+    {
+        Cache cache = make_cache( compiler );
+
+        // The exception reaches the caller and nothing is cached; the next acquire compiles again.
+        for ( int attempt = 0; attempt < 2; ++attempt )
+        {
+            bool threw = false;
+            try
+            {
+                cache.acquire( make_desc( 8 ) );
+            }
+            catch ( const std::runtime_error& )
+            {
+                threw = true;
+            }
+            CHECK( threw );
+            CHECK( cache.size() == 0 );
+        }
+        CHECK( compiler.compiles.load() == 2 );
+
+        // A prewarm that throws leaves nothing behind for acquire to wait on.
+        cache.prewarm( make_desc( 8 ) );
+        cache.clear();
+        CHECK( cache.size() == 0 );
+        compiler.throwFragment = 0xffff;
+        CHECK( cache.acquire( make_desc( 8 ) ) == 1 );
+
+        // Neither is a null state.
+        CHECK( cache.acquire( make_desc( 9 ) ) == 0 );
+        CHECK( cache.acquire( make_desc( 9 ) ) == 0 );
+        CHECK( cache.size() == 1 );
+        CHECK( compiler.compiles.load() == 6 );
+
+        const Cache::Stats stats = cache.stats();
+        CHECK( stats.misses == 5 && stats.hits == 0 );
+        // Compiles that threw are not counted.
+        CHECK( stats.compiles == 3 );
+    }
+    // Only the state that compiled is released.
+    CHECK( compiler.released_once( 1 ) );
+}
+
+}
+
+int main()
+{
+    test_hash_equality();
+    test_concurrent_acquire();
+    test_prewarm();
+    test_clear();
+    test_failures();
+    return test_result();
+}
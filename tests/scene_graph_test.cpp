@@ -0,0 +1,167 @@
+#include "instance_store.hpp"
+#include "job_system.hpp"
+#include "math.hpp"
+#include "scene_graph.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Builds a small hierarchy next to a plain list of parents and local
+// transforms, then dirties nodes at different depths and checks update()
+// recomputes exactly the dirty subtrees and that every world matrix matches
+// the product of the local ones along its path. Adding nodes to shallower
+// levels makes the next update() sort the levels again, which must keep
+// handles, parents and world matrices intact.
+namespace
+{
+
+struct Local
+{
+    SceneGraph::Node parent;
+    math::float3 position;
+    math::quat rotation;
+    math::float3 scale;
+};
+
+struct Tree
+{
+    SceneGraph graph;
+    std::vector<Local> locals;
+
+    SceneGraph::Node add( SceneGraph::Node parent, const math::float3& position, float angle, const math::float3& scale )
+    {
+        const math::quat rotation = math::make_quat_Y_rotate( angle ) * math::make_quat_X_rotate( 0.5f * angle );
+        locals.push_back( { parent, position, rotation, scale } );
+        const SceneGraph::Node node = graph.add_node( parent, position, rotation, scale );
+        CHECK( node == locals.size() - 1 );
+        return node;
+    }
+
+    void rotate( SceneGraph::Node node, float angle )
+    {
+        locals[ node ].rotation = math::make_quat_Z_rotate( angle );
+        graph.set_local_rotation( node, locals[ node ].rotation );
+    }
+
+    void move( SceneGraph::Node node, const math::float3& position )
+    {
+        locals[ node ].position = position;
+        graph.set_local_position( node, position );
+    }
+
+    void scale( SceneGraph::Node node, const math::float3& scale )
+    {
+        locals[ node ].scale = scale;
+        graph.set_local_scale( node, scale );
+    }
+
+    // Composed from the root down with the full matrix product.
+    math::float4x4 expected_world( SceneGraph::Node node ) const
+    {
+        const Local& local = locals[ node ];
+        const math::float4x4 transform = math::make_trs( local.position, local.rotation, local.scale );
+        return local.parent == SceneGraph::kNoParent ? transform : expected_world( local.parent ) * transform;
+    }
+
+    // How many nodes' world matrices differ from the expected ones, or whose parent changed.
+    size_t wrong() const
+    {
+        size_t wrong = 0;
+        for ( SceneGraph::Node node = 0; node < locals.size(); ++node )
+        {
+            wrong += graph.parent( node ) != locals[ node ].parent;
+            const math::float4x4 expected = expected_world( node );
+            const math::float4x4& world = graph.world_transform( node );
+            for ( int c = 0; c < 4; ++c )
+            {
+                const math::float4 difference = world.columns[ c ] - expected.columns[ c ];
+                wrong += std::fabs( difference.x ) + std::fabs( difference.y ) + std::fabs( difference.z ) + std::fabs( difference.w ) > 1e-4f;
+            }
+        }
+        return wrong;
+    }
+};
+
+void test_update( JobSystem& jobs, size_t grain )
+{
+    // root ─┬─ a ─┬─ c ── e
+    //       │     └─ d
+    //       └─ b ── f
+    Tree tree;
+    const SceneGraph::Node root = tree.add( SceneGraph::kNoParent, { 0.f, 0.f, -10.f }, 0.3f, { 1.f, 1.f, 1.f } );
+    const SceneGraph::Node a = tree.add( root, { 2.f, 0.f, 0.f }, 0.7f, { 0.5f, 0.5f, 0.5f } );
+    const SceneGraph::Node b = tree.add( root, { -2.f, 1.f, 0.f }, -0.2f, { 1.f, 2.f, 1.f } );
+    const SceneGraph::Node c = tree.add( a, { 0.f, 3.f, 0.f }, 1.1f, { 2.f, 2.f, 2.f } );
+    const SceneGraph::Node d = tree.add( a, { 1.f, 0.f, 1.f }, 0.f, { 1.f, 1.f, 1.f } );
+    const SceneGraph::Node e = tree.add( c, { 0.f, 0.f, 4.f }, -0.9f, { 1.5f, 1.5f, 1.5f } );
+    const SceneGraph::Node f = tree.add( b, { 0.f, -1.f, 2.f }, 0.4f, { 1.f, 1.f, 1.f } );
+    CHECK( tree.graph.size() == 7 );
+    CHECK( tree.graph.level_count() == 4 );
+
+    InstanceStore store;
+    store.resize( 1 );
+    tree.graph.bind_instance( e, 0, 0.5f );
+
+    // Everything is new, then nothing has changed.
+    CHECK( tree.graph.update( jobs, &store, grain ) == 7 );
+    CHECK( tree.wrong() == 0 );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 0 );
+
+    // The bound instance took e's world transform, its scale of 0.5 * 2 * 1.5 and the radius times that.
+    const math::float4 position = tree.expected_world( e ).columns[3];
+    CHECK( std::fabs( store.stream( InstanceStore::PositionX )[0] - position.x ) < 1e-4f );
+    CHECK( std::fabs( store.stream( InstanceStore::PositionY )[0] - position.y ) < 1e-4f );
+    CHECK( std::fabs( store.stream( InstanceStore::PositionZ )[0] - position.z ) < 1e-4f );
+    CHECK( std::fabs( store.stream( InstanceStore::ScaleX )[0] - 1.5f ) < 1e-5f );
+    CHECK( std::fabs( store.stream( InstanceStore::BoundingRadius )[0] - 0.75f ) < 1e-5f );
+
+    // An inner node takes its subtree with it and nothing else.
+    tree.rotate( a, 0.25f );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 4 );
+    CHECK( tree.wrong() == 0 );
+
+    // A leaf alone, then two subtrees at once, one inside the other's level.
+    tree.move( e, { 1.f, 1.f, 1.f } );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 1 );
+    tree.scale( c, { 3.f, 1.f, 3.f } );
+    tree.move( f, { 0.f, 0.f, 0.f } );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 3 );
+    CHECK( tree.wrong() == 0 );
+
+    // A node below the root after deeper ones, so the levels are sorted again, and nodes under it and
+    // under the deepest one.
+    const SceneGraph::Node g = tree.add( root, { 0.f, 5.f, 0.f }, 0.6f, { 1.f, 1.f, 1.f } );
+    tree.add( g, { 1.f, 0.f, 0.f }, -0.3f, { 2.f, 2.f, 2.f } );
+    tree.add( e, { 0.f, 2.f, 0.f }, 0.1f, { 1.f, 1.f, 1.f } );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 3 );
+    CHECK( tree.graph.size() == 10 );
+    CHECK( tree.graph.level_count() == 5 );
+    CHECK( tree.wrong() == 0 );
+
+    // The dirty tracking follows the nodes to where the sort put them.
+    tree.rotate( a, -0.5f );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 5 );
+    tree.move( g, { 0.f, 6.f, 0.f } );
+    tree.move( d, { 1.f, 1.f, 1.f } );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 3 );
+    tree.rotate( root, 0.9f );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 10 );
+    CHECK( tree.wrong() == 0 );
+    CHECK( tree.graph.update( jobs, &store, grain ) == 0 );
+}
+
+}
+
+int main()
+{
+    // Levels in one chunk and split into chunks of a node, run by one worker and by several.
+    for ( size_t workers : { 1u, 3u } )
+    {
+        JobSystem jobs( workers );
+        for ( size_t grain : { 1u, 1024u } )
+            test_update( jobs, grain );
+    }
+    return test_result();
+}
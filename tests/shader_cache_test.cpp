@@ -0,0 +1,111 @@
+#include "shader_cache.hpp"
+#include "test.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+std::string read_file( const std::string& path )
+{
+    std::ifstream file( path, std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+}
+
+void touch( const fs::path& path )
+{
+    std::ofstream( path ) << "x";
+}
+
+void test_key()
+{
+    const std::string key = ShaderCache::make_key( "kernel void f() {}", "-O2" );
+    CHECK( key.size() == 16 );
+    CHECK( key.find_first_not_of( "0123456789abcdef" ) == std::string::npos );
+
+    CHECK( key == ShaderCache::make_key( "kernel void f() {}", "-O2" ) );
+    CHECK( key != ShaderCache::make_key( "kernel void g() {}", "-O2" ) );
+    CHECK( key != ShaderCache::make_key( "kernel void f() {}", "-O3" ) );
+    CHECK( key != ShaderCache::make_key( "kernel void f() {}" ) );
+
+    // Where the source ends and the options begin is part of the key.
+    CHECK( ShaderCache::make_key( "ab", "c" ) != ShaderCache::make_key( "a", "bc" ) );
+}
+
+void test_lookup_and_store( const fs::path& root )
+{
+    // The directory doesn't exist until the first store.
+    const ShaderCache cache( ( root / "nested" / "cache" ).string() );
+    const std::string key = ShaderCache::make_key( "source" );
+
+    std::string path;
+    CHECK( !cache.lookup( "program", key, path ) );
+
+    const std::string library = "not really a metallib";
+    CHECK( cache.store( "program", key, library.data(), library.size() ) );
+    CHECK( cache.lookup( "program", key, path ) );
+    CHECK( path == cache.entry_path( "program", key ) );
+    CHECK( read_file( path ) == library );
+    CHECK( !fs::exists( path + ".tmp" ) );
+
+    // Another key or another name misses.
+    CHECK( !cache.lookup( "program", ShaderCache::make_key( "changed source" ), path ) );
+    CHECK( !cache.lookup( "other", key, path ) );
+}
+
+void test_invalidation( const fs::path& root )
+{
+    const ShaderCache cache( ( root / "invalidation" ).string() );
+    const fs::path directory = cache.directory();
+    const std::string oldKey = ShaderCache::make_key( "old" );
+    const std::string newKey = ShaderCache::make_key( "new" );
+    const std::string otherKey = ShaderCache::make_key( "other" );
+
+    const char data[] = "library";
+    CHECK( cache.store( "program", oldKey, data, sizeof(data) ) );
+    CHECK( cache.store( "program-foo", otherKey, data, sizeof(data) ) );
+    CHECK( cache.store( "programs", otherKey, data, sizeof(data) ) );
+    // Files that only look like entries.
+    touch( directory / "program-nothexnothexnoth.metallib" );
+    touch( directory / ( "program-" + oldKey + ".metallib.tmp" ) );
+    touch( directory / "notes.txt" );
+
+    // Storing a new key drops the old one, and nothing that isn't exactly `program-<key>.metallib`.
+    CHECK( cache.store( "program", newKey, data, sizeof(data) ) );
+    std::string path;
+    CHECK( !cache.lookup( "program", oldKey, path ) );
+    CHECK( cache.lookup( "program", newKey, path ) );
+    CHECK( cache.lookup( "program-foo", otherKey, path ) );
+    CHECK( cache.lookup( "programs", otherKey, path ) );
+    CHECK( fs::exists( directory / "program-nothexnothexnoth.metallib" ) );
+    CHECK( fs::exists( directory / ( "program-" + oldKey + ".metallib.tmp" ) ) );
+    CHECK( fs::exists( directory / "notes.txt" ) );
+
+    CHECK( cache.invalidate( "program", newKey ) == 0 );
+    CHECK( cache.invalidate( "program" ) == 1 );
+    CHECK( !cache.lookup( "program", newKey, path ) );
+    CHECK( cache.lookup( "program-foo", otherKey, path ) );
+
+    // A cache directory that doesn't exist has nothing to invalidate.
+    CHECK( ShaderCache( ( root / "missing" ).string() ).invalidate( "program" ) == 0 );
+}
+
+}
+
+int main()
+{
+    const fs::path root = fs::temp_directory_path() / "shader_cache_test";
+    fs::remove_all( root );
+
+    test_key();
+    test_lookup_and_store( root );
+    test_invalidation( root );
+
+    fs::remove_all( root );
+    return test_result();
+}
@@ -0,0 +1,276 @@
+#include "software_rasterizer.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Rasterizes meshes whose coverage is known exactly and compares every pixel:
+// the fill rule on pixel centers, meshes that tile the target or a silhouette
+// without cracks or pixels drawn twice, and triangles reaching far beyond the
+// target. Each runs on a small target and again in the far corner of a large
+// one, where float edge functions lose the bits that tell neighbors apart.
+// Positions are given in pixels from the corner, the vertex function maps them
+// to clip space; the fragment function writes white.
+namespace
+{
+
+// Of the region the meshes are placed in, at the bottom right of the target.
+constexpr size_t kSize = 64;
+constexpr size_t kTargetSizes[] = { kSize, 2048 };
+constexpr uint32_t kWhite = 0xffffffff;
+
+void test_vertex( const gpu::HeadlessDraw& draw, uint32_t vertexId, uint32_t, SoftwareVertex& out )
+{
+    out.position = reinterpret_cast<const math::float4*>( draw.vertexBuffers[0].pData )[ vertexId ];
+}
+
+bool test_vertex_bounds( const gpu::HeadlessDraw& draw, uint32_t maxIndex )
+{
+    return draw.vertexBuffers[0].pData && ( size_t( maxIndex ) + 1 ) * sizeof(math::float4) <= draw.vertexBuffers[0].size;
+}
+
+math::float4 test_fragment( const float* )
+{
+    return { 1.f, 1.f, 1.f, 1.f };
+}
+
+struct Canvas
+{
+    gpu::HeadlessTarget target;
+    size_t origin;
+    JobSystem jobs { 1 };
+    SoftwareRasterizer rasterizer { jobs };
+    std::vector<math::float4> positions;
+    std::vector<uint32_t> indices;
+
+    explicit Canvas( size_t targetSize )
+        : target( targetSize, targetSize )
+        , origin( targetSize - kSize )
+    {
+        rasterizer.register_vertex_function( "test_vertex", test_vertex, 0, test_vertex_bounds );
+        rasterizer.register_fragment_function( "test_fragment", test_fragment );
+    }
+
+    // A vertex at pixel coordinates x, y of the region, y pointing down, for a perspective divide by w.
+    uint32_t vertex( double x, double y, float w = 1.f )
+    {
+        const double size = double( target.width() );
+        const float ndcX = float( ( origin + x ) / size * 2.0 - 1.0 );
+        const float ndcY = float( 1.0 - ( origin + y ) / size * 2.0 );
+        positions.push_back( { ndcX * w, ndcY * w, 0.5f * w, w } );
+        return static_cast<uint32_t>( positions.size() - 1 );
+    }
+
+    void triangle( uint32_t a, uint32_t b, uint32_t c )
+    {
+        indices.insert( indices.end(), { a, b, c } );
+    }
+
+    // Draws the mesh into the cleared target and returns how many fragments were covered.
+    uint64_t draw( gpu::CullMode cullMode = gpu::CullMode::None )
+    {
+        gpu::HeadlessDraw draw = {};
+        draw.pipeline.colorFormat = static_cast<uint16_t>( gpu::PixelFormat::BGRA8Unorm_sRGB );
+        draw.pipeline.depthFormat = static_cast<uint16_t>( gpu::PixelFormat::Depth32Float );
+        draw.vertexFunction = "test_vertex";
+        draw.fragmentFunction = "test_fragment";
+        draw.depthCompare = gpu::CompareFunction::Always;
+        draw.depthWrite = false;
+        draw.cullMode = cullMode;
+        draw.winding = gpu::Winding::Clockwise;
+        draw.vertexBuffers[0] = { reinterpret_cast<const uint8_t*>( positions.data() ), positions.size() * sizeof(math::float4) };
+        draw.indexType = gpu::IndexType::UInt32;
+        draw.pIndices = reinterpret_cast<const uint8_t*>( indices.data() );
+        draw.indexCount = indices.size();
+        draw.instanceCount = 1;
+
+        target.clear();
+        rasterizer.reset_stats();
+        rasterizer.draw( target, draw );
+        return rasterizer.stats().fragmentsCovered;
+    }
+
+    bool covered( size_t x, size_t y ) const { return target.color()[ ( origin + y ) * target.width() + origin + x ] == kWhite; }
+
+    // Over the region.
+    template<typename Fn>
+    size_t count_pixels( Fn&& fn ) const
+    {
+        size_t count = 0;
+        for ( size_t y = 0; y < kSize; ++y )
+            for ( size_t x = 0; x < kSize; ++x )
+                count += fn( x, y );
+        return count;
+    }
+
+    // Over the whole target.
+    size_t covered_pixels() const
+    {
+        return std::count( target.color(), target.color() + target.width() * target.height(), kWhite );
+    }
+
+    size_t uncovered_region_pixels() const { return count_pixels( [this]( size_t x, size_t y ) { return !covered( x, y ); } ); }
+};
+
+void test_top_left_rule( size_t targetSize )
+{
+    // A square whose corners are pixel centers, split along the diagonal through more of them.
+    // Only the pixels on its top and left sides belong to it: exactly the 4x4 pixels from 2, 2.
+    Canvas canvas( targetSize );
+    const uint32_t a = canvas.vertex( 2.5, 2.5 ), b = canvas.vertex( 6.5, 2.5 );
+    const uint32_t c = canvas.vertex( 6.5, 6.5 ), d = canvas.vertex( 2.5, 6.5 );
+
+    canvas.triangle( a, b, d );
+    CHECK( canvas.draw() == 10 );
+    CHECK( canvas.count_pixels( [&]( size_t x, size_t y ) {
+        return canvas.covered( x, y ) != ( x >= 2 && y >= 2 && x + y < 8 );
+    } ) == 0 );
+
+    canvas.triangle( b, c, d );
+    CHECK( canvas.draw() == 16 );
+    CHECK( canvas.count_pixels( [&]( size_t x, size_t y ) {
+        return canvas.covered( x, y ) != ( x >= 2 && x < 6 && y >= 2 && y < 6 );
+    } ) == 0 );
+
+    // The same with the other winding.
+    canvas.indices = { a, d, b, b, d, c };
+    CHECK( canvas.draw() == 16 );
+    CHECK( canvas.covered_pixels() == 16 );
+}
+
+void test_shared_edges( size_t targetSize )
+{
+    // Slivers fanned around an off-center point, their far ends well outside the region.
+    // Together they cover every pixel of it once.
+    Canvas canvas( targetSize );
+    const uint32_t center = canvas.vertex( 31.3, 29.7 );
+    constexpr int kSlices = 97;
+    for ( int i = 0; i < kSlices; ++i )
+    {
+        const double angle = 2.0 * M_PI * i / kSlices;
+        canvas.vertex( 31.3 + 100.0 * cos( angle ), 29.7 + 100.0 * sin( angle ) );
+    }
+    for ( uint32_t i = 0; i < kSlices; ++i )
+        canvas.triangle( center, 1 + i, 1 + ( i + 1 ) % kSlices );
+
+    CHECK( canvas.draw() == canvas.covered_pixels() );
+    CHECK( canvas.uncovered_region_pixels() == 0 );
+}
+
+void test_dense_mesh( size_t targetSize )
+{
+    // A jittered grid of small triangles, a little larger than the region, the diagonals
+    // alternating and vertices at arbitrary subpixel positions.
+    Canvas canvas( targetSize );
+    std::mt19937 random( 7 );
+    std::uniform_real_distribution<double> jitter( -0.9, 0.9 );
+    constexpr int kCells = 30;
+    constexpr double kCell = 2.5;
+    for ( int y = 0; y <= kCells; ++y )
+        for ( int x = 0; x <= kCells; ++x )
+        {
+            const bool border = x == 0 || y == 0 || x == kCells || y == kCells;
+            canvas.vertex( ( x - 1 ) * kCell + ( border ? 0.0 : jitter( random ) ),
+                           ( y - 1 ) * kCell + ( border ? 0.0 : jitter( random ) ) );
+        }
+    for ( uint32_t y = 0; y < kCells; ++y )
+        for ( uint32_t x = 0; x < kCells; ++x )
+        {
+            const uint32_t i = y * ( kCells + 1 ) + x;
+            if ( ( x + y ) % 2 )
+            {
+                canvas.triangle( i, i + 1, i + kCells + 2 );
+                canvas.triangle( i, i + kCells + 2, i + kCells + 1 );
+            }
+            else
+            {
+                canvas.triangle( i, i + 1, i + kCells + 1 );
+                canvas.triangle( i + 1, i + kCells + 2, i + kCells + 1 );
+            }
+        }
+
+    CHECK( canvas.draw() == canvas.covered_pixels() );
+    CHECK( canvas.uncovered_region_pixels() == 0 );
+
+    // A closed sphere under a perspective divide: with back faces culled, its front faces cover
+    // the silhouette once, without holes.
+    canvas.positions.clear();
+    canvas.indices.clear();
+    constexpr int kRings = 24;
+    constexpr int kSegments = 40;
+    constexpr double kRadius = 25.0;
+    for ( int ring = 0; ring <= kRings; ++ring )
+        for ( int segment = 0; segment < kSegments; ++segment )
+        {
+            const double theta = M_PI * ring / kRings;
+            const double phi = 2.0 * M_PI * segment / kSegments + 0.1;
+            const float w = float( 1.5 + 0.5 * sin( theta ) * sin( phi ) );
+            canvas.vertex( 32.2 + kRadius * sin( theta ) * cos( phi ), 31.6 + kRadius * cos( theta ), w );
+        }
+    for ( uint32_t ring = 0; ring < kRings; ++ring )
+        for ( uint32_t segment = 0; segment < kSegments; ++segment )
+        {
+            const uint32_t i = ring * kSegments + segment;
+            const uint32_t next = ring * kSegments + ( segment + 1 ) % kSegments;
+            if ( ring > 0 )
+                canvas.triangle( i, next, next + kSegments );
+            if ( ring + 1 < kRings )
+                canvas.triangle( i, next + kSegments, i + kSegments );
+        }
+
+    const uint64_t covered = canvas.draw( gpu::CullMode::Back );
+    CHECK( covered == canvas.covered_pixels() );
+    // The silhouette is the polygon of the equator's segments, inside the circle and
+    // covering everything a pixel in from its inscribed one.
+    const double inner = kRadius * cos( M_PI / kSegments ) - 1.0;
+    CHECK( canvas.count_pixels( [&]( size_t x, size_t y ) {
+        const double dx = x + 0.5 - 32.2, dy = y + 0.5 - 31.6;
+        const double distance = sqrt( dx * dx + dy * dy );
+        return canvas.covered( x, y ) ? distance > kRadius + 0.01 : distance < inner;
+    } ) == 0 );
+}
+
+void test_guard_band( size_t targetSize )
+{
+    // Two triangles whose corners are a hundred million pixels out, sharing a diagonal across the
+    // whole target, then with the corner they share reaching just behind the near plane.
+    Canvas canvas( targetSize );
+    const double far = 1e8;
+    const uint32_t a = canvas.vertex( -far, -far ), b = canvas.vertex( far + 7.3, -far );
+    const uint32_t c = canvas.vertex( far, far ), d = canvas.vertex( -far, far - 3.1 );
+    canvas.triangle( a, b, c );
+    canvas.triangle( a, c, d );
+    const size_t pixels = targetSize * targetSize;
+    CHECK( canvas.draw() == pixels );
+    CHECK( canvas.covered_pixels() == pixels );
+
+    canvas.positions[ a ].z = -0.01f;
+    CHECK( canvas.draw() == pixels );
+    CHECK( canvas.covered_pixels() == pixels );
+    CHECK( canvas.rasterizer.stats().trianglesClipped == 2 );
+
+    // A triangle around the guard band that cuts off two of its corners, split into four.
+    const double band = double( 1 << 21 );
+    canvas.positions.clear();
+    canvas.indices.clear();
+    canvas.triangle( canvas.vertex( 0.0, -1.6 * band ), canvas.vertex( 1.6 * band, 1.1 * band ), canvas.vertex( -1.6 * band, 1.1 * band ) );
+    CHECK( canvas.draw() == pixels );
+    CHECK( canvas.covered_pixels() == pixels );
+    CHECK( canvas.rasterizer.stats().trianglesClipped == 1 );
+}
+
+}
+
+int main()
+{
+    for ( size_t targetSize : kTargetSizes )
+    {
+        test_top_left_rule( targetSize );
+        test_shared_edges( targetSize );
+        test_dense_mesh( targetSize );
+        test_guard_band( targetSize );
+    }
+    return test_result();
+}
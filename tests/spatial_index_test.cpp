@@ -0,0 +1,213 @@
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "hashed_grid.hpp"
+#include "instance_store.hpp"
+#include "loose_octree.hpp"
+#include "math.hpp"
+#include "test.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Builds every spatial index over a few thousand random spheres and checks
+// each cull against cull_spheres over all of them and each raycast against
+// the nearest ray_sphere hit. Then moves part of the instances, some far out
+// and some grown, updates the indices and checks again. A clump of instances
+// at one point and a scene of a single instance cover the degenerate splits.
+namespace
+{
+
+constexpr float kWorldExtent = 100.f;
+constexpr size_t kRayCount = 256;
+
+using S = InstanceStore::Stream;
+
+std::vector<uint32_t> expected_visible( const InstanceStore& store, const Frustum& frustum )
+{
+    std::vector<uint32_t> visible( store.size() );
+    visible.resize( cull_spheres( frustum, store.stream( S::PositionX ), store.stream( S::PositionY ), store.stream( S::PositionZ ),
+                                  store.stream( S::BoundingRadius ), store.size(), 0, visible.data() ) );
+    std::sort( visible.begin(), visible.end() );
+    return visible;
+}
+
+bool expected_hit( const InstanceStore& store, const SpatialIndex::Ray& ray, SpatialIndex::RayHit& hit )
+{
+    bool found = false;
+    float nearest = ray.maxDistance;
+    for ( size_t i = 0; i < store.size(); ++i )
+    {
+        const float t = ray_sphere( ray, instance_sphere( store, i ) );
+        if ( t >= 0.f && t <= nearest )
+        {
+            nearest = t;
+            hit = { static_cast<uint32_t>( i ), t };
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Looking down -z from the origin, and from outside the instances back at them.
+std::vector<Frustum> test_frustums()
+{
+    const math::float4x4 projection = math::make_perspective( 60.f * M_PI / 180.f, 1.f, 0.1f, kWorldExtent * 2.f );
+    return { make_frustum( projection ),
+             make_frustum( projection * math::make_translate( { 0.f, 0.f, -kWorldExtent } ) ),
+             make_frustum( math::make_perspective( 10.f * M_PI / 180.f, 2.f, 1.f, 30.f ) * math::make_translate( { 5.f, -5.f, 0.f } ) ) };
+}
+
+void check_index( SpatialIndex& index, const InstanceStore& store, std::mt19937& random )
+{
+    std::vector<uint32_t> visible( store.size() );
+    for ( const Frustum& frustum : test_frustums() )
+    {
+        visible.resize( store.size() );
+        visible.resize( index.cull( frustum, visible.data() ) );
+        std::sort( visible.begin(), visible.end() );
+        CHECK( visible == expected_visible( store, frustum ) );
+    }
+
+    // Rays from anywhere in the cube in every direction; ties between spheres at the same distance may go
+    // either way, so distances are compared.
+    std::uniform_real_distribution<float> coordinate( -kWorldExtent * 0.5f, kWorldExtent * 0.5f );
+    size_t wrong = 0;
+    for ( size_t r = 0; r < kRayCount; ++r )
+    {
+        const math::float3 direction = { coordinate( random ), coordinate( random ), coordinate( random ) };
+        const SpatialIndex::Ray ray = { { coordinate( random ), coordinate( random ), coordinate( random ) }, math::normalize( direction ), kWorldExtent };
+        SpatialIndex::RayHit expectedHit = {}, hit = {};
+        const bool expectedFound = expected_hit( store, ray, expectedHit );
+        const bool found = index.raycast( ray, hit );
+        wrong += found != expectedFound || ( found && std::fabs( hit.distance - expectedHit.distance ) > 1e-4f );
+        wrong += found && std::fabs( ray_sphere( ray, instance_sphere( store, hit.instance ) ) - hit.distance ) > 1e-4f;
+    }
+    CHECK( wrong == 0 );
+}
+
+// Every instance in exactly one leaf, ranges in ascending order with gaps between them, and the same
+// instances as cull() in them.
+void check_bvh( const Bvh& bvh, const InstanceStore& store )
+{
+    std::vector<uint32_t> seen( store.size(), 0 );
+    for ( const Bvh::Node& node : bvh.nodes() )
+        if ( node.left == 0 )
+            for ( uint32_t k = node.first; k < node.first + node.count; ++k )
+                seen[ bvh.indices()[ k ] ]++;
+    CHECK( std::count( seen.begin(), seen.end(), 1 ) == static_cast<ptrdiff_t>( store.size() ) );
+    CHECK( bvh.sah_cost() >= 1.f );
+
+    for ( const Frustum& frustum : test_frustums() )
+    {
+        std::vector<Bvh::Range> ranges;
+        bvh.cull_ranges( frustum, ranges );
+        std::vector<uint32_t> inRanges;
+        for ( size_t r = 0; r < ranges.size(); ++r )
+        {
+            CHECK( ranges[ r ].begin < ranges[ r ].end );
+            CHECK( r == 0 || ranges[ r - 1 ].end < ranges[ r ].begin );
+            inRanges.insert( inRanges.end(), bvh.indices().begin() + ranges[ r ].begin, bvh.indices().begin() + ranges[ r ].end );
+        }
+
+        std::vector<uint32_t> visible( store.size() );
+        visible.resize( bvh.cull( frustum, visible.data() ) );
+        std::sort( visible.begin(), visible.end() );
+        std::sort( inRanges.begin(), inRanges.end() );
+        CHECK( inRanges == visible );
+    }
+}
+
+void test_indices( size_t instanceCount, float clumped )
+{
+    std::mt19937 random( 7 );
+    std::uniform_real_distribution<float> coordinate( -kWorldExtent * 0.5f, kWorldExtent * 0.5f );
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+
+    // A share of the instances all at one point, the rest scattered through the cube.
+    InstanceStore store;
+    store.resize( instanceCount );
+    for ( size_t i = 0; i < instanceCount; ++i )
+    {
+        if ( unit( random ) < clumped )
+            store.set_position( i, 3.f, -2.f, -20.f );
+        else
+            store.set_position( i, coordinate( random ), coordinate( random ), coordinate( random ) );
+        store.set_bounding_radius( i, 0.25f + unit( random ) );
+    }
+
+    Bvh bvh;
+    LooseOctree octree;
+    HashedGrid grid;
+    SpatialIndex* const indices[] = { &bvh, &octree, &grid };
+    for ( SpatialIndex* pIndex : indices )
+    {
+        pIndex->build( store );
+        check_index( *pIndex, store, random );
+    }
+    check_bvh( bvh, store );
+
+    // A tenth of the instances move, some of them far out of the cube, and a few grow to cover much of it.
+    std::vector<uint32_t> moved;
+    for ( uint32_t i = 0; i < instanceCount; i += 10 )
+    {
+        const float reach = i % 30 == 0 ? 4.f : 1.f;
+        store.set_position( i, coordinate( random ) * reach, coordinate( random ) * reach, coordinate( random ) * reach );
+        if ( i % 70 == 0 )
+            store.set_bounding_radius( i, kWorldExtent * 0.2f );
+        moved.push_back( i );
+    }
+    for ( SpatialIndex* pIndex : indices )
+    {
+        pIndex->update( store, moved.data(), moved.size() );
+        check_index( *pIndex, store, random );
+    }
+    check_bvh( bvh, store );
+
+    // Rebuilt from the moved instances, the refit tree is no cheaper than a new one.
+    const float refitCost = bvh.sah_cost();
+    bvh.build( store );
+    CHECK( bvh.sah_cost() <= refitCost * 1.01f );
+    check_index( bvh, store, random );
+    check_bvh( bvh, store );
+}
+
+// A few instances cost less to test one by one than to split, so they stay in the root.
+void test_bvh_leaves()
+{
+    InstanceStore store;
+    store.resize( 4 );
+    for ( size_t i = 0; i < 4; ++i )
+    {
+        store.set_position( i, float( i ), 0.f, 0.f );
+        store.set_bounding_radius( i, 1.f );
+    }
+    Bvh bvh;
+    bvh.build( store );
+    CHECK( bvh.nodes().size() == 1 );
+    CHECK( bvh.sah_cost() == 4.f );
+
+    // Far apart, splitting pays off, but leaves stay at or below the limit.
+    store.resize( 1000 );
+    for ( size_t i = 0; i < store.size(); ++i )
+    {
+        store.set_position( i, float( i ) * 10.f, float( i % 7 ), 0.f );
+        store.set_bounding_radius( i, 1.f );
+    }
+    bvh.build( store );
+    CHECK( bvh.nodes().size() > 1 );
+    for ( const Bvh::Node& node : bvh.nodes() )
+        CHECK( node.left != 0 || node.count <= Bvh::kMaxLeafSize );
+}
+
+}
+
+int main()
+{
+    for ( size_t instanceCount : { 1u, 2000u } )
+        for ( float clumped : { 0.f, 0.2f } )
+            test_indices( instanceCount, clumped );
+    test_bvh_leaves();
+    return test_result();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+
+// Each test is an executable of its own that ctest runs; it reports the checks
+// that failed and exits with 1 if there were any.
+
+inline int g_checkFailures = 0;
+
+#define CHECK( condition ) \
+    do \
+    { \
+        if ( !( condition ) ) \
+        { \
+            __builtin_printf("%s:%d: check failed: %s \n", __FILE__, __LINE__, #condition); \
+            g_checkFailures++; \
+        } \
+    } while ( false )
+
+inline int test_result()
+{
+    if ( g_checkFailures > 0 )
+        __builtin_printf("%d check(s) failed \n", g_checkFailures);
+    return g_checkFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+// Measures iteration over the entity-component store against the same data
+// kept the naive way, as one vector of game object structs. Both hold the same
+// entities: moving and static renderables and some non-renderable ones. Two
+// passes are timed: filling the instance buffer with the render system, and a
+// movement update that touches only transforms and velocities.
+//
+//   entity_tool [entity count] [iterations]
+
+#include "culling.hpp"
+#include "entity_world.hpp"
+#include "instance_store.hpp"
+#include "job_system.hpp"
+#include "math.hpp"
+#include "render_system.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+struct VelocityComponent
+{
+    math::float3 velocity;
+};
+
+// Everything an entity may have in one struct, plus the gameplay state such
+// structs tend to collect, which every pass drags through the cache.
+struct GameObject
+{
+    TransformComponent transform;
+    math::float3 velocity;
+    ColorComponent color;
+    float radius;
+    uint32_t mesh;
+    bool renderable;
+    bool moving;
+    char name[32];
+    float gameplay[24];
+};
+
+constexpr float kDeltaTime = 1.f / 60.f;
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+void report( const char* label, double ms, size_t count )
+{
+    __builtin_printf("  %-28s %9.3f ms, %7.2f ns per entity \n", label, ms, ms * 1e6 / std::max<size_t>( count, 1 ));
+}
+
+void move( TransformComponent& transform, const math::float3& velocity )
+{
+    transform.position = transform.position + velocity * kDeltaTime;
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long entityCount = argc > 1 ? atol( argv[1] ) : 1000000;
+    const long iterations = argc > 2 ? atol( argv[2] ) : 10;
+    if ( argc > 3 || entityCount <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [entity count] [iterations] \n", argv[0]);
+        return 1;
+    }
+
+    EntityWorld world;
+    RenderSystem renderSystem( world );
+    const EntityWorld::ComponentId velocityId = world.register_component<VelocityComponent>();
+    const EntityWorld::ComponentId transformId = renderSystem.transform_component();
+    const EntityWorld::ComponentMask renderable = renderSystem.renderable_mask();
+    const EntityWorld::ComponentMask moving = EntityWorld::mask( transformId ) | EntityWorld::mask( velocityId );
+
+    // Half move and render, 40% only render, 10% move without being drawn.
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> coordinate( -100.f, 100.f );
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+    std::vector<GameObject> objects( entityCount );
+    for ( GameObject& object : objects )
+    {
+        const float kind = unit( random );
+        object = {};
+        object.renderable = kind < 0.9f;
+        object.moving = kind < 0.5f || kind >= 0.9f;
+        object.transform.position = { coordinate( random ), coordinate( random ), coordinate( random ) };
+        object.transform.rotation = math::make_quat_Y_rotate( unit( random ) * 6.283f );
+        object.transform.scale = { 1.f, 1.f, 1.f };
+        object.velocity = { unit( random ) - 0.5f, unit( random ) - 0.5f, unit( random ) - 0.5f };
+        object.color.color = { unit( random ), unit( random ), unit( random ), 1.f };
+        object.radius = 0.5f + unit( random );
+        object.mesh = 0;
+
+        const Entity entity = world.create( ( object.renderable ? renderable : 0 ) | ( object.moving ? moving : 0 ) );
+        *world.get<TransformComponent>( entity, transformId ) = object.transform;
+        if ( object.moving )
+            world.get<VelocityComponent>( entity, velocityId )->velocity = object.velocity;
+        if ( object.renderable )
+        {
+            world.get<ColorComponent>( entity, renderSystem.color_component() )->color = object.color.color;
+            world.get<BoundsComponent>( entity, renderSystem.bounds_component() )->radius = object.radius;
+            world.get<MeshComponent>( entity, renderSystem.mesh_component() )->mesh = object.mesh;
+        }
+    }
+
+    JobSystem jobs;
+    std::vector<EntityWorld::Chunk> chunks;
+    world.query( 0, chunks );
+    __builtin_printf("%zu entities in %zu archetypes and %zu chunks of %zu bytes, %zu threads, best of %ld \n",
+                     world.size(), world.archetype_count(), chunks.size(), EntityWorld::kChunkSize, jobs.thread_count(), iterations);
+    __builtin_printf("game object struct: %zu bytes \n", sizeof(GameObject));
+
+    // Looking down -z from the origin, at about 5% of the entities.
+    const Frustum frustum = make_frustum( math::make_perspective( 60.f * M_PI / 180.f, 1.f, 0.1f, 200.f ) );
+    const size_t renderableCount = std::count_if( objects.begin(), objects.end(), []( const GameObject& o ) { return o.renderable; } );
+    std::vector<PackedInstance> naiveInstances( renderableCount );
+    std::vector<PackedInstance> instances( renderableCount );
+    std::vector<CompactInstance> compactInstances( renderableCount );
+
+    size_t naiveVisible = 0;
+    size_t visible = 0;
+    __builtin_printf("fill instances (%zu renderable): \n", renderableCount);
+    report( "game objects", best_ms( iterations, [&]() {
+        naiveVisible = 0;
+        for ( const GameObject& object : objects )
+        {
+            if ( !object.renderable || object.mesh != 0 || !sphere_visible( frustum, object.transform.position, object.radius ) )
+                continue;
+            const math::float4x4 worldTransform = math::make_trs( object.transform.position, object.transform.rotation, object.transform.scale );
+            pack_instance( reinterpret_cast<const float*>( &worldTransform ), &object.color.color.x, naiveInstances[ naiveVisible++ ] );
+        }
+    } ), renderableCount );
+    report( "render system", best_ms( iterations, [&]() {
+        visible = renderSystem.fill_instances( jobs, frustum, 0, instances.data() );
+    } ), renderableCount );
+    report( "render system, compact", best_ms( iterations, [&]() {
+        renderSystem.fill_instances( jobs, frustum, 0, compactInstances.data() );
+    } ), renderableCount );
+
+    // Same instances in another order: compare sums of the translations.
+    double naiveSum = 0.0, sum = 0.0;
+    for ( size_t i = 0; i < naiveVisible; ++i )
+        naiveSum += naiveInstances[ i ].transform[12] + naiveInstances[ i ].transform[13] + naiveInstances[ i ].transform[14];
+    for ( size_t i = 0; i < visible; ++i )
+        sum += instances[ i ].transform[12] + instances[ i ].transform[13] + instances[ i ].transform[14];
+    const bool match = naiveVisible == visible && std::fabs( naiveSum - sum ) <= 1e-6 * std::max( 1.0, std::fabs( naiveSum ) );
+    __builtin_printf("  %zu visible, %s \n", visible, match ? "both fills agree" : "fills DIFFER");
+
+    const size_t movingCount = std::count_if( objects.begin(), objects.end(), []( const GameObject& o ) { return o.moving; } );
+    __builtin_printf("move (%zu entities): \n", movingCount);
+    report( "game objects", best_ms( iterations, [&]() {
+        for ( GameObject& object : objects )
+            if ( object.moving )
+                move( object.transform, object.velocity );
+    } ), movingCount );
+    report( "entities", best_ms( iterations, [&]() {
+        world.for_each_chunk( moving, [&]( const EntityWorld::Chunk& chunk ) {
+            TransformComponent* pTransforms = chunk.get<TransformComponent>( transformId );
+            const VelocityComponent* pVelocities = chunk.get<VelocityComponent>( velocityId );
+            for ( size_t i = 0; i < chunk.count; ++i )
+                move( pTransforms[ i ], pVelocities[ i ].velocity );
+        } );
+    } ), movingCount );
+    report( "entities, parallel chunks", best_ms( iterations, [&]() {
+        world.parallel_for_each_chunk( jobs, moving, [&]( const EntityWorld::Chunk& chunk ) {
+            TransformComponent* pTransforms = chunk.get<TransformComponent>( transformId );
+            const VelocityComponent* pVelocities = chunk.get<VelocityComponent>( velocityId );
+            for ( size_t i = 0; i < chunk.count; ++i )
+                move( pTransforms[ i ], pVelocities[ i ].velocity );
+        } );
+    } ), movingCount );
+
+    return match ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// Times loading a large file the ways the tree has done it: the original
+// read_source, ifstream -> stringstream -> string; a single read into one
+// string; Utility::read_source on top of MappedFile, one copy; and the
+// MappedFile view itself, no copy. Every variant sums the bytes it got, so all
+// of them touch the whole file. The file is read once before timing, the
+// numbers are for a file in the page cache.
+//
+//   file_bench [megabytes] [iterations] [file]
+//
+// Without a file, one of the given size is written to the temp directory and
+// removed afterwards.
+
+#include "utility.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+uint64_t checksum( const char* pData, size_t size )
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+    for ( ; i + 8 <= size; i += 8 )
+    {
+        uint64_t word;
+        memcpy( &word, pData + i, 8 );
+        sum += word;
+    }
+    for ( ; i < size; ++i )
+        sum += static_cast<unsigned char>( pData[i] );
+    return sum;
+}
+
+std::string read_through_stringstream( const char* filepath )
+{
+    std::ifstream file( filepath );
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+std::string read_once( const char* filepath )
+{
+    std::string out;
+    FILE* pFile = fopen( filepath, "rb" );
+    if ( !pFile )
+        return out;
+
+    fseek( pFile, 0, SEEK_END );
+    out.resize( static_cast<size_t>( ftell( pFile ) ) );
+    fseek( pFile, 0, SEEK_SET );
+    out.resize( fread( out.data(), 1, out.size(), pFile ) );
+    fclose( pFile );
+    return out;
+}
+
+bool write_test_file( const std::string& path, size_t size )
+{
+    std::ofstream file( path, std::ios::binary | std::ios::trunc );
+    std::mt19937 random( 1 );
+    std::vector<uint32_t> block( 1 << 18 );
+    for ( size_t written = 0; written < size && file; )
+    {
+        for ( uint32_t& word : block )
+            word = random();
+        const size_t bytes = std::min( size - written, block.size() * sizeof(uint32_t) );
+        file.write( reinterpret_cast<const char*>( block.data() ), static_cast<std::streamsize>( bytes ) );
+        written += bytes;
+    }
+    return static_cast<bool>( file );
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long megabytes = argc > 1 ? atol( argv[1] ) : 512;
+    const long iterations = argc > 2 ? atol( argv[2] ) : 5;
+    if ( argc > 4 || megabytes <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [megabytes] [iterations] [file] \n", argv[0]);
+        return 1;
+    }
+
+    std::string path;
+    if ( argc > 3 )
+        path = argv[3];
+    else
+    {
+        path = ( std::filesystem::temp_directory_path() / "file_bench.bin" ).string();
+        if ( !write_test_file( path, static_cast<size_t>( megabytes ) << 20 ) )
+        {
+            __builtin_printf("Failed to write %s \n", path.c_str());
+            return 1;
+        }
+    }
+
+    const std::string reference = read_once( path.c_str() );
+    const uint64_t expected = checksum( reference.data(), reference.size() );
+    const size_t size = reference.size();
+    __builtin_printf("%s, %.1f MB, best of %ld \n", path.c_str(), size / 1048576.0, iterations);
+
+    bool agree = true;
+    auto run = [&]( const char* label, auto&& load ) {
+        uint64_t sum = 0;
+        const double ms = best_ms( iterations, [&]() { sum = load(); } );
+        agree = agree && sum == expected;
+        __builtin_printf("  %-36s %9.2f ms %8.2f GB/s \n", label, ms, size / ( ms * 1e6 ));
+    };
+
+    run( "ifstream -> stringstream -> string", [&]() {
+        const std::string s = read_through_stringstream( path.c_str() );
+        return checksum( s.data(), s.size() );
+    } );
+    run( "one read into a string", [&]() {
+        const std::string s = read_once( path.c_str() );
+        return checksum( s.data(), s.size() );
+    } );
+    run( "Utility::read_source", [&]() {
+        const std::string s = Utility::read_source( path.c_str() );
+        return checksum( s.data(), s.size() );
+    } );
+    run( "MappedFile view", [&]() {
+        const MappedFile file( path.c_str() );
+        return checksum( file.view().data(), file.size() );
+    } );
+
+    if ( argc <= 3 )
+        std::filesystem::remove( path );
+
+    if ( !agree )
+    {
+        __builtin_printf("the variants read different bytes \n");
+        return 1;
+    }
+    return 0;
+}
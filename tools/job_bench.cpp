@@ -0,0 +1,111 @@
+// Measures how the per-instance transform loop scales across the job system.
+// Every instance builds its matrix the way Renderer::draw originally did, from
+// scale, two rotations and a translation multiplied together, and the loop is
+// split into parallel_for chunks of the renderer's grain. One thread runs the
+// loop serially, more threads run it on a JobSystem with one worker fewer,
+// the calling thread making up the rest.
+//
+//   job_bench [instance count] [max threads] [iterations]
+
+#include "job_system.hpp"
+#include "math.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+constexpr size_t kInstanceRows = 1000;
+// Renderer::kInstanceGrain, the chunk size of the renderer's instance loops.
+constexpr size_t kGrain = 1024;
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+void update_instances( const math::float4x4& fullRotation, float angle, size_t begin, size_t end, math::float4x4* pTransforms )
+{
+    const math::float4x4 scale = math::make_scale( { 0.1f, 0.1f, 0.1f } );
+    for ( size_t i = begin; i < end; ++i )
+    {
+        const size_t ix = i % kInstanceRows;
+        const size_t iy = ( i / kInstanceRows ) % kInstanceRows;
+        const math::float4x4 zrot = math::make_Z_rotate( angle * sinf( (float) ix ) );
+        const math::float4x4 yrot = math::make_Y_rotate( angle * cosf( (float) iy ) );
+        const math::float4x4 translate = math::make_translate( { ix * 0.25f, iy * 0.25f, -10.f } );
+        pTransforms[ i ] = fullRotation * translate * yrot * zrot * scale;
+    }
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long instanceCount = argc > 1 ? atol( argv[1] ) : 1000000;
+    const long maxThreads = argc > 2 ? atol( argv[2] ) : std::max( 1u, std::thread::hardware_concurrency() );
+    const long iterations = argc > 3 ? atol( argv[3] ) : 10;
+    if ( argc > 4 || instanceCount <= 0 || maxThreads <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [instance count] [max threads] [iterations] \n", argv[0]);
+        return 1;
+    }
+
+    std::vector<math::float4x4> transforms( instanceCount );
+    const math::float4x4 fullRotation = math::make_Y_rotate( 0.3f ) * math::make_X_rotate( 0.15f );
+    const float angle = 0.3f;
+
+    __builtin_printf("%ld instances, grain %zu, best of %ld \n", instanceCount, kGrain, iterations);
+    __builtin_printf("  threads          ms   instances/s   speedup \n");
+
+    const double serialMs = best_ms( iterations, [&]() {
+        update_instances( fullRotation, angle, 0, instanceCount, transforms.data() );
+    } );
+    const math::float4x4 reference = transforms[ instanceCount - 1 ];
+    __builtin_printf("  %7d %11.3f %13.3e %9.2f \n", 1, serialMs, instanceCount * 1e3 / serialMs, 1.0);
+
+    // Powers of two, and the maximum.
+    std::vector<long> threadCounts;
+    for ( long threads = 2; threads < maxThreads; threads *= 2 )
+        threadCounts.push_back( threads );
+    if ( maxThreads > 1 )
+        threadCounts.push_back( maxThreads );
+
+    for ( long threads : threadCounts )
+    {
+        JobSystem jobs( threads - 1 );
+        const double ms = best_ms( iterations, [&]() {
+            jobs.parallel_for( instanceCount, kGrain, [&]( size_t begin, size_t end ) {
+                update_instances( fullRotation, angle, begin, end, transforms.data() );
+            } );
+        } );
+        __builtin_printf("  %7ld %11.3f %13.3e %9.2f \n", threads, ms, instanceCount * 1e3 / ms, serialMs / ms);
+
+        if ( memcmp( &transforms[ instanceCount - 1 ], &reference, sizeof(reference) ) != 0 )
+        {
+            __builtin_printf("parallel result differs from the serial one \n");
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+// Times the math layer's vector and matrix operations against the same
+// operations written as plain scalar loops over float arrays, each over
+// arrays of operands large enough to leave the cache, and checks that both
+// agree. Then times building an instance's transform from translation,
+// rotation and scale: as a chain of 4x4 matrices, the way Renderer::draw used
+// to, and with make_trs and mul_affine. Numbers are only meaningful in an
+// optimized build.
+//
+//   math_bench [count] [iterations]
+
+#include "math.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+// Time stamp counter ticks of the least disturbed of `iterations` runs, 0
+// where there is no counter to read.
+template<typename Fn>
+double best_ticks( long iterations, Fn&& fn )
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const unsigned long long start = __rdtsc();
+        fn();
+        best = std::min( best, double( __rdtsc() - start ) );
+    }
+    return best;
+#else
+    (void) iterations;
+    (void) fn;
+    return 0.0;
+#endif
+}
+
+void report( const char* label, double mathMs, double scalarMs, size_t count, float maxError )
+{
+    __builtin_printf("  %-24s %8.2f ns %8.2f ns %6.2fx   max difference %g \n", label,
+                     mathMs * 1e6 / count, scalarMs * 1e6 / count, scalarMs / mathMs, maxError);
+}
+
+float max_difference( const float* a, const float* b, size_t count )
+{
+    float error = 0.f;
+    for ( size_t i = 0; i < count; ++i )
+        error = std::max( error, std::fabs( a[i] - b[i] ) );
+    return error;
+}
+
+// The scalar reference, column-major like the math types: m[column][row].
+namespace scalar
+{
+
+struct float4 { float v[4]; };
+struct float4x4 { float m[4][4]; };
+
+void mul( const float4x4& a, const float4x4& b, float4x4& r )
+{
+    for ( int c = 0; c < 4; ++c )
+        for ( int row = 0; row < 4; ++row )
+        {
+            float sum = 0.f;
+            for ( int k = 0; k < 4; ++k )
+                sum += a.m[k][row] * b.m[c][k];
+            r.m[c][row] = sum;
+        }
+}
+
+void transform( const float4x4& a, const float4& v, float4& r )
+{
+    for ( int row = 0; row < 4; ++row )
+    {
+        float sum = 0.f;
+        for ( int k = 0; k < 4; ++k )
+            sum += a.m[k][row] * v.v[k];
+        r.v[row] = sum;
+    }
+}
+
+void transform3( const float4x4& a, const float4& v, float4& r )
+{
+    for ( int row = 0; row < 3; ++row )
+        r.v[row] = a.m[0][row] * v.v[0] + a.m[1][row] * v.v[1] + a.m[2][row] * v.v[2];
+    r.v[3] = 0.f;
+}
+
+void madd( const float4& a, float s, const float* b, float4& r )
+{
+    for ( int k = 0; k < 4; ++k )
+        r.v[k] = a.v[k] * s + b[k];
+}
+
+}
+
+static_assert( sizeof(scalar::float4x4) == sizeof(math::float4x4) && sizeof(scalar::float4) == sizeof(math::float4),
+               "the scalar types mirror the math types' layout" );
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long count = argc > 1 ? atol( argv[1] ) : 1000000;
+    const long iterations = argc > 2 ? atol( argv[2] ) : 10;
+    if ( argc > 3 || count <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [count] [iterations] \n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> value( -2.f, 2.f );
+    std::vector<math::float4x4> matrices( count );
+    std::vector<math::float4x4> others( count );
+    std::vector<math::float4> vectors( count );
+    for ( long i = 0; i < count; ++i )
+    {
+        for ( math::float4& c : matrices[i].columns )
+            c = { value( random ), value( random ), value( random ), value( random ) };
+        for ( math::float4& c : others[i].columns )
+            c = { value( random ), value( random ), value( random ), value( random ) };
+        vectors[i] = { value( random ), value( random ), value( random ), value( random ) };
+    }
+    std::vector<math::float3x3> matrices3( count );
+    std::vector<math::float3> vectors3( count );
+    for ( long i = 0; i < count; ++i )
+    {
+        matrices3[i] = math::discard_translation( matrices[i] );
+        vectors3[i] = vectors[i].xyz();
+    }
+
+    // The scalar code reads the same bytes through its own types.
+    auto pScalarMatrices = reinterpret_cast<const scalar::float4x4*>( matrices.data() );
+    auto pScalarOthers = reinterpret_cast<const scalar::float4x4*>( others.data() );
+    auto pScalarVectors = reinterpret_cast<const scalar::float4*>( vectors.data() );
+
+    std::vector<math::float4x4> matrixOut( count );
+    std::vector<scalar::float4x4> scalarMatrixOut( count );
+    std::vector<math::float4> vectorOut( count );
+    std::vector<scalar::float4> scalarVectorOut( count );
+    std::vector<math::float3> vector3Out( count );
+
+    __builtin_printf("%ld operations, best of %ld, per operation \n", count, iterations);
+    __builtin_printf("  %-24s %11s %11s %7s \n", "", "math", "scalar", "ratio");
+
+    {
+        const double mathMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                matrixOut[i] = matrices[i] * others[i];
+        } );
+        const double scalarMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                scalar::mul( pScalarMatrices[i], pScalarOthers[i], scalarMatrixOut[i] );
+        } );
+        report( "float4x4 * float4x4", mathMs, scalarMs, count,
+                max_difference( &matrixOut[0].columns[0].x, &scalarMatrixOut[0].m[0][0], count * 16 ) );
+    }
+    {
+        const double mathMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                vectorOut[i] = matrices[i] * vectors[i];
+        } );
+        const double scalarMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                scalar::transform( pScalarMatrices[i], pScalarVectors[i], scalarVectorOut[i] );
+        } );
+        report( "float4x4 * float4", mathMs, scalarMs, count,
+                max_difference( &vectorOut[0].x, scalarVectorOut[0].v, count * 4 ) );
+    }
+    {
+        const double mathMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                vector3Out[i] = matrices3[i] * vectors3[i];
+        } );
+        const double scalarMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                scalar::transform3( pScalarMatrices[i], pScalarVectors[i], scalarVectorOut[i] );
+        } );
+        // float3's padding lane is undefined, compare x, y and z.
+        float error = 0.f;
+        for ( long i = 0; i < count; ++i )
+            error = std::max( error, max_difference( &vector3Out[i].x, scalarVectorOut[i].v, 3 ) );
+        report( "float3x3 * float3", mathMs, scalarMs, count, error );
+    }
+    {
+        const double mathMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                vectorOut[i] = vectors[i] * 0.5f + others[i].columns[0];
+        } );
+        const double scalarMs = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                scalar::madd( pScalarVectors[i], 0.5f, pScalarOthers[i].m[0], scalarVectorOut[i] );
+        } );
+        report( "float4 * s + float4", mathMs, scalarMs, count,
+                max_difference( &vectorOut[0].x, scalarVectorOut[0].v, count * 4 ) );
+    }
+
+    __builtin_printf("\n%ld instance transforms, best of %ld, per instance \n", count, iterations);
+    __builtin_printf("  %-44s %8s %8s %14s \n", "", "ns", "ticks", "max difference");
+
+    std::vector<math::float3> translations( count );
+    std::vector<math::float3> angles( count );
+    std::vector<math::quat> rotations( count );
+    for ( long i = 0; i < count; ++i )
+    {
+        translations[i] = { value( random ), value( random ), value( random ) };
+        angles[i] = { 0.f, value( random ), value( random ) };
+        rotations[i] = math::make_quat_Y_rotate( angles[i].y ) * math::make_quat_Z_rotate( angles[i].z );
+    }
+    const math::float4x4 parent = math::make_Y_rotate( 0.3f ) * math::make_X_rotate( 0.15f );
+    const math::float3 scale = { 0.1f, 0.1f, 0.1f };
+
+    std::vector<math::float4x4> chained( count );
+    auto run = [&]( const char* label, auto&& fn ) {
+        const double ms = best_ms( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                matrixOut[i] = fn( i );
+        } );
+        const double ticks = best_ticks( iterations, [&]() {
+            for ( long i = 0; i < count; ++i )
+                matrixOut[i] = fn( i );
+        } );
+        __builtin_printf("  %-44s %8.2f %8.1f %14g \n", label, ms * 1e6 / count, ticks / count,
+                         max_difference( &matrixOut[0].columns[0].x, &chained[0].columns[0].x, count * 16 ));
+    };
+
+    // The reference every variant is compared against.
+    for ( long i = 0; i < count; ++i )
+        chained[i] = parent * math::make_translate( translations[i] ) * math::make_Y_rotate( angles[i].y )
+                   * math::make_Z_rotate( angles[i].z ) * math::make_scale( scale );
+
+    run( "parent * T * Ry * Rz * S, 4x4 multiplies", [&]( long i ) {
+        return parent * math::make_translate( translations[i] ) * math::make_Y_rotate( angles[i].y )
+             * math::make_Z_rotate( angles[i].z ) * math::make_scale( scale );
+    } );
+    run( "mul_affine( parent, make_trs, Euler )", [&]( long i ) {
+        return math::mul_affine( parent, math::make_trs( translations[i], angles[i], scale ) );
+    } );
+    run( "mul_affine( parent, make_trs, quaternion )", [&]( long i ) {
+        return math::mul_affine( parent, math::make_trs( translations[i], rotations[i], scale ) );
+    } );
+
+    return 0;
+}
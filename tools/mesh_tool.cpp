@@ -0,0 +1,235 @@
+// Converts OBJ and glTF meshes to the binary container MeshFile loads, or
+// describes an existing container. Meshes are run through optimize_mesh() and
+// given a chain of simplified levels of detail unless --raw is given, and split
+// into meshlets either way. Vertices are written as float32 unless
+// --vertex-format picks one of the packed formats in mesh.hpp; conversion prints
+// what each format would cost and lose on the mesh.
+//
+//   mesh_tool [--raw] [--vertex-format <format>] <input.obj | input.gltf | input.glb> <output.mesh>
+//   mesh_tool <input.mesh>
+
+#include "mesh.hpp"
+#include "mesh_import.hpp"
+#include "mesh_optimize.hpp"
+#include "mesh_simplify.hpp"
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+int describe( const char* path )
+{
+    const auto start = std::chrono::steady_clock::now();
+    const MeshFile mesh( path );
+    if ( !mesh.is_valid() )
+        return 1;
+
+    // Touch every page, which is what uploading the mesh costs on top of opening it.
+    volatile uint8_t sink = 0;
+    auto touch = [&sink]( const void* pData, size_t size ) {
+        for ( size_t i = 0; i < size; i += kMeshSectionAlignment )
+            sink = sink + static_cast<const uint8_t*>( pData )[ i ];
+    };
+    touch( mesh.vertex_data(), mesh.vertex_data_size() );
+    touch( mesh.index_data(), mesh.index_data_size() );
+    const double loadMs = elapsed_ms( start );
+
+    const MeshHeader& header = mesh.header();
+    __builtin_printf("%s: %u vertices (%s, %u byte stride), %u indices (%u bit), %u submeshes \n",
+                     path, header.vertexCount, mesh_vertex_format_name( static_cast<MeshVertexFormat>( header.vertexFormat ) ), header.vertexStride, header.indexCount, header.indexSize * 8, header.submeshCount);
+    __builtin_printf("bounds [%g %g %g] - [%g %g %g], radius %g \n",
+                     header.bounds.min[0], header.bounds.min[1], header.bounds.min[2],
+                     header.bounds.max[0], header.bounds.max[1], header.bounds.max[2], header.bounds.radius);
+    for ( uint32_t i = 0; i < header.submeshCount; ++i )
+        __builtin_printf("  submesh %u: indices [%u, +%u) \n", i, mesh.submeshes()[ i ].indexOffset, mesh.submeshes()[ i ].indexCount);
+    if ( header.meshletCount > 0 )
+    {
+        size_t triangles = 0;
+        size_t vertices = 0;
+        size_t cullable = 0;
+        for ( uint32_t i = 0; i < header.meshletCount; ++i )
+        {
+            triangles += mesh.meshlets()[ i ].triangleCount;
+            vertices += mesh.meshlets()[ i ].vertexCount;
+            cullable += mesh.meshlets()[ i ].coneCutoff < 1.f;
+        }
+        __builtin_printf("%u meshlets, %.1f triangles and %.1f vertices on average, %zu with a back face cone \n",
+                         header.meshletCount, double( triangles ) / header.meshletCount, double( vertices ) / header.meshletCount, cullable);
+    }
+    for ( uint32_t i = 0; i < header.lodCount; ++i )
+    {
+        const MeshLod& lod = mesh.lods()[ i ];
+        __builtin_printf("  lod %u: %u triangles, error %g, %u meshlets \n", i, lod.indexCount / 3, lod.error, lod.meshletCount);
+    }
+    __builtin_printf("mapped and paged in %.3f ms \n", loadMs);
+    return 0;
+}
+
+// Of level 0 once there are levels of detail.
+void print_stats( const char* label, const MeshData& mesh, MeshVertexFormat format )
+{
+    const uint32_t* pIndices = mesh.indices.data();
+    size_t indexCount = mesh.indices.size();
+    if ( !mesh.lods.empty() )
+    {
+        pIndices += mesh.lods[0].indexOffset;
+        indexCount = mesh.lods[0].indexCount;
+    }
+    const VertexCacheStats cache = analyze_vertex_cache( pIndices, indexCount, mesh.vertices.size() );
+    const float overfetch = analyze_vertex_fetch( pIndices, indexCount, mesh.vertices.size(), mesh_vertex_stride( format ) );
+    __builtin_printf("%s: ACMR %.3f, ATVR %.3f, overfetch %.3f \n", label, cache.acmr, cache.atvr, overfetch);
+}
+
+// Vertex bytes a draw of everything pulls through 64 byte lines in each format, and the largest
+// position (in mesh units) and normal error the format's round trip leaves.
+void compare_vertex_formats( const MeshData& mesh )
+{
+    float radius = 0.f;
+    for ( const MeshData::Vertex& v : mesh.vertices )
+        radius = std::max( radius, std::sqrt( v.position[0] * v.position[0] + v.position[1] * v.position[1] + v.position[2] * v.position[2] ) );
+
+    const size_t vertexCount = mesh.vertices.size();
+    std::vector<uint8_t> encoded( vertexCount * mesh_vertex_stride( MeshVertexFormat::Float32 ) );
+    std::vector<MeshData::Vertex> decoded( vertexCount );
+    for ( uint32_t f = 0; f < static_cast<uint32_t>( MeshVertexFormat::Count ); ++f )
+    {
+        const MeshVertexFormat format = static_cast<MeshVertexFormat>( f );
+        encode_vertices( mesh.vertices.data(), vertexCount, format, radius, encoded.data() );
+        decode_vertices( encoded.data(), vertexCount, format, radius, decoded.data() );
+
+        float positionError = 0.f;
+        double normalError = 0.0;
+        for ( size_t i = 0; i < vertexCount; ++i )
+        {
+            const float* a = mesh.vertices[ i ].position;
+            const float* b = decoded[ i ].position;
+            positionError = std::max( positionError, std::sqrt( ( a[0] - b[0] ) * ( a[0] - b[0] ) + ( a[1] - b[1] ) * ( a[1] - b[1] ) + ( a[2] - b[2] ) * ( a[2] - b[2] ) ) );
+
+            const float* n = mesh.vertices[ i ].normal;
+            const float* m = decoded[ i ].normal;
+            const double lengths = std::sqrt( double( n[0] * n[0] + n[1] * n[1] + n[2] * n[2] ) * ( m[0] * m[0] + m[1] * m[1] + m[2] * m[2] ) );
+            if ( lengths > 0.0 )
+                normalError = std::max( normalError, std::acos( std::min( ( n[0] * m[0] + n[1] * m[1] + n[2] * m[2] ) / lengths, 1.0 ) ) );
+        }
+
+        const size_t stride = mesh_vertex_stride( format );
+        const float overfetch = analyze_vertex_fetch( mesh.indices.data(), mesh.indices.size(), vertexCount, stride );
+        __builtin_printf("  %-16s %2zu bytes per vertex, %9.1f KiB fetched, position error %.3g, normal error %.4f degrees \n",
+                         mesh_vertex_format_name( format ), stride, overfetch * vertexCount * stride / 1024.0,
+                         positionError, normalError * 180.0 / M_PI);
+    }
+}
+
+bool parse_vertex_format( const char* name, MeshVertexFormat& format )
+{
+    for ( uint32_t f = 0; f < static_cast<uint32_t>( MeshVertexFormat::Count ); ++f )
+    {
+        if ( strcmp( name, mesh_vertex_format_name( static_cast<MeshVertexFormat>( f ) ) ) == 0 )
+        {
+            format = static_cast<MeshVertexFormat>( f );
+            return true;
+        }
+    }
+    return false;
+}
+
+int usage( const char* program )
+{
+    __builtin_printf("usage: %s [--raw] [--vertex-format <format>] <input.obj | input.gltf | input.glb> <output.mesh> \n", program);
+    __builtin_printf("       %s <input.mesh> \n", program);
+    __builtin_printf("formats:");
+    for ( uint32_t f = 0; f < static_cast<uint32_t>( MeshVertexFormat::Count ); ++f )
+        __builtin_printf(" %s", mesh_vertex_format_name( static_cast<MeshVertexFormat>( f ) ));
+    __builtin_printf(" \n");
+    return 1;
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const char* program = argv[0];
+    bool raw = false;
+    bool options = false;
+    MeshVertexFormat format = MeshVertexFormat::Float32;
+    while ( argc > 1 && strncmp( argv[1], "--", 2 ) == 0 )
+    {
+        if ( strcmp( argv[1], "--raw" ) == 0 )
+            raw = true;
+        else if ( strcmp( argv[1], "--vertex-format" ) == 0 && argc > 2 && parse_vertex_format( argv[2], format ) )
+        {
+            argc--;
+            argv++;
+        }
+        else
+            return usage( program );
+        options = true;
+        argc--;
+        argv++;
+    }
+
+    if ( argc == 2 && !options )
+        return describe( argv[1] );
+
+    if ( argc != 3 )
+        return usage( program );
+
+    auto start = std::chrono::steady_clock::now();
+    MeshData mesh;
+    if ( !import_mesh( argv[1], mesh ) )
+        return 1;
+    const double importMs = elapsed_ms( start );
+
+    if ( mesh.indices.empty() )
+    {
+        __builtin_printf("%s has no triangles. \n", argv[1]);
+        return 1;
+    }
+
+    double optimizeMs = 0.0;
+    double simplifyMs = 0.0;
+    if ( !raw )
+    {
+        print_stats( "as authored", mesh, format );
+        start = std::chrono::steady_clock::now();
+        optimize_mesh( mesh );
+        optimizeMs = elapsed_ms( start );
+        print_stats( "optimized", mesh, format );
+
+        start = std::chrono::steady_clock::now();
+        build_lods( mesh );
+        simplifyMs = elapsed_ms( start );
+    }
+
+    // Meshlets are ranges of the final triangle order, so they come last. Grouping triangles by meshlet
+    // costs some cache reuse; the vertices are renumbered again to follow the new order.
+    start = std::chrono::steady_clock::now();
+    build_meshlets( mesh );
+    if ( !raw )
+        optimize_vertex_fetch( mesh );
+    const double meshletMs = elapsed_ms( start );
+    if ( !raw )
+        print_stats( "in meshlets", mesh, format );
+    compare_vertex_formats( mesh );
+
+    start = std::chrono::steady_clock::now();
+    if ( !write_mesh( argv[2], mesh, format ) )
+        return 1;
+    const double writeMs = elapsed_ms( start );
+
+    // The index data holds every level of detail after the full one.
+    const size_t triangles = ( mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].indexCount ) / 3;
+    __builtin_printf("%s: %zu vertices, %zu triangles, %zu submeshes, imported in %.3f ms, optimized in %.3f ms, %zu lods built in %.3f ms, meshlets built in %.3f ms, written in %.3f ms \n",
+                     argv[1], mesh.vertices.size(), triangles, mesh.submeshes.size(), importMs, optimizeMs, mesh.lods.size(), simplifyMs, meshletMs, writeMs);
+    return describe( argv[2] );
+}
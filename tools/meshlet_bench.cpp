@@ -0,0 +1,131 @@
+// Times build_meshlets on a generated sphere, then cull_meshlets from random
+// views around it, and reports how many meshlets survive and how many draws
+// their ranges take with and without merging across culled ones.
+//
+//   meshlet_bench [rings] [views]
+
+#include "math.hpp"
+#include "meshlet.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+// Unit sphere of `rings` rings and twice as many segments, counter-clockwise seen from outside.
+MeshData make_sphere( uint32_t rings )
+{
+    const uint32_t segments = rings * 2;
+    MeshData mesh;
+    for ( uint32_t ring = 0; ring <= rings; ++ring )
+        for ( uint32_t segment = 0; segment <= segments; ++segment )
+        {
+            const float theta = float( M_PI ) * ring / rings;
+            const float phi = 2.f * float( M_PI ) * segment / segments;
+            const float p[3] = { sinf( theta ) * cosf( phi ), cosf( theta ), -sinf( theta ) * sinf( phi ) };
+            mesh.vertices.push_back( { { p[0], p[1], p[2] }, { p[0], p[1], p[2] } } );
+        }
+    for ( uint32_t ring = 0; ring < rings; ++ring )
+        for ( uint32_t segment = 0; segment < segments; ++segment )
+        {
+            const uint32_t i = ring * ( segments + 1 ) + segment;
+            const uint32_t below = i + segments + 1;
+            if ( ring > 0 )
+                mesh.indices.insert( mesh.indices.end(), { i, below, i + 1 } );
+            if ( ring + 1 < rings )
+                mesh.indices.insert( mesh.indices.end(), { i + 1, below, below + 1 } );
+        }
+    mesh.submeshes.push_back( { 0, static_cast<uint32_t>( mesh.indices.size() ), {}, 0 } );
+    return mesh;
+}
+
+struct View
+{
+    Frustum frustum;
+    math::float3 eye;
+};
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long rings = argc > 1 ? atol( argv[1] ) : 256;
+    const long viewCount = argc > 2 ? atol( argv[2] ) : 1000;
+    if ( argc > 3 || rings < 2 || viewCount <= 0 )
+    {
+        __builtin_printf("usage: %s [rings] [views] \n", argv[0]);
+        return 1;
+    }
+
+    const MeshData sphere = make_sphere( static_cast<uint32_t>( rings ) );
+    MeshData mesh;
+    const double buildMs = best_ms( 5, [&]() {
+        mesh = sphere;
+        build_meshlets( mesh );
+    } );
+    __builtin_printf("%zu triangles into %zu meshlets in %.3f ms, %.2f M triangles/s \n",
+                     mesh.indices.size() / 3, mesh.meshlets.size(), buildMs, mesh.indices.size() / 3 / buildMs * 1e-3);
+
+    // Eyes between 1.5 and 6 radii out looking at the sphere, some with it only partly in view.
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> unit( -1.f, 1.f );
+    std::uniform_real_distribution<float> distance( 1.5f, 6.f );
+    const math::float4x4 projection = math::make_perspective( 60.f * float( M_PI ) / 180.f, 16.f / 9.f, 0.1f, 100.f );
+    std::vector<View> views( viewCount );
+    for ( View& view : views )
+    {
+        view.eye = { unit( random ), unit( random ), distance( random ) };
+        const math::float4x4 world = math::make_Y_rotate( float( M_PI ) * unit( random ) ) * math::make_X_rotate( float( M_PI ) * unit( random ) );
+        view.frustum = make_frustum( projection * math::make_translate( -view.eye ) * world );
+        const math::float4 eye = math::inverse_affine( world ) * math::float4 { view.eye.x, view.eye.y, view.eye.z, 1.f };
+        view.eye = { eye.x, eye.y, eye.z };
+    }
+
+    std::vector<MeshletRange> ranges;
+    ranges.reserve( mesh.meshlets.size() );
+    for ( size_t mergeGap : { size_t( 0 ), size_t( 2 ) } )
+    {
+        size_t visible = 0;
+        size_t draws = 0;
+        size_t indices = 0;
+        const double ms = best_ms( 5, [&]() {
+            visible = draws = indices = 0;
+            for ( const View& view : views )
+            {
+                ranges.clear();
+                visible += cull_meshlets( mesh.meshlets.data(), mesh.meshlets.size(), view.frustum, view.eye, mergeGap, ranges );
+                draws += ranges.size();
+                for ( const MeshletRange& range : ranges )
+                    indices += range.indexCount;
+            }
+        } );
+        __builtin_printf("  merge gap %zu: %8.3f us per view, %5.1f%% of meshlets visible, %6.1f draws and %5.1f%% of triangles per view \n",
+                         mergeGap, ms * 1e3 / viewCount, 100.0 * visible / ( double( viewCount ) * mesh.meshlets.size() ),
+                         double( draws ) / viewCount, 100.0 * indices / ( double( viewCount ) * mesh.indices.size() ));
+    }
+    return 0;
+}
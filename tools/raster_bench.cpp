@@ -0,0 +1,138 @@
+// Times SoftwareRasterizer on grids of triangles covering the whole target,
+// from a pixel across to large ones, so that setup, binning and the per pixel
+// edge function loop each dominate somewhere. Vertices are jittered off the
+// pixel grid and every pixel is covered once per draw.
+//
+//   raster_bench [target size] [iterations]
+
+#include "headless_backend.hpp"
+#include "job_system.hpp"
+#include "software_rasterizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+void grid_vertex( const gpu::HeadlessDraw& draw, uint32_t vertexId, uint32_t, SoftwareVertex& out )
+{
+    const math::float4* pPositions = reinterpret_cast<const math::float4*>( draw.vertexBuffers[0].pData );
+    out.position = pPositions[ vertexId ];
+    out.varyings[0] = pPositions[ vertexId ].x;
+    out.varyings[1] = pPositions[ vertexId ].y;
+}
+
+bool grid_vertex_bounds( const gpu::HeadlessDraw& draw, uint32_t maxIndex )
+{
+    return ( size_t( maxIndex ) + 1 ) * sizeof(math::float4) <= draw.vertexBuffers[0].size;
+}
+
+math::float4 grid_fragment( const float* varyings )
+{
+    return { varyings[0] * 0.5f + 0.5f, varyings[1] * 0.5f + 0.5f, 0.5f, 1.f };
+}
+
+// Cells of `cell` pixels, two triangles each, over a size x size target.
+void make_grid( size_t size, double cell, std::vector<math::float4>& positions, std::vector<uint32_t>& indices )
+{
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<double> jitter( -0.2 * cell, 0.2 * cell );
+    const uint32_t cells = static_cast<uint32_t>( ( size + cell - 1 ) / cell );
+
+    positions.clear();
+    indices.clear();
+    for ( uint32_t y = 0; y <= cells; ++y )
+        for ( uint32_t x = 0; x <= cells; ++x )
+        {
+            const bool border = x == 0 || y == 0 || x == cells || y == cells;
+            const double px = x * cell + ( border ? 0.0 : jitter( random ) );
+            const double py = y * cell + ( border ? 0.0 : jitter( random ) );
+            positions.push_back( { float( px / size * 2.0 - 1.0 ), float( 1.0 - py / size * 2.0 ), 0.5f, 1.f } );
+        }
+    for ( uint32_t y = 0; y < cells; ++y )
+        for ( uint32_t x = 0; x < cells; ++x )
+        {
+            const uint32_t i = y * ( cells + 1 ) + x;
+            indices.insert( indices.end(), { i, i + 1, i + cells + 2, i, i + cells + 2, i + cells + 1 } );
+        }
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long size = argc > 1 ? atol( argv[1] ) : 1024;
+    const long iterations = argc > 2 ? atol( argv[2] ) : 10;
+    if ( argc > 3 || size <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [target size] [iterations] \n", argv[0]);
+        return 1;
+    }
+
+    JobSystem jobs;
+    SoftwareRasterizer rasterizer( jobs );
+    rasterizer.register_vertex_function( "grid_vertex", grid_vertex, 2, grid_vertex_bounds );
+    rasterizer.register_fragment_function( "grid_fragment", grid_fragment );
+    gpu::HeadlessTarget target( size, size );
+
+    __builtin_printf("%ldx%ld target, %zu threads, best of %ld \n", size, size, jobs.thread_count(), iterations);
+
+    std::vector<math::float4> positions;
+    std::vector<uint32_t> indices;
+    for ( double cell : { 1.5, 4.0, 16.0, 64.0, 256.0 } )
+    {
+        make_grid( size, cell, positions, indices );
+
+        gpu::HeadlessDraw draw = {};
+        draw.pipeline.colorFormat = static_cast<uint16_t>( gpu::PixelFormat::BGRA8Unorm_sRGB );
+        draw.pipeline.depthFormat = static_cast<uint16_t>( gpu::PixelFormat::Depth32Float );
+        draw.vertexFunction = "grid_vertex";
+        draw.fragmentFunction = "grid_fragment";
+        draw.depthCompare = gpu::CompareFunction::Less;
+        draw.depthWrite = true;
+        draw.cullMode = gpu::CullMode::Back;
+        draw.winding = gpu::Winding::Clockwise;
+        draw.vertexBuffers[0] = { reinterpret_cast<const uint8_t*>( positions.data() ), positions.size() * sizeof(math::float4) };
+        draw.indexType = gpu::IndexType::UInt32;
+        draw.pIndices = reinterpret_cast<const uint8_t*>( indices.data() );
+        draw.indexCount = indices.size();
+        draw.instanceCount = 1;
+
+        const double ms = best_ms( iterations, [&]() {
+            target.clear();
+            rasterizer.draw( target, draw );
+        } );
+
+        rasterizer.reset_stats();
+        target.clear();
+        rasterizer.draw( target, draw );
+        const SoftwareRasterizer::Stats stats = rasterizer.stats();
+        __builtin_printf("  %6.1f px cells: %8zu triangles %9.3f ms, %7.2f M triangles/s, %8.2f M fragments/s, %llu of %ld pixels covered \n",
+                         cell, indices.size() / 3, ms, indices.size() / 3 / ms * 1e-3, stats.fragmentsCovered / ms * 1e-3,
+                         static_cast<unsigned long long>( stats.fragmentsCovered ), size * size);
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+// Stores an offline compiled shader library in the ShaderCache, keyed by the
+// source it was built from. Run by the build after compiling shader/*.metal.
+//
+//   shader_cache_tool <cache dir> <name> <source file> <library file> [compile options]
+
+#include "shader_cache.hpp"
+#include "utility.hpp"
+
+int main( int argc, const char* argv[] )
+{
+    if ( argc < 5 || argc > 6 )
+    {
+        __builtin_printf("usage: %s <cache dir> <name> <source file> <library file> [compile options] \n", argv[0]);
+        return 1;
+    }
+
+    const MappedFile source( argv[3] );
+    const MappedFile library( argv[4] );
+    if ( !source.is_open() || !library.is_open() )
+        return 1;
+
+    ShaderCache cache( argv[1] );
+    const std::string key = ShaderCache::make_key( source.view(), argc == 6 ? argv[5] : "" );
+    if ( !cache.store( argv[2], key, library.data(), library.size() ) )
+        return 1;
+
+    __builtin_printf("Cached %s as %s \n", argv[2], cache.entry_path( argv[2], key ).c_str());
+    return 0;
+}
@@ -0,0 +1,672 @@
+// Lays out the structs of a Metal shader by the Metal Shading Language's rules
+// and writes a C++ file of static_asserts that fail to compile when the matching
+// shader_types in renderer.hpp have a different size, alignment, member offset
+// or member type. Run by the build before compiling MetalCore, with the same
+// options the shaders are compiled with.
+//
+//   shader_layout_tool <source.metal> <output.cpp> [-DNAME=VALUE ...] <struct> ...
+//
+// Only what program.metal needs is understood: #if / #ifdef / #ifndef / #elif /
+// #else / #endif on integer expressions of defined names, scalars, vectors, packed vectors, float and
+// half matrices, fixed size arrays and structs declared earlier.
+
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Scalar
+{
+    const char* name;
+    uint32_t size;
+    // The C++ type holding it in shader_types. half has none, it is stored as its bits.
+    const char* cppType;
+};
+
+// Longer names first, so that "uint" is not read as "u" + "int".
+constexpr Scalar kScalars[] = {
+    { "ushort", 2, "uint16_t" },
+    { "short", 2, "int16_t" },
+    { "uchar", 1, "uint8_t" },
+    { "char", 1, "int8_t" },
+    { "float", 4, "float" },
+    { "half", 2, "uint16_t" },
+    { "uint", 4, "uint32_t" },
+    { "bool", 1, "bool" },
+    { "int", 4, "int32_t" },
+};
+
+struct Layout
+{
+    uint32_t size;
+    uint32_t alignment;
+    // Empty when any C++ type of the right size will do.
+    std::string cppType;
+};
+
+struct Member
+{
+    std::string type;
+    std::string name;
+    uint32_t count;
+};
+
+struct Struct
+{
+    std::vector<Member> members;
+    // Set when a declaration could not be read; the struct can then not be checked.
+    std::string error;
+};
+
+using Defines = std::map<std::string, std::string>;
+
+bool is_identifier_char( char c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || c == '_';
+}
+
+std::string trim( const std::string& s )
+{
+    const size_t begin = s.find_first_not_of( " \t\r" );
+    const size_t end = s.find_last_not_of( " \t\r" );
+    return begin == std::string::npos ? std::string() : s.substr( begin, end - begin + 1 );
+}
+
+std::string strip_comments( const std::string& source )
+{
+    std::string out;
+    out.reserve( source.size() );
+    for ( size_t i = 0; i < source.size(); ++i )
+    {
+        if ( source.compare( i, 2, "//" ) == 0 )
+        {
+            while ( i < source.size() && source[ i ] != '\n' )
+                i++;
+            out += '\n';
+        }
+        else if ( source.compare( i, 2, "/*" ) == 0 )
+        {
+            const size_t end = source.find( "*/", i + 2 );
+            for ( ; i < source.size() && i < end + 1; ++i )
+                if ( source[ i ] == '\n' )
+                    out += '\n';
+            i = end == std::string::npos ? source.size() : end + 1;
+        }
+        else
+        {
+            out += source[ i ];
+        }
+    }
+    return out;
+}
+
+// Integer #if expressions: literals, names (undefined ones are 0), defined,
+// parentheses, ! and the comparison and logical operators.
+class Expression
+{
+    public:
+        Expression( const std::string& text, const Defines& defines )
+            : m_text( text )
+            , m_position( 0 )
+            , m_defines( defines )
+            , m_depth( 0 )
+            , m_ok( true )
+        {
+        }
+
+        bool evaluate( long& value )
+        {
+            value = logical_or();
+            skip_space();
+            return m_ok && m_position == m_text.size();
+        }
+
+    private:
+        void skip_space()
+        {
+            while ( m_position < m_text.size() && ( m_text[ m_position ] == ' ' || m_text[ m_position ] == '\t' ) )
+                m_position++;
+        }
+
+        bool accept( const char* op )
+        {
+            skip_space();
+            const size_t length = strlen( op );
+            if ( m_text.compare( m_position, length, op ) != 0 )
+                return false;
+            // "<" is not the start of "<=", nor "!" of "!=".
+            if ( length == 1 && m_position + 1 < m_text.size() && m_text[ m_position + 1 ] == '=' && strchr( "<>!", op[0] ) )
+                return false;
+            m_position += length;
+            return true;
+        }
+
+        std::string identifier()
+        {
+            skip_space();
+            const size_t begin = m_position;
+            while ( m_position < m_text.size() && is_identifier_char( m_text[ m_position ] ) )
+                m_position++;
+            return m_text.substr( begin, m_position - begin );
+        }
+
+        long logical_or()
+        {
+            long value = logical_and();
+            while ( accept( "||" ) )
+                value = ( logical_and() != 0 ) || value != 0;
+            return value;
+        }
+
+        long logical_and()
+        {
+            long value = equality();
+            while ( accept( "&&" ) )
+                value = ( equality() != 0 ) && value != 0;
+            return value;
+        }
+
+        long equality()
+        {
+            long value = relational();
+            for ( ;; )
+            {
+                if ( accept( "==" ) )
+                    value = value == relational();
+                else if ( accept( "!=" ) )
+                    value = value != relational();
+                else
+                    return value;
+            }
+        }
+
+        long relational()
+        {
+            long value = unary();
+            for ( ;; )
+            {
+                if ( accept( "<=" ) )
+                    value = value <= unary();
+                else if ( accept( ">=" ) )
+                    value = value >= unary();
+                else if ( accept( "<" ) )
+                    value = value < unary();
+                else if ( accept( ">" ) )
+                    value = value > unary();
+                else
+                    return value;
+            }
+        }
+
+        long unary()
+        {
+            if ( accept( "!" ) )
+                return !unary();
+            if ( accept( "(" ) )
+            {
+                const long value = logical_or();
+                m_ok = m_ok && accept( ")" );
+                return value;
+            }
+
+            const std::string name = identifier();
+            if ( name.empty() )
+            {
+                m_ok = false;
+                return 0;
+            }
+            if ( name == "defined" )
+            {
+                const bool parenthesized = accept( "(" );
+                const std::string macro = identifier();
+                m_ok = m_ok && !macro.empty() && ( !parenthesized || accept( ")" ) );
+                return m_defines.count( macro ) > 0;
+            }
+            if ( isdigit( static_cast<unsigned char>( name[0] ) ) )
+            {
+                char* pEnd = nullptr;
+                const long value = strtol( name.c_str(), &pEnd, 0 );
+                m_ok = m_ok && *pEnd == '\0';
+                return value;
+            }
+
+            // A macro's value is an expression of its own, which may name further macros.
+            auto it = m_defines.find( name );
+            if ( it == m_defines.end() )
+                return 0;
+            if ( ++m_depth > 32 )
+            {
+                m_ok = false;
+                return 0;
+            }
+            Expression nested( it->second, m_defines );
+            nested.m_depth = m_depth;
+            long value = 0;
+            m_ok = m_ok && nested.evaluate( value );
+            m_depth--;
+            return value;
+        }
+
+        const std::string& m_text;
+        size_t m_position;
+        const Defines& m_defines;
+        int m_depth;
+        bool m_ok;
+};
+
+bool evaluate( const std::string& expression, const Defines& defines, bool& value )
+{
+    long n = 0;
+    if ( !Expression( expression, defines ).evaluate( n ) )
+        return false;
+    value = n != 0;
+    return true;
+}
+
+// Drops the lines excluded by conditionals and applies #define to `defines`.
+bool preprocess( const std::string& source, Defines& defines, std::string& out )
+{
+    struct Conditional
+    {
+        bool active;
+        bool taken;
+        bool parentActive;
+    };
+    std::vector<Conditional> stack;
+    bool active = true;
+
+    size_t lineNumber = 0;
+    size_t begin = 0;
+    while ( begin <= source.size() )
+    {
+        size_t end = source.find( '\n', begin );
+        if ( end == std::string::npos )
+            end = source.size();
+        const std::string line = trim( source.substr( begin, end - begin ) );
+        begin = end + 1;
+        lineNumber++;
+
+        if ( line.empty() || line[0] != '#' )
+        {
+            if ( active )
+                out += line + '\n';
+            else
+                out += '\n';
+            continue;
+        }
+        out += '\n';
+
+        const std::string directive = trim( line.substr( 1 ) );
+        const size_t split = directive.find_first_of( " \t(" );
+        const std::string keyword = directive.substr( 0, split );
+        const std::string rest = split == std::string::npos ? std::string() : trim( directive.substr( split ) );
+
+        bool value = false;
+        if ( keyword == "if" || keyword == "ifdef" || keyword == "ifndef" )
+        {
+            const std::string expression = keyword == "ifdef" ? "defined " + rest : keyword == "ifndef" ? "!defined " + rest : rest;
+            if ( !evaluate( expression, defines, value ) )
+            {
+                __builtin_printf("line %zu: cannot evaluate #%s %s \n", lineNumber, keyword.c_str(), rest.c_str());
+                return false;
+            }
+            stack.push_back( { value, value, active } );
+            active = active && value;
+        }
+        else if ( keyword == "elif" || keyword == "else" )
+        {
+            if ( stack.empty() )
+            {
+                __builtin_printf("line %zu: #%s without #if \n", lineNumber, keyword.c_str());
+                return false;
+            }
+            Conditional& top = stack.back();
+            if ( keyword == "elif" && !evaluate( rest, defines, value ) )
+            {
+                __builtin_printf("line %zu: cannot evaluate #elif %s \n", lineNumber, rest.c_str());
+                return false;
+            }
+            top.active = !top.taken && ( keyword == "else" || value );
+            top.taken = top.taken || top.active;
+            active = top.parentActive && top.active;
+        }
+        else if ( keyword == "endif" )
+        {
+            if ( stack.empty() )
+            {
+                __builtin_printf("line %zu: #endif without #if \n", lineNumber);
+                return false;
+            }
+            active = stack.back().parentActive;
+            stack.pop_back();
+        }
+        else if ( active && keyword == "define" )
+        {
+            const size_t nameEnd = rest.find_first_of( " \t" );
+            defines[ rest.substr( 0, nameEnd ) ] = nameEnd == std::string::npos ? "1" : trim( rest.substr( nameEnd ) );
+        }
+        else if ( active && keyword == "undef" )
+        {
+            defines.erase( rest );
+        }
+    }
+
+    if ( !stack.empty() )
+    {
+        __builtin_printf("missing #endif \n");
+        return false;
+    }
+    return true;
+}
+
+// Identifiers, numbers and single punctuation characters, without [[ attributes ]].
+std::vector<std::string> tokenize( const std::string& source )
+{
+    std::vector<std::string> tokens;
+    for ( size_t i = 0; i < source.size(); )
+    {
+        const char c = source[ i ];
+        if ( isspace( static_cast<unsigned char>( c ) ) )
+        {
+            i++;
+        }
+        else if ( source.compare( i, 2, "[[" ) == 0 )
+        {
+            const size_t end = source.find( "]]", i + 2 );
+            i = end == std::string::npos ? source.size() : end + 2;
+        }
+        else if ( is_identifier_char( c ) )
+        {
+            const size_t begin = i;
+            while ( i < source.size() && is_identifier_char( source[ i ] ) )
+                i++;
+            tokens.push_back( source.substr( begin, i - begin ) );
+        }
+        else
+        {
+            tokens.push_back( std::string( 1, c ) );
+            i++;
+        }
+    }
+    return tokens;
+}
+
+// Reads every `struct Name { type name[N], ...; ... };` at namespace scope, in declaration order.
+void parse_structs( const std::vector<std::string>& tokens, std::map<std::string, Struct>& structs )
+{
+    int depth = 0;
+    for ( size_t i = 0; i < tokens.size(); ++i )
+    {
+        if ( tokens[ i ] == "{" )
+            depth++;
+        else if ( tokens[ i ] == "}" )
+            depth--;
+
+        if ( depth != 0 || tokens[ i ] != "struct" || i + 2 >= tokens.size() || tokens[ i + 2 ] != "{" )
+            continue;
+
+        Struct& parsed = structs[ tokens[ i + 1 ] ];
+        parsed = {};
+        i += 3;
+        while ( i < tokens.size() && tokens[ i ] != "}" )
+        {
+            size_t end = i;
+            while ( end < tokens.size() && tokens[ end ] != ";" && tokens[ end ] != "}" && tokens[ end ] != "{" && tokens[ end ] != "(" )
+                end++;
+            if ( end == tokens.size() || tokens[ end ] != ";" )
+            {
+                parsed.error = "declaration of " + ( i < tokens.size() ? tokens[ i ] : std::string() ) + " is not a plain member";
+                // Skip to the struct's closing brace.
+                int inner = 0;
+                for ( ; i < tokens.size(); ++i )
+                {
+                    if ( tokens[ i ] == "{" )
+                        inner++;
+                    else if ( tokens[ i ] == "}" && inner-- == 0 )
+                        break;
+                }
+                break;
+            }
+
+            size_t k = i;
+            while ( k < end && ( tokens[ k ] == "const" || tokens[ k ] == "volatile" ) )
+                k++;
+            const std::string type = k < end ? tokens[ k++ ] : std::string();
+            while ( k < end )
+            {
+                Member member = { type, tokens[ k++ ], 1 };
+                if ( k + 2 < end && tokens[ k ] == "[" && tokens[ k + 2 ] == "]" )
+                {
+                    member.count = static_cast<uint32_t>( strtoul( tokens[ k + 1 ].c_str(), nullptr, 0 ) );
+                    k += 3;
+                }
+                if ( member.count == 0 || !is_identifier_char( member.name[0] ) )
+                    parsed.error = "cannot read member " + member.name;
+                parsed.members.push_back( member );
+                if ( k < end && tokens[ k ] == "," )
+                    k++;
+            }
+            i = end + 1;
+        }
+    }
+}
+
+bool type_layout( const std::string& type, const std::map<std::string, Layout>& structLayouts, Layout& layout )
+{
+    auto it = structLayouts.find( type );
+    if ( it != structLayouts.end() )
+    {
+        layout = it->second;
+        return true;
+    }
+
+    const bool packed = type.compare( 0, 7, "packed_" ) == 0;
+    const std::string name = packed ? type.substr( 7 ) : type;
+    for ( const Scalar& scalar : kScalars )
+    {
+        const size_t length = strlen( scalar.name );
+        if ( name.compare( 0, length, scalar.name ) != 0 )
+            continue;
+
+        const std::string shape = name.substr( length );
+        if ( shape.empty() && !packed )
+        {
+            layout = { scalar.size, scalar.size, strcmp( scalar.name, "half" ) == 0 ? "" : scalar.cppType };
+            return true;
+        }
+
+        const bool isVector = shape.size() == 1;
+        const bool isMatrix = shape.size() == 3 && shape[1] == 'x' && !packed
+                           && ( strcmp( scalar.name, "float" ) == 0 || strcmp( scalar.name, "half" ) == 0 );
+        const uint32_t columns = shape.empty() ? 0 : shape[0] - '0';
+        const uint32_t rows = isMatrix ? shape[2] - '0' : 1;
+        if ( !( isVector || isMatrix ) || columns < 2 || columns > 4 || ( isMatrix && ( rows < 2 || rows > 4 ) ) )
+            return false;
+
+        // Three element vectors take the size of four unless packed.
+        if ( isVector )
+        {
+            const uint32_t stored = packed ? columns : ( columns == 3 ? 4 : columns );
+            layout.size = stored * scalar.size;
+            layout.alignment = packed ? scalar.size : layout.size;
+            if ( !packed && strcmp( scalar.name, "float" ) == 0 && columns >= 3 )
+                layout.cppType = "math::float" + std::to_string( columns );
+            else
+                layout.cppType = std::string( scalar.cppType ) + "[" + std::to_string( stored ) + "]";
+            return true;
+        }
+
+        // floatCxR: C columns, each a vector of R.
+        const uint32_t column = ( rows == 3 ? 4 : rows ) * scalar.size;
+        layout.size = columns * column;
+        layout.alignment = column;
+        layout.cppType = strcmp( scalar.name, "float" ) == 0 && columns == rows && columns >= 3 ? "math::float" + shape : "";
+        return true;
+    }
+    return false;
+}
+
+struct Placed
+{
+    const Member* pMember;
+    Layout layout;
+    uint32_t offset;
+};
+
+bool struct_layout( const std::string& name, const Struct& parsed, const std::map<std::string, Layout>& structLayouts,
+                    Layout& layout, std::vector<Placed>& placed )
+{
+    if ( !parsed.error.empty() )
+    {
+        __builtin_printf("struct %s: %s \n", name.c_str(), parsed.error.c_str());
+        return false;
+    }
+
+    layout = { 0, 1, "" };
+    placed.clear();
+    for ( const Member& member : parsed.members )
+    {
+        Layout element;
+        if ( !type_layout( member.type, structLayouts, element ) )
+        {
+            __builtin_printf("struct %s: unknown type %s of %s \n", name.c_str(), member.type.c_str(), member.name.c_str());
+            return false;
+        }
+
+        Layout field = element;
+        if ( member.count > 1 )
+        {
+            field.size = element.size * member.count;
+            field.cppType = element.cppType.empty() || element.cppType.find( '[' ) != std::string::npos
+                          ? "" : element.cppType + "[" + std::to_string( member.count ) + "]";
+        }
+
+        const uint32_t offset = ( layout.size + field.alignment - 1 ) / field.alignment * field.alignment;
+        placed.push_back( { &member, field, offset } );
+        layout.size = offset + field.size;
+        layout.alignment = std::max( layout.alignment, field.alignment );
+    }
+    layout.size = ( layout.size + layout.alignment - 1 ) / layout.alignment * layout.alignment;
+    return true;
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    Defines defines;
+    std::vector<const char*> names;
+    for ( int i = 3; i < argc; ++i )
+    {
+        if ( strncmp( argv[i], "-D", 2 ) == 0 )
+        {
+            const char* pEquals = strchr( argv[i], '=' );
+            defines[ pEquals ? std::string( argv[i] + 2, pEquals ) : std::string( argv[i] + 2 ) ] = pEquals ? pEquals + 1 : "1";
+        }
+        else
+        {
+            names.push_back( argv[i] );
+        }
+    }
+
+    if ( argc < 4 || names.empty() )
+    {
+        __builtin_printf("usage: %s <source.metal> <output.cpp> [-DNAME=VALUE ...] <struct> ... \n", argv[0]);
+        return 1;
+    }
+
+    const std::string source = Utility::read_source( argv[1] );
+    if ( source.empty() )
+    {
+        __builtin_printf("Could not read %s \n", argv[1]);
+        return 1;
+    }
+
+    std::string options;
+    for ( const auto& define : defines )
+        options += " " + define.first + "=" + define.second;
+
+    std::string code;
+    if ( !preprocess( strip_comments( source ), defines, code ) )
+    {
+        __builtin_printf("%s: preprocessing failed \n", argv[1]);
+        return 1;
+    }
+
+    std::map<std::string, Struct> structs;
+    parse_structs( tokenize( code ), structs );
+
+    std::string out;
+    out += "// Generated by shader_layout_tool from " + std::string( argv[1] ) + ( options.empty() ? "" : " with" + options ) + ". Do not edit.\n\n";
+    out += "#include \"renderer.hpp\"\n\n#include <cstddef>\n#include <type_traits>\n";
+
+    // Structs are laid out on demand, so members may use any struct the shader declares.
+    std::map<std::string, Layout> structLayouts;
+    std::vector<Placed> placed;
+    for ( const auto& entry : structs )
+    {
+        Layout layout;
+        if ( struct_layout( entry.first, entry.second, structLayouts, layout, placed ) )
+            structLayouts[ entry.first ] = layout;
+    }
+
+    for ( const char* pName : names )
+    {
+        auto it = structs.find( pName );
+        Layout layout;
+        if ( it == structs.end() )
+        {
+            __builtin_printf("%s: no struct %s \n", argv[1], pName);
+            return 1;
+        }
+        if ( !struct_layout( pName, it->second, structLayouts, layout, placed ) )
+            return 1;
+
+        const std::string cppName = std::string( "shader_types::" ) + pName;
+        const std::string size = std::to_string( layout.size );
+        const std::string alignment = std::to_string( layout.alignment );
+        __builtin_printf("%s: %u bytes, %u byte aligned \n", pName, layout.size, layout.alignment);
+
+        out += "\n// " + std::string( pName ) + ": " + size + " bytes, " + alignment + " byte aligned\n";
+        out += "static_assert( sizeof(" + cppName + ") == " + size + ", \"" + cppName + " is " + size + " bytes in Metal\" );\n";
+        out += "static_assert( alignof(" + cppName + ") == " + alignment + ", \"" + cppName + " is " + alignment + " byte aligned in Metal\" );\n";
+        for ( const Placed& field : placed )
+        {
+            const std::string member = cppName + "::" + field.pMember->name;
+            const std::string offset = std::to_string( field.offset );
+            __builtin_printf("  %-24s %-16s offset %3u, %3u bytes \n",
+                             field.pMember->name.c_str(), field.pMember->type.c_str(), field.offset, field.layout.size);
+
+            out += "static_assert( offsetof(" + cppName + ", " + field.pMember->name + ") == " + offset + ", \"" + member + " is at " + offset + " in Metal\" );\n";
+            out += "static_assert( sizeof(" + member + ") == " + std::to_string( field.layout.size ) + ", \"" + member + " is " + std::to_string( field.layout.size ) + " bytes in Metal\" );\n";
+            if ( !field.layout.cppType.empty() )
+                out += "static_assert( std::is_same<decltype(" + member + "), " + field.layout.cppType + ">::value, \"" + member + " is a "
+                     + field.pMember->type + ( field.pMember->count > 1 ? "[" + std::to_string( field.pMember->count ) + "]" : "" )
+                     + " in Metal, " + field.layout.cppType + " in C++\" );\n";
+        }
+    }
+
+    FILE* pFile = fopen( argv[2], "wb" );
+    if ( !pFile )
+    {
+        __builtin_printf("Could not open %s for writing \n", argv[2]);
+        return 1;
+    }
+    const bool ok = fwrite( out.data(), 1, out.size(), pFile ) == out.size();
+    fclose( pFile );
+    if ( !ok )
+    {
+        __builtin_printf("Could not write %s \n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,251 @@
+// Measures the spatial indices against testing every instance: building them,
+// culling against a view frustum, picking with rays, and keeping them up to
+// date while part of the instances move, frame after frame. Instances are
+// spheres scattered through a cube around the camera. Last, walls are
+// rasterized into an occlusion buffer and the instances in view tested against
+// it. tests/spatial_index_test.cpp checks the answers against brute force.
+//
+//   spatial_tool [instance count] [iterations]
+
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "hashed_grid.hpp"
+#include "instance_store.hpp"
+#include "loose_octree.hpp"
+#include "math.hpp"
+#include "occlusion_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+constexpr float kWorldExtent = 200.f;
+constexpr size_t kRayCount = 1024;
+constexpr float kMotionRatios[] = { 0.01f, 0.1f, 0.5f, 1.f };
+constexpr size_t kOcclusionSize = 256;
+constexpr size_t kWallCount = 8;
+
+// The unit cube as occluder geometry.
+constexpr float kCubePositions[] = {
+    -0.5f, -0.5f, -0.5f,  0.5f, -0.5f, -0.5f,  -0.5f, 0.5f, -0.5f,  0.5f, 0.5f, -0.5f,
+    -0.5f, -0.5f,  0.5f,  0.5f, -0.5f,  0.5f,  -0.5f, 0.5f,  0.5f,  0.5f, 0.5f,  0.5f,
+};
+constexpr uint32_t kCubeIndices[] = {
+    0, 2, 3, 0, 3, 1,  4, 5, 7, 4, 7, 6,  0, 1, 5, 0, 5, 4,
+    2, 6, 7, 2, 7, 3,  0, 4, 6, 0, 6, 2,  1, 3, 7, 1, 7, 5,
+};
+
+double elapsed_ms( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Best of `iterations` runs, the least disturbed one.
+template<typename Fn>
+double best_ms( long iterations, Fn&& fn )
+{
+    double best = 1e30;
+    for ( long i = 0; i < iterations; ++i )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min( best, elapsed_ms( start ) );
+    }
+    return best;
+}
+
+void report( const char* label, double ms )
+{
+    __builtin_printf("  %-28s %9.3f ms \n", label, ms);
+}
+
+size_t cull_linear( const InstanceStore& store, const Frustum& frustum, uint32_t* pVisible )
+{
+    using S = InstanceStore::Stream;
+    return cull_spheres( frustum, store.stream( S::PositionX ), store.stream( S::PositionY ), store.stream( S::PositionZ ),
+                         store.stream( S::BoundingRadius ), store.size(), 0, pVisible );
+}
+
+bool raycast_linear( const InstanceStore& store, const SpatialIndex::Ray& ray, SpatialIndex::RayHit& hit )
+{
+    bool found = false;
+    float nearest = ray.maxDistance;
+    for ( size_t i = 0; i < store.size(); ++i )
+    {
+        const float t = ray_sphere( ray, instance_sphere( store, i ) );
+        if ( t >= 0.f && t <= nearest )
+        {
+            nearest = t;
+            hit = { static_cast<uint32_t>( i ), t };
+            found = true;
+        }
+    }
+    return found;
+}
+
+}
+
+int main( int argc, const char* argv[] )
+{
+    const long instanceCount = argc > 1 ? atol( argv[1] ) : 100000;
+    const long iterations = argc > 2 ? atol( argv[2] ) : 10;
+    if ( argc > 3 || instanceCount <= 0 || iterations <= 0 )
+    {
+        __builtin_printf("usage: %s [instance count] [iterations] \n", argv[0]);
+        return 1;
+    }
+
+    std::mt19937 random( 1 );
+    std::uniform_real_distribution<float> coordinate( -kWorldExtent * 0.5f, kWorldExtent * 0.5f );
+    std::uniform_real_distribution<float> unit( 0.f, 1.f );
+
+    // Every instance has a velocity of up to a unit per frame, used when it is one of the moving ones.
+    InstanceStore store;
+    store.resize( instanceCount );
+    std::vector<math::float3> start( instanceCount ), velocities( instanceCount );
+    for ( long i = 0; i < instanceCount; ++i )
+    {
+        start[ i ] = { coordinate( random ), coordinate( random ), coordinate( random ) };
+        velocities[ i ] = math::float3{ unit( random ) - 0.5f, unit( random ) - 0.5f, unit( random ) - 0.5f } * 2.f;
+        store.set_position( i, start[ i ].x, start[ i ].y, start[ i ].z );
+        store.set_bounding_radius( i, 0.25f + unit( random ) );
+    }
+
+    // Looking down -z from the origin, at about 5% of the instances.
+    const Frustum frustum = make_frustum( math::make_perspective( 60.f * M_PI / 180.f, 1.f, 0.1f, kWorldExtent ) );
+    std::vector<uint32_t> expected( instanceCount ), visible( instanceCount );
+    size_t expectedCount = 0;
+
+    Bvh bvh;
+    LooseOctree octree;
+    HashedGrid grid;
+    SpatialIndex* const indices[] = { &bvh, &octree, &grid };
+
+    __builtin_printf("%ld instances, best of %ld \n", instanceCount, iterations);
+    __builtin_printf("build: \n");
+    for ( SpatialIndex* pIndex : indices )
+        report( pIndex->name(), best_ms( iterations, [&]() { pIndex->build( store ); } ) );
+    __builtin_printf("  bvh: %zu nodes, SAH cost %.1f; octree: %zu nodes; grid: %zu cells of %.2f \n",
+                     bvh.nodes().size(), bvh.sah_cost(), octree.node_count(), grid.cell_count(), grid.cell_size());
+
+    __builtin_printf("cull: \n");
+    report( "every instance", best_ms( iterations, [&]() { expectedCount = cull_linear( store, frustum, expected.data() ); } ) );
+    for ( SpatialIndex* pIndex : indices )
+        report( pIndex->name(), best_ms( iterations, [&]() { pIndex->cull( frustum, visible.data() ); } ) );
+    std::vector<Bvh::Range> ranges;
+    report( "bvh ranges", best_ms( iterations, [&]() { ranges.clear(); bvh.cull_ranges( frustum, ranges ); } ) );
+    __builtin_printf("  %zu visible, %zu bvh ranges \n", expectedCount, ranges.size());
+
+    // Rays from inside the cube in every direction, as picking through a camera anywhere in it would cast.
+    std::vector<SpatialIndex::Ray> rays( kRayCount );
+    for ( SpatialIndex::Ray& ray : rays )
+    {
+        const math::float3 direction = { unit( random ) - 0.5f, unit( random ) - 0.5f, unit( random ) - 0.5f };
+        ray.origin = { coordinate( random ), coordinate( random ), coordinate( random ) };
+        ray.direction = math::normalize( direction );
+        ray.maxDistance = kWorldExtent;
+    }
+
+    std::vector<SpatialIndex::RayHit> expectedHits( kRayCount ), hits( kRayCount );
+    std::vector<char> expectedFound( kRayCount ), found( kRayCount );
+    __builtin_printf("raycast %zu rays: \n", kRayCount);
+    report( "every instance", best_ms( 1, [&]() {
+        for ( size_t r = 0; r < kRayCount; ++r )
+            expectedFound[ r ] = raycast_linear( store, rays[ r ], expectedHits[ r ] );
+    } ) );
+    const size_t hitCount = std::count( expectedFound.begin(), expectedFound.end(), 1 );
+    for ( SpatialIndex* pIndex : indices )
+    {
+        report( pIndex->name(), best_ms( iterations, [&]() {
+            for ( size_t r = 0; r < kRayCount; ++r )
+                found[ r ] = pIndex->raycast( rays[ r ], hits[ r ] );
+        } ) );
+    }
+    __builtin_printf("  %zu hits \n", hitCount);
+
+    // `iterations` frames of moving a share of the instances, updating the index and culling, from the same start for each.
+    std::vector<uint32_t> order( instanceCount );
+    for ( long i = 0; i < instanceCount; ++i )
+        order[ i ] = static_cast<uint32_t>( i );
+    std::shuffle( order.begin(), order.end(), random );
+
+    for ( float ratio : kMotionRatios )
+    {
+        std::vector<uint32_t> moved( order.begin(), order.begin() + std::max<long>( 1, std::lround( ratio * instanceCount ) ) );
+        std::sort( moved.begin(), moved.end() );
+        __builtin_printf("%ld frames moving %zu instances (%.0f%%), per frame: update, cull, both \n", iterations, moved.size(), ratio * 100.f);
+
+        // The bvh twice, refit and rebuilt every frame.
+        float refitCost = 0.f;
+        for ( int variant = 0; variant <= 3; ++variant )
+        {
+            SpatialIndex* pIndex = variant < 3 ? indices[ variant ] : &bvh;
+            for ( long i = 0; i < instanceCount; ++i )
+                store.set_position( i, start[ i ].x, start[ i ].y, start[ i ].z );
+            pIndex->build( store );
+
+            double updateMs = 0.0, cullMs = 0.0;
+            for ( long frame = 0; frame < iterations; ++frame )
+            {
+                for ( uint32_t i : moved )
+                {
+                    const math::float3 p = start[ i ] + velocities[ i ] * float( frame + 1 );
+                    store.set_position( i, p.x, p.y, p.z );
+                }
+
+                auto t0 = std::chrono::steady_clock::now();
+                if ( variant < 3 )
+                    pIndex->update( store, moved.data(), moved.size() );
+                else
+                    pIndex->build( store );
+                updateMs += elapsed_ms( t0 );
+
+                t0 = std::chrono::steady_clock::now();
+                pIndex->cull( frustum, visible.data() );
+                cullMs += elapsed_ms( t0 );
+            }
+            if ( variant == 0 )
+                refitCost = bvh.sah_cost();
+            updateMs /= iterations;
+            cullMs /= iterations;
+            __builtin_printf("  %-28s %9.3f ms %9.3f ms %9.3f ms \n", variant < 3 ? pIndex->name() : "bvh, rebuilt", updateMs, cullMs, updateMs + cullMs);
+        }
+        __builtin_printf("  bvh SAH cost %.1f after refits \n", refitCost);
+    }
+
+    // Walls a little ahead of the camera, each hiding a wedge of the instances behind it.
+    const math::float4x4 projection = math::make_perspective( 60.f * M_PI / 180.f, 1.f, 0.1f, kWorldExtent );
+    std::vector<math::float4x4> walls( kWallCount );
+    for ( math::float4x4& wall : walls )
+    {
+        const math::float3 position = { ( unit( random ) - 0.5f ) * 30.f, ( unit( random ) - 0.5f ) * 30.f, -15.f - unit( random ) * 20.f };
+        wall = projection * math::make_trs( position, math::make_quat_Y_rotate( ( unit( random ) - 0.5f ) * 0.5f ), { 12.f, 8.f, 1.f } );
+    }
+
+    OcclusionBuffer occlusion( kOcclusionSize, kOcclusionSize );
+    expectedCount = cull_linear( store, frustum, expected.data() );
+    size_t unoccludedCount = 0;
+    __builtin_printf("occlusion, %zu walls into %zux%zu: \n", kWallCount, kOcclusionSize, kOcclusionSize);
+    report( "rasterize", best_ms( iterations, [&]() {
+        occlusion.clear();
+        for ( const math::float4x4& wall : walls )
+            occlusion.rasterize( wall, kCubePositions, 8, kCubeIndices, sizeof( kCubeIndices ) / sizeof( kCubeIndices[0] ) );
+        occlusion.build_hierarchy();
+    } ) );
+    report( "test instances in view", best_ms( iterations, [&]() {
+        using S = InstanceStore::Stream;
+        std::copy( expected.begin(), expected.begin() + expectedCount, visible.begin() );
+        unoccludedCount = occlusion.cull_spheres( projection, store.stream( S::PositionX ), store.stream( S::PositionY ), store.stream( S::PositionZ ),
+                                                  store.stream( S::BoundingRadius ), visible.data(), expectedCount );
+    } ) );
+    __builtin_printf("  %zu triangles rasterized, %zu of %zu instances in view occluded \n",
+                     occlusion.triangles_rasterized(), expectedCount - unoccludedCount, expectedCount);
+
+    return 0;
+}